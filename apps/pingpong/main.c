@@ -52,9 +52,8 @@ main(int argc, char* argv[])
     ueth_init(&eth, &config);
 
     while (usys_running()) {
-        // Poll io
-        usys_msleep(1);
-        ueth_poll(&eth);
+        // Poll io (blocks until io or a timer is due)
+        ueth_poll_wait(&eth, 1000);
     }
 
     // Notify remotes of shutdown and clean
@@ -0,0 +1,167 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file main.c
+ *
+ * @brief Run many nodes on a simulated network, faster than real time.
+ *
+ * usage: simulate [nodes] [seconds] [latency ms] [loss per 10000]
+ *
+ * Every node boots from a few others, discovery fills the tables. Prints
+ * how full the tables are each simulated second.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "ueth.h"
+#include "usim.h"
+#include "usys_log.h"
+
+#define SIM_PORT 30303
+#define SIM_BOOT 3 /*!< nodes each node starts from */
+
+void sim_boot(ueth_context* nodes, uint32_t n, uint32_t i);
+void sim_report(usim* sim, ueth_context* nodes, uint32_t n, clock_t start);
+
+int main(int argc, char* argv[]);
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t n = argc > 1 ? atoi(argv[1]) : 64;
+    int64_t end = (argc > 2 ? atoi(argv[2]) : 60) * 1000, next, report;
+    usim_link link = { .latency = argc > 3 ? atoi(argv[3]) : 50,
+                       .jitter = 10,
+                       .bandwidth = 1000000,
+                       .loss = argc > 4 ? atoi(argv[4]) : 0 };
+    ueth_config config = { .udp = SIM_PORT,
+                           .interval_discovery = 5,
+                           .io_backend = ASYNC_IO_BACKEND_MOCK,
+                           .crypto_inline = 1 };
+    ueth_context* nodes;
+    int64_t* due;
+    clock_t start = clock();
+    usim sim;
+    uint32_t i;
+
+    // Only problems, thousands of nodes make a lot of noise
+    usys_log_mask_set(USYS_LOG_MASK(USYS_LOG_WARN) |
+                      USYS_LOG_MASK(USYS_LOG_ERRO));
+    nodes = usys_malloc(n * sizeof(ueth_context));
+    due = usys_malloc(n * sizeof(int64_t));
+    if (!(nodes && due) || usim_init(&sim, n, &link, 1)) {
+        usys_log_err("[SIM] out of memory (%d nodes)", n);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        usim_host_set(&sim, i);
+        ueth_init(&nodes[i], &config);
+        due[i] = 0;
+    }
+    for (i = 0; i < n; i++) sim_boot(nodes, n, i);
+
+    // Poll nodes that received something or have a timer due, then jump to
+    // whatever happens next
+    report = 1000;
+    while (sim.now < end) {
+        next = end;
+        for (i = 0; i < n; i++) {
+            if (!(usim_host_woken(&sim, i) || due[i] <= sim.now)) {
+                if (due[i] < next) next = due[i];
+                continue;
+            }
+            usim_host_set(&sim, i);
+            ueth_poll_wait(&nodes[i], 0);
+            due[i] = sim.now + ueth_next(&nodes[i]);
+            if (due[i] <= sim.now) due[i] = sim.now + 1;
+            if (due[i] < next) next = due[i];
+        }
+        if (usim_next(&sim) < next) next = usim_next(&sim);
+        if (report < next) next = report;
+        usim_run(&sim, next);
+        if (sim.now >= report) {
+            sim_report(&sim, nodes, n, start);
+            report += 1000;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        usim_host_set(&sim, i);
+        ueth_deinit(&nodes[i]);
+    }
+    usim_deinit(&sim);
+    usys_free(due);
+    usys_free(nodes);
+    usys_log_flush();
+    return 0;
+}
+
+void
+sim_boot(ueth_context* nodes, uint32_t n, uint32_t i)
+{
+    // Like ueth_boot, with enodes of simulated hosts
+    rlpx_io_discovery* d = rlpx_io_discovery_get_context(&nodes[i].discovery);
+    rlpx_node node;
+    uint32_t j;
+    for (uint32_t b = 0; b < SIM_BOOT && b + 1 < n; b++) {
+        j = (i + 1 + rand() % (n - 1)) % n;
+        rlpx_node_init(
+            &node, &nodes[j].id.Q, usys_htoa(usim_ip(j)), SIM_PORT, SIM_PORT);
+        ktable_insert(
+            &d->table, &node.id, node.ipv4, node.port_tcp, node.port_udp, NULL);
+        rlpx_node_deinit(&node);
+    }
+}
+
+void
+sim_report(usim* sim, ueth_context* nodes, uint32_t n, clock_t start)
+{
+    // Table fill is the measure of convergence
+    rlpx_io_discovery* d;
+    uint32_t size, min = UINT32_MAX, sum = 0, mask;
+    for (uint32_t i = 0; i < n; i++) {
+        d = rlpx_io_discovery_get_context(&nodes[i].discovery);
+        size = knodes_size(d->table.nodes, KTABLE_N_NODES);
+        sum += size;
+        if (size < min) min = size;
+    }
+
+    // Only the report is shown at NOTE, the nodes' own lines stay quiet
+    mask = usys_log_mask_set(USYS_LOG_MASK(USYS_LOG_NOTE));
+    usys_log(
+        "[SIM] %lds (cpu %.2fs) table avg %d min %d",
+        (long)(sim->now / 1000),
+        (double)(clock() - start) / CLOCKS_PER_SEC,
+        n ? sum / n : 0,
+        min);
+    usys_log(
+        "[SIM] datagrams %lu lost %lu unroutable %lu",
+        (unsigned long)sim->stats.datagrams,
+        (unsigned long)sim->stats.lost,
+        (unsigned long)sim->stats.unroutable);
+    usys_log_mask_set(mask);
+}
+
+//
+//
+//
@@ -3,10 +3,12 @@
 # libusys objs
 option (UETH_USE_UNIX "os abstraction layer linkage" ON)
 option (UETH_USE_KLIB "generic stdlib" ON)
+option (UETH_USE_IO_URING "io_uring async io backend (linux)" ON)
 
 # libucrypto config
 option(UETH_USE_MBEDTLS "Link with libmbedcrypto.a" ON)
 option(UETH_USE_SECP256K1 "Link with libsecp256k1.a" ON)
+option(UETH_USE_PTHREAD "Crypto offload worker threads" ON)
 
 # TODO depreciate these?
 add_definitions(-DURLP_CONFIG_UNIX)
@@ -39,6 +39,7 @@ uaes_deinit(uaes_ctx** ctx_p)
     uaes_ctx* ctx = *ctx_p;
     *ctx_p = NULL;
     mbedtls_aes_free(&ctx->ctx);
+    memset(ctx->iv, 0, 16);
 }
 
 void
@@ -56,14 +57,12 @@ uaes_crypt_ctr(
     size_t inlen,
     uint8_t* out)
 {
-
-    int err = 0;
-    uaes_ctx tmp;
-    uint8_t block[16];
-    size_t nc_off = 0;
+    int err;
+    uaes_ctx tmp, *tmp_p = &tmp;
     err = uaes_init(&tmp, keysz, key);
     if (err) return err;
-    err = mbedtls_aes_crypt_ctr(&tmp.ctx, inlen, &nc_off, iv, block, in, out);
+    err = uaes_crypt_ctr_op(&tmp, iv, in, inlen, out);
+    uaes_deinit(&tmp_p);
     return err;
 }
 
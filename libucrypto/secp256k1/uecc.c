@@ -20,6 +20,8 @@
  */
 
 #include "uecc.h"
+#include "uecc_cache.h"
+#include "ukeccak256.h"
 #include "urand.h"
 #include <string.h>
 
@@ -35,7 +37,7 @@
 // clang-format on
 
 // private
-const byte* fromhex(const char* str);
+int fromhex(const char* str, byte* out, size_t outlen);
 
 int
 uecc_key_init(uecc_ctx* ctx, const uecc_private_key* d)
@@ -46,8 +48,13 @@ uecc_key_init(uecc_ctx* ctx, const uecc_private_key* d)
 int
 uecc_key_init_string(uecc_ctx* ctx, int radix, const char* s)
 {
+    uecc_private_key d;
+    int err;
     if (!(radix == 16)) return -1;
-    return uecc_key_init_binary(ctx, (uecc_private_key*)fromhex(s));
+    fromhex(s, d.b, sizeof(d.b));
+    err = uecc_key_init_binary(ctx, &d);
+    memset(d.b, 0, sizeof(d.b));
+    return err;
 }
 
 int
@@ -72,13 +79,16 @@ uecc_key_init_binary(uecc_ctx* ctx, const uecc_private_key* d)
 void
 uecc_key_deinit(uecc_ctx* ctx)
 {
+    uecc_cache_deinit(ctx);
     secp256k1_context_destroy(ctx->grp);
 }
 
 int
 uecc_z_cmp_str(const uecc_shared_secret_w_header* a, const char* b)
 {
-    return memcmp(&a->b[1], fromhex(b), 32);
+    byte z[32];
+    fromhex(b, z, sizeof(z));
+    return memcmp(&a->b[1], z, 32);
 }
 
 int
@@ -108,7 +118,7 @@ uecc_qtob(const uecc_public_key* q, byte* b, size_t l)
     int ok;
     size_t tmp = l;
     secp256k1_context* ctx;
-    ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN);
+    ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
     ok = secp256k1_ec_pubkey_serialize(
         ctx, b, &tmp, q, SECP256K1_EC_UNCOMPRESSED);
     secp256k1_context_destroy(ctx);
@@ -120,8 +130,7 @@ uecc_btoq(const byte* b, size_t l, uecc_public_key* q)
 {
     int err;
     secp256k1_context* grp;
-    grp = secp256k1_context_create(
-        SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
+    grp = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
     err = secp256k1_ec_pubkey_parse(grp, q, b, l) == 1 ? 0 : -1;
     secp256k1_context_destroy(grp);
     return err;
@@ -130,10 +139,39 @@ uecc_btoq(const byte* b, size_t l, uecc_public_key* q)
 int
 uecc_cmpq(const uecc_public_key* a, const uecc_public_key* b)
 {
+    // Prefer uecc_node_id_cmp when comparing the same keys more than once
+    int ok;
     uint8_t puba[65], pubb[65];
-    if (uecc_qtob(a, puba, 65)) return 0;
-    if (uecc_qtob(b, pubb, 65)) return 0;
-    return memcmp(puba, pubb, 65) ? 0 : 1;
+    size_t la = sizeof(puba), lb = sizeof(pubb);
+    secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    ok = secp256k1_ec_pubkey_serialize(
+             ctx, puba, &la, a, SECP256K1_EC_UNCOMPRESSED) &&
+         secp256k1_ec_pubkey_serialize(
+             ctx, pubb, &lb, b, SECP256K1_EC_UNCOMPRESSED);
+    secp256k1_context_destroy(ctx);
+    return ok && !memcmp(puba, pubb, 65) ? 1 : 0;
+}
+
+int
+uecc_node_id_init(uecc_node_id* id, const uecc_public_key* q)
+{
+    uint8_t pub[65];
+    if (uecc_qtob(q, pub, sizeof(pub))) return -1;
+    id->q = *q;
+    memcpy(id->raw.b, &pub[1], sizeof(h512));
+    ukeccak256(id->raw.b, sizeof(h512), id->hash.b, sizeof(h256));
+    return 0;
+}
+
+int
+uecc_node_id_init_bin(uecc_node_id* id, const byte* b64)
+{
+    uint8_t pub[65] = { 0x04 };
+    memcpy(&pub[1], b64, sizeof(h512));
+    if (uecc_btoq(pub, sizeof(pub), &id->q)) return -1;
+    memcpy(id->raw.b, b64, sizeof(h512));
+    ukeccak256(id->raw.b, sizeof(h512), id->hash.b, sizeof(h256));
+    return 0;
 }
 
 int
@@ -146,7 +184,27 @@ uecc_agree_bin(uecc_ctx* ctx, const byte* bytes, size_t blen)
 int
 uecc_agree(uecc_ctx* ctx, const uecc_public_key* key)
 {
-    int ok = secp256k1_ecdh_raw(ctx->grp, ctx->z.b, key, ctx->d.b);
+    return uecc_agree_r(ctx, key, &ctx->z);
+}
+
+int
+uecc_agree_bin_r(
+    const uecc_ctx* ctx,
+    const byte* bytes,
+    size_t blen,
+    uecc_shared_secret_w_header* z)
+{
+    uecc_public_key key;
+    return uecc_btoq(bytes, blen, &key) ? -1 : uecc_agree_r(ctx, &key, z);
+}
+
+int
+uecc_agree_r(
+    const uecc_ctx* ctx,
+    const uecc_public_key* key,
+    uecc_shared_secret_w_header* z)
+{
+    int ok = secp256k1_ecdh_raw(ctx->grp, z->b, key, ctx->d.b);
     return ok ? 0 : -1;
 }
 
@@ -181,32 +239,48 @@ uecc_verify(
 
 int
 uecc_recover_bin(const byte* b, byte* digest, uecc_public_key* key)
+{
+    const byte* d = digest;
+    return uecc_recover_batch(&b, &d, key, NULL, 1) ? -1 : 0;
+}
+
+int
+uecc_recover_batch(
+    const byte** sigs,
+    const byte** digests,
+    uecc_public_key* keys,
+    int* errs,
+    size_t n)
 {
     secp256k1_context* ctx;
     uecc_signature rawsig;
-    int v = b[64], err;
-    ctx = secp256k1_context_create(
-        SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
-    if (!ctx) return -1;
-
-    IF_ERR_EXIT(
-        !secp256k1_ecdsa_recoverable_signature_parse_compact(
-            ctx, &rawsig, b, v));
-    IF_ERR_EXIT(!secp256k1_ecdsa_recover(ctx, key, &rawsig, digest));
+    size_t i;
+    int bad = 0, err;
 
-EXIT:
-    secp256k1_context_destroy(ctx);
-    return 0;
+    // Recovery only needs verify tables, build them once for the lot
+    ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
+    for (i = 0; i < n; i++) {
+        err = 0;
+        if (!(ctx &&
+              secp256k1_ecdsa_recoverable_signature_parse_compact(
+                  ctx, &rawsig, sigs[i], sigs[i][64]) &&
+              secp256k1_ecdsa_recover(ctx, &keys[i], &rawsig, digests[i]))) {
+            memset(&keys[i], 0, sizeof(uecc_public_key));
+            err = -1;
+            bad++;
+        }
+        if (errs) errs[i] = err;
+    }
+    if (ctx) secp256k1_context_destroy(ctx);
+    return bad;
 }
 
-#define FROMHEX_MAXLEN 512
-const byte*
-fromhex(const char* str)
+int
+fromhex(const char* str, byte* out, size_t outlen)
 {
-    static byte buf[FROMHEX_MAXLEN];
-    memset(buf, 0, FROMHEX_MAXLEN);
     size_t len = strlen(str) / 2;
-    if (len > FROMHEX_MAXLEN) len = FROMHEX_MAXLEN;
+    memset(out, 0, outlen);
+    if (len > outlen) len = outlen;
     for (size_t i = 0; i < len; i++) {
         byte c = 0;
         if (str[i * 2] >= '0' && str[i * 2] <= '9')
@@ -217,9 +291,9 @@ fromhex(const char* str)
             c += (str[i * 2 + 1] - '0');
         if ((str[i * 2 + 1] & ~0x20) >= 'A' && (str[i * 2 + 1] & ~0x20) <= 'F')
             c += (10 + (str[i * 2 + 1] & ~0x20) - 'A');
-        buf[i] = c;
+        out[i] = c;
     }
-    return buf;
+    return (int)len;
 }
 
 //
@@ -29,6 +29,7 @@ extern "C" {
 #include "secp256k1.h"
 #include "secp256k1_ecdh.h"
 #include "secp256k1_recovery.h"
+#include <string.h>
 
 typedef unsigned char byte;
 
@@ -52,6 +53,26 @@ typedef h256 uecc_private_key;
 typedef h256 uecc_shared_secret;
 typedef h264 uecc_shared_secret_w_header;
 
+struct uecc_cache;
+
+/**
+ * @brief Public key carried with its wire form and keccak id. Each is
+ * computed once at init so comparing and indexing peers never has to
+ * serialize a key again.
+ */
+typedef struct
+{
+    uecc_public_key q; /*!< parsed key */
+    h512 raw;          /*!< uncompressed key without 0x04 header (wire) */
+    h256 hash;         /*!< keccak256(raw) (kademlia id) */
+} uecc_node_id;
+
+/**
+ * @brief Key context. After init a key is only read by uecc_sign,
+ * uecc_agree_r, uecc_agree_cached_r and uecies_decrypt, which may be called
+ * from any number of threads at once. uecc_agree and uecc_agree_cached store
+ * the secret in z and need a key per thread.
+ */
 typedef struct
 {
     secp256k1_context* grp;        /*!< lib export */
@@ -59,6 +80,7 @@ typedef struct
     uecc_public_key Q;             /*!< public key */
     uecc_public_key Qp;            /*!< remote public key */
     uecc_shared_secret_w_header z; /*!< shared secret */
+    struct uecc_cache* cache;      /*!< static secrets (see uecc_cache.h) */
 } uecc_ctx;
 
 /**
@@ -85,6 +107,37 @@ int uecc_qtob(const uecc_public_key* q, byte* b, size_t l);
 int uecc_btoq(const byte*, size_t l, uecc_public_key* q);
 int uecc_cmpq(const uecc_public_key* a, const uecc_public_key* b);
 
+/**
+ * @brief Build a node id from a parsed key
+ *
+ * @param id
+ * @param q
+ *
+ * @return 0 OK -1 invalid key
+ */
+int uecc_node_id_init(uecc_node_id* id, const uecc_public_key* q);
+
+/**
+ * @brief Build a node id from its 64 byte wire form
+ *
+ * @param id
+ * @param b64 uncompressed key without 0x04 header
+ *
+ * @return 0 OK -1 invalid key
+ */
+int uecc_node_id_init_bin(uecc_node_id* id, const byte* b64);
+
+/**
+ * @brief Compare node ids
+ *
+ * @return 0 same key
+ */
+static inline int
+uecc_node_id_cmp(const uecc_node_id* a, const uecc_node_id* b)
+{
+    return memcmp(a->raw.b, b->raw.b, sizeof(h512));
+}
+
 /**
  * @brief
  *
@@ -95,6 +148,27 @@ int uecc_cmpq(const uecc_public_key* a, const uecc_public_key* b);
  */
 int uecc_agree(uecc_ctx* ctx, const uecc_public_key* k);
 int uecc_agree_bin(uecc_ctx* ctx, const byte* bytes, size_t blen);
+
+/**
+ * @brief Reentrant ecdh. Same as uecc_agree but the secret is written to the
+ * caller and ctx is only read, so one static key may be shared by any number
+ * of threads. (uecc_agree writes ctx->z and must not be used on a shared key)
+ *
+ * @param ctx local key
+ * @param k remote public key
+ * @param z shared secret result
+ *
+ * @return 0 OK -1 error
+ */
+int uecc_agree_r(
+    const uecc_ctx* ctx,
+    const uecc_public_key* k,
+    uecc_shared_secret_w_header* z);
+int uecc_agree_bin_r(
+    const uecc_ctx* ctx,
+    const byte* bytes,
+    size_t blen,
+    uecc_shared_secret_w_header* z);
 /**
  * @brief
  *
@@ -140,6 +214,26 @@ int uecc_verify(
  */
 int uecc_recover_bin(const byte* bytes, byte* b, uecc_public_key* key);
 
+/**
+ * @brief Recover the signers of many signatures sharing one secp256k1
+ * context. Context setup costs more than a recovery, so discovery storms
+ * should verify what arrived in a poll cycle together.
+ *
+ * @param sigs n pointers to 65 byte signatures [r|s|v]
+ * @param digests n pointers to 32 byte signed digests
+ * @param keys n recovered keys (zeroed on failure)
+ * @param errs n results 0 OK -1 bad signature (or NULL)
+ * @param n
+ *
+ * @return number of signatures that failed to recover
+ */
+int uecc_recover_batch(
+    const byte** sigs,
+    const byte** digests,
+    uecc_public_key* keys,
+    int* errs,
+    size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,170 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "uecc_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define UECC_CACHE_MMAP 1
+#endif
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#define UECC_CACHE_LOCK(c) pthread_mutex_lock(&(c)->lock)
+#define UECC_CACHE_UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+#else
+#define UECC_CACHE_LOCK(c)
+#define UECC_CACHE_UNLOCK(c)
+#endif
+
+// private
+void* uecc_cache_alloc(size_t* sz);
+void uecc_cache_free(void* mem, size_t sz);
+void uecc_cache_wipe(void* mem, size_t sz);
+
+int
+uecc_cache_init(uecc_ctx* ctx, uint32_t n)
+{
+    uecc_cache* c;
+    size_t sz = sizeof(uecc_cache) + n * sizeof(uecc_cache_entry);
+    if (!n) return -1;
+    uecc_cache_deinit(ctx);
+    c = uecc_cache_alloc(&sz);
+    if (!c) return -1;
+    c->sz = sz;
+    c->n = n;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_init(&c->lock, NULL);
+#endif
+    ctx->cache = c;
+    return 0;
+}
+
+void
+uecc_cache_deinit(uecc_ctx* ctx)
+{
+    uecc_cache* c = ctx->cache;
+    ctx->cache = NULL;
+    if (!c) return;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_destroy(&c->lock);
+#endif
+    uecc_cache_free(c, c->sz);
+}
+
+int
+uecc_agree_cached(uecc_ctx* ctx, const uecc_public_key* q)
+{
+    return uecc_agree_cached_r(ctx, q, &ctx->z);
+}
+
+int
+uecc_agree_cached_r(
+    const uecc_ctx* ctx,
+    const uecc_public_key* q,
+    uecc_shared_secret_w_header* z)
+{
+    uecc_cache* c = ctx->cache;
+    uecc_cache_entry *e, *old;
+    if (!c) return uecc_agree_r(ctx, q, z);
+
+    // Hit - skip ecdh
+    UECC_CACHE_LOCK(c);
+    for (uint32_t i = 0; i < c->n; i++) {
+        e = &c->e[i];
+        if (e->used && !memcmp(&e->q, q, sizeof(uecc_public_key))) {
+            e->used = ++c->tick;
+            c->hits++;
+            memcpy(z, &e->z, sizeof(uecc_shared_secret_w_header));
+            UECC_CACHE_UNLOCK(c);
+            return 0;
+        }
+    }
+    c->misses++;
+    UECC_CACHE_UNLOCK(c);
+
+    // Miss - ecdh outside of the lock, then wipe least recent and remember
+    // new secret (unless another thread stored the same key meanwhile)
+    if (uecc_agree_r(ctx, q, z)) return -1;
+    UECC_CACHE_LOCK(c);
+    old = NULL;
+    for (uint32_t i = 0; i < c->n; i++) {
+        e = &c->e[i];
+        if (e->used && !memcmp(&e->q, q, sizeof(uecc_public_key))) {
+            old = e;
+            break;
+        }
+        if (!old || e->used < old->used) old = e;
+    }
+    uecc_cache_wipe(old, sizeof(uecc_cache_entry));
+    memcpy(&old->q, q, sizeof(uecc_public_key));
+    memcpy(&old->z, z, sizeof(uecc_shared_secret_w_header));
+    old->used = ++c->tick;
+    UECC_CACHE_UNLOCK(c);
+    return 0;
+}
+
+void*
+uecc_cache_alloc(size_t* sz)
+{
+    void* mem;
+#ifdef UECC_CACHE_MMAP
+    size_t page = sysconf(_SC_PAGESIZE);
+    *sz = (*sz + page - 1) & ~(page - 1);
+    mem = mmap(
+        NULL, *sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    mlock(mem, *sz); // best effort, RLIMIT_MEMLOCK may refuse
+#ifdef MADV_DONTDUMP
+    madvise(mem, *sz, MADV_DONTDUMP);
+#endif
+#else
+    mem = malloc(*sz);
+    if (mem) memset(mem, 0, *sz);
+#endif
+    return mem;
+}
+
+void
+uecc_cache_free(void* mem, size_t sz)
+{
+    uecc_cache_wipe(mem, sz);
+#ifdef UECC_CACHE_MMAP
+    munlock(mem, sz);
+    munmap(mem, sz);
+#else
+    free(mem);
+#endif
+}
+
+void
+uecc_cache_wipe(void* mem, size_t sz)
+{
+    // volatile so the wipe is not optimized away ahead of a free
+    volatile uint8_t* p = mem;
+    while (sz--) *p++ = 0;
+}
+
+//
+//
+//
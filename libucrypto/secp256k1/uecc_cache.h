@@ -0,0 +1,109 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#ifndef UECC_CACHE_H_
+#define UECC_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uecc.h"
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifndef UECC_CACHE_N
+#define UECC_CACHE_N 32 /*!< default remote keys remembered per static key */
+#endif
+
+typedef struct
+{
+    uint32_t used;                 /*!< last use, 0 when slot is free */
+    uecc_public_key q;             /*!< remote static public key */
+    uecc_shared_secret_w_header z; /*!< ecdh(d, q) */
+} uecc_cache_entry;
+
+/**
+ * @brief LRU of static-static shared secrets of one static key. Lives in
+ * memory that is locked (not swapped) and excluded from core dumps where the
+ * platform allows, and is wiped on eviction and release.
+ */
+typedef struct uecc_cache
+{
+    size_t sz;              /*!< bytes mapped */
+    uint32_t n;             /*!< slots */
+    uint32_t tick;          /*!< lru clock */
+    uint32_t hits, misses;  /*!< stats */
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_t lock;   /*!< slots are shared by all users of the key */
+#endif
+    uecc_cache_entry e[];   /*!< slots */
+} uecc_cache;
+
+/**
+ * @brief Attach a shared secret cache to a static key
+ *
+ * @param ctx static key
+ * @param n number of remote keys to remember
+ *
+ * @return 0 OK -1 error
+ */
+int uecc_cache_init(uecc_ctx* ctx, uint32_t n);
+
+/**
+ * @brief Wipe and release cache of a static key (called by uecc_key_deinit)
+ *
+ * @param ctx static key
+ */
+void uecc_cache_deinit(uecc_ctx* ctx);
+
+/**
+ * @brief Same as uecc_agree but remembers the result per remote key. Only use
+ * with long lived remote keys - one time keys would just churn the cache.
+ *
+ * @param ctx static key
+ * @param q remote static public key
+ *
+ * @return 0 OK -1 error
+ */
+int uecc_agree_cached(uecc_ctx* ctx, const uecc_public_key* q);
+
+/**
+ * @brief Reentrant uecc_agree_cached. The secret is written to the caller so
+ * a static key and its cache may be shared between threads.
+ *
+ * @param ctx static key
+ * @param q remote static public key
+ * @param z shared secret result
+ *
+ * @return 0 OK -1 error
+ */
+int uecc_agree_cached_r(
+    const uecc_ctx* ctx,
+    const uecc_public_key* q,
+    uecc_shared_secret_w_header* z);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
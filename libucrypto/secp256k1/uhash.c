@@ -22,62 +22,46 @@
 #include "uhash.h"
 #include <string.h>
 
-void
-usha256_init(usha256_ctx* ctx)
-{
-    secp256k1_sha256_initialize(ctx);
-}
-
-void
-usha256_update(usha256_ctx* ctx, const uint8_t* msg, size_t mlen)
-{
-    secp256k1_sha256_write(ctx, msg, mlen);
-}
-
-void
-usha256_finish(usha256_ctx* ctx, uint8_t* sha)
-{
-    secp256k1_sha256_finalize(ctx, sha);
-}
-
-void
-usha256_free(usha256_ctx* ctx)
-{
-    ((void)ctx);
-}
-
-void
-usha256(const uint8_t* msg, size_t msglen, uint8_t* sha)
-{
-    usha256_ctx ctx;
-    usha256_init(&ctx);
-    usha256_update(&ctx, msg, msglen);
-    usha256_finish(&ctx, sha);
-    usha256_free(&ctx);
-}
-
 void
 uhmac_sha256_init(uhmac_sha256_ctx* ctx, const uint8_t* key, size_t klen)
 {
-    secp256k1_hmac_sha256_initialize(ctx, key, klen);
+    uint8_t pad[64];
+    memset(pad, 0, 64);
+    if (klen > 64) {
+        usha256(key, klen, pad);
+    } else {
+        memcpy(pad, key, klen);
+    }
+    for (int i = 0; i < 64; i++) pad[i] ^= 0x36;
+    usha256_init(&ctx->inner);
+    usha256_update(&ctx->inner, pad, 64);
+    for (int i = 0; i < 64; i++) pad[i] ^= 0x36 ^ 0x5c;
+    usha256_init(&ctx->outer);
+    usha256_update(&ctx->outer, pad, 64);
+    memset(pad, 0, 64);
 }
 
 void
 uhmac_sha256_update(uhmac_sha256_ctx* ctx, const uint8_t* b, size_t l)
 {
-    secp256k1_hmac_sha256_write(ctx, b, l);
+    usha256_update(&ctx->inner, b, l);
 }
 
 void
 uhmac_sha256_finish(uhmac_sha256_ctx* ctx, uint8_t* hmac)
 {
-    secp256k1_hmac_sha256_finalize(ctx, hmac);
+    uint8_t tmp[32];
+    usha256_finish(&ctx->inner, tmp);
+    usha256_update(&ctx->outer, tmp, 32);
+    usha256_finish(&ctx->outer, hmac);
+    memset(tmp, 0, 32);
 }
 
 void
 uhmac_sha256_free(uhmac_sha256_ctx* ctx)
 {
-    ((void)ctx);
+    usha256_free(&ctx->inner);
+    usha256_free(&ctx->outer);
 }
 
 void
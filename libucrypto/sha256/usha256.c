@@ -0,0 +1,302 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usha256.h"
+#include <string.h>
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#include <pthread.h>
+#endif
+
+// The backend may be switched while other threads hash (usha256_backend_set)
+#if defined(__GNUC__)
+#define usha256_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define usha256_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define usha256_load(p) (*(p))
+#define usha256_store(p, v) (*(p) = (v))
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USHA256_HAVE_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Compress n consecutive 64 byte blocks into state
+ */
+typedef void (*usha256_compress_fn)(uint32_t*, const uint8_t*, size_t);
+
+void usha256_backend_detect(void);
+void usha256_compress_detect(uint32_t* s, const uint8_t* b, size_t n);
+void usha256_compress_portable(uint32_t* s, const uint8_t* b, size_t n);
+#ifdef USHA256_HAVE_SHANI
+void usha256_compress_shani(uint32_t* s, const uint8_t* b, size_t n);
+#endif
+
+usha256_compress_fn g_usha256_compress = usha256_compress_detect;
+USHA256_BACKEND g_usha256_backend = USHA256_BACKEND_PORTABLE;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+pthread_once_t g_usha256_once = PTHREAD_ONCE_INIT; /*!< first use detect */
+#endif
+
+const uint32_t g_usha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+void
+usha256_init(usha256_ctx* ctx)
+{
+    ctx->s[0] = 0x6a09e667, ctx->s[1] = 0xbb67ae85;
+    ctx->s[2] = 0x3c6ef372, ctx->s[3] = 0xa54ff53a;
+    ctx->s[4] = 0x510e527f, ctx->s[5] = 0x9b05688c;
+    ctx->s[6] = 0x1f83d9ab, ctx->s[7] = 0x5be0cd19;
+    ctx->bytes = 0;
+}
+
+void
+usha256_update(usha256_ctx* ctx, const uint8_t* msg, size_t mlen)
+{
+    size_t off = ctx->bytes % 64, n;
+    usha256_compress_fn compress = usha256_load(&g_usha256_compress);
+    ctx->bytes += mlen;
+
+    // Top up a partial block
+    if (off) {
+        n = 64 - off < mlen ? 64 - off : mlen;
+        memcpy(&ctx->b[off], msg, n);
+        msg += n, mlen -= n;
+        if (off + n < 64) return;
+        compress(ctx->s, ctx->b, 1);
+    }
+
+    // Whole blocks straight from caller memory in one call
+    if ((n = mlen / 64)) {
+        compress(ctx->s, msg, n);
+        msg += n * 64, mlen -= n * 64;
+    }
+    if (mlen) memcpy(ctx->b, msg, mlen);
+}
+
+void
+usha256_finish(usha256_ctx* ctx, uint8_t* sha)
+{
+    uint8_t pad[72];
+    uint64_t bits = ctx->bytes * 8;
+    size_t padlen = 64 - ((ctx->bytes + 8) % 64);
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; i++) pad[padlen + i] = bits >> (56 - 8 * i);
+    usha256_update(ctx, pad, padlen + 8);
+    for (int i = 0; i < 8; i++) {
+        sha[i * 4 + 0] = ctx->s[i] >> 24;
+        sha[i * 4 + 1] = ctx->s[i] >> 16;
+        sha[i * 4 + 2] = ctx->s[i] >> 8;
+        sha[i * 4 + 3] = ctx->s[i];
+    }
+}
+
+void
+usha256_free(usha256_ctx* ctx)
+{
+    memset(ctx, 0, sizeof(usha256_ctx));
+}
+
+void
+usha256(const uint8_t* msg, size_t msglen, uint8_t* sha)
+{
+    usha256_ctx ctx;
+    usha256_init(&ctx);
+    usha256_update(&ctx, msg, msglen);
+    usha256_finish(&ctx, sha);
+    usha256_free(&ctx);
+}
+
+void
+usha256_backend_detect()
+{
+    if (usha256_load(&g_usha256_compress) == usha256_compress_detect) {
+        if (usha256_backend_set(USHA256_BACKEND_SHANI)) {
+            usha256_backend_set(USHA256_BACKEND_PORTABLE);
+        }
+    }
+}
+
+USHA256_BACKEND
+usha256_backend()
+{
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_once(&g_usha256_once, usha256_backend_detect);
+#else
+    usha256_backend_detect();
+#endif
+    return usha256_load(&g_usha256_backend);
+}
+
+int
+usha256_backend_set(USHA256_BACKEND b)
+{
+    if (b == USHA256_BACKEND_PORTABLE) {
+        usha256_store(&g_usha256_compress, usha256_compress_portable);
+        usha256_store(&g_usha256_backend, b);
+        return 0;
+    }
+#ifdef USHA256_HAVE_SHANI
+    if (b == USHA256_BACKEND_SHANI) {
+        // leaf 1 ecx: ssse3 (9) sse4.1 (19), leaf 7 ebx: sha (29)
+        unsigned int a, bx, c, d;
+        if (!__get_cpuid(1, &a, &bx, &c, &d)) return -1;
+        if (!((c >> 9) & 1) || !((c >> 19) & 1)) return -1;
+        if (!__get_cpuid_count(7, 0, &a, &bx, &c, &d)) return -1;
+        if (!((bx >> 29) & 1)) return -1;
+        usha256_store(&g_usha256_compress, usha256_compress_shani);
+        usha256_store(&g_usha256_backend, b);
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+void
+usha256_compress_detect(uint32_t* s, const uint8_t* b, size_t n)
+{
+    usha256_backend();
+    usha256_load(&g_usha256_compress)(s, b, n);
+}
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define EP1(x) (ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define SIG0(x) (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define SIG1(x) (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+void
+usha256_compress_portable(uint32_t* s, const uint8_t* b, size_t n)
+{
+    uint32_t w[64], a, bb, c, d, e, f, g, h, t1, t2;
+    for (; n; n--, b += 64) {
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)b[i * 4] << 24 | (uint32_t)b[i * 4 + 1] << 16 |
+                   (uint32_t)b[i * 4 + 2] << 8 | (uint32_t)b[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            w[i] = SIG1(w[i - 2]) + w[i - 7] + SIG0(w[i - 15]) + w[i - 16];
+        }
+        a = s[0], bb = s[1], c = s[2], d = s[3];
+        e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            t1 = h + EP1(e) + CH(e, f, g) + g_usha256_k[i] + w[i];
+            t2 = EP0(a) + MAJ(a, bb, c);
+            h = g, g = f, f = e, e = d + t1;
+            d = c, c = bb, bb = a, a = t1 + t2;
+        }
+        s[0] += a, s[1] += bb, s[2] += c, s[3] += d;
+        s[4] += e, s[5] += f, s[6] += g, s[7] += h;
+    }
+}
+
+#ifdef USHA256_HAVE_SHANI
+
+// Four rounds of message group g. cur holds W[4g..4g+3], nxt and prv are the
+// neighbouring schedule vectors which are advanced in place.
+#define SHANI_QUAD(g, cur, nxt, prv)                                           \
+    do {                                                                       \
+        msg = _mm_add_epi32(                                                   \
+            cur, _mm_loadu_si128((const __m128i*)&g_usha256_k[4 * (g)]));      \
+        st1 = _mm_sha256rnds2_epu32(st1, st0, msg);                            \
+        if ((g) >= 3 && (g) <= 14) {                                           \
+            tmp = _mm_alignr_epi8(cur, prv, 4);                                \
+            nxt = _mm_add_epi32(nxt, tmp);                                     \
+            nxt = _mm_sha256msg2_epu32(nxt, cur);                              \
+        }                                                                      \
+        msg = _mm_shuffle_epi32(msg, 0x0e);                                    \
+        st0 = _mm_sha256rnds2_epu32(st0, st1, msg);                            \
+        if ((g) >= 1 && (g) <= 12) prv = _mm_sha256msg1_epu32(prv, cur);       \
+    } while (0)
+
+__attribute__((target("sha,sse4.1,ssse3"))) void
+usha256_compress_shani(uint32_t* s, const uint8_t* b, size_t n)
+{
+    __m128i st0, st1, msg, tmp, m0, m1, m2, m3, abef, cdgh;
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Load state as ABEF/CDGH
+    tmp = _mm_loadu_si128((const __m128i*)&s[0]);
+    st1 = _mm_loadu_si128((const __m128i*)&s[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    st1 = _mm_shuffle_epi32(st1, 0x1b);
+    st0 = _mm_alignr_epi8(tmp, st1, 8);
+    st1 = _mm_blend_epi16(st1, tmp, 0xf0);
+
+    for (; n; n--, b += 64) {
+        abef = st0, cdgh = st1;
+        m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&b[0]), mask);
+        m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&b[16]), mask);
+        m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&b[32]), mask);
+        m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&b[48]), mask);
+        SHANI_QUAD(0, m0, m1, m3);
+        SHANI_QUAD(1, m1, m2, m0);
+        SHANI_QUAD(2, m2, m3, m1);
+        SHANI_QUAD(3, m3, m0, m2);
+        SHANI_QUAD(4, m0, m1, m3);
+        SHANI_QUAD(5, m1, m2, m0);
+        SHANI_QUAD(6, m2, m3, m1);
+        SHANI_QUAD(7, m3, m0, m2);
+        SHANI_QUAD(8, m0, m1, m3);
+        SHANI_QUAD(9, m1, m2, m0);
+        SHANI_QUAD(10, m2, m3, m1);
+        SHANI_QUAD(11, m3, m0, m2);
+        SHANI_QUAD(12, m0, m1, m3);
+        SHANI_QUAD(13, m1, m2, m0);
+        SHANI_QUAD(14, m2, m3, m1);
+        SHANI_QUAD(15, m3, m0, m2);
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+    }
+
+    // Store state back as ABCD/EFGH
+    tmp = _mm_shuffle_epi32(st0, 0x1b);
+    st1 = _mm_shuffle_epi32(st1, 0xb1);
+    st0 = _mm_blend_epi16(tmp, st1, 0xf0);
+    st1 = _mm_alignr_epi8(st1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&s[0], st0);
+    _mm_storeu_si128((__m128i*)&s[4], st1);
+}
+
+#endif
+
+//
+//
+//
@@ -0,0 +1,73 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#ifndef USHA256_H_
+#define USHA256_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Compression backends. Selected at runtime on first use.
+ */
+typedef enum {
+    USHA256_BACKEND_PORTABLE = 0, /*!< plain C */
+    USHA256_BACKEND_SHANI = 1     /*!< x86 SHA extensions */
+} USHA256_BACKEND;
+
+typedef struct
+{
+    uint32_t s[8];   /*!< chaining state */
+    uint8_t b[64];   /*!< partial block */
+    uint64_t bytes;  /*!< total bytes absorbed */
+} usha256_ctx;
+
+void usha256_init(usha256_ctx*);
+void usha256_update(usha256_ctx*, const uint8_t*, size_t);
+void usha256_finish(usha256_ctx*, uint8_t*);
+void usha256_free(usha256_ctx*);
+void usha256(const uint8_t* msg, size_t msglen, uint8_t* sha);
+
+/**
+ * @brief Backend in use, detects cpu features on first call.
+ *
+ * @return USHA256_BACKEND
+ */
+USHA256_BACKEND usha256_backend(void);
+
+/**
+ * @brief Force a backend (ie: for testing and benchmarks). Safe while other
+ * threads hash, each compression runs on the old or the new backend.
+ *
+ * @param b backend
+ *
+ * @return 0 OK -1 backend not supported on this cpu
+ */
+int usha256_backend_set(USHA256_BACKEND b);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
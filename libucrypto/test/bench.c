@@ -0,0 +1,408 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ *
+ * @brief ucrypto_bench [threads] [ms]
+ *
+ * Runs every case for [ms] milliseconds on one thread and then on [threads]
+ * threads (each with its own keys and buffers) and prints ops/sec, cycles/op
+ * and MB/s. Cycles are read from the TSC where available so they are wall
+ * clock cycles at the reference frequency.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "uaes.h"
+#include "uecc.h"
+#include "uecies_decrypt.h"
+#include "uecies_encrypt.h"
+#include "uhash.h"
+#include "ukeccak256.h"
+#include "urand.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#include <pthread.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() ((uint64_t)__rdtsc())
+#else
+#define BENCH_CYCLES() ((uint64_t)0)
+#endif
+
+#define BENCH_THREADS_MAX 64
+#define BENCH_AUTH_PLAIN 194 /*!< rlpx auth body (sig+hepub+pub+nonce+ver) */
+#define BENCH_ACK_PLAIN 97   /*!< rlpx ack body (pub+nonce+ver) */
+#define BENCH_BATCH 16       /*!< signatures per uecc_recover_batch call */
+#define BENCH_BUF 16384
+
+/**
+ * @brief Per thread state. Every case only touches its own bench_ctx so the
+ * threaded runs measure the library and not contention in the bench.
+ */
+typedef struct
+{
+    uecc_ctx key;               /*!< local static key */
+    uecc_ctx peer;              /*!< remote static key */
+    uecc_signature sig;         /*!< signature over digest */
+    h520 sig_bin;               /*!< serialized sig */
+    h256 digest;                /*!< message signed */
+    uaes_ctx aes;               /*!< keyed ctr context */
+    uint8_t auth[BENCH_AUTH_PLAIN + 113]; /*!< ecies auth cipher */
+    uint8_t ack[BENCH_ACK_PLAIN + 113];   /*!< ecies ack cipher */
+    uint8_t in[BENCH_BUF];                /*!< input */
+    uint8_t out[BENCH_BUF + 128];         /*!< output */
+} bench_ctx;
+
+typedef int (*bench_fn)(bench_ctx*, size_t);
+
+typedef struct
+{
+    const char* name; /*!< printed */
+    bench_fn fn;      /*!< one op */
+    size_t len;       /*!< bytes per op (0 if not a throughput case) */
+    size_t ops;       /*!< ops per fn call */
+} bench_case;
+
+typedef struct
+{
+    const bench_case* c; /*!< case to run */
+    bench_ctx* ctx;      /*!< this threads state */
+    uint64_t ms;         /*!< run time */
+    uint64_t ops;        /*!< result ops */
+    uint64_t ns;         /*!< result elapsed */
+    uint64_t cycles;     /*!< result tsc delta */
+    int err;             /*!< result first error */
+} bench_run;
+
+int bench_ctx_init(bench_ctx* ctx);
+void bench_ctx_deinit(bench_ctx* ctx);
+void bench_exec(bench_run* run);
+int bench_case_run(const bench_case* c, bench_ctx* ctxs, int n, uint64_t ms);
+uint64_t bench_now_ns(void);
+
+int bench_keygen(bench_ctx* ctx, size_t len);
+int bench_sign(bench_ctx* ctx, size_t len);
+int bench_recover(bench_ctx* ctx, size_t len);
+int bench_recover_batch(bench_ctx* ctx, size_t len);
+int bench_ecdh(bench_ctx* ctx, size_t len);
+int bench_ecies_enc(bench_ctx* ctx, size_t len);
+int bench_ecies_dec_auth(bench_ctx* ctx, size_t len);
+int bench_ecies_dec_ack(bench_ctx* ctx, size_t len);
+int bench_keccak(bench_ctx* ctx, size_t len);
+int bench_aes_ctr(bench_ctx* ctx, size_t len);
+int bench_hmac(bench_ctx* ctx, size_t len);
+int bench_kdf(bench_ctx* ctx, size_t len);
+int bench_urand(bench_ctx* ctx, size_t len);
+
+const bench_case g_bench_cases[] = {
+    { "keygen", bench_keygen, 0, 1 },
+    { "sign", bench_sign, 0, 1 },
+    { "recover", bench_recover, 0, 1 },
+    { "recover (batch 16)", bench_recover_batch, 0, BENCH_BATCH },
+    { "ecdh", bench_ecdh, 0, 1 },
+    { "ecies encrypt auth", bench_ecies_enc, BENCH_AUTH_PLAIN, 1 },
+    { "ecies encrypt ack", bench_ecies_enc, BENCH_ACK_PLAIN, 1 },
+    { "ecies decrypt auth", bench_ecies_dec_auth, BENCH_AUTH_PLAIN, 1 },
+    { "ecies decrypt ack", bench_ecies_dec_ack, BENCH_ACK_PLAIN, 1 },
+    { "keccak256 32", bench_keccak, 32, 1 },
+    { "keccak256 256", bench_keccak, 256, 1 },
+    { "keccak256 1024", bench_keccak, 1024, 1 },
+    { "keccak256 16384", bench_keccak, 16384, 1 },
+    { "aes128 ctr 16384", bench_aes_ctr, 16384, 1 },
+    { "hmac sha256 64", bench_hmac, 64, 1 },
+    { "hmac sha256 1024", bench_hmac, 1024, 1 },
+    { "kdf 32", bench_kdf, 32, 1 },
+    { "urand 32", bench_urand, 32, 1 },
+};
+
+int
+main(int argc, char* argv[])
+{
+    int err = 0, n = 4;
+    uint64_t ms = 500;
+    bench_ctx* ctxs;
+    if (argc > 1) n = atoi(argv[1]);
+    if (argc > 2) ms = strtoull(argv[2], NULL, 10);
+    if (n < 1) n = 1;
+    if (n > BENCH_THREADS_MAX) n = BENCH_THREADS_MAX;
+#ifndef UCRYPTO_CONFIG_PTHREAD
+    if (n > 1) printf("built without UETH_USE_PTHREAD, threads=1\n");
+    n = 1;
+#endif
+
+    ctxs = malloc(sizeof(bench_ctx) * n);
+    if (!ctxs) return -1;
+    for (int i = 0; i < n; i++) {
+        if (bench_ctx_init(&ctxs[i])) {
+            while (i--) bench_ctx_deinit(&ctxs[i]);
+            free(ctxs);
+            return -1;
+        }
+    }
+
+    printf("%-22s %7s %12s %10s %10s\n", "case", "threads", "ops/s",
+           "cycles/op", "MB/s");
+    for (size_t i = 0; i < sizeof(g_bench_cases) / sizeof(bench_case); i++) {
+        err |= bench_case_run(&g_bench_cases[i], ctxs, 1, ms);
+        if (n > 1) err |= bench_case_run(&g_bench_cases[i], ctxs, n, ms);
+    }
+
+    for (int i = 0; i < n; i++) bench_ctx_deinit(&ctxs[i]);
+    free(ctxs);
+    return err;
+}
+
+uint64_t
+bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int
+bench_ctx_init(bench_ctx* ctx)
+{
+    int err = -1;
+    uaes_ctx* aes;
+    memset(ctx, 0, sizeof(bench_ctx));
+    urand(ctx->in, sizeof(ctx->in));
+    urand(ctx->digest.b, 32);
+    if (uecc_key_init_new(&ctx->key)) return -1;
+    if (uecc_key_init_new(&ctx->peer)) goto ERR_KEY;
+    if (uecc_sign(&ctx->key, ctx->digest.b, 32, &ctx->sig)) goto ERR_PEER;
+    uecc_sig_to_bin(&ctx->sig, ctx->sig_bin.b);
+    if (uaes_init_128(&ctx->aes, ctx->in)) goto ERR_PEER;
+
+    // Ciphers for the decrypt cases are sent to our own static key
+    if (uecies_encrypt(&ctx->key.Q, NULL, 0, ctx->in, BENCH_AUTH_PLAIN,
+                       ctx->auth) < 0)
+        goto ERR_AES;
+    if (uecies_encrypt(&ctx->key.Q, NULL, 0, ctx->in, BENCH_ACK_PLAIN,
+                       ctx->ack) < 0)
+        goto ERR_AES;
+    return 0;
+
+ERR_AES:
+    aes = &ctx->aes;
+    uaes_deinit(&aes);
+ERR_PEER:
+    uecc_key_deinit(&ctx->peer);
+ERR_KEY:
+    uecc_key_deinit(&ctx->key);
+    return err;
+}
+
+void
+bench_ctx_deinit(bench_ctx* ctx)
+{
+    uaes_ctx* aes = &ctx->aes;
+    uaes_deinit(&aes);
+    uecc_key_deinit(&ctx->peer);
+    uecc_key_deinit(&ctx->key);
+}
+
+void
+bench_exec(bench_run* run)
+{
+    uint64_t start, stop, now, c0;
+    run->ops = 0;
+    run->err = 0;
+    start = bench_now_ns();
+    stop = start + run->ms * 1000000ULL;
+    c0 = BENCH_CYCLES();
+    do {
+        // Check the clock every few ops so timing stays out of short cases
+        for (int i = 0; i < 8; i++) {
+            int err = run->c->fn(run->ctx, run->c->len);
+            if (err && !run->err) run->err = err;
+        }
+        run->ops += 8 * run->c->ops;
+    } while ((now = bench_now_ns()) < stop);
+    run->cycles = BENCH_CYCLES() - c0;
+    run->ns = now - start;
+}
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+void*
+bench_thread(void* arg)
+{
+    bench_exec((bench_run*)arg);
+    return NULL;
+}
+#endif
+
+int
+bench_case_run(const bench_case* c, bench_ctx* ctxs, int n, uint64_t ms)
+{
+    bench_run runs[BENCH_THREADS_MAX];
+    double ops = 0.0, cycles = 0.0, rate, mbs;
+    int err = 0;
+    for (int i = 0; i < n; i++) {
+        runs[i].c = c;
+        runs[i].ctx = &ctxs[i];
+        runs[i].ms = ms;
+    }
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_t threads[BENCH_THREADS_MAX];
+    int started = 1;
+    for (int i = 1; i < n; i++, started++) {
+        if (pthread_create(&threads[i], NULL, bench_thread, &runs[i])) break;
+    }
+    bench_exec(&runs[0]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    n = started;
+#else
+    bench_exec(&runs[0]);
+#endif
+
+    // Aggregate rate is the sum of each threads rate; cycles/op is per thread
+    for (int i = 0; i < n; i++) {
+        ops += (double)runs[i].ops * 1e9 / (double)runs[i].ns;
+        cycles += (double)runs[i].cycles / (double)runs[i].ops;
+        if (runs[i].err && !err) err = runs[i].err;
+    }
+    rate = ops;
+    cycles /= n;
+    mbs = c->len ? rate * (double)c->len / 1e6 : 0.0;
+    printf("%-22s %7d %12.0f %10.0f ", c->name, n, rate, cycles);
+    if (c->len) {
+        printf("%10.1f", mbs);
+    } else {
+        printf("%10s", "-");
+    }
+    printf("%s\n", err ? " (error)" : "");
+    return err ? -1 : 0;
+}
+
+int
+bench_keygen(bench_ctx* ctx, size_t len)
+{
+    uecc_ctx k;
+    int err;
+    ((void)ctx);
+    ((void)len);
+    err = uecc_key_init_new(&k);
+    if (!err) uecc_key_deinit(&k);
+    return err;
+}
+
+int
+bench_sign(bench_ctx* ctx, size_t len)
+{
+    ((void)len);
+    return uecc_sign(&ctx->key, ctx->digest.b, 32, &ctx->sig);
+}
+
+int
+bench_recover(bench_ctx* ctx, size_t len)
+{
+    uecc_public_key q;
+    ((void)len);
+    return uecc_recover_bin(ctx->sig_bin.b, ctx->digest.b, &q) ? -1 : 0;
+}
+
+int
+bench_recover_batch(bench_ctx* ctx, size_t len)
+{
+    const byte* sigs[BENCH_BATCH];
+    const byte* digests[BENCH_BATCH];
+    uecc_public_key keys[BENCH_BATCH];
+    int errs[BENCH_BATCH];
+    ((void)len);
+    for (int i = 0; i < BENCH_BATCH; i++) {
+        sigs[i] = ctx->sig_bin.b;
+        digests[i] = ctx->digest.b;
+    }
+    return uecc_recover_batch(sigs, digests, keys, errs, BENCH_BATCH) ? -1 : 0;
+}
+
+int
+bench_ecdh(bench_ctx* ctx, size_t len)
+{
+    ((void)len);
+    return uecc_agree(&ctx->key, &ctx->peer.Q);
+}
+
+int
+bench_ecies_enc(bench_ctx* ctx, size_t len)
+{
+    return uecies_encrypt(&ctx->peer.Q, NULL, 0, ctx->in, len, ctx->out) < 0
+               ? -1
+               : 0;
+}
+
+int
+bench_ecies_dec_auth(bench_ctx* ctx, size_t len)
+{
+    int sz = uecies_decrypt(&ctx->key, NULL, 0, ctx->auth,
+                            uecies_encrypt_size(len), ctx->out);
+    return sz == (int)len ? 0 : -1;
+}
+
+int
+bench_ecies_dec_ack(bench_ctx* ctx, size_t len)
+{
+    int sz = uecies_decrypt(&ctx->key, NULL, 0, ctx->ack,
+                            uecies_encrypt_size(len), ctx->out);
+    return sz == (int)len ? 0 : -1;
+}
+
+int
+bench_keccak(bench_ctx* ctx, size_t len)
+{
+    return ukeccak256(ctx->in, len, ctx->out, 32);
+}
+
+int
+bench_aes_ctr(bench_ctx* ctx, size_t len)
+{
+    return uaes_crypt_ctr_op(&ctx->aes, ctx->digest.b, ctx->in, len, ctx->out);
+}
+
+int
+bench_hmac(bench_ctx* ctx, size_t len)
+{
+    uhmac_sha256(ctx->digest.b, 32, ctx->in, len, ctx->out);
+    return 0;
+}
+
+int
+bench_kdf(bench_ctx* ctx, size_t len)
+{
+    uhash_kdf(ctx->in, len, ctx->out, 32);
+    return 0;
+}
+
+int
+bench_urand(bench_ctx* ctx, size_t len)
+{
+    return urand(ctx->out, len);
+}
+
+//
+//
+//
@@ -19,11 +19,14 @@
  * @date 2017
  */
 
+#include "uaes.h"
 #include "uecc.h"
+#include "uecc_cache.h"
 #include "uecies_decrypt.h"
 #include "uecies_encrypt.h"
 #include "uhash.h"
 #include "ukeccak256.h"
+#include "upool.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -91,17 +94,37 @@ const char* g_ecdh_pub =
     "7332598b6aa4e180a41e92f4ebbae3518da847f0b1c0bbfe20bcf4e1";
 const char* g_ecdh_secret =
     "ee1418607c2fcfb57fda40380e885a707f49000a5dda056d828b7d9bd1f29a08";
+const char* g_sha_in[] = {
+    "",
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+};
+const char* g_sha_out[] = {
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+};
+const char* g_aes_key = "2b7e151628aed2a6abf7158809cf4f3c";
+const char* g_aes_ctr = "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+const char* g_aes_plain =
+    "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51";
+const char* g_aes_cipher =
+    "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff";
 /**
  * @brief Prototypes
  */
 int test_ecc(void);
 int test_ecdh(void);
+int test_ecdh_cache(void);
 int test_recover(void);
+int test_sha256(void);
 int test_kdf(void);
 int test_hmac(void);
 int test_keccak(void);
+int test_aes(void);
 int test_ecies_encrypt(void);
 int test_ecies_decrypt(void);
+int test_upool(void);
 
 int
 main(int argc, char* argv[])
@@ -111,12 +134,16 @@ main(int argc, char* argv[])
     int err = 0;
     err |= test_ecc();
     err |= test_ecdh();
+    err |= test_ecdh_cache();
     err |= test_recover();
+    err |= test_sha256();
     err |= test_kdf();
     err |= test_hmac();
     err |= test_keccak();
+    err |= test_aes();
     err |= test_ecies_encrypt();
     err |= test_ecies_decrypt();
+    err |= test_upool();
     return err;
 }
 
@@ -196,6 +223,36 @@ EXIT:
     return err;
 }
 
+int
+test_ecdh_cache()
+{
+    int err = 0;
+    uecc_ctx s, r[3];
+    uecc_shared_secret_w_header z[3];
+    int order[] = { 0, 1, 0, 2, 1, 0 }; // miss miss hit then evict lru
+
+    IF_ERR_EXIT(uecc_key_init_new(&s));
+    for (int i = 0; i < 3; i++) {
+        IF_ERR_EXIT(uecc_key_init_new(&r[i]));
+        IF_ERR_EXIT(uecc_agree(&s, &r[i].Q));
+        memcpy(&z[i], &s.z, sizeof(z[i]));
+    }
+
+    // Cache of two remote keys returns same secrets as uncached agree
+    IF_ERR_EXIT(uecc_cache_init(&s, 2));
+    for (int i = 0; i < 6; i++) {
+        memset(&s.z, 0, sizeof(s.z));
+        IF_ERR_EXIT(uecc_agree_cached(&s, &r[order[i]].Q));
+        IF_ERR_EXIT(memcmp(&s.z, &z[order[i]], sizeof(s.z)) ? -1 : 0);
+    }
+    IF_ERR_EXIT(s.cache->hits == 1 && s.cache->misses == 5 ? 0 : -1);
+
+EXIT:
+    uecc_key_deinit(&s);
+    for (int i = 0; i < 3; i++) uecc_key_deinit(&r[i]);
+    return err;
+}
+
 int
 test_recover()
 {
@@ -214,10 +271,69 @@ test_recover()
     uecc_qtob(&pub, rawpub, 65);
     uecc_qtob(&alice.Q, alicepub, 65);
     err = memcmp(rawpub, alicepub, 65) ? -1 : 0;
+
+    // Batch, every other signature has a bad recovery id
+    uint8_t sigs[4][65];
+    const uint8_t *psigs[4], *pmsgs[4];
+    uecc_public_key keys[4];
+    int errs[4];
+    for (int i = 0; i < 4; i++) {
+        memcpy(sigs[i], rawsig, 65);
+        if (i & 1) sigs[i][64] = 7;
+        psigs[i] = sigs[i];
+        pmsgs[i] = msg;
+    }
+    if (!(uecc_recover_batch(psigs, pmsgs, keys, errs, 4) == 2)) err = -1;
+    for (int i = 0; i < 4; i++) {
+        if (!(errs[i] == ((i & 1) ? -1 : 0))) err = -1;
+        if (!(i & 1) && !uecc_cmpq(&keys[i], &alice.Q)) err = -1;
+    }
+    if (!uecc_recover_bin(sigs[1], msg, &pub)) err = -1;
+
     uecc_key_deinit(&alice);
     return err;
 }
 
+int
+test_sha256()
+{
+    int err = 0;
+    uint8_t big[1000], result[32], expect[32], first[32];
+    usha256_ctx ctx;
+    USHA256_BACKEND backends[] = { USHA256_BACKEND_PORTABLE,
+                                   USHA256_BACKEND_SHANI },
+                    start = usha256_backend();
+
+    for (uint32_t i = 0; i < sizeof(big); i++) big[i] = (uint8_t)(i * 7);
+
+    for (int b = 0; b < 2; b++) {
+        if (usha256_backend_set(backends[b])) continue; // not on this cpu
+
+        // Known answers
+        for (int i = 0; i < 3; i++) {
+            usha256((const uint8_t*)g_sha_in[i], strlen(g_sha_in[i]), result);
+            memcpy(expect, makebin(g_sha_out[i], NULL), 32);
+            IF_ERR_EXIT(memcmp(result, expect, 32) ? -1 : 0);
+        }
+
+        // Odd sized updates across block boundaries match one-shot, and
+        // every backend matches the portable one
+        usha256(big, sizeof(big), expect);
+        usha256_init(&ctx);
+        for (size_t i = 0, n = 1; i < sizeof(big); i += n, n += 13) {
+            usha256_update(&ctx, &big[i], i + n > 1000 ? 1000 - i : n);
+        }
+        usha256_finish(&ctx, result);
+        IF_ERR_EXIT(memcmp(result, expect, 32) ? -1 : 0);
+        if (b == 0) memcpy(first, result, 32);
+        IF_ERR_EXIT(memcmp(result, first, 32) ? -1 : 0);
+    }
+
+EXIT:
+    usha256_backend_set(start);
+    return err;
+}
+
 int
 test_kdf()
 {
@@ -262,8 +378,10 @@ test_hmac()
     uhmac_sha256_init(&h256, key, 16);
     uhmac_sha256_update(&h256, input, 10);
     uhmac_sha256_finish(&h256, result);
-    err = memcmp(expect, result, lres) ? -1 : 0;
+    IF_ERR_EXIT(memcmp(expect, result, lres) ? -1 : 0);
 
+EXIT:
+    uhmac_sha256_free(&h256);
     return err;
 }
 
@@ -312,6 +430,37 @@ EXIT:
     return err;
 }
 
+int
+test_aes()
+{
+    int err = 0;
+    uint8_t key[16], plain[32], expect[32], out[32], iv[16];
+    uaes_ctx ctx, *ctx_p = &ctx;
+
+    memcpy(key, makebin(g_aes_key, NULL), 16);
+    memcpy(plain, makebin(g_aes_plain, NULL), 32);
+    memcpy(expect, makebin(g_aes_cipher, NULL), 32);
+
+    // Keyed context
+    IF_ERR_EXIT(uaes_init_128(&ctx, key));
+    memcpy(iv, makebin(g_aes_ctr, NULL), 16);
+    IF_ERR_EXIT(uaes_crypt_ctr_op(&ctx, iv, plain, 32, out));
+    uaes_deinit(&ctx_p);
+    IF_ERR_EXIT(memcmp(out, expect, 32) ? -1 : 0);
+
+    // One-shot, round trip
+    memcpy(iv, makebin(g_aes_ctr, NULL), 16);
+    IF_ERR_EXIT(uaes_crypt_ctr(128, key, iv, plain, 32, out));
+    IF_ERR_EXIT(memcmp(out, expect, 32) ? -1 : 0);
+    memcpy(iv, makebin(g_aes_ctr, NULL), 16);
+    IF_ERR_EXIT(uaes_crypt_ctr(128, key, iv, out, 32, out));
+    IF_ERR_EXIT(memcmp(out, plain, 32) ? -1 : 0);
+    IF_ERR_EXIT(uaes_crypt_ctr(100, key, iv, plain, 32, out) ? 0 : -1);
+
+EXIT:
+    return err;
+}
+
 int
 test_ecies_encrypt()
 {
@@ -363,6 +512,83 @@ EXIT:
     return err;
 }
 
+typedef struct
+{
+    upool_job job;
+    uint8_t in[64];
+    uint8_t out[32];
+} test_upool_job;
+
+int g_test_upool_done = 0;
+int g_test_upool_notify = 0; /*!< bumped by workers under the pool lock */
+
+void
+test_upool_work(upool_job* job)
+{
+    test_upool_job* t = (test_upool_job*)job;
+    ukeccak256(t->in, sizeof(t->in), t->out, 32);
+    job->err = 0;
+}
+
+void
+test_upool_notify(void* ctx)
+{
+    ((void)ctx);
+    g_test_upool_notify++;
+}
+
+void
+test_upool_done(upool_job* job)
+{
+    test_upool_job* t = (test_upool_job*)job;
+    uint8_t expect[32];
+    ukeccak256(t->in, sizeof(t->in), expect, 32);
+    if (!memcmp(expect, t->out, 32)) g_test_upool_done++;
+}
+
+int
+test_upool()
+{
+    int err = 0, queued, active;
+    uint32_t threads[] = { 0, 1, 4 };
+    test_upool_job jobs[32];
+    upool pool;
+
+    // NULL pool runs inline
+    g_test_upool_done = 0;
+    memset(jobs[0].in, 0x11, 64);
+    queued = upool_submit(
+        NULL, &jobs[0].job, test_upool_work, test_upool_done, NULL);
+    IF_ERR_EXIT(!queued && g_test_upool_done == 1 ? 0 : -1);
+
+    for (uint32_t t = 0; t < sizeof(threads) / sizeof(uint32_t); t++) {
+        g_test_upool_done = g_test_upool_notify = queued = 0;
+        IF_ERR_EXIT(upool_init(&pool, threads[t]));
+        upool_notify_set(&pool, test_upool_notify, NULL);
+        active = upool_active(&pool);
+        for (int i = 0; i < 32; i++) {
+            memset(jobs[i].in, i, 64);
+            queued += upool_submit(
+                &pool, &jobs[i].job, test_upool_work, test_upool_done, NULL);
+        }
+        // Drain half way through the event loop, rest on flush
+        while (active && g_test_upool_done < 16) {
+            upool_poll(&pool);
+        }
+        upool_flush(&pool);
+        upool_deinit(&pool);
+        IF_ERR_EXIT(g_test_upool_done == 32 ? 0 : -1);
+        IF_ERR_EXIT(queued == (active ? 32 : 0) ? 0 : -1);
+
+        // Told at least once per drain, never more than once per job
+        IF_ERR_EXIT(!active || g_test_upool_notify >= 1 ? 0 : -1);
+        IF_ERR_EXIT(g_test_upool_notify <= queued ? 0 : -1);
+    }
+
+EXIT:
+    return err;
+}
+
 const uint8_t*
 makebin(const char* str, size_t* len)
 {
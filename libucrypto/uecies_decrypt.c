@@ -29,7 +29,7 @@
 
 int
 uecies_decrypt(
-    uecc_ctx* ctx,
+    const uecc_ctx* ctx,
     const uint8_t* shared_mac,
     size_t shared_mac_len,
     const uint8_t* cipher,
@@ -43,13 +43,16 @@ uecies_decrypt(
     uaes_iv* iv_ref = (uaes_iv*)&cipher[65];
     uaes_iv iv;
     memcpy(&iv.b, iv_ref->b, 16);
-    uaes_ctr_128_key* ekey = (uaes_ctr_128_key*)key;
+    uaes_ctx aes, *aes_p = &aes;
     uhmac_sha256_ctx hmac;
+    uecc_shared_secret_w_header z;
 
-    sz = uecc_agree_bin(ctx, cipher, 65);
+    // Secret stays on our stack so ctx can be shared between threads
+    sz = uecc_agree_bin_r(ctx, cipher, 65, &z);
     if (sz) return -1;
 
-    uhash_kdf(&ctx->z.b[1], 32, key, 32);
+    uhash_kdf(&z.b[1], 32, key, 32);
+    memset(z.b, 0, sizeof(z.b));
     usha256(&key[16], 16, mkey);
     uhmac_sha256_init(&hmac, mkey, 32);
     uhmac_sha256_update(&hmac, &cipher[65], len - 32 - 65);
@@ -60,7 +63,10 @@ uecies_decrypt(
         if (!(tmac[i] == cipher[len - 32 + i])) return -1;
     }
 
-    sz = uaes_crypt_ctr_128(ekey, &iv, &cipher[81], len - 32 - 16 - 65, plain);
+    sz = uaes_init_128(&aes, key);
+    if (sz) return sz;
+    sz = uaes_crypt_ctr_op(&aes, iv.b, &cipher[81], len - 32 - 16 - 65, plain);
+    uaes_deinit(&aes_p);
 
-    return sz ? sz : len - 32 - 16 - 65;
+    return sz ? sz : (int)(len - 32 - 16 - 65);
 }
@@ -30,8 +30,12 @@ extern "C" {
 #include "uecc.h"
 #include "uhash.h"
 
+/**
+ * @brief Decrypt with our key. ctx is only read so a static key may be
+ * shared between threads.
+ */
 int uecies_decrypt(
-    uecc_ctx* ctx,
+    const uecc_ctx* ctx,
     const uint8_t* shared_mac,
     size_t shared_mac_len,
     const uint8_t* cipher,
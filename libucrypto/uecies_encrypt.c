@@ -38,7 +38,7 @@ uecies_encrypt(
     size_t tmp = sizeof(uecc_public_key_w_header);
     uhmac_sha256_ctx hmac;
     uecc_ctx ecc;
-    uaes_ctr_128_key* ekey = (uaes_ctr_128_key*)&key[0];
+    uaes_ctx aes, *aes_p = &aes;
     uaes_iv* iv_dst = (uaes_iv*)&out[65];
 
     uecc_key_init_new(&ecc);
@@ -51,7 +51,10 @@ uecies_encrypt(
     usha256(&key[16], 16, mkey);
     urand(iv_dst->b, 16);
     memcpy(iv.b, iv_dst->b, 16);
-    err = uaes_crypt_ctr_128(ekey, &iv, in, inlen, &out[81]);
+    err = uaes_init_128(&aes, key);
+    if (err) goto EXIT;
+    err = uaes_crypt_ctr_op(&aes, iv.b, in, inlen, &out[81]);
+    uaes_deinit(&aes_p);
     if (err) goto EXIT;
     uhmac_sha256_init(&hmac, mkey, 32);
     uhmac_sha256_update(&hmac, &out[65], 16 + inlen);
@@ -0,0 +1,193 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "upool.h"
+#include <string.h>
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+// private
+void* upool_worker(void* arg);
+#endif
+
+int
+upool_init(upool* pool, uint32_t n)
+{
+    memset(pool, 0, sizeof(upool));
+    pool->todo_tail = &pool->todo;
+    pool->done_tail = &pool->done;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    if (n > UPOOL_MAX_THREADS) n = UPOOL_MAX_THREADS;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (pool->n = 0; pool->n < n; pool->n++) {
+        if (pthread_create(
+                &pool->threads[pool->n], NULL, upool_worker, pool)) {
+            upool_deinit(pool);
+            return -1;
+        }
+    }
+#else
+    ((void)n);
+#endif
+    return 0;
+}
+
+void
+upool_deinit(upool* pool)
+{
+    upool_flush(pool);
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->n; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->lock);
+#endif
+    pool->n = 0;
+}
+
+void
+upool_notify_set(upool* pool, upool_notify_fn fn, void* ctx)
+{
+    pool->notify = fn;
+    pool->notify_ctx = ctx;
+}
+
+int
+upool_submit(
+    upool* pool,
+    upool_job* job,
+    upool_work_fn work,
+    upool_done_fn done,
+    void* ctx)
+{
+    job->next = NULL;
+    job->work = work;
+    job->done = done;
+    job->ctx = ctx;
+    job->err = 0;
+    if (!upool_active(pool)) {
+        // Inline
+        work(job);
+        done(job);
+        return 0;
+    }
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_lock(&pool->lock);
+    *pool->todo_tail = job;
+    pool->todo_tail = &job->next;
+    pool->busy++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    return 1;
+}
+
+int
+upool_poll(upool* pool)
+{
+    int n = 0;
+    upool_job *job, *next;
+    if (!upool_active(pool)) return 0;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    // Take finished list under lock, callbacks run unlocked (may submit)
+    pthread_mutex_lock(&pool->lock);
+    job = pool->done;
+    pool->done = NULL;
+    pool->done_tail = &pool->done;
+    pthread_mutex_unlock(&pool->lock);
+#else
+    job = NULL;
+#endif
+    for (; job; job = next, n++) {
+        next = job->next;
+        job->done(job);
+    }
+    return n;
+}
+
+int
+upool_pending(upool* pool)
+{
+    int ret = 0;
+    if (!upool_active(pool)) return 0;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_lock(&pool->lock);
+    ret = pool->busy || pool->done;
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    return ret;
+}
+
+void
+upool_flush(upool* pool)
+{
+    if (!upool_active(pool)) return;
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    // Done callbacks may submit more work so loop until quiet
+    do {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->busy) pthread_cond_wait(&pool->done_cond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    } while (upool_poll(pool));
+#endif
+}
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+void*
+upool_worker(void* arg)
+{
+    upool* pool = arg;
+    upool_job* job;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->todo && !pool->stop) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (!pool->todo) break; // stop
+        job = pool->todo;
+        pool->todo = job->next;
+        if (!pool->todo) pool->todo_tail = &pool->todo;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->work(job);
+
+        pthread_mutex_lock(&pool->lock);
+        job->next = NULL;
+        if (!pool->done && pool->notify) pool->notify(pool->notify_ctx);
+        *pool->done_tail = job;
+        pool->done_tail = &job->next;
+        if (!--pool->busy) pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif
+
+//
+//
+//
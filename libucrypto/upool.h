@@ -0,0 +1,161 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#ifndef UPOOL_H_
+#define UPOOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifndef UPOOL_MAX_THREADS
+#define UPOOL_MAX_THREADS 16
+#endif
+
+/**
+ * @brief Crypto offload pool.
+ *
+ * Work functions run on a worker thread. Done functions run on whichever
+ * thread drains the pool with upool_poll (ie: the event loop), so done
+ * callbacks may touch io state without locks. Without pthreads, or with a
+ * pool of 0 threads (or a NULL pool), upool_submit runs work and done inline.
+ */
+typedef struct upool_job upool_job;
+typedef void (*upool_work_fn)(upool_job*);
+typedef void (*upool_done_fn)(upool_job*);
+typedef void (*upool_notify_fn)(void*);
+
+struct upool_job
+{
+    struct upool_job* next; /*!< queue link */
+    upool_work_fn work;     /*!< runs on a worker */
+    upool_done_fn done;     /*!< runs on the draining thread */
+    void* ctx;              /*!< caller context */
+    int err;                /*!< result of work */
+};
+
+typedef struct
+{
+    uint32_t n;                   /*!< worker threads */
+    uint32_t busy;                /*!< jobs queued or running */
+    int stop;                     /*!< workers exit */
+    upool_job *todo, **todo_tail; /*!< submitted */
+    upool_job *done, **done_tail; /*!< finished, waiting for upool_poll */
+    upool_notify_fn notify;       /*!< done list no longer empty */
+    void* notify_ctx;             /*!< passed to notify */
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    pthread_mutex_t lock;                 /*!< guards queues */
+    pthread_cond_t work_cond;             /*!< signal workers */
+    pthread_cond_t done_cond;             /*!< signal flush */
+    pthread_t threads[UPOOL_MAX_THREADS]; /*!< workers */
+#endif
+} upool;
+
+/**
+ * @brief Start worker threads
+ *
+ * @param pool
+ * @param n number of workers (0 runs jobs inline)
+ *
+ * @return 0 OK -1 error
+ */
+int upool_init(upool* pool, uint32_t n);
+
+/**
+ * @brief Finish all jobs, run their done callbacks and stop workers
+ *
+ * @param pool
+ */
+void upool_deinit(upool* pool);
+
+/**
+ * @brief Tell the draining thread there is work for upool_poll (ie: wake
+ * its event loop). fn runs on a worker, once per job finishing onto an
+ * empty done list. Set before submitting.
+ *
+ * @param pool
+ * @param fn callback or NULL
+ * @param ctx passed to fn
+ */
+void upool_notify_set(upool* pool, upool_notify_fn fn, void* ctx);
+
+/**
+ * @brief Queue a job. Job memory belongs to caller until done is called.
+ *
+ * @param pool pool or NULL to run inline
+ * @param job caller storage for job
+ * @param work runs on worker
+ * @param done runs from upool_poll
+ * @param ctx caller context
+ *
+ * @return 1 queued on a worker, 0 work and done already ran inline
+ */
+int upool_submit(
+    upool* pool,
+    upool_job* job,
+    upool_work_fn work,
+    upool_done_fn done,
+    void* ctx);
+
+/**
+ * @brief Run done callbacks of finished jobs
+ *
+ * @param pool
+ *
+ * @return number of jobs completed
+ */
+int upool_poll(upool* pool);
+
+/**
+ * @brief Wait for every submitted job and run its done callback
+ *
+ * @param pool
+ */
+void upool_flush(upool* pool);
+
+/**
+ * @brief True while jobs are queued, running or waiting for upool_poll (a
+ * poll thread with pending jobs and no notify should not block long)
+ *
+ * @param pool
+ */
+int upool_pending(upool* pool);
+
+/**
+ * @brief True when submitted jobs complete asynchronously
+ */
+static inline int
+upool_active(const upool* pool)
+{
+    return pool && pool->n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
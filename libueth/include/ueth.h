@@ -30,26 +30,39 @@ extern "C" {
 
 #include "discovery/rlpx_io_discovery.h"
 #include "rlpx_io_devp2p.h"
+#include "ueth_shard.h"
 
 typedef struct
 {
     const char* p2p_private_key;
-    int p2p_enable;
+    int p2p_enable; /*!< accept peers (tcp, on the udp port) */
     uint32_t udp;
     uint32_t interval_discovery;
+    int io_backend;    /*!< ASYNC_IO_BACKEND (0 best available) */
+    uint32_t shards;   /*!< peer threads (0 peers poll with discovery) */
+    int shard_pin;     /*!< pin shard i to cpu i */
+    int crypto_inline; /*!< no crypto workers (ie: a simulation) */
+    int stats;         /*!< log loop latency (UETH_CONFIG_STATS_REPORT) */
 } ueth_config;
 
 typedef struct ueth_context
 {
     uecc_ctx id;
     ueth_config config;
-    async_io io;
+    async_io io; /*!< listener (peers polled here, see p2p_enable) */
     int (*poll)(struct ueth_context*);
     uint32_t n;
-    uint32_t tick;
+    int64_t tick;          /*!< last discovery report */
+    uint32_t wait;         /*!< longest a poll may block (ms) */
+    async_io_stats* stats; /*!< latency of our loop (NULL off) */
+    int64_t stats_tick;    /*!< last stats report */
     knodes bootnodes[UETH_CONFIG_MAX_BOOTNODES];
     rlpx_io discovery;
     rlpx_io ch[UETH_CONFIG_NUM_CHANNELS];
+    upool pool;
+    async_io_loop loop;
+    uint32_t nshard;                          /*!< peer shards in use */
+    ueth_shard shard[UETH_CONFIG_MAX_SHARDS]; /*!< peers by shard */
 } ueth_context;
 
 int ueth_init(ueth_context* ctx, ueth_config* config);
@@ -57,12 +70,53 @@ void ueth_deinit(ueth_context* ctx);
 int ueth_boot(ueth_context* ctx, int, ...);
 int ueth_stop(ueth_context* ctx);
 
+/**
+ * @brief How long the node has nothing to do unless io arrives (next timer of
+ * the discovery table, next report, crypto jobs in flight)
+ *
+ * @param ctx
+ *
+ * @return ms
+ */
+uint32_t ueth_next(ueth_context* ctx);
+
+/**
+ * @brief Service timers then block in the io loop until io arrives or the
+ * next deadline (see ueth_next), but no longer than ms.
+ *
+ * @param ctx
+ * @param ms upper bound of time spent waiting
+ *
+ * @return
+ */
 static inline int
-ueth_poll(ueth_context* ctx)
+ueth_poll_wait(ueth_context* ctx, uint32_t ms)
 {
+    ctx->wait = ms;
     return ctx->poll(ctx);
 }
 
+/**
+ * @brief Shard owning peer ch, post commands for ch there (NULL when peers
+ * poll with discovery on the caller thread)
+ */
+static inline ueth_shard*
+ueth_channel_shard(ueth_context* ctx, rlpx_io* ch)
+{
+    ueth_shard* s;
+    for (uint32_t i = 0; i < ctx->nshard; i++) {
+        s = &ctx->shard[i];
+        if (ch >= s->ch && ch < s->ch + s->n) return s;
+    }
+    return NULL;
+}
+
+static inline int
+ueth_poll(ueth_context* ctx)
+{
+    return ueth_poll_wait(ctx, 1);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,6 +28,21 @@ extern "C" {
 
 #define UETH_CONFIG_NUM_CHANNELS 30
 #define UETH_CONFIG_MAX_BOOTNODES 20
+#define UETH_CONFIG_ECDH_CACHE_N 64
+
+// Crypto offload workers. Handshakes only read the shared static key so any
+// number of workers may run them at once.
+#define UETH_CONFIG_CRYPTO_THREADS 4
+
+// Peer event loop threads (see ueth_config.shards). Each shard gets its share
+// of the crypto workers. A shard wakes for io, commands, or after WAIT ms.
+#define UETH_CONFIG_MAX_SHARDS 16
+#define UETH_CONFIG_SHARD_WAIT 1000
+#define UETH_CONFIG_SHARD_QUEUE 256 /*!< commands posted and not yet run */
+
+// Loop latency histograms (see ueth_config.stats) are logged then cleared
+// every REPORT ms, by each loop for itself.
+#define UETH_CONFIG_STATS_REPORT 10000
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,212 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file ueth_shard.h
+ *
+ * @brief Multi reactor support. Peers are split over shards, each polling
+ * its own loop on its own thread (see ueth_config.shards).
+ */
+#ifndef UETH_SHARD_H_
+#define UETH_SHARD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ueth_config.h"
+
+#include "async_io_mpsc.h"
+#include "rlpx_io_devp2p.h"
+
+#ifdef UETH_CONFIG_PTHREAD
+#include <pthread.h>
+#endif
+
+struct ueth_shard;
+typedef struct ueth_shard_cmd ueth_shard_cmd;
+typedef void (*ueth_shard_cmd_fn)(struct ueth_shard*, ueth_shard_cmd*);
+
+/**
+ * @brief Work handed to a shard by another thread. Command memory (and what
+ * it points to) belongs to the shard from a successful post until done runs,
+ * or until fn ran when there is no done.
+ */
+struct ueth_shard_cmd
+{
+    ueth_shard_cmd_fn fn;   /*!< runs on the shard thread */
+    ueth_shard_cmd_fn done; /*!< runs after fn (optional) */
+    void* ctx;              /*!< caller context */
+    rlpx_io* ch;            /*!< peer (send, connect, disconnect) */
+    uint8_t* b;             /*!< message to send */
+    uint32_t l;             /*!< size of b */
+    const rlpx_node* node;  /*!< where to connect */
+    int reason;             /*!< RLPX_DEVP2P_DISCONNECT_REASON */
+    int err;                /*!< result of fn */
+};
+
+/**
+ * @brief Event loop thread owning a range of peers. Everything a peer uses
+ * (loop, io buffers, crypto offload) belongs to its shard, so shards never
+ * share state and other threads reach a peer only by posting a command.
+ */
+typedef struct ueth_shard
+{
+    uint32_t id;                 /*!< index in ueth_context */
+    rlpx_io* ch;                 /*!< first peer owned */
+    uint32_t n;                  /*!< peers owned */
+    int running;                 /*!< cleared by the stop command */
+    int started;                 /*!< thread is running */
+    async_io_loop loop;          /*!< readiness of our peers */
+    async_io listener;           /*!< inbound peers (see ueth_shard_listen) */
+    async_io_pool pool;          /*!< buffers of our peers */
+    upool crypto;                /*!< crypto offload of our peers */
+    async_io_mpsc q;             /*!< posted commands */
+    ueth_shard_cmd stop;         /*!< posted by ueth_shard_stop */
+    async_io_stats* stats;       /*!< latency of our loop (NULL off) */
+    int64_t stats_tick;          /*!< last stats report */
+#ifdef UETH_CONFIG_PTHREAD
+    pthread_t thread; /*!< runs ueth_shard_poll */
+#endif
+} ueth_shard;
+
+/**
+ * @brief Move peers (already initialized) over to a new shard
+ *
+ * @param shard
+ * @param id index of shard
+ * @param ch first peer
+ * @param n number of peers
+ * @param backend ASYNC_IO_BACKEND of the shard loop
+ * @param threads crypto offload workers
+ *
+ * @return 0 OK -1 error
+ */
+int ueth_shard_init(
+    ueth_shard* shard,
+    uint32_t id,
+    rlpx_io* ch,
+    uint32_t n,
+    int backend,
+    uint32_t threads);
+
+/**
+ * @brief Take inbound peers on port (before start). Every shard listens on
+ * the same port, the kernel spreads connections over them and each is
+ * handed to an idle peer of the shard that accepted it.
+ *
+ * @return 0 OK -1 error
+ */
+int ueth_shard_listen(ueth_shard* shard, uint32_t port);
+
+/**
+ * @brief Stop shard (if started) and free it. Deinit peers first.
+ */
+void ueth_shard_deinit(ueth_shard* shard);
+
+/**
+ * @brief Measure the shard loop, reported by the shard (before start)
+ *
+ * @return 0 OK -1 out of memory
+ */
+int ueth_shard_stats_enable(ueth_shard* shard);
+
+/**
+ * @brief Run shard on its own thread
+ *
+ * @param shard
+ * @param cpu pin thread to cpu (-1 let the os schedule it)
+ *
+ * @return 0 OK -1 no thread (caller keeps polling with ueth_shard_poll)
+ */
+int ueth_shard_start(ueth_shard* shard, int cpu);
+
+/**
+ * @brief Let the shard finish its poll and join its thread. The peers may be
+ * used by the caller afterwards.
+ */
+void ueth_shard_stop(ueth_shard* shard);
+
+/**
+ * @brief Prepare a command for posting
+ *
+ * @param cmd
+ * @param done runs on the shard thread after the command (NULL none)
+ * @param ctx caller context
+ */
+void ueth_shard_cmd_init(
+    ueth_shard_cmd* cmd,
+    ueth_shard_cmd_fn done,
+    void* ctx);
+
+/**
+ * @brief Queue fn to run on the shard thread. Safe from any thread, never
+ * blocks nor takes a lock (see UETH_CONFIG_SHARD_QUEUE).
+ *
+ * @return 0 OK -1 queue full (command not posted)
+ */
+int ueth_shard_post(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    ueth_shard_cmd_fn fn);
+
+/**
+ * @brief Post rlpx_io_send(ch, b, l)
+ */
+int ueth_shard_send(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    uint8_t* b,
+    uint32_t l);
+
+/**
+ * @brief Post rlpx_io_connect_node(ch, node)
+ */
+int ueth_shard_connect(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    const rlpx_node* node);
+
+/**
+ * @brief Post a devp2p disconnect to ch (cmd->err -1 if ch is not ready)
+ */
+int ueth_shard_disconnect(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    RLPX_DEVP2P_DISCONNECT_REASON reason);
+
+/**
+ * @brief One turn of the shard loop (the shard thread calls this)
+ *
+ * @param shard
+ * @param ms max wait for io or a command
+ *
+ * @return 0 OK or or'd handler errors, -1 wait error
+ */
+int ueth_shard_poll(ueth_shard* shard, uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
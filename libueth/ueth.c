@@ -20,20 +20,28 @@
  */
 
 #include "ueth.h"
+#include "uecc_cache.h"
 #include "ueth_boot_nodes.h"
 #include "usys_io.h"
 #include "usys_log.h"
 #include "usys_time.h"
 
 int ueth_poll_internal(ueth_context* ctx);
+void ueth_stats_report(ueth_context* ctx);
 int ueth_on_erro(void* ctx);
 int ueth_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
 int ueth_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int ueth_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
+void ueth_on_wake(void* ctx);
+void ueth_on_crypto(void* ctx);
+
+async_io_settings g_ueth_listen_settings = {.on_accept = ueth_on_accept };
 
 int
 ueth_init(ueth_context* ctx, ueth_config* config)
 {
     h256 key;
+    uint32_t s, first, threads;
 
     memset(ctx, 0, sizeof(ueth_context));
 
@@ -50,34 +58,105 @@ ueth_init(ueth_context* ctx, ueth_config* config)
         uecc_key_init_new(&ctx->id);
     }
 
+    // Remember static secrets of peers we reconnect to
+    uecc_cache_init(&ctx->id, UETH_CONFIG_ECDH_CACHE_N);
+
+    // Public key crypto off the poll thread (runs inline if no workers)
+    upool_init(
+        &ctx->pool, config->crypto_inline ? 0 : UETH_CONFIG_CRYPTO_THREADS);
+
+    // Sockets register here as they open (see async_io_loop_sync), finished
+    // crypto jobs wake us
+    async_io_loop_init_backend(&ctx->loop, config->io_backend);
+    if (upool_active(&ctx->pool)) {
+        async_io_loop_wake_init(&ctx->loop, ueth_on_wake, ctx);
+        upool_notify_set(&ctx->pool, ueth_on_crypto, ctx);
+    }
+
     // init constants
     ctx->n = (sizeof(ctx->ch) / sizeof(rlpx_io));
+    ctx->nshard = config->shards;
+    if (ctx->nshard > UETH_CONFIG_MAX_SHARDS) {
+        ctx->nshard = UETH_CONFIG_MAX_SHARDS;
+    }
+    if (ctx->nshard > ctx->n) ctx->nshard = ctx->n;
 
     // Init peer pipes (tcp)
     for (uint32_t i = 0; i < ctx->n; i++) {
         rlpx_io_tcp_init(&ctx->ch[i], &ctx->id, &ctx->config.udp);
         rlpx_io_devp2p_install(&ctx->ch[i]);
+        rlpx_io_pool_set(&ctx->ch[i], &ctx->pool);
+        async_io_loop_add(&ctx->loop, &ctx->ch[i].io);
+    }
+
+    // Peers connecting to us, taken by shards when there are any
+    async_io_tcp_init(&ctx->io, &g_ueth_listen_settings, ctx);
+    if (config->p2p_enable && !ctx->nshard &&
+        !async_io_tcp_listen(&ctx->io, config->udp, 0)) {
+        async_io_loop_add(&ctx->loop, &ctx->io);
     }
 
     // Init discovery pipe
     rlpx_io_udp_init(&ctx->discovery, &ctx->id, &ctx->config.udp);
     rlpx_io_discovery_install(&ctx->discovery);
+    rlpx_io_pool_set(&ctx->discovery, &ctx->pool);
+    async_io_loop_add(&ctx->loop, &ctx->discovery.io);
+
+    // Loop latency histograms, peers moving to shards are measured there
+    if (config->stats && (ctx->stats = usys_malloc(sizeof(async_io_stats)))) {
+        async_io_stats_init(ctx->stats);
+        async_io_loop_stats_set(&ctx->loop, ctx->stats);
+        ctx->stats_tick = usys_tick();
+    }
 
     // Setup boot nodes
     ueth_boot(ctx, 4, TEST_NET_6, TEST_NET_15, GETH_P2P_LOCAL, CPP_P2P_LOCAL);
 
+    // Hand peers to shards in equal ranges, a shard that has no thread is
+    // polled by ueth_poll
+    threads = ctx->nshard ? UETH_CONFIG_CRYPTO_THREADS / ctx->nshard : 0;
+    for (s = 0; s < ctx->nshard; s++) {
+        first = s * ctx->n / ctx->nshard;
+        ueth_shard_init(
+            &ctx->shard[s],
+            s,
+            &ctx->ch[first],
+            (s + 1) * ctx->n / ctx->nshard - first,
+            config->io_backend,
+            threads ? threads : 1);
+        if (config->p2p_enable) ueth_shard_listen(&ctx->shard[s], config->udp);
+        if (config->stats) ueth_shard_stats_enable(&ctx->shard[s]);
+        ueth_shard_start(&ctx->shard[s], config->shard_pin ? (int)s : -1);
+    }
+
     return 0;
 }
 
 void
 ueth_deinit(ueth_context* ctx)
 {
+    // Peers are ours again once shards stopped
+    for (uint32_t s = 0; s < ctx->nshard; s++) ueth_shard_stop(&ctx->shard[s]);
+    async_io_deinit(&ctx->io);
+
     // Shutdown any open connections..
     for (uint32_t i = 0; i < ctx->n; i++) rlpx_io_deinit(&ctx->ch[i]);
 
+    // Shard loops and pools are empty now
+    for (uint32_t s = 0; s < ctx->nshard; s++) {
+        ueth_shard_deinit(&ctx->shard[s]);
+    }
+
     // Shutdown udp
     rlpx_io_deinit(&ctx->discovery);
 
+    // Stop crypto workers (channels landed their jobs above)
+    upool_deinit(&ctx->pool);
+
+    // Channels left the loop when their io was released
+    async_io_loop_deinit(&ctx->loop);
+    if (ctx->stats) usys_free(ctx->stats);
+
     // Free static key
     uecc_key_deinit(&ctx->id);
 }
@@ -117,6 +196,9 @@ ueth_stop(ueth_context* ctx)
     uint32_t mask = 0, i, c = 0, b = 0;
     rlpx_io* ch[ctx->n];
     rlpx_io_devp2p* devp2p;
+
+    // Peers are polled from here on
+    for (i = 0; i < ctx->nshard; i++) ueth_shard_stop(&ctx->shard[i]);
     for (i = 0; i < ctx->n; i++) {
         if (rlpx_io_is_ready(&ctx->ch[i])) {
             devp2p = ctx->ch[i].protocols[0].context;
@@ -142,14 +224,68 @@ ueth_stop(ueth_context* ctx)
     return 0;
 }
 
+uint32_t
+ueth_next(ueth_context* ctx)
+{
+    int64_t elapsed = usys_tick() - ctx->tick;
+    int64_t interval = (int64_t)ctx->config.interval_discovery * 1000;
+    uint32_t ms, next;
+    rlpx_io_discovery* d = rlpx_io_discovery_get_context(&ctx->discovery);
+
+    // Shards we poll ourselves have nothing to wake our loop
+    for (uint32_t i = 0; i < ctx->nshard; i++) {
+        if (!ctx->shard[i].started) return 1;
+    }
+
+    next = ktable_next(&d->table);
+    ms = elapsed > interval ? 0 : interval - elapsed + 1;
+    return ms < next ? ms : next;
+}
+
+int
+ueth_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    // First idle peer takes it, none idle and the connection is closed
+    ueth_context* eth = ctx;
+    rlpx_io* ch;
+    for (uint32_t i = 0; i < eth->n; i++) {
+        ch = &eth->ch[i];
+        if (async_io_has_sock(&ch->io) || rlpx_io_error_get(ch)) continue;
+        return rlpx_io_accept(ch, s, addr);
+    }
+    return -1;
+}
+
+void
+ueth_on_wake(void* ctx)
+{
+    // Resume io waiting on crypto offload
+    upool_poll(&((ueth_context*)ctx)->pool);
+}
+
+void
+ueth_on_crypto(void* ctx)
+{
+    async_io_loop_wake(&((ueth_context*)ctx)->loop);
+}
+
+void
+ueth_stats_report(ueth_context* ctx)
+{
+    async_io_stats_print(ctx->stats, "(ueth)");
+    async_io_stats_init(ctx->stats);
+    ctx->stats_tick = usys_tick();
+}
+
 int
 ueth_poll_internal(ueth_context* ctx)
 {
-    uint32_t i, b = 0, now = usys_now();
+    uint32_t i, wait;
+    int64_t t, now = usys_tick();
     rlpx_io_discovery* d;
-    async_io* ch[ctx->n + 1];
 
-    for (i = 0; i < ctx->n; i++) {
+    // Peers of shards are maintained by their shard
+    for (i = 0; !ctx->nshard && i < ctx->n; i++) {
         // Refresh channel if it is in error
         if (rlpx_io_error_get(&ctx->ch[i])) {
             // Kick out of discovery table
@@ -165,15 +301,21 @@ ueth_poll_internal(ueth_context* ctx)
             // d = rlpx_io_discovery_get_context(&ctx->discovery);
             // rlpx_io_discovery_connect(d, &ctx->ch[i]);
         }
-        // Add to io polling if there is a socket
-        if (async_io_has_sock(&ctx->ch[i].io)) {
-            ch[b++] = (async_io*)&ctx->ch[i];
-        }
     }
 
+    // Shards without a thread take their turn here
+    for (i = 0; i < ctx->nshard; i++) {
+        if (!ctx->shard[i].started) ueth_shard_poll(&ctx->shard[i], 0);
+    }
+
+    // Resume io waiting on crypto offload
+    upool_poll(&ctx->pool);
+
     d = rlpx_io_discovery_get_context(&ctx->discovery);
+    t = ctx->stats ? usys_tick_ns() : 0;
     ktable_poll(&d->table);
-    if ((now - ctx->tick) > ctx->config.interval_discovery) {
+    async_io_stats_timers(ctx->stats, t);
+    if (now - ctx->tick > (int64_t)ctx->config.interval_discovery * 1000) {
         ctx->tick = now;
         usys_log(
             "[SYS] want peers (%d/%d)",
@@ -181,9 +323,14 @@ ueth_poll_internal(ueth_context* ctx)
             knodes_size(d->table.nodes, KTABLE_N_NODES));
     }
 
-    // Add our listener to poll
-    ch[b++] = (async_io*)&ctx->discovery;
-    async_io_poll_n(ch, b, 1);
+    if (ctx->stats && now - ctx->stats_tick >= UETH_CONFIG_STATS_REPORT) {
+        ueth_stats_report(ctx);
+    }
+
+    // Channels and our listener are watched by the loop, sleep there until
+    // io or the next timer
+    wait = ueth_next(ctx);
+    async_io_loop_poll(&ctx->loop, wait < ctx->wait ? wait : ctx->wait);
     return 0;
 }
 
@@ -0,0 +1,326 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "ueth_shard.h"
+#include "usys_time.h"
+
+#ifdef UETH_CONFIG_PTHREAD
+#include <sched.h>
+#endif
+
+// private
+void ueth_shard_on_wake(void* ctx);
+void ueth_shard_on_crypto(void* ctx);
+int ueth_shard_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
+void ueth_shard_on_stop(ueth_shard* shard, ueth_shard_cmd* cmd);
+void ueth_shard_on_send(ueth_shard* shard, ueth_shard_cmd* cmd);
+void ueth_shard_on_connect(ueth_shard* shard, ueth_shard_cmd* cmd);
+void ueth_shard_on_disconnect(ueth_shard* shard, ueth_shard_cmd* cmd);
+void ueth_shard_stats_report(ueth_shard* shard);
+void* ueth_shard_thread(void* arg);
+
+async_io_settings g_ueth_shard_listen_settings = {
+    .on_accept = ueth_shard_on_accept
+};
+
+int
+ueth_shard_init(
+    ueth_shard* shard,
+    uint32_t id,
+    rlpx_io* ch,
+    uint32_t n,
+    int backend,
+    uint32_t threads)
+{
+    memset(shard, 0, sizeof(ueth_shard));
+    shard->id = id;
+    shard->ch = ch;
+    shard->n = n;
+    async_io_pool_init(&shard->pool);
+    upool_init(&shard->crypto, threads);
+    async_io_loop_init_backend(&shard->loop, backend);
+    async_io_tcp_init(&shard->listener, &g_ueth_shard_listen_settings, shard);
+    if (async_io_mpsc_init(&shard->q, UETH_CONFIG_SHARD_QUEUE) ||
+        async_io_loop_wake_init(&shard->loop, ueth_shard_on_wake, shard)) {
+        return -1;
+    }
+    upool_notify_set(&shard->crypto, ueth_shard_on_crypto, shard);
+
+    // Peers leave the callers loop and pools for ours
+    for (uint32_t i = 0; i < n; i++) {
+        if (ch[i].io.loop) async_io_loop_remove(ch[i].io.loop, &ch[i].io);
+        async_io_buffer_pool_set(&ch[i].io, &shard->pool);
+        rlpx_io_pool_set(&ch[i], &shard->crypto);
+        async_io_loop_add(&shard->loop, &ch[i].io);
+    }
+    return 0;
+}
+
+int
+ueth_shard_listen(ueth_shard* shard, uint32_t port)
+{
+    if (async_io_tcp_listen(&shard->listener, port, USYS_LISTEN_REUSEPORT)) {
+        return -1;
+    }
+    if (!shard->listener.loop) {
+        async_io_loop_add(&shard->loop, &shard->listener);
+    }
+    return 0;
+}
+
+void
+ueth_shard_deinit(ueth_shard* shard)
+{
+    ueth_shard_stop(shard);
+    async_io_deinit(&shard->listener);
+    upool_deinit(&shard->crypto);
+    async_io_loop_deinit(&shard->loop);
+    if (shard->stats) usys_free(shard->stats);
+    async_io_pool_deinit(&shard->pool);
+    async_io_mpsc_deinit(&shard->q);
+    memset(shard, 0, sizeof(ueth_shard));
+}
+
+int
+ueth_shard_stats_enable(ueth_shard* shard)
+{
+    if (!shard->stats) shard->stats = usys_malloc(sizeof(async_io_stats));
+    if (!shard->stats) return -1;
+    async_io_stats_init(shard->stats);
+    async_io_loop_stats_set(&shard->loop, shard->stats);
+    shard->stats_tick = usys_tick();
+    return 0;
+}
+
+int
+ueth_shard_start(ueth_shard* shard, int cpu)
+{
+#ifdef UETH_CONFIG_PTHREAD
+    cpu_set_t set;
+    if (shard->started) return 0;
+    shard->running = 1;
+    if (pthread_create(&shard->thread, NULL, ueth_shard_thread, shard)) {
+        shard->running = 0;
+        return -1;
+    }
+    shard->started = 1;
+#ifdef __linux__
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET((int)(cpu % sysconf(_SC_NPROCESSORS_ONLN)), &set);
+        pthread_setaffinity_np(shard->thread, sizeof(set), &set);
+    }
+#else
+    ((void)set);
+    ((void)cpu);
+#endif
+    return 0;
+#else
+    ((void)shard);
+    ((void)cpu);
+    return -1;
+#endif
+}
+
+void
+ueth_shard_stop(ueth_shard* shard)
+{
+#ifdef UETH_CONFIG_PTHREAD
+    if (!shard->started) return;
+    ueth_shard_cmd_init(&shard->stop, NULL, NULL);
+    while (ueth_shard_post(shard, &shard->stop, ueth_shard_on_stop)) {
+        usys_msleep(1); // full, let the shard drain
+    }
+    pthread_join(shard->thread, NULL);
+    shard->started = 0;
+#else
+    ((void)shard);
+#endif
+}
+
+void
+ueth_shard_cmd_init(ueth_shard_cmd* cmd, ueth_shard_cmd_fn done, void* ctx)
+{
+    memset(cmd, 0, sizeof(ueth_shard_cmd));
+    cmd->done = done;
+    cmd->ctx = ctx;
+}
+
+int
+ueth_shard_post(ueth_shard* shard, ueth_shard_cmd* cmd, ueth_shard_cmd_fn fn)
+{
+    cmd->fn = fn;
+    cmd->err = 0;
+    if (async_io_mpsc_push(&shard->q, cmd)) return -1;
+    async_io_loop_wake(&shard->loop);
+    return 0;
+}
+
+int
+ueth_shard_send(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    uint8_t* b,
+    uint32_t l)
+{
+    cmd->ch = ch;
+    cmd->b = b;
+    cmd->l = l;
+    return ueth_shard_post(shard, cmd, ueth_shard_on_send);
+}
+
+int
+ueth_shard_connect(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    const rlpx_node* node)
+{
+    cmd->ch = ch;
+    cmd->node = node;
+    return ueth_shard_post(shard, cmd, ueth_shard_on_connect);
+}
+
+int
+ueth_shard_disconnect(
+    ueth_shard* shard,
+    ueth_shard_cmd* cmd,
+    rlpx_io* ch,
+    RLPX_DEVP2P_DISCONNECT_REASON reason)
+{
+    cmd->ch = ch;
+    cmd->reason = reason;
+    return ueth_shard_post(shard, cmd, ueth_shard_on_disconnect);
+}
+
+int
+ueth_shard_poll(ueth_shard* shard, uint32_t ms)
+{
+    for (uint32_t i = 0; i < shard->n; i++) {
+        if (rlpx_io_error_get(&shard->ch[i])) rlpx_io_refresh(&shard->ch[i]);
+    }
+
+    // Resume io waiting on crypto offload (finished jobs wake us)
+    upool_poll(&shard->crypto);
+    if (shard->stats &&
+        usys_tick() - shard->stats_tick >= UETH_CONFIG_STATS_REPORT) {
+        ueth_shard_stats_report(shard);
+    }
+    return async_io_loop_poll(&shard->loop, ms);
+}
+
+void
+ueth_shard_stats_report(ueth_shard* shard)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "(shard %d)", shard->id);
+    async_io_stats_print(shard->stats, name);
+    async_io_stats_init(shard->stats);
+    shard->stats_tick = usys_tick();
+}
+
+void
+ueth_shard_on_wake(void* ctx)
+{
+    // Commands run in batches of at most a queue full, a producer that keeps
+    // up with us does not starve io (we wake ourselves for the rest)
+    ueth_shard* shard = ctx;
+    ueth_shard_cmd* cmd;
+    uint32_t n = 0;
+    while ((cmd = async_io_mpsc_pop(&shard->q))) {
+        cmd->fn(shard, cmd);
+        if (cmd->done) cmd->done(shard, cmd);
+        if (++n == UETH_CONFIG_SHARD_QUEUE) {
+            async_io_loop_wake(&shard->loop);
+            break;
+        }
+    }
+}
+
+void
+ueth_shard_on_crypto(void* ctx)
+{
+    async_io_loop_wake(&((ueth_shard*)ctx)->loop);
+}
+
+int
+ueth_shard_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    // First idle peer takes it, none idle and the connection is closed
+    ueth_shard* shard = ctx;
+    rlpx_io* ch;
+    for (uint32_t i = 0; i < shard->n; i++) {
+        ch = &shard->ch[i];
+        if (async_io_has_sock(&ch->io) || rlpx_io_error_get(ch)) continue;
+        return rlpx_io_accept(ch, s, addr);
+    }
+    return -1;
+}
+
+void
+ueth_shard_on_stop(ueth_shard* shard, ueth_shard_cmd* cmd)
+{
+    ((void)cmd);
+    shard->running = 0;
+}
+
+void
+ueth_shard_on_send(ueth_shard* shard, ueth_shard_cmd* cmd)
+{
+    ((void)shard);
+    cmd->err = rlpx_io_send(cmd->ch, cmd->b, cmd->l);
+}
+
+void
+ueth_shard_on_connect(ueth_shard* shard, ueth_shard_cmd* cmd)
+{
+    ((void)shard);
+    cmd->err = rlpx_io_connect_node(cmd->ch, cmd->node);
+}
+
+void
+ueth_shard_on_disconnect(ueth_shard* shard, ueth_shard_cmd* cmd)
+{
+    // Only a peer past the handshake has a session to say goodbye on
+    rlpx_io_devp2p* devp2p = cmd->ch->protocols[0].context;
+    ((void)shard);
+    cmd->err = -1;
+    if (devp2p && rlpx_io_is_ready(cmd->ch)) {
+        cmd->err = rlpx_io_devp2p_send_disconnect(devp2p, cmd->reason);
+    }
+}
+
+void*
+ueth_shard_thread(void* arg)
+{
+    ueth_shard* shard = arg;
+    while (shard->running) ueth_shard_poll(shard, UETH_CONFIG_SHARD_WAIT);
+    return NULL;
+}
+
+//
+//
+//
@@ -38,6 +38,7 @@ extern "C" {
 #define KNODES_EMPTY 0x01
 #define KNODES_PENDING 0x02
 #define KNODES_CONNECTING 0x04
+#define KNODES_REMOVED 0x08 /*!< empty, but probe chains continue past */
 
 #define KNODES_IS_EMPTY(n) (n.flags & KNODES_EMPTY)
 
@@ -48,10 +49,10 @@ typedef int knode_key;
  */
 typedef struct knodes
 {
-    uint32_t ip, tcp, udp;  /*!< endpoing data*/
-    uint8_t flags;          /*!< */
-    knode_key key;          /*!< hash lookup*/
-    uecc_public_key nodeid; /*!< pubkey */
+    uint32_t ip, tcp, udp; /*!< endpoing data*/
+    uint8_t flags;         /*!< */
+    knode_key key;         /*!< hash lookup*/
+    uecc_node_id nodeid;   /*!< pubkey */
 } knodes;
 
 static inline void
@@ -90,7 +91,7 @@ knodes_insert(
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp,
-    uecc_public_key* q)
+    const uecc_node_id* q)
 {
     nodes[idx].flags = 0;
     nodes[idx].ip = ip;
@@ -108,7 +109,7 @@ knodes_insert_free(
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp,
-    uecc_public_key* q)
+    const uecc_node_id* q)
 {
     knode_key key = 0;
     for (key = 0; key < count; key++) {
@@ -123,7 +124,7 @@ knodes_insert_free(
 static inline int
 knodes_remove(knodes* n, knode_key idx)
 {
-    n[idx].flags |= KNODES_EMPTY;
+    n[idx].flags |= KNODES_EMPTY | KNODES_REMOVED;
     return 0;
 }
 
@@ -22,8 +22,9 @@
 #include "ktable.h"
 #include "urand.h"
 
-int ktable_timer_want_pong(utimers* key, void* ctx, uint32_t tick);
-int ktable_timer_refresh(utimers* key, void* ctx, uint32_t tick);
+uint32_t ktable_slot(const uecc_node_id* q);
+int ktable_timer_want_pong(utimers* key, void* ctx, uint64_t tick);
+int ktable_timer_refresh(utimers* key, void* ctx, uint64_t tick);
 void ktable_neighbours_walk(const urlp* rlp, int idx, void* ctx);
 
 int
@@ -34,7 +35,10 @@ ktable_init(ktable* table, ktable_settings* settings, void* ctx)
     table->settings = *settings;
     table->context = ctx;
     table->timerid = KTABLE_N_TIMERS - 1;
-    utimers_init(table->timers, KTABLE_N_TIMERS);
+    if (utimers_init(table->timers, KTABLE_N_TIMERS)) {
+        knodes_deinit(table->nodes, KTABLE_N_NODES);
+        return -1;
+    }
     utimers_insert(table->timers, table->timerid, ktable_timer_refresh, table);
     utimers_start(table->timers, table->timerid, table->settings.refresh);
     return 0;
@@ -48,20 +52,31 @@ ktable_deinit(ktable* table)
     memset(table, 0, sizeof(ktable));
 }
 
+uint32_t
+ktable_slot(const uecc_node_id* q)
+{
+    // Node id is a hash already, any 4 bytes spread well
+    const uint8_t* h = q->hash.b;
+    uint32_t x = ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) |
+                 ((uint32_t)h[2] << 8) | h[3];
+    return x % KTABLE_N_NODES;
+}
+
 knode_key
-ktable_pub_to_key(ktable* self, uecc_public_key* q)
+ktable_pub_to_key(ktable* self, const uecc_node_id* q)
 {
-    uint8_t h32[32], pub65[65];
-    int i, c;
-    uecc_qtob(q, pub65, sizeof(pub65));
-    ukeccak256(&pub65[1], 64, h32, 32);
-    for (i = 0; i < KTABLE_N_NODES; i++) {
-        for (c = 0; c < 32; c++) {
-            if (!(self->keys[i].h32[c] == h32[c])) break;
+    uint32_t i, n, slot = ktable_slot(q);
+    knodes* node;
+    for (n = 0; n < KTABLE_N_NODES; n++) {
+        i = (slot + n) % KTABLE_N_NODES;
+        node = &self->nodes[i];
+        if (KNODES_IS_EMPTY((*node))) {
+            if (node->flags & KNODES_REMOVED) continue;
+            break; // never used, end of probe chain
         }
-        if (c == 32) break; // all equal
+        if (!memcmp(node->nodeid.hash.b, q->hash.b, sizeof(h256))) return i;
     }
-    return i == KTABLE_N_NODES ? -1 : i;
+    return -1;
 }
 
 void
@@ -70,8 +85,14 @@ ktable_poll(ktable* self)
     utimers_poll(self->timers, KTABLE_N_TIMERS);
 }
 
+uint32_t
+ktable_next(ktable* self)
+{
+    return utimers_next(self->timers, KTABLE_N_TIMERS);
+}
+
 int
-ktable_ping(ktable* self, uecc_public_key* q)
+ktable_ping(ktable* self, const uecc_node_id* q)
 {
     knodes* n = ktable_get(self, q);
     if (n) {
@@ -86,7 +107,7 @@ ktable_ping(ktable* self, uecc_public_key* q)
 int
 ktable_on_ping(
     ktable* self,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp)
@@ -106,7 +127,7 @@ ktable_on_ping(
 int
 ktable_on_pong(
     ktable* self,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp)
@@ -151,8 +172,7 @@ ktable_neighbours_walk(const urlp* rlp, int idx, void* ctx)
     ktable* self = (ktable*)ctx;
     knodes node;
     uint32_t n = urlp_children(rlp), udp, tcp, publen = 64, ip, iplen = 16;
-    uint8_t pub[65] = { 0x04 };
-    uecc_public_key q;
+    uint8_t pub[64];
     if (n < 4) return; /*!< invalid rlp */
 
     // short circuit bail. Arrive inside no errors
@@ -160,8 +180,9 @@ ktable_neighbours_walk(const urlp* rlp, int idx, void* ctx)
         (!(err = urlp_idx_to_u32(rlp, 0, &ip))) &&
         (!(err = urlp_idx_to_u32(rlp, 1, &udp))) &&
         (!(err = urlp_idx_to_u32(rlp, 2, &tcp))) &&
-        (!(err = urlp_idx_to_mem(rlp, 3, &pub[1], &publen))) &&
-        (!(err = uecc_btoq(pub, publen + 1, &q)))) {
+        (!(err = urlp_idx_to_mem(rlp, 3, pub, &publen))) &&
+        (publen == 64) &&
+        (!(err = uecc_node_id_init_bin(&node.nodeid, pub)))) {
         // TODO - ipv4 only
         // Note - reading the rlp as a uint32 converts to host byte order.  To
         // preserve network byte order than read rlp as mem.  usys networking io
@@ -169,7 +190,6 @@ ktable_neighbours_walk(const urlp* rlp, int idx, void* ctx)
         node.ip = ip;
         node.tcp = tcp;
         node.udp = udp;
-        node.nodeid = q;
         node.flags = node.key = 0;
         self->settings.want_ping(self, &node);
     }
@@ -184,19 +204,19 @@ ktable_update_recent(ktable* table, knodes* node)
 }
 
 knodes*
-ktable_get(ktable* self, uecc_public_key* q)
+ktable_get(ktable* self, const uecc_node_id* q)
 {
     knode_key key = ktable_pub_to_key(self, q);
     return key >= 0 ? knodes_get(self->nodes, key) : NULL;
 }
 
 knode_key
-ktable_insert_rlp(ktable* table, uecc_public_key* key, const urlp* rlp)
+ktable_insert_rlp(ktable* table, const uecc_node_id* key, const urlp* rlp)
 {
     int err = 0;
     uint32_t n = urlp_children(rlp), udp, tcp, ip, publen = 64, iplen = 16;
-    uint8_t pub[65] = { 0x04 };
-    uecc_public_key q;
+    uint8_t pub[64];
+    uecc_node_id q;
     if (n < 4) return -1; /*!< invalid rlp */
 
     // short circuit bail. Arrive inside no errors
@@ -204,8 +224,8 @@ ktable_insert_rlp(ktable* table, uecc_public_key* key, const urlp* rlp)
         (!(err = urlp_idx_to_u32(rlp, 0, &ip))) &&
         (!(err = urlp_idx_to_u32(rlp, 1, &udp))) &&
         (!(err = urlp_idx_to_u32(rlp, 2, &tcp))) &&
-        (!(err = urlp_idx_to_mem(rlp, 3, &pub[1], &publen))) &&
-        (!(err = uecc_btoq(pub, publen + 1, &q)))) {
+        (!(err = urlp_idx_to_mem(rlp, 3, pub, &publen))) &&
+        (publen == 64) && (!(err = uecc_node_id_init_bin(&q, pub)))) {
         return ktable_insert(table, key, ip, udp, tcp, NULL);
     }
     return 0;
@@ -214,7 +234,7 @@ ktable_insert_rlp(ktable* table, uecc_public_key* key, const urlp* rlp)
 knode_key
 ktable_insert(
     ktable* self,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp,
@@ -222,8 +242,7 @@ ktable_insert(
 {
     ((void)meta);
     knodes* node = ktable_get(self, q);
-    knode_key key;
-    uint8_t pub[65];
+    uint32_t i, n, slot;
     if (node) {
         node->ip = ip;
         node->tcp = tcp;
@@ -231,19 +250,21 @@ ktable_insert(
         node->nodeid = *q;
         return 0;
     } else {
-        key = knodes_insert_free(self->nodes, KTABLE_N_NODES, ip, tcp, udp, q);
-        if (key >= 0) {
-            uecc_qtob(q, pub, 65);
-            ukeccak256(&pub[1], 64, self->keys[key].h32, 32);
-            return key;
-        } else {
-            return -1; // no room in table ping nodes cache insert
+        // First free slot on the probe chain of this id
+        slot = ktable_slot(q);
+        for (n = 0; n < KTABLE_N_NODES; n++) {
+            i = (slot + n) % KTABLE_N_NODES;
+            if (KNODES_IS_EMPTY(self->nodes[i])) {
+                knodes_insert(self->nodes, i, ip, tcp, udp, q);
+                return i;
+            }
         }
+        return -1; // no room in table ping nodes cache insert
     }
 }
 
 void
-ktable_remove(ktable* self, uecc_public_key* q)
+ktable_remove(ktable* self, const uecc_node_id* q)
 {
     knode_key key = ktable_pub_to_key(self, q);
     if (key >= 0) ktable_remove_key(self, key);
@@ -256,7 +277,7 @@ ktable_remove_key(ktable* self, knode_key key)
 }
 
 int
-ktable_timer_want_pong(utimers* t, void* ctx, uint32_t tick)
+ktable_timer_want_pong(utimers* t, void* ctx, uint64_t tick)
 {
     // This node didn't pong us back - remove from the table
     // Timers and node share same lookup key
@@ -267,7 +288,7 @@ ktable_timer_want_pong(utimers* t, void* ctx, uint32_t tick)
 }
 
 int
-ktable_timer_refresh(utimers* t, void* ctx, uint32_t tick)
+ktable_timer_refresh(utimers* t, void* ctx, uint64_t tick)
 {
     // Send some find nodes
     ktable* table = (ktable*)ctx;
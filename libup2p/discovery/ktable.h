@@ -53,11 +53,6 @@ typedef struct ktable_settings
     ktable_want_find_fn want_find;
 } ktable_settings;
 
-typedef struct
-{
-    uint8_t h32[32];
-} ktable_keys;
-
 /**
  * @brief A list of nodes we know about
  */
@@ -65,17 +60,18 @@ typedef struct ktable
 {
     ktable_settings settings;         /*!< callers config*/
     void* context;                    /*!< callers callback context */
-    int timerid;                      /*!< refresh timer id */
-    ktable_keys keys[KTABLE_N_NODES]; /*!< */
-    utimers timers[KTABLE_N_TIMERS];  /*!< */
-    knodes nodes[KTABLE_N_NODES];     /*!< */
-    knodes* recents[3];               /*!< last ping */
+    int timerid;                     /*!< refresh timer id */
+    utimers timers[KTABLE_N_TIMERS]; /*!< */
+    knodes nodes[KTABLE_N_NODES];    /*!< open addressed by node id hash */
+    knodes* recents[3];              /*!< last ping */
 } ktable;
 
 /**
  * @brief Initialize a ktable context
  *
  * @param table Adress of table
+ *
+ * @return 0 OK -1 out of memory (timing wheel)
  */
 int ktable_init(ktable* table, ktable_settings* settings, void*);
 
@@ -87,14 +83,15 @@ int ktable_init(ktable* table, ktable_settings* settings, void*);
 void ktable_deinit(ktable* table);
 
 /**
- * @brief Return a node index from a public key
+ * @brief Return a node index from a node id. Probes the table from the slot
+ * picked by the id hash.
  *
  * @param self
  * @param q
  *
- * @return
+ * @return index or -1 not found
  */
-knode_key ktable_pub_to_key(ktable* self, uecc_public_key* q);
+knode_key ktable_pub_to_key(ktable* self, const uecc_node_id* q);
 
 /**
  * @brief Call periodically to maintain table
@@ -103,6 +100,15 @@ knode_key ktable_pub_to_key(ktable* self, uecc_public_key* q);
  */
 void ktable_poll(ktable* self);
 
+/**
+ * @brief How long until ktable_poll has a timer to service
+ *
+ * @param self
+ *
+ * @return ms or UWHEEL_NONE
+ */
+uint32_t ktable_next(ktable* self);
+
 /**
  * @brief Ping a node in the table
  *
@@ -111,7 +117,7 @@ void ktable_poll(ktable* self);
  *
  * @return
  */
-int ktable_ping(ktable* self, uecc_public_key* q);
+int ktable_ping(ktable* self, const uecc_node_id* q);
 
 /**
  * @brief Ping from somewhere. Will add node into table if it is not already in
@@ -129,7 +135,7 @@ int ktable_ping(ktable* self, uecc_public_key* q);
  */
 int ktable_on_ping(
     ktable* self,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp);
@@ -148,7 +154,7 @@ int ktable_on_ping(
  */
 int ktable_on_pong(
     ktable* self,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp);
@@ -189,7 +195,7 @@ void ktable_update_recent(ktable* table, knodes* node);
  *
  * @return the node or NULL if it does not exist
  */
-knodes* ktable_get(ktable* self, uecc_public_key* q);
+knodes* ktable_get(ktable* self, const uecc_node_id* q);
 
 /**
  * @brief Add a node to our table using rlp data received from find node reply
@@ -199,7 +205,10 @@ knodes* ktable_get(ktable* self, uecc_public_key* q);
  *
  * @return
  */
-knode_key ktable_insert_rlp(ktable* table, uecc_public_key*, const urlp* rlp);
+knode_key ktable_insert_rlp(
+    ktable* table,
+    const uecc_node_id*,
+    const urlp* rlp);
 
 /**
  * @brief Add a node to out table using raw data
@@ -216,7 +225,7 @@ knode_key ktable_insert_rlp(ktable* table, uecc_public_key*, const urlp* rlp);
  */
 knode_key ktable_insert(
     ktable* table,
-    uecc_public_key* q,
+    const uecc_node_id* q,
     uint32_t ip,
     uint32_t tcp,
     uint32_t udp,
@@ -228,7 +237,7 @@ knode_key ktable_insert(
  * @param self
  * @param key
  */
-void ktable_remove(ktable* self, uecc_public_key* q);
+void ktable_remove(ktable* self, const uecc_node_id* q);
 
 /**
  * @brief
@@ -36,11 +36,16 @@ ktable_settings g_rlpx_io_discovery_table_settings = {
     .want_find = rlpx_io_discovery_table_find
 };
 
-void
+int
 rlpx_io_discovery_init(rlpx_io_discovery* self, rlpx_io* base)
 {
     memset(self, 0, sizeof(rlpx_io_discovery));
 
+    //
+    if (ktable_init(&self->table, &g_rlpx_io_discovery_table_settings, self)) {
+        return -1;
+    }
+
     //
     self->base = base;
 
@@ -49,9 +54,7 @@ rlpx_io_discovery_init(rlpx_io_discovery* self, rlpx_io* base)
     base->protocols[0].ready = rlpx_io_discovery_ready;
     base->protocols[0].recv = rlpx_io_discovery_recv;
     base->protocols[0].uninstall = rlpx_io_discovery_uninstall;
-
-    //
-    ktable_init(&self->table, &g_rlpx_io_discovery_table_settings, self);
+    return 0;
 }
 
 int
@@ -61,8 +64,8 @@ rlpx_io_discovery_install(rlpx_io* base)
                                   ? NULL
                                   : rlpx_malloc(sizeof(rlpx_io_discovery));
     if (self) {
-        rlpx_io_discovery_init(self, base);
-        return 0;
+        if (!rlpx_io_discovery_init(self, base)) return 0;
+        rlpx_free(self);
     }
     return -1;
 }
@@ -150,7 +153,8 @@ rlpx_io_discovery_recv(void* ctx, const urlp* rlp)
                 src.ip,
                 src.tcp,
                 async_io_port(&self->base->io));
-            usys_log("[ IN] [UDP] (ping) %s:%d", usys_htoa(src.ip), src.udp);
+            usys_log_info(
+                "[ IN] [UDP] (ping) %s:%d", usys_htoa(src.ip), src.udp);
         }
     } else if (type == RLPX_DISCOVERY_PONG) {
 
@@ -169,7 +173,7 @@ rlpx_io_discovery_recv(void* ctx, const urlp* rlp)
                 async_io_ip_addr(&self->base->io),
                 0,
                 0);
-            usys_log(
+            usys_log_info(
                 "[ IN] [UDP] (pong) %s:%d",
                 usys_htoa(async_io_ip_addr(&self->base->io)),
                 async_io_port(&self->base->io));
@@ -193,7 +197,7 @@ rlpx_io_discovery_recv(void* ctx, const urlp* rlp)
 
         // Received some neighbours
         err = ktable_on_neighbours(&self->table, &crlp);
-        usys_log(
+        usys_log_info(
             "[ IN] [UDP] (neighbours) %s:%d",
             usys_htoa(async_io_ip_addr(&self->base->io)),
             async_io_port(&self->base->io));
@@ -347,21 +351,21 @@ rlpx_io_discovery_write_pong(
 int
 rlpx_io_discovery_write_find(
     uecc_ctx* skey,
-    uecc_public_key* nodeid,
+    const uecc_node_id* nodeid,
     uint32_t timestamp,
     uint8_t* b,
     uint32_t* l)
 {
     int err = -1;
     urlp* rlp = urlp_list();
-    uint8_t pub[65] = { 0x04 };
+    uint8_t pub[64];
     if (nodeid) {
-        uecc_qtob(nodeid, pub, sizeof(pub));
+        memcpy(pub, nodeid->raw.b, 64);
     } else {
-        urand(&pub[1], 64);
+        urand(pub, 64);
     }
     if (rlp) {
-        urlp_push_u8_arr(rlp, &pub[1], 64);
+        urlp_push_u8_arr(rlp, pub, 64);
         urlp_push_u32(rlp, timestamp);
         err = rlpx_io_discovery_write(skey, RLPX_DISCOVERY_FIND, rlp, b, l);
         urlp_free(&rlp);
@@ -400,19 +404,23 @@ rlpx_io_discovery_send_ping(
     uint32_t timestamp)
 {
     int err;
-    uint32_t len = 200;
-    uint8_t stack[len];
+    rlpx_io_message* msg = rlpx_io_message_alloc(ip, port, 200);
+    if (!msg) return -1;
     err = rlpx_io_discovery_write_ping(
         self->base->skey,
         4,
         ep_src,
         ep_dst,
         timestamp ? timestamp : usys_now() + 15,
-        stack,
-        &len);
-    // usys_log("[OUT] [UDP] (ping) (size: %d) %s", len, usys_htoa(ip));
-    if (!err) err = rlpx_io_sendto(self->base, ip, port, stack, len);
-    return err;
+        msg->b,
+        &msg->sz);
+    // usys_log("[OUT] [UDP] (ping) (size: %d) %s", msg->sz, usys_htoa(ip));
+    if (!err) {
+        return rlpx_io_send_message(self->base, msg);
+    } else {
+        rlpx_free(msg);
+        return err;
+    }
 }
 
 int
@@ -425,17 +433,21 @@ rlpx_io_discovery_send_pong(
     uint32_t timestamp)
 {
     int err;
-    uint32_t len = 200;
-    uint8_t stack[len];
+    rlpx_io_message* msg = rlpx_io_message_alloc(ip, port, 200);
+    if (!msg) return -1;
     err = rlpx_io_discovery_write_pong(
         self->base->skey,
         ep_to,
         echo,
         timestamp ? timestamp : usys_now() + 15,
-        stack,
-        &len);
-    if (!err) err = rlpx_io_sendto(self->base, ip, port, stack, len);
-    return err;
+        msg->b,
+        &msg->sz);
+    if (!err) {
+        return rlpx_io_send_message(self->base, msg);
+    } else {
+        rlpx_free(msg);
+        return err;
+    }
 }
 
 int
@@ -443,21 +455,25 @@ rlpx_io_discovery_send_find(
     rlpx_io_discovery* self,
     uint32_t ip,
     uint32_t port,
-    uecc_public_key* nodeid,
+    const uecc_node_id* nodeid,
     uint32_t timestamp)
 {
     int err;
-    uint32_t len = 200;
-    uint8_t stack[len];
+    rlpx_io_message* msg = rlpx_io_message_alloc(ip, port, 200);
+    if (!msg) return -1;
     err = rlpx_io_discovery_write_find(
         self->base->skey,
         nodeid,
         timestamp ? timestamp : usys_now() + 15,
-        stack,
-        &len);
+        msg->b,
+        &msg->sz);
     // usys_log("[OUT] [UDP] (find) %s", usys_htoa(ip));
-    if (!err) err = rlpx_io_sendto(self->base, ip, port, stack, len);
-    return err;
+    if (!err) {
+        return rlpx_io_send_message(self->base, msg);
+    } else {
+        rlpx_free(msg);
+        return err;
+    }
 }
 
 int
@@ -469,16 +485,20 @@ rlpx_io_discovery_send_neighbours(
     uint32_t timestamp)
 {
     int err;
-    uint32_t len = 200;
-    uint8_t stack[len];
+    rlpx_io_message* msg = rlpx_io_message_alloc(ip, port, 200);
+    if (!msg) return -1;
     err = rlpx_io_discovery_write_neighbours(
         self->base->skey,
         table,
         timestamp ? timestamp : usys_now() + 15,
-        stack,
-        &len);
-    if (!err) err = rlpx_io_sendto(self->base, ip, port, stack, len);
-    return err;
+        msg->b,
+        &msg->sz);
+    if (!err) {
+        return rlpx_io_send_message(self->base, msg);
+    } else {
+        rlpx_free(msg);
+        return err;
+    }
 }
 
 int
@@ -56,8 +56,10 @@ typedef struct
  *
  * @param self
  * @param base
+ *
+ * @return 0 OK -1 out of memory (base is left as is)
  */
-void rlpx_io_discovery_init(rlpx_io_discovery* self, rlpx_io* base);
+int rlpx_io_discovery_init(rlpx_io_discovery* self, rlpx_io* base);
 
 /**
  * @brief
@@ -229,7 +231,7 @@ int rlpx_io_discovery_write_pong(
  */
 int rlpx_io_discovery_write_find(
     uecc_ctx* skey,
-    uecc_public_key* nodeid,
+    const uecc_node_id* nodeid,
     uint32_t timestamp,
     uint8_t* b,
     uint32_t* l);
@@ -274,7 +276,7 @@ int rlpx_io_discovery_send_find(
     rlpx_io_discovery* self,
     uint32_t ip,
     uint32_t port,
-    uecc_public_key* nodeid,
+    const uecc_node_id* nodeid,
     uint32_t timestamp);
 
 int rlpx_io_discovery_send_neighbours(
@@ -37,7 +37,19 @@
 // DEVP2P client string max size (from "hello" packet)
 #define RLPX_CLIENT_MAX_LEN 80
 
+// Frame bodies up to this size are decrypted on the stack
+#define RLPX_FRAME_BODY_STACK 1024
+
+// Largest frame body we accept
+#define RLPX_FRAME_BODY_MAX (1 << 20)
+
 // Every protocol type has a number that is mapped to handler in array
 #define RLPX_IO_MAX_PROTOCOL 8
 
+// Discovery datagrams verified as one batch (flushed early when full)
+#define RLPX_IO_UDP_BATCH_MAX 64
+
+// Smallest share of a batch worth handing to another offload worker
+#define RLPX_IO_UDP_BATCH_MIN 8
+
 #endif
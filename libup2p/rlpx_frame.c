@@ -25,71 +25,34 @@
 // @brief Private methods
 
 /**
- * @brief Authenticate and decrypt header frame
+ * @brief Parse a decrypted body frame
  *
- * @param x cipher secrets context data
- * @param header [in] input data to decrypt
- * @param header_urlp [out]
- * @param body_len [out] advertised frame length from header
- *
- * @return 0 OK -1 error
- */
-int frame_parse_header(
-    rlpx_coder* x,
-    const uint8_t* header,
-    urlp** header_urlp,
-    uint32_t* body_len);
-
-/**
- * @brief Authenticate and decrypt a body frame
- *
- * @param x cipher secrets context data
- * @param body [in] input data to decrypt
- * @param body_len [in] length of body data
+ * @param body [in] plain text body
+ * @param body_len [in] length of body data (aes padded)
  * @param rlp [out] allocated rlp list of body
  *
- * @return
- */
-int frame_parse_body(
-    rlpx_coder* x,
-    const uint8_t* body,
-    uint32_t body_len,
-    urlp** rlp);
-
-/**
- * @brief Update MAC state, convert plaintext to cipher text with MAC
- *
- * @param rlpx_coder [in] cipher secrets context data
- * @param x [in] egress data
- * @param xlen [in] egress data length
- * @param out [out] encrypted output
- * @param mac [out] mac
- *
  * @return 0 OK -1 error
  */
-int frame_egress(
-    rlpx_coder*,
-    const uint8_t* x,
-    size_t xlen,
-    uint8_t* out,
-    uint8_t* mac);
+int frame_parse_body(const uint8_t* body, uint32_t body_len, urlp** rlp);
 
 /**
- * @brief
+ * @brief Advance a MAC state with a header or frame seed
  *
- * @param rlpx_coder [in] cipher secrets context data
- * @param x [in] ingress data
- * @param xlen [in] ingress data length
- * @param expect [in] MAC used to validate ingress data
- * @param out [out] decrypted data
+ * HEADER:
+ * mac.update(aes(mac-secret,mac.digest) ^ header-ciphertext).digest
  *
- * @return
+ * FRAME: (frame ciphertext absorbed before calling)
+ * mac.update(aes(mac-secret,mac.digest) ^ left128(mac.digest)).digest
+ *
+ * @param mac [in/out] egress or ingress mac state
+ * @param aes [in] aes ecb context of mac-secret
+ * @param seed [in] header cipher text or NULL for frame
+ * @param out [out] 16 byte mac
  */
-int frame_ingress(
-    rlpx_coder*,
-    const uint8_t* x,
-    size_t xlen,
-    const uint8_t* expect,
+void frame_mac(
+    ukeccak256_ctx* mac,
+    uaes_ctx* aes,
+    const uint8_t* seed,
     uint8_t* out);
 
 // public
@@ -104,96 +67,147 @@ rlpx_frame_write(
     uint32_t* l)
 {
     size_t len = AES_LEN(datalen);
-    uint8_t head[32], body[len];
     if (*l < (32 + len + 16)) {
         *l = 32 + len + 16;
         return -1;
     }
     *l = 32 + len + 16;
-    memcpy(body, data, datalen);
-    memset(&body[datalen], 0, len - datalen);
-    memset(head, 0, 32);
-    WRITE_BE(3, head, (uint8_t*)&datalen);
+
+    // Body first, data may alias out
+    memmove(&out[32], data, datalen);
+    memset(&out[32 + datalen], 0, len - datalen);
+    memset(out, 0, 16);
+    WRITE_BE(3, out, (uint8_t*)&datalen);
 
     // TODO - fix rlpx.list(protocol-type[,context-id])
-    head[3] = '\xc2', head[4] = '\x80' + type, head[5] = '\x80' + id;
+    out[3] = '\xc2', out[4] = '\x80' + type, out[5] = '\x80' + id;
 
-    frame_egress(x, head, 0, out, &out[16]);
-    frame_egress(x, body, len, &out[32], &out[32 + len]);
-    return 0;
+    return rlpx_coder_seal(x, out, len);
 }
 
 uint32_t
 rlpx_frame_parse(rlpx_coder* x, const uint8_t* frame, size_t l, urlp** rlp_p)
 {
+    uint8_t head[16], stack[RLPX_FRAME_BODY_STACK], *body = stack;
+    size_t sz = sizeof(stack);
+    urlp *hrlp = NULL, *brlp = NULL;
+    uint32_t ret = 0;
+    int err;
 
-    int err = 0;
-    uint32_t sz;
-    urlp *head = NULL, *body = NULL;
-
-    if (l < 32) return 0;
-
-    // Parse header
-    err = frame_parse_header(x, frame, &head, &sz);
-    if (err) return 0;
-
-    // Check length (accounts for aes padding)
-    if (l < (32 + (AES_LEN(sz)) + 16)) {
-        urlp_free(&head);
-        return 0;
+    // Smallest frame carries one block of body
+    if (l < 64) return 64;
+
+    // Authenticate and decrypt header and body, a big body that is all here
+    // gets a buffer sized from the (authenticated) header
+    err = rlpx_coder_open(x, frame, l, head, body, &sz);
+    if (err > 0 && sz > RLPX_FRAME_BODY_MAX) return 0;
+    if (err > 0 && l < (32 + sz + 16)) return 32 + sz + 16;
+    if (err > 0) {
+        if (!(body = rlpx_malloc(sz))) return 0;
+        err = rlpx_coder_open(x, frame, l, head, body, &sz);
     }
+    if (err) goto EXIT;
+
+    // Parse header rlp
+    hrlp = urlp_parse(head + 3, 13);
+    if (!hrlp) goto EXIT;
 
     // Parse body
-    err = frame_parse_body(x, frame + 32, sz, &body);
-    if (err) {
-        urlp_free(&head);
-        return 0;
-    }
+    if (frame_parse_body(body, AES_LEN(sz), &brlp)) goto EXIT;
 
     // Return rlp frame to caller
     if (!*rlp_p) {
         *rlp_p = urlp_list();
-        if (!*rlp_p) {
-            urlp_free(&head);
-            urlp_free(&body);
-            return 0;
-        }
+        if (!*rlp_p) goto EXIT;
     }
-    urlp_push(*rlp_p, head);
-    urlp_push(*rlp_p, body);
-    return 32 + AES_LEN(sz) + 16;
+    urlp_push(*rlp_p, hrlp);
+    urlp_push(*rlp_p, brlp);
+    hrlp = brlp = NULL;
+    ret = 32 + AES_LEN(sz) + 16;
+EXIT:
+    if (hrlp) urlp_free(&hrlp);
+    if (brlp) urlp_free(&brlp);
+    if (body != stack) rlpx_free(body);
+    return ret;
 }
 
 int
-frame_parse_header(
-    rlpx_coder* x,
-    const uint8_t* hdr,
-    urlp** header_urlp,
-    uint32_t* body_len)
+rlpx_coder_seal(rlpx_coder* x, uint8_t* frame, size_t len)
 {
-    int err = -1;
-    uint8_t tmp[32];
-
-    err = frame_ingress(x, hdr, 0, &hdr[16], tmp);
-    if (err) return err;
+    uint8_t* body = &frame[32];
+    if (len % 16) return -1;
 
-    // Read in big endian length prefix, give to caller
-    *body_len = 0;
-    READ_BE(3, body_len, tmp);
+    // Header cipher text seeds the header mac
+    if (uaes_crypt_ctr_op(&x->aes, x->iv_enc, frame, 16, frame)) return -1;
+    frame_mac(&x->emac, &x->aes_mac, frame, &frame[16]);
 
-    // Parse header rlp, give to caller
-    *header_urlp = urlp_parse(tmp + 3, 13);
-    return *header_urlp ? 0 : -1;
+    // Encrypt and absorb each block while it is hot
+    for (size_t i = 0; i < len; i += 16) {
+        if (uaes_crypt_ctr_op(&x->aes, x->iv_enc, &body[i], 16, &body[i])) {
+            return -1;
+        }
+        ukeccak256_update(&x->emac, &body[i], 16);
+    }
+    frame_mac(&x->emac, &x->aes_mac, NULL, &body[len]);
+    return 0;
 }
 
 int
-frame_parse_body(rlpx_coder* x, const uint8_t* frame, uint32_t l, urlp** rlp)
+rlpx_coder_open(
+    rlpx_coder* x,
+    const uint8_t* frame,
+    size_t l,
+    uint8_t* head,
+    uint8_t* body,
+    size_t* bodylen)
 {
-    int err;
-    uint8_t body[(l = l % 16 ? AES_LEN(l) : l)];
-    err = frame_ingress(x, frame, l, frame + l, body);
-    if (err) return err;
+    const uint8_t* cipher = &frame[32];
+    ukeccak256_ctx imac;
+    uint8_t mac[16], iv[16];
+    uint32_t sz = 0;
+    size_t len;
+
+    // Work on a copy of the ingress mac and counter, they are only written
+    // back once the whole frame checks out
+    if (l < 32) return -1;
+    imac = x->imac;
+    memcpy(iv, x->iv_dec, 16);
+
+    // Check header mac and decrypt
+    frame_mac(&imac, &x->aes_mac, frame, mac);
+    if (memcmp(mac, &frame[16], 16)) return -1;
+    if (uaes_crypt_ctr_op(&x->aes, iv, frame, 16, head)) return -1;
+
+    // Read in big endian length prefix (accounts for aes padding)
+    READ_BE(3, &sz, head);
+    len = AES_LEN(sz);
+    if (!len) return -1;
+    if (l < (32 + len + 16) || *bodylen < len) {
+        *bodylen = len;
+        return 1;
+    }
+
+    // Absorb and decrypt each block while it is hot
+    for (size_t i = 0; i < len; i += 16) {
+        ukeccak256_update(&imac, (uint8_t*)&cipher[i], 16);
+        if (uaes_crypt_ctr_op(&x->aes, iv, &cipher[i], 16, &body[i])) {
+            return -1;
+        }
+    }
+    frame_mac(&imac, &x->aes_mac, NULL, mac);
+    if (memcmp(mac, &cipher[len], 16)) {
+        memset(body, 0, len);
+        return -1;
+    }
+    x->imac = imac;
+    memcpy(x->iv_dec, iv, 16);
+    *bodylen = sz;
+    return 0;
+}
 
+int
+frame_parse_body(const uint8_t* body, uint32_t l, urlp** rlp)
+{
     if (body[0] < 0xc0) {
         // Some technical debt? Early packets did not nest their body frames
         // So we nest them here and pass up stack and we'll see how that goes
@@ -209,75 +223,22 @@ frame_parse_body(rlpx_coder* x, const uint8_t* frame, uint32_t l, urlp** rlp)
     return *rlp ? 0 : -1;
 }
 
-int
-frame_egress(
-    rlpx_coder* x,
-    const uint8_t* plain,
-    size_t xlen,
-    uint8_t* out,
-    uint8_t* mac)
-{
-    // encrypt
-    // HEADER:
-    // egress.update(aes(mac-secret,egress-mac) ^ header-ciphertext).digest
-    //
-    // FRAME:
-    // egress-mac.update(aes(mac-secret,egress-mac) ^
-    // left128(egress-mac.update(frame-ciphertext).digest))
-    //
-    // if xlen == 0 x is a header else x is a frame
-    uint8_t xin[32], tmp[32];
-    memset(xin, 0, 32);
-    if (xlen) {
-        if (uaes_crypt_ctr_update(&x->aes_enc, plain, xlen, out)) return -1;
-        ukeccak256_update(&x->emac, (uint8_t*)out, xlen);
-        ukeccak256_digest(&x->emac, xin);
-    } else {
-        if (uaes_crypt_ctr_update(&x->aes_enc, plain, 16, out)) return -1;
-        memcpy(xin, out, 16);
-    }
-    ukeccak256_digest(&x->emac, tmp);          // egress-mac
-    uaes_crypt_ecb_enc(&x->aes_mac, tmp, tmp); // aes(mac-secret,egress-mac)
-    XORN(tmp, xin, 16);                        // aes(...)^cipher
-    ukeccak256_update(&x->emac, tmp, 16);      // ingress(...)
-    ukeccak256_digest(&x->emac, tmp);          // ingress(...).digest
-    memcpy(mac, tmp, 16);
-    return 0;
-}
-
-int
-frame_ingress(
-    rlpx_coder* x,
-    const uint8_t* cipher,
-    size_t xlen,
-    const uint8_t* expect,
+void
+frame_mac(
+    ukeccak256_ctx* mac,
+    uaes_ctx* aes,
+    const uint8_t* seed,
     uint8_t* out)
 {
-    // Check mac and decrypt
-    // HEADER:
-    // ingress.update(aes(mac-secret,ingress-mac) ^ header-ciphertext).digest
-    //
-    // FRAME: (ingress frame ciphertext before calling))
-    // ingres-mac.update(aes(mac-secret,ingres-mac) ^
-    // left128(ingres-mac.update(frame-ciphertext).digest))
-    //
-    // if xlen == 0 x is a header else x is a frame
-    uint8_t tmp[32], xin[32];
-    memset(xin, 0, 32);
-    if (xlen) {
-        ukeccak256_update(&x->imac, (uint8_t*)cipher, xlen);
-        ukeccak256_digest(&x->imac, xin);
-    } else {
-        xlen = 16;
-        memcpy(xin, cipher, 16);
-    }
-    ukeccak256_digest(&x->imac, tmp);          // ingress-mac
-    uaes_crypt_ecb_enc(&x->aes_mac, tmp, tmp); // aes(mac-secret,ingress-mac)
-    XORN(tmp, xin, 16);                        // aes(...)^cipher
-    ukeccak256_update(&x->imac, tmp, 16);      // ingress(...)
-    ukeccak256_digest(&x->imac, tmp);          // ingress(...).digest
-    if (memcmp(tmp, expect, 16)) return -1;    // compare expect with actual
-    return uaes_crypt_ctr_update(&x->aes_dec, cipher, xlen, out);
+    // The frame seed is the same digest we encrypt so take it only once
+    uint8_t digest[32], tmp[16];
+    ukeccak256_digest(mac, digest);          // mac
+    uaes_crypt_ecb_enc(aes, digest, tmp);    // aes(mac-secret,mac)
+    if (!seed) seed = digest;                // left128(mac) for frames
+    XORN(tmp, seed, 16);                     // aes(...)^seed
+    ukeccak256_update(mac, tmp, 16);         // mac.update(...)
+    ukeccak256_digest(mac, digest);          // mac.update(...).digest
+    memcpy(out, digest, 16);
 }
 
 //
@@ -45,6 +45,7 @@ extern "C" {
  * mac-secret = sha3(ecdhe-shared-secret || aes-secret)
  **/
 
+#include "rlpx_config.h"
 #include "uaes.h"
 #include "uecc.h"
 #include "ukeccak256.h"
@@ -54,8 +55,9 @@ typedef struct
 {
     ukeccak256_ctx emac; /*!< egress mac */
     ukeccak256_ctx imac; /*!< ingress mac */
-    uaes_ctx aes_enc;    /*!< aes dec */
-    uaes_ctx aes_dec;    /*!< aes dec */
+    uaes_ctx aes;        /*!< aes-secret, one key schedule both ways */
+    uint8_t iv_enc[16];  /*!< egress counter */
+    uint8_t iv_dec[16];  /*!< ingress counter */
     uaes_ctx aes_mac;    /*!< aes ecb of egress/ingress mac updates */
 } rlpx_coder;
 
@@ -67,8 +69,64 @@ int rlpx_frame_write(
     size_t datalen,
     uint8_t* out,
     uint32_t* l);
+
+/**
+ * @brief Authenticate, decrypt and parse the frame at the start of frame.
+ *
+ * A frame that is not all in l yet leaves the ingress state untouched, the
+ * return is then the length of the whole frame (more than l).
+ *
+ * @param x cipher secrets context data
+ * @param frame [in] frame data received so far
+ * @param l length of frame data available
+ * @param rlp_p [out] header and body rlp pushed onto (allocated if NULL)
+ *
+ * @return length of the frame, 0 error
+ */
 uint32_t
-rlpx_frame_parse(rlpx_coder* x, const uint8_t* frame, size_t l, urlp**);
+rlpx_frame_parse(rlpx_coder* x, const uint8_t* frame, size_t l, urlp** rlp_p);
+
+/**
+ * @brief Encrypt and MAC a frame in place in a single pass.
+ *
+ * frame holds the plain text header at [0..16] and the aes padded plain text
+ * body at [32..32+len]. Each body block is encrypted and absorbed into the
+ * egress mac while it is still in cache. On return frame holds
+ * header || header-mac || frame || frame-mac
+ *
+ * @param x cipher secrets context data
+ * @param frame [in/out] frame of 32 + len + 16 bytes
+ * @param len length of body (multiple of 16)
+ *
+ * @return 0 OK -1 error
+ */
+int rlpx_coder_seal(rlpx_coder* x, uint8_t* frame, size_t len);
+
+/**
+ * @brief Authenticate and decrypt a frame in a single pass.
+ *
+ * Each body block is absorbed into the ingress mac and decrypted while it is
+ * still in cache. The ingress mac and cipher only advance when the whole
+ * frame is authentic, any other return leaves them untouched (a frame mac
+ * mismatch also clears the body).
+ *
+ * @param x cipher secrets context data
+ * @param frame [in] header || header-mac || frame || frame-mac
+ * @param l length of frame data available
+ * @param head [out] 16 byte plain text header
+ * @param body [out] plain text body (aes padded)
+ * @param bodylen [in/out] size of body buffer / advertised frame length (aes
+ * padded length needed when 1 is returned)
+ *
+ * @return 0 OK -1 error 1 frame longer than l or body buffer too small
+ */
+int rlpx_coder_open(
+    rlpx_coder* x,
+    const uint8_t* frame,
+    size_t l,
+    uint8_t* head,
+    uint8_t* body,
+    size_t* bodylen);
 
 #ifdef __cplusplus
 }
@@ -33,6 +33,7 @@
 
 #include "rlpx_handshake.h"
 #include "rlpx_helper_macros.h"
+#include "uecc_cache.h"
 #include "uecies_decrypt.h"
 #include "uecies_encrypt.h"
 #include "urand.h"
@@ -64,11 +65,7 @@ rlpx_encrypt(urlp* rlp, const uecc_public_key* q, uint8_t* p, size_t* l)
     uint16_t prefix = uecies_encrypt_size(padsz + rlpsz), sz = prefix + 2;
 
     // Dynamic stack buffer for plain text
-    uint8_t plain[rlpsz + padsz], *psz = (uint8_t *)&prefix;
-
-    // endian test
-    static int x = 1;
-    *(uint16_t*)p = *(uint8_t*)&x ? (psz[0] << 8 | psz[1]) : *(uint16_t*)psz;
+    uint8_t plain[rlpsz + padsz];
 
     // Is caller buffer big enough?
     if (!(sz <= *l)) {
@@ -78,6 +75,8 @@ rlpx_encrypt(urlp* rlp, const uecc_public_key* q, uint8_t* p, size_t* l)
 
     // Inform caller size, print and encrypt rlp
     *l = sz;
+    p[0] = prefix >> 8;
+    p[1] = prefix;
     if (urlp_print(rlp, plain, &rlpsz)) return -1;
     urand(&plain[rlpsz], padsz);
     err = uecies_encrypt(q, p, 2, plain, padsz + rlpsz, &p[2]);
@@ -87,9 +86,8 @@ rlpx_encrypt(urlp* rlp, const uecc_public_key* q, uint8_t* p, size_t* l)
 uint32_t
 rlpx_decrypt(uecc_ctx* ecc, const uint8_t* c, size_t l, urlp** rlp_p)
 {
-    // endian test
-    static int x = 1;
-    uint16_t sz = *(uint8_t*)&x ? (c[0] << 8 | c[1]) : *(uint16_t*)c;
+    // cipher prefix big endian
+    uint16_t sz = c[0] << 8 | c[1];
 
     // Dynamic stack buffer for cipher text
     uint8_t buffer[sz];
@@ -108,7 +106,7 @@ rlpx_handshake_alloc(
     uecc_ctx* skey,
     uecc_ctx* ekey,
     h256* nonce,
-    const uecc_public_key* to)
+    const uecc_node_id* to)
 {
     rlpx_handshake* hs = rlpx_malloc(sizeof(rlpx_handshake));
     if (hs) {
@@ -120,8 +118,10 @@ rlpx_handshake_alloc(
         hs->nonce = nonce;
         if (orig) {
             rlpx_handshake_auth_init(hs, to);
-        } else {
+        } else if (to) {
             rlpx_handshake_ack_init(hs, to);
+        } else {
+            hs->cipher_len = 0; // ack written once the auth names the remote
         }
     }
     return hs;
@@ -137,14 +137,7 @@ rlpx_handshake_free(rlpx_handshake** hs_p)
 }
 
 int
-rlpx_handshake_secrets(
-    rlpx_handshake* hs,
-    int orig,
-    ukeccak256_ctx* emac,
-    ukeccak256_ctx* imac,
-    uaes_ctx* aes_enc,
-    uaes_ctx* aes_dec,
-    uaes_ctx* aes_mac)
+rlpx_handshake_secrets(rlpx_handshake* hs, int orig, rlpx_coder* x)
 {
     int err;
     uint8_t *sent = hs->cipher, *recv = hs->cipher_remote;
@@ -155,43 +148,44 @@ rlpx_handshake_secrets(
     memcpy(out, orig ? hs->nonce->b : hs->nonce_remote.b, 32);
 
     // aes-secret / mac-secret
-    ukeccak256(buf, 64, out, 32);       // h(nonces)
-    memcpy(buf, &hs->ekey->z.b[1], 32); // (ephemeral || h(nonces))
-    ukeccak256(buf, 64, out, 32);       // S(ephemeral || H(nonces))
-    ukeccak256(buf, 64, out, 32);       // S(ephemeral || H(shared))
-    uaes_init_bin(aes_enc, out, 32);    // aes-secret save
-    uaes_init_bin(aes_dec, out, 32);    // aes-secret save
-    ukeccak256(buf, 64, out, 32);       // S(ephemeral || H(aes-secret))
-    uaes_init_bin(aes_mac, out, 32);    // mac-secret save
+    ukeccak256(buf, 64, out, 32);        // h(nonces)
+    memcpy(buf, &hs->ekey->z.b[1], 32);  // (ephemeral || h(nonces))
+    ukeccak256(buf, 64, out, 32);        // S(ephemeral || H(nonces))
+    ukeccak256(buf, 64, out, 32);        // S(ephemeral || H(shared))
+    uaes_init_bin(&x->aes, out, 32);     // aes-secret save
+    memset(x->iv_enc, 0, 16);            // egress and ingress counters
+    memset(x->iv_dec, 0, 16);            //
+    ukeccak256(buf, 64, out, 32);        // S(ephemeral || H(aes-secret))
+    uaes_init_bin(&x->aes_mac, out, 32); // mac-secret save
 
     // Ingress / egress
-    ukeccak256_init(emac);
-    ukeccak256_init(imac);
-    XOR32_SET(buf, out, hs->nonce->b);       // (mac-secret^recepient-nonce);
-    memcpy(&buf[32], recv, rlen);            // (m..^nonce)||auth-recv-init)
-    ukeccak256_update(imac, buf, 32 + rlen); // S(m..^nonce)||auth-recv)
-    XOR32(buf, hs->nonce->b);                // UNDO xor
-    XOR32(buf, hs->nonce_remote.b);          // (mac-secret^nonce);
-    memcpy(&buf[32], sent, slen);            // (m..^nonce)||auth-sentd-init)
-    ukeccak256_update(emac, buf, 32 + slen); // S(m..^nonce)||auth-sent)
+    ukeccak256_init(&x->emac);
+    ukeccak256_init(&x->imac);
+    XOR32_SET(buf, out, hs->nonce->b);           // (mac-secret^recepient-nonce)
+    memcpy(&buf[32], recv, rlen);                // (m..^nonce)||auth-recv-init)
+    ukeccak256_update(&x->imac, buf, 32 + rlen); // S(m..^nonce)||auth-recv)
+    XOR32(buf, hs->nonce->b);                    // UNDO xor
+    XOR32(buf, hs->nonce_remote.b);              // (mac-secret^nonce);
+    memcpy(&buf[32], sent, slen);                // (m..^nonce)||auth-sent-init)
+    ukeccak256_update(&x->emac, buf, 32 + slen); // S(m..^nonce)||auth-sent)
 
     return err;
 }
 
 int
-rlpx_handshake_auth_init(rlpx_handshake* hs, const uecc_public_key* to)
+rlpx_handshake_auth_init(rlpx_handshake* hs, const uecc_node_id* to)
 {
 
     int err = 0;
     uint8_t rawsig[65];
     uint8_t rawpub[65];
     uecc_shared_secret x;
+    uecc_shared_secret_w_header z;
     uecc_signature sig;
     urlp* rlp;
-    if (uecc_agree(hs->skey, to)) return -1;
-    for (int i = 0; i < 32; i++) {
-        x.b[i] = hs->skey->z.b[i + 1] ^ hs->nonce->b[i];
-    }
+    if (uecc_agree_cached_r(hs->skey, &to->q, &z)) return -1;
+    for (int i = 0; i < 32; i++) x.b[i] = z.b[i + 1] ^ hs->nonce->b[i];
+    memset(z.b, 0, sizeof(z.b));
     if (uecc_sign(hs->ekey, x.b, 32, &sig)) return -1;
     uecc_sig_to_bin(&sig, rawsig);
     uecc_qtob(&hs->skey->Q, rawpub, 65);
@@ -201,17 +195,18 @@ rlpx_handshake_auth_init(rlpx_handshake* hs, const uecc_public_key* to)
         urlp_push_u8_arr(rlp, hs->nonce->b, 32);
         urlp_push_u64(rlp, 4);
     }
-    err = rlpx_encrypt(rlp, to, hs->cipher, &hs->cipher_len);
+    err = rlpx_encrypt(rlp, &to->q, hs->cipher, &hs->cipher_len);
     urlp_free(&rlp);
     return err;
 }
 
 int
-rlpx_handshake_ack_init(rlpx_handshake* hs, const uecc_public_key* to)
+rlpx_handshake_ack_init(rlpx_handshake* hs, const uecc_node_id* to)
 {
     h520 rawekey;
     urlp* rlp;
     int err = 0;
+    hs->cipher_len = sizeof(hs->cipher);
     if (uecc_qtob(&hs->ekey->Q, rawekey.b, sizeof(rawekey.b))) return -1;
     if (!(rlp = urlp_list())) return -1;
     if (rlp) {
@@ -224,7 +219,7 @@ rlpx_handshake_ack_init(rlpx_handshake* hs, const uecc_public_key* to)
         return -1;
     }
 
-    err = rlpx_encrypt(rlp, to, hs->cipher, &hs->cipher_len);
+    err = rlpx_encrypt(rlp, &to->q, hs->cipher, &hs->cipher_len);
     urlp_free(&rlp);
     return err;
 }
@@ -232,10 +227,11 @@ rlpx_handshake_ack_init(rlpx_handshake* hs, const uecc_public_key* to)
 int
 rlpx_handshake_auth_install(rlpx_handshake* hs, urlp** rlp_p)
 {
-    int err = -1;
-    uint8_t buffer[65];
+    int err = -1, agreed = 0;
     urlp* rlp = *rlp_p;
     const urlp* seek;
+    uecc_shared_secret_w_header z;
+    memset(z.b, 0, sizeof(z.b));
     if ((seek = urlp_at(rlp, 3))) {
         // Get version
         hs->version_remote = urlp_as_u64(seek);
@@ -246,19 +242,19 @@ rlpx_handshake_auth_install(rlpx_handshake* hs, urlp** rlp_p)
     }
     if ((seek = urlp_at(rlp, 1)) &&
         urlp_size(seek) == sizeof(uecc_public_key)) {
-        // Get secret from remote public key
-        buffer[0] = 0x04;
-        memcpy(&buffer[1], urlp_ref(seek, NULL), urlp_size(seek));
-        uecc_btoq(buffer, 65, &hs->skey_remote);
-        uecc_agree(hs->skey, &hs->skey_remote);
+        // Get secret from remote public key (none, no handshake)
+        if (!uecc_node_id_init_bin(&hs->skey_remote, urlp_ref(seek, NULL))) {
+            agreed = !uecc_agree_cached_r(hs->skey, &hs->skey_remote.q, &z);
+        }
     }
-    if ((seek = urlp_at(rlp, 0)) &&
+    if (agreed && (seek = urlp_at(rlp, 0)) &&
         // Get remote ephemeral public key from signature
         urlp_size(seek) == sizeof(uecc_signature)) {
         uecc_shared_secret x;
-        XOR32_SET(x.b, (&hs->skey->z.b[1]), hs->nonce_remote.b);
+        XOR32_SET(x.b, (&z.b[1]), hs->nonce_remote.b);
         err = uecc_recover_bin(urlp_ref(seek, NULL), x.b, &hs->ekey_remote);
     }
+    memset(z.b, 0, sizeof(z.b));
     // urlp_free(&rlp);
     return err;
 }
@@ -33,6 +33,7 @@ extern "C" {
 #endif
 
 #include "rlpx_config.h"
+#include "rlpx_frame.h"
 #include "uaes.h"
 #include "uecc.h"
 #include "ukeccak256.h"
@@ -48,7 +49,7 @@ typedef struct
     h256* nonce;
     h256 nonce_remote;
     uecc_public_key ekey_remote;
-    uecc_public_key skey_remote;
+    uecc_node_id skey_remote;
     uint64_t version_remote;
     size_t cipher_len;
     size_t cipher_remote_len;
@@ -57,12 +58,18 @@ typedef struct
 } rlpx_handshake;
 
 // Constructors
+
+/**
+ * @brief Handshake with remote to. A recipient that does not know who is
+ * calling (to NULL, ie: accepted) writes its ack with rlpx_handshake_ack_init
+ * once rlpx_handshake_auth_install read skey_remote, cipher_len is 0 until.
+ */
 rlpx_handshake* rlpx_handshake_alloc(
     int orig,
     uecc_ctx* skey,
     uecc_ctx* ekey,
     h256* nonce,
-    const uecc_public_key* to);
+    const uecc_node_id* to);
 void rlpx_handshake_free(rlpx_handshake** hs_p);
 
 /**
@@ -76,22 +83,17 @@ void rlpx_handshake_free(rlpx_handshake** hs_p);
  * egress  = sha3(mac-secret^their nonce || cipher sent )
  * ingress = sha3(mac-secret^our nonce   || cipher received)
  *
+ * The aes-secret is expanded once, egress and ingress keep their own counter.
+ *
  * @param hs
- * @param x
  * @param orig
+ * @param x
  *
  * @return
  */
 
-int rlpx_handshake_secrets(
-    rlpx_handshake* hs,
-    int orig,
-    ukeccak256_ctx* emac,
-    ukeccak256_ctx* imac,
-    uaes_ctx* aes_enc,
-    uaes_ctx* aes_dec,
-    uaes_ctx* aes_mac);
-int rlpx_handshake_auth_init(rlpx_handshake*, const uecc_public_key*);
+int rlpx_handshake_secrets(rlpx_handshake* hs, int orig, rlpx_coder* x);
+int rlpx_handshake_auth_init(rlpx_handshake*, const uecc_node_id*);
 int rlpx_handshake_auth_install(rlpx_handshake* hs, urlp** rlp_p);
 int rlpx_handshake_auth_recv(
     rlpx_handshake* hs,
@@ -99,7 +101,7 @@ int rlpx_handshake_auth_recv(
     size_t l,
     urlp** rlp_p);
 // Ack
-int rlpx_handshake_ack_init(rlpx_handshake*, const uecc_public_key*);
+int rlpx_handshake_ack_init(rlpx_handshake*, const uecc_node_id*);
 int rlpx_handshake_ack_install(rlpx_handshake* hs, urlp** rlp_p);
 int rlpx_handshake_ack_recv(
     rlpx_handshake* hs,
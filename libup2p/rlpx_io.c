@@ -27,10 +27,12 @@
 // Private io callbacks (discv4)
 int rlpx_io_on_erro_from(void* ctx);
 int rlpx_io_on_recv_from(void* ctx, int err, uint8_t* b, uint32_t l);
-int rlpx_io_on_accept(void* ctx);
+int rlpx_io_on_drain_from(void* ctx);
+int rlpx_io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
 int rlpx_io_on_connect(void* ctx);
 int rlpx_io_on_erro(void* ctx);
 int rlpx_io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
+void rlpx_io_on_sent(void* ctx, async_io_buf* buf);
 int rlpx_io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
 
 // Private protocol callbacks
@@ -41,10 +43,28 @@ int rlpx_io_on_pong(void* ctx, const urlp* rlp);
 int rlpx_io_on_recv_auth(void* ctx, int err, uint8_t* b, uint32_t l);
 int rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l);
 
+// Private crypto offload
+int rlpx_io_on_recv_held(void* ctx, int err, uint8_t* b, uint32_t l);
+int rlpx_io_recv_udp_dispatch(rlpx_io* ch, int type, urlp* rlp);
+int rlpx_io_check_udp(const uint8_t* b, uint32_t len, h256* shash);
+void rlpx_io_pool_drain(rlpx_io* io);
+void rlpx_io_auth_work(upool_job* job);
+void rlpx_io_auth_done(upool_job* job);
+void rlpx_io_ack_work(upool_job* job);
+void rlpx_io_ack_done(upool_job* job);
+void rlpx_io_job_install(rlpx_io* io);
+void rlpx_io_job_fail(rlpx_io* io, int err, const char* what);
+int rlpx_io_ack_open(rlpx_handshake* hs, const uint8_t* ack, size_t l);
+int rlpx_io_ack_secrets(rlpx_io* ch);
+void rlpx_io_udp_work(upool_job* job);
+void rlpx_io_udp_done(upool_job* job);
+
 async_io_settings g_rlpx_disc_settings = {
     .on_erro = rlpx_io_on_erro_from, //
     .on_send = rlpx_io_on_send,      //
+    .on_sent = rlpx_io_on_sent,      //
     .on_recv = rlpx_io_on_recv_from, //
+    .on_drain = rlpx_io_on_drain_from,
 };
 
 // IO callback handlers
@@ -53,6 +73,7 @@ async_io_settings g_rlpx_io_settings = { //
     .on_connect = rlpx_io_on_connect,
     .on_erro = rlpx_io_on_erro,
     .on_send = rlpx_io_on_send,
+    .on_sent = rlpx_io_on_sent,
     .on_recv = rlpx_io_on_recv
 };
 
@@ -125,12 +146,14 @@ rlpx_io_init(rlpx_io* rlpx, uecc_ctx* s, const uint32_t* listen)
 
     // Init message pointer
     rlpx->tail_p = &rlpx->outgoing;
+    rlpx->rx_tail = &rlpx->rx;
 }
 
 void
 rlpx_io_deinit(rlpx_io* rlpx)
 {
     rlpx_io_message* msg;
+    rlpx_io_pool_drain(rlpx);
     async_io_deinit(&rlpx->io);
     uecc_key_deinit(&rlpx->ekey);
     for (uint32_t i = 0; i < RLPX_IO_MAX_PROTOCOL; i++) {
@@ -150,10 +173,39 @@ rlpx_io_deinit(rlpx_io* rlpx)
 void
 rlpx_io_refresh(rlpx_io* rlpx)
 {
+    rlpx_io_message* msg;
+    rlpx_io_pool_drain(rlpx);
     rlpx->error = rlpx->shutdown = rlpx->ready = 0;
     rlpx_node_deinit(&rlpx->node);
     if (rlpx->hs) rlpx_handshake_free(&rlpx->hs);
-    // TODO free outgoing
+    while (rlpx->outgoing) {
+        msg = rlpx->outgoing;
+        rlpx->outgoing = msg->next;
+        rlpx_io_message_free(rlpx, msg);
+    }
+    rlpx->tail_p = &rlpx->outgoing;
+}
+
+void
+rlpx_io_pool_drain(rlpx_io* io)
+{
+    // Jobs in flight point at us, land them before state goes away. Done
+    // handlers see shutdown and only release their memory.
+    int shutdown = io->shutdown;
+    rlpx_io_udp_packet* rx;
+    io->shutdown = 1;
+    if (io->pending) upool_flush(io->pool);
+    io->shutdown = shutdown;
+    while (io->rx) {
+        rx = io->rx;
+        io->rx = rx->next;
+        rlpx_free(rx);
+    }
+    io->rx_tail = &io->rx;
+    io->rx_n = 0;
+    if (io->job_b) rlpx_free(io->job_b);
+    io->job_b = NULL;
+    io->job_l = 0;
 }
 
 int
@@ -211,16 +263,16 @@ rlpx_io_connect_node(rlpx_io* ch, const rlpx_node* n)
 }
 
 int
-rlpx_io_accept(rlpx_io* ch, const uecc_public_key* from)
+rlpx_io_accept(rlpx_io* ch, usys_socket_fd s, usys_sockaddr* addr)
 {
-    // TODO - this is a stub.
+    // Responder, our ack goes out once the remote auth is installed
     if (ch->hs) rlpx_handshake_free(&ch->hs);
-    ch->node.id = *from;
-    ch->hs = rlpx_handshake_alloc(0, ch->skey, &ch->ekey, &ch->nonce, from);
+    ch->hs = rlpx_handshake_alloc(0, ch->skey, &ch->ekey, &ch->nonce, NULL);
     if (ch->hs) {
-        async_io_tcp_accept(&ch->io); // stub
-        ch->io.sock = 3;              // stub
-        return rlpx_io_send(ch, ch->hs->cipher, ch->hs->cipher_len);
+        ch->node.ipv4 = addr->ip;
+        async_io_tcp_accept(&ch->io, s, addr);
+        async_io_on_recv(&ch->io, rlpx_io_on_recv_auth);
+        return 0;
     } else {
         return -1;
     }
@@ -230,18 +282,62 @@ int
 rlpx_io_send_auth(rlpx_io* ch)
 {
     if (ch->hs) rlpx_handshake_free(&ch->hs);
-    ch->hs =
+    ch->pending++;
+    if (upool_submit(
+            ch->pool, &ch->job, rlpx_io_auth_work, rlpx_io_auth_done, ch)) {
+        return 0; // resumes in rlpx_io_auth_done
+    }
+    return ch->job.err;
+}
+
+void
+rlpx_io_auth_work(upool_job* job)
+{
+    // Worker thread, only touches job_hs (the loop installs it when done)
+    rlpx_io* ch = job->ctx;
+    ch->job_hs =
         rlpx_handshake_alloc(1, ch->skey, &ch->ekey, &ch->nonce, &ch->node.id);
-    if (ch->hs) {
-        usys_log(
+    job->err = ch->job_hs ? 0 : -1;
+}
+
+void
+rlpx_io_auth_done(upool_job* job)
+{
+    rlpx_io* ch = job->ctx;
+    ch->pending--;
+    rlpx_io_job_install(ch);
+    if (rlpx_io_is_shutdown(ch)) {
+        job->err = -1;
+        return;
+    }
+    if (!job->err) {
+        usys_log_info(
             "[OUT] (auth) (size: %d) (%s)",
             ch->hs->cipher_len,
             usys_htoa(ch->node.ipv4));
         async_io_on_recv(&ch->io, rlpx_io_on_recv_ack);
-        return rlpx_io_send(ch, ch->hs->cipher, ch->hs->cipher_len);
-    } else {
-        return -1;
+        job->err = rlpx_io_send(ch, ch->hs->cipher, ch->hs->cipher_len);
     }
+    if (job->err) rlpx_io_job_fail(ch, job->err, "auth");
+}
+
+void
+rlpx_io_job_install(rlpx_io* io)
+{
+    // Loop thread, the handshake a job built is ours again
+    if (!io->job_hs) return;
+    if (io->hs) rlpx_handshake_free(&io->hs);
+    io->hs = io->job_hs;
+    io->job_hs = NULL;
+}
+
+void
+rlpx_io_job_fail(rlpx_io* io, int err, const char* what)
+{
+    // Nobody returns our error to the io, close it like on_recv would
+    usys_log_err("[ERR] socket %d (%s) %d", io->io.sock, what, err);
+    rlpx_io_error_set(io, 1);
+    rlpx_io_close(io);
 }
 
 int
@@ -253,75 +349,96 @@ rlpx_io_send(rlpx_io* io, uint8_t* b, uint32_t l)
 int
 rlpx_io_sendto(rlpx_io* io, uint32_t ip, uint32_t port, uint8_t* b, uint32_t l)
 {
-    int err = rlpx_io_sendto_enqueue(io, ip, port, b, l);
-    if (!err) {
-        if (!async_io_state_busy(&io->io)) err = rlpx_io_sendto_dequeue(io);
+    // Caller keeps b, protocols encode in place instead (see message_alloc)
+    rlpx_io_message* msg = rlpx_io_message_alloc(ip, port, l);
+    if (!msg) return -1;
+    memcpy(msg->b, b, l);
+    return rlpx_io_send_message(io, msg);
+}
+
+rlpx_io_message*
+rlpx_io_message_alloc(uint32_t ip, uint32_t port, uint32_t l)
+{
+    rlpx_io_message* msg = rlpx_malloc(l + sizeof(rlpx_io_message));
+    if (msg) {
+        memset(msg, 0, sizeof(rlpx_io_message));
+        msg->ip = ip;
+        msg->port = port;
+        msg->sz = l;
     }
-    return err;
+    return msg;
 }
 
 int
-rlpx_io_sendto_enqueue(
-    rlpx_io* io,
-    uint32_t ip,
-    uint32_t port,
-    uint8_t* b,
-    uint32_t l)
+rlpx_io_send_message(rlpx_io* io, rlpx_io_message* msg)
 {
-    // TODO can avoid mem copies if we use heap instead of static space output
-    int err = -1;
+    int err = rlpx_io_sendto_enqueue(io, msg);
+    if (!err) err = rlpx_io_sendto_dequeue(io);
+    return err;
+}
 
+int
+rlpx_io_sendto_enqueue(rlpx_io* io, rlpx_io_message* msg)
+{
     // If a max outgoing is set, make sure this packet doesn't exeded it,
-    // otherwise have unlimited outgoing
-    rlpx_io_message* mesg = NULL;
-    if ((!io->outgoing_max) || (io->outgoing_bytes + l < io->outgoing_max)) {
-        mesg = rlpx_malloc(l + sizeof(rlpx_io_message));
-    }
-    if (mesg) {
-        memset(mesg, 0, sizeof(rlpx_io_message));
-        mesg->ip = ip;
-        mesg->port = port;
-        mesg->sz = l;
-        memcpy(mesg->b, b, l);
-        io->outgoing_bytes += mesg->sz;
-        io->outgoing_count++;
-        *io->tail_p = mesg;
-        io->tail_p = &mesg->next;
-        err = 0;
+    // otherwise have unlimited outgoing. Message is ours either way.
+    if (io->outgoing_max && io->outgoing_bytes + msg->sz >= io->outgoing_max) {
+        rlpx_free(msg);
+        return -1;
     }
-    return err;
+    io->outgoing_bytes += msg->sz;
+    io->outgoing_count++;
+    *io->tail_p = msg;
+    io->tail_p = &msg->next;
+    return 0;
 }
 
 int
 rlpx_io_sendto_dequeue(rlpx_io* io)
 {
     int err = 0;
-    rlpx_io_message* deleteme = io->outgoing;
-    if (io->outgoing) {
-        err = io->send(io, io->outgoing);
-        if (!err) {
-            io->outgoing_bytes -= io->outgoing->sz;
-            io->outgoing_count--;
-            io->outgoing = io->outgoing->next;
-            if (!io->outgoing) io->tail_p = &io->outgoing;
-            rlpx_free(deleteme);
+    rlpx_io_message* msg;
+
+    // Hand messages to the driver, a message taken is the driver's to free
+    // once sent (see rlpx_io_on_sent)
+    while (!err && (msg = io->outgoing)) {
+        io->outgoing = msg->next;
+        if (!io->outgoing) io->tail_p = &io->outgoing;
+        if ((err = io->send(io, msg))) {
+            msg->next = io->outgoing;
+            io->outgoing = msg;
+            if (!msg->next) io->tail_p = &msg->next;
         }
     }
     return err;
 }
 
+void
+rlpx_io_message_free(rlpx_io* io, rlpx_io_message* msg)
+{
+    io->outgoing_bytes -= msg->sz;
+    io->outgoing_count--;
+    rlpx_free(msg);
+}
+
 int
 rlpx_io_send_udp(rlpx_io* io, rlpx_io_message* msg)
 {
-    async_io_memcpy(&io->io, msg->b, msg->sz);
-    return async_io_udp_send(&io->io, msg->ip, msg->port);
+    // Queued as is, many go out per send call
+    msg->buf.b = msg->b;
+    msg->buf.l = msg->sz;
+    msg->buf.addr.ip = msg->ip;
+    msg->buf.addr.port = msg->port;
+    return async_io_udp_sendq(&io->io, &msg->buf);
 }
 
 int
 rlpx_io_send_tcp(rlpx_io* io, rlpx_io_message* msg)
 {
-    async_io_memcpy(&io->io, msg->b, msg->sz);
-    return async_io_tcp_send(&io->io);
+    // Queued as is, many go out per send call
+    msg->buf.b = msg->b;
+    msg->buf.l = msg->sz;
+    return async_io_tcp_sendq(&io->io, &msg->buf);
 }
 
 int
@@ -334,18 +451,17 @@ rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l)
     urlp* rlp = NULL;
     while ((l) && (!err)) {
         sz = rlpx_frame_parse(&ch->x, d, l, &rlp);
-        if (sz > 0) {
-            if (sz <= l) {
-                if (!urlp_idx_to_u16(rlp, 0, &type)) {
-                    p = type < RLPX_IO_MAX_PROTOCOL ? &ch->protocols[type]
-                                                    : NULL;
-                    err = p ? p->recv(ch, urlp_at(rlp, 1)) : -1;
-                }
-                d += sz;
-                l -= sz;
-            } else {
-                err = -1;
+        if (sz > l) {
+            // Frame not all here, the io keeps it for the next read
+            async_io_recv_keep(&ch->io, l);
+            break;
+        } else if (sz > 0) {
+            if (!urlp_idx_to_u16(rlp, 0, &type)) {
+                p = type < RLPX_IO_MAX_PROTOCOL ? &ch->protocols[type] : NULL;
+                err = p ? p->recv(ch, urlp_at(rlp, 1)) : -1;
             }
+            d += sz;
+            l -= sz;
             urlp_free(&rlp);
         } else {
             err = -1;
@@ -355,16 +471,9 @@ rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l)
 }
 
 int
-rlpx_io_parse_udp(
-    const uint8_t* b,
-    uint32_t len,
-    uecc_public_key* node_id,
-    int* type,
-    urlp** rlp)
+rlpx_io_check_udp(const uint8_t* b, uint32_t len, h256* shash)
 {
-    // Stack
-    h256 hash, shash;
-    int err;
+    h256 hash;
 
     // Check len before parsing around
     if (len < (sizeof(h256) + 65 + 3)) return -1;
@@ -373,9 +482,24 @@ rlpx_io_parse_udp(
     ukeccak256((uint8_t*)&b[32], len - 32, hash.b, 32);
     if (memcmp(hash.b, b, 32)) return -1;
 
-    // Recover signature from signed hash of type+rlp
-    ukeccak256((uint8_t*)&b[32 + 65], len - (32 + 65), shash.b, 32);
-    err = uecc_recover_bin(&b[32], shash.b, node_id);
+    // Signed hash of type+rlp
+    ukeccak256((uint8_t*)&b[32 + 65], len - (32 + 65), shash->b, 32);
+    return 0;
+}
+
+int
+rlpx_io_parse_udp(
+    const uint8_t* b,
+    uint32_t len,
+    uecc_public_key* node_id,
+    int* type,
+    urlp** rlp)
+{
+    h256 shash;
+
+    // Check packet and recover signature from signed hash of type+rlp
+    if (rlpx_io_check_udp(b, len, &shash)) return -1;
+    if (uecc_recover_bin(&b[32], shash.b, node_id)) return -1;
 
     // Return OK
     *type = b[32 + 65];
@@ -383,29 +507,160 @@ rlpx_io_parse_udp(
     return 0;
 }
 
+int
+rlpx_io_parse_udp_batch(rlpx_io_udp_packet* p, uint32_t n)
+{
+    // Stack
+    uint32_t i, c = 0;
+    int bad = 0;
+    if (!n) return 0;
+    h256 shash[n];
+    const uint8_t *sigs[n], *digests[n];
+    uecc_public_key keys[n];
+    rlpx_io_udp_packet* v[n];
+    int errs[n];
+
+    // Cheap checks first, only well formed packets go to recovery
+    for (i = 0; p && i < n; p = p->next, i++) {
+        p->rlp = NULL;
+        if ((p->err = rlpx_io_check_udp(p->b, p->l, &shash[c]))) {
+            bad++;
+            continue;
+        }
+        sigs[c] = &p->b[32];
+        digests[c] = shash[c].b;
+        v[c++] = p;
+    }
+
+    // Recover signers together
+    bad += uecc_recover_batch(sigs, digests, keys, errs, c);
+    for (i = 0; i < c; i++) {
+        p = v[i];
+        if ((p->err = errs[i])) continue;
+        uecc_node_id_init(&p->id, &keys[i]);
+        p->type = p->b[32 + 65];
+        p->rlp = urlp_parse(&p->b[32 + 65 + 1], p->l - (32 + 65 + 1));
+    }
+    return bad;
+}
+
 // h256:32 + Signature:65 + type + RLP
 int
 rlpx_io_recv_udp(rlpx_io* ch, const uint8_t* b, size_t l)
 {
-    int type, err;
-    urlp *rlp, *list;
+    int err = rlpx_io_recv_udp_queue(ch, b, l);
+    return err ? err : rlpx_io_recv_udp_flush(ch);
+}
+
+int
+rlpx_io_recv_udp_queue(rlpx_io* ch, const uint8_t* b, size_t l)
+{
+    rlpx_io_udp_packet* p;
+    if (!(p = rlpx_malloc(sizeof(rlpx_io_udp_packet) + l))) return -1;
+    p->next = NULL;
+    p->addr = ch->io.addr;
+    p->rlp = NULL;
+    p->l = l;
+    memcpy(p->b, b, l);
+    *ch->rx_tail = p;
+    ch->rx_tail = &p->next;
+    if (++ch->rx_n >= RLPX_IO_UDP_BATCH_MAX) return rlpx_io_recv_udp_flush(ch);
+    return 0;
+}
+
+int
+rlpx_io_recv_udp_flush(rlpx_io* ch)
+{
+    uint32_t i, k, n, total = ch->rx_n, jobs = 1;
+    rlpx_io_udp_packet *p = ch->rx, *next, **tail;
+    rlpx_io_udp_batch* batch;
+    if (!total) return 0;
+    ch->rx = NULL;
+    ch->rx_tail = &ch->rx;
+    ch->rx_n = 0;
+
+    // Fan out over workers, keeping enough packets per job to be worth it
+    if (upool_active(ch->pool)) {
+        jobs = (total + RLPX_IO_UDP_BATCH_MIN - 1) / RLPX_IO_UDP_BATCH_MIN;
+        if (jobs > ch->pool->n) jobs = ch->pool->n;
+    }
+    for (i = 0; i < jobs; i++) {
+        n = total / jobs + (i < total % jobs ? 1 : 0);
+        if (!(batch = rlpx_malloc(sizeof(rlpx_io_udp_batch)))) break;
+        batch->p = p;
+        batch->n = n;
+        for (tail = &batch->p, k = 0; k < n; k++) tail = &(*tail)->next;
+        p = *tail;
+        *tail = NULL;
+        ch->pending++;
+        upool_submit(
+            ch->pool, &batch->job, rlpx_io_udp_work, rlpx_io_udp_done, ch);
+    }
+
+    // Out of memory, drop what is left
+    while (p) {
+        next = p->next;
+        rlpx_free(p);
+        p = next;
+    }
+    return i == jobs ? 0 : -1;
+}
+
+int
+rlpx_io_recv_udp_dispatch(rlpx_io* ch, int type, urlp* rlp)
+{
+    int err = -1;
+    urlp* list;
     rlpx_io_protocol* p = &ch->protocols[0];
-    if (!(err = rlpx_io_parse_udp(b, l, &ch->node.id, &type, &rlp))) {
-        // We wrap the packet type and body into a list
-        // type,[body]  -- per wire specification
-        // [type,[body]] - per our implementation after wire for unified handler
-        list = urlp_list();
-        if (list) {
-            urlp_push_u16(list, type);
-            urlp_push(list, rlp);
-            err = p->recv(p->context, list);
-            urlp_free(&list);
+    // We wrap the packet type and body into a list
+    // type,[body]  -- per wire specification
+    // [type,[body]] - per our implementation after wire for unified handler
+    list = urlp_list();
+    if (list) {
+        urlp_push_u16(list, type);
+        urlp_push(list, rlp);
+        err = p->recv(p->context, list);
+        urlp_free(&list);
+    } else {
+        urlp_free(&rlp);
+    }
+    return err;
+}
+
+void
+rlpx_io_udp_work(upool_job* job)
+{
+    rlpx_io_udp_batch* batch = (rlpx_io_udp_batch*)job;
+    job->err = rlpx_io_parse_udp_batch(batch->p, batch->n);
+}
+
+void
+rlpx_io_udp_done(upool_job* job)
+{
+    rlpx_io_udp_batch* batch = (rlpx_io_udp_batch*)job;
+    rlpx_io* ch = job->ctx;
+    rlpx_io_udp_packet *p = batch->p, *next;
+    usys_sockaddr addr;
+    int sending;
+    ch->pending--;
+    for (; p; p = next) {
+        next = p->next;
+        if (rlpx_io_is_shutdown(ch) || p->err) {
+            if (p->rlp) urlp_free(&p->rlp);
         } else {
-            urlp_free(&rlp);
+            // Handlers read the sender from io, as if we just received it. A
+            // send in progress owns io addr, replies to us only get queued.
+            addr = ch->io.addr;
+            sending = async_io_state_send(&ch->io);
+            ch->io.addr = p->addr;
+            ch->node.id = p->id;
+            p->err = rlpx_io_recv_udp_dispatch(ch, p->type, p->rlp);
+            if (sending) ch->io.addr = addr;
         }
-        return err;
+        if (p->err) usys_log("[ IN] [UDP] %s", "recv (error)");
+        rlpx_free(p);
     }
-    return err;
+    rlpx_free(batch);
 }
 
 int
@@ -417,16 +672,15 @@ rlpx_io_recv_auth(rlpx_io* ch, const uint8_t* b, size_t l)
     // Decrypt authentication packet (allocates rlp context)
     if ((err = rlpx_handshake_auth_recv(ch->hs, b, l, &rlp))) return err;
 
-    // Process the Decrypted RLP data
-    if (!(err = rlpx_handshake_auth_install(ch->hs, &rlp))) {
-        err = rlpx_handshake_secrets(
-            ch->hs,
-            0,
-            &ch->x.emac,
-            &ch->x.imac,
-            &ch->x.aes_enc,
-            &ch->x.aes_dec,
-            &ch->x.aes_mac);
+    // Process the Decrypted RLP data, the auth tells us who an accepted
+    // remote is
+    if (!(err = rlpx_handshake_auth_install(ch->hs, &rlp)) &&
+        !ch->hs->cipher_len) {
+        ch->node.id = ch->hs->skey_remote;
+        err = rlpx_handshake_ack_init(ch->hs, &ch->hs->skey_remote);
+    }
+    if (!err) {
+        err = rlpx_handshake_secrets(ch->hs, 0, &ch->x);
     }
 
     // Free rlp and return
@@ -436,37 +690,46 @@ rlpx_io_recv_auth(rlpx_io* ch, const uint8_t* b, size_t l)
 
 int
 rlpx_io_recv_ack(rlpx_io* ch, const uint8_t* ack, size_t l)
+{
+    int err = rlpx_io_ack_open(ch->hs, ack, l);
+    return err ? err : rlpx_io_ack_secrets(ch);
+}
+
+int
+rlpx_io_ack_open(rlpx_handshake* hs, const uint8_t* ack, size_t l)
 {
     int err = -1;
     urlp* rlp = NULL;
 
     // Decrypt authentication packet
-    if ((err = rlpx_handshake_ack_recv(ch->hs, ack, l, &rlp))) return err;
+    if ((err = rlpx_handshake_ack_recv(hs, ack, l, &rlp))) return err;
 
     // Process the Decrypted RLP data
-    if (!(err = rlpx_handshake_ack_install(ch->hs, &rlp))) {
-        err = rlpx_handshake_secrets(
-            ch->hs,
-            1,
-            &ch->x.emac,
-            &ch->x.imac,
-            &ch->x.aes_enc,
-            &ch->x.aes_dec,
-            &ch->x.aes_mac);
-    }
+    err = rlpx_handshake_ack_install(hs, &rlp);
 
     // Free rlp and return
     urlp_free(&rlp);
     return err;
 }
 
+int
+rlpx_io_ack_secrets(rlpx_io* ch)
+{
+    return rlpx_handshake_secrets(ch->hs, 1, &ch->x);
+}
+
 int
 rlpx_io_on_recv_auth(void* ctx, int err, uint8_t* b, uint32_t l)
 {
     rlpx_io* io = (rlpx_io*)ctx;
     if (!err) {
-        usys_log("[ IN] (auth) size: %d", l);
-        return rlpx_io_recv_auth(io, b, l);
+        usys_log_info("[ IN] (auth) size: %d", l);
+        if ((err = rlpx_io_recv_auth(io, b, l))) return err;
+        async_io_on_recv(&io->io, rlpx_io_on_recv);
+        if ((err = rlpx_io_send(io, io->hs->cipher, io->hs->cipher_len))) {
+            return err;
+        }
+        return io->protocols[0].ready(io->protocols[0].context);
     } else {
         return err;
     }
@@ -477,22 +740,20 @@ rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l)
 {
     rlpx_io* io = (rlpx_io*)ctx;
     if (!err) {
-        if (!rlpx_io_recv_ack(io, b, l)) {
-            // TODO Free handshake?
-            l -= io->hs->cipher_remote_len;
-            usys_log("[ IN] (ack) size: %d", io->hs->cipher_remote_len);
-            if (l) {
-                if (rlpx_io_recv(io, &b[io->hs->cipher_remote_len], l)) {
-                    usys_log_err("[ERR] %d", io->io.sock);
-                }
-            }
-            async_io_on_recv(&io->io, rlpx_io_on_recv);
-            return io->protocols[0].ready(io->protocols[0].context);
-            return 0;
-        } else {
-            usys_log_err("[ERR] socket %d (ack)", io->io.sock);
-            return -1;
+        // Keep a copy, async io reuses its buffer once we return. The job
+        // owns the handshake until it is done.
+        if (!io->hs || !(io->job_b = rlpx_malloc(l))) return -1;
+        memcpy(io->job_b, b, l);
+        io->job_l = l;
+        io->job_hs = io->hs;
+        io->hs = NULL;
+        io->pending++;
+        async_io_on_recv(&io->io, rlpx_io_on_recv_held);
+        if (upool_submit(
+                io->pool, &io->job, rlpx_io_ack_work, rlpx_io_ack_done, io)) {
+            return 0; // resumes in rlpx_io_ack_done
         }
+        return io->job.err;
     } else {
         usys_log_err("[ERR] socket %d (ack)", io->io.sock);
         return err;
@@ -500,13 +761,72 @@ rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l)
 }
 
 int
-rlpx_io_on_accept(void* ctx)
+rlpx_io_on_recv_held(void* ctx, int err, uint8_t* b, uint32_t l)
 {
-    rlpx_io* ch = (rlpx_io*)ctx;
-    usys_log("p2p.accept %d", ch->io.sock);
+    // Frames that arrive before our ack is processed wait in the io buffer
+    rlpx_io* io = (rlpx_io*)ctx;
+    ((void)b);
+    if (err) return err;
+    async_io_recv_keep(&io->io, l);
     return 0;
 }
 
+void
+rlpx_io_ack_work(upool_job* job)
+{
+    // Worker thread, only touches the job's handshake and input
+    rlpx_io* io = job->ctx;
+    job->err = rlpx_io_ack_open(io->job_hs, io->job_b, io->job_l);
+}
+
+void
+rlpx_io_ack_done(upool_job* job)
+{
+    rlpx_io* io = job->ctx;
+    uint8_t* b = io->job_b;
+    uint32_t l = io->job_l, ack_l;
+    io->job_b = NULL;
+    io->job_l = 0;
+    io->pending--;
+    rlpx_io_job_install(io);
+    if (rlpx_io_is_shutdown(io)) {
+        job->err = -1;
+    } else {
+        // Session keys are installed here, on the loop thread
+        if (!job->err) job->err = rlpx_io_ack_secrets(io);
+        if (!job->err) {
+            ack_l = io->hs->cipher_remote_len;
+            usys_log_info("[ IN] (ack) size: %d", ack_l);
+            async_io_on_recv(&io->io, rlpx_io_on_recv);
+            if (!upool_active(io->pool)) {
+                // Inline, still in on_recv. The io keeps what we leave of b
+                if (l > ack_l) {
+                    job->err = rlpx_io_recv(io, &b[ack_l], l - ack_l);
+                }
+            } else if (l > ack_l || io->io.c) {
+                // Frames after the ack lead those held in the io buffer
+                job->err =
+                    async_io_recv_again(&io->io, &b[ack_l], l - ack_l);
+            }
+        }
+        if (!job->err) {
+            job->err = io->protocols[0].ready(io->protocols[0].context);
+        }
+        if (job->err) rlpx_io_job_fail(io, job->err, "ack");
+    }
+    rlpx_free(b);
+}
+
+int
+rlpx_io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    // Channels do not listen (see rlpx_io_accept), refuse
+    rlpx_io* ch = (rlpx_io*)ctx;
+    usys_log("p2p.accept %d (%s)", ch->io.sock, usys_htoa(addr->ip));
+    ((void)s);
+    return -1;
+}
+
 int
 rlpx_io_on_connect(void* ctx)
 {
@@ -557,16 +877,29 @@ rlpx_io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l)
     return err;
 }
 
+void
+rlpx_io_on_sent(void* ctx, async_io_buf* buf)
+{
+    rlpx_io_message_free((rlpx_io*)ctx, (rlpx_io_message*)buf);
+}
+
 int
 rlpx_io_on_recv_from(void* ctx, int err, uint8_t* b, uint32_t l)
 {
+    // Hold on to datagram, verified with the rest when the socket is empty
     rlpx_io* self = ctx;
-    if (!err) err = rlpx_io_recv_udp(self, b, l);
+    if (!err) err = rlpx_io_recv_udp_queue(self, b, l);
 
     if (err) usys_log("[ IN] [UDP] %s", "recv (error)");
     return err;
 }
 
+int
+rlpx_io_on_drain_from(void* ctx)
+{
+    return rlpx_io_recv_udp_flush((rlpx_io*)ctx);
+}
+
 //
 //
 //
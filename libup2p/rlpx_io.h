@@ -37,6 +37,7 @@ extern "C" {
 #include "rlpx_handshake.h"
 #include "rlpx_node.h"
 #include "unonce.h"
+#include "upool.h"
 
 /**
  * @brief forward declar for fn types
@@ -64,16 +65,43 @@ typedef struct
 } rlpx_io_protocol;
 
 /**
- * @brief Outgoing messages to eventually go to wire
+ * @brief Outgoing messages to eventually go to wire. Sent from b by
+ * reference (async_io_..._sendq) and freed once out.
  */
 typedef struct rlpx_io_message
 {
+    async_io_buf buf; /*!< send queue entry (first member) */
     struct rlpx_io_message* next;
     uint32_t ip, port;
     uint32_t sz;
     uint8_t b[];
 } rlpx_io_message;
 
+/**
+ * @brief Discovery datagram waiting on signature recovery
+ */
+typedef struct rlpx_io_udp_packet
+{
+    struct rlpx_io_udp_packet* next; /*!< batch link */
+    usys_sockaddr addr;              /*!< sender */
+    uecc_node_id id;                 /*!< recovered sender id */
+    int err;                         /*!< verify result */
+    int type;                        /*!< packet type */
+    urlp* rlp;                       /*!< packet body */
+    uint32_t l;                      /*!< packet size */
+    uint8_t b[];                     /*!< packet */
+} rlpx_io_udp_packet;
+
+/**
+ * @brief Datagrams verified together by one offload job
+ */
+typedef struct
+{
+    upool_job job;         /*!< pool job */
+    uint32_t n;            /*!< number of packets */
+    rlpx_io_udp_packet* p; /*!< packets */
+} rlpx_io_udp_batch;
+
 /**
  * @brief The main rlpx_io context.  First parameter to all api calls (ie: this)
  */
@@ -98,6 +126,15 @@ typedef struct rlpx_io
     rlpx_io_message* outgoing;   /*!< pending messages to transmit */
     rlpx_io_message** tail_p;    /*!< tail ptr */
     rlpx_io_protocol protocols[RLPX_IO_MAX_PROTOCOL]; /*!< map */
+    upool* pool;                 /*!< crypto offload (NULL inline) */
+    upool_job job;               /*!< handshake job in flight */
+    uint32_t pending;            /*!< jobs in flight */
+    rlpx_handshake* job_hs;      /*!< handshake the job works on */
+    uint8_t* job_b;              /*!< handshake job input copy */
+    uint32_t job_l;              /*!< handshake job input size */
+    rlpx_io_udp_packet* rx;      /*!< datagrams read this poll cycle */
+    rlpx_io_udp_packet** rx_tail; /*!< tail ptr */
+    uint32_t rx_n;               /*!< number of datagrams in rx */
 } rlpx_io;
 
 // constructors
@@ -124,17 +161,33 @@ int rlpx_io_connect_host(
     uint32_t tcp);
 int rlpx_io_connect_enode(rlpx_io* ch, const char* enode);
 int rlpx_io_connect_node(rlpx_io* ch, const rlpx_node* node);
-int rlpx_io_accept(rlpx_io* ch, const uecc_public_key* from);
+
+/**
+ * @brief Take an accepted connection (async_io on_accept of a listener),
+ * wait for its auth and answer with our ack. The remote is whoever the auth
+ * says it is (ch->node.id once the auth is in).
+ *
+ * @return 0 OK (ch owns s) -1 error (caller still owns s)
+ */
+int rlpx_io_accept(rlpx_io* ch, usys_socket_fd s, usys_sockaddr* addr);
 int rlpx_io_send_auth(rlpx_io* ch);
 int rlpx_io_send(rlpx_io* io, uint8_t *b, uint32_t l);
 int rlpx_io_sendto(rlpx_io*, uint32_t ip, uint32_t, uint8_t* b, uint32_t l);
-int rlpx_io_sendto_enqueue(
-    rlpx_io* io,
-    uint32_t ip,
-    uint32_t port,
-    uint8_t* b,
-    uint32_t l);
+
+/**
+ * @brief Room for a message of at most l bytes to encode in place (write
+ * msg->b, set msg->sz) then hand to rlpx_io_send_message. A message never
+ * queued goes back with rlpx_free.
+ *
+ * @param ip port destination (0 connected peer)
+ *
+ * @return message or NULL
+ */
+rlpx_io_message* rlpx_io_message_alloc(uint32_t ip, uint32_t port, uint32_t l);
+int rlpx_io_send_message(rlpx_io* io, rlpx_io_message* msg);
+int rlpx_io_sendto_enqueue(rlpx_io* io, rlpx_io_message* msg);
 int rlpx_io_sendto_dequeue(rlpx_io* io);
+void rlpx_io_message_free(rlpx_io* io, rlpx_io_message* msg);
 int rlpx_io_send_tcp(rlpx_io* io, rlpx_io_message* msg);
 int rlpx_io_send_udp(rlpx_io* io, rlpx_io_message* msg);
 int rlpx_io_parse_udp(
@@ -143,11 +196,28 @@ int rlpx_io_parse_udp(
     uecc_public_key* node_id,
     int* type,
     urlp** rlp);
+int rlpx_io_parse_udp_batch(rlpx_io_udp_packet* p, uint32_t n);
 int rlpx_io_recv_udp(rlpx_io* ch, const uint8_t* b, size_t l);
+int rlpx_io_recv_udp_queue(rlpx_io* ch, const uint8_t* b, size_t l);
+int rlpx_io_recv_udp_flush(rlpx_io* ch);
 int rlpx_io_recv(rlpx_io* ch, const uint8_t* d, size_t l);
 int rlpx_io_recv_auth(rlpx_io*, const uint8_t*, size_t l);
 int rlpx_io_recv_ack(rlpx_io* ch, const uint8_t*, size_t l);
 
+/**
+ * @brief Move public key work of this io onto a crypto offload pool. The
+ * handshake and discovery paths suspend while a job is in flight and resume
+ * when the owner of the pool drains it with upool_poll.
+ *
+ * @param io
+ * @param pool pool or NULL to run crypto inline
+ */
+static inline void
+rlpx_io_pool_set(rlpx_io* io, upool* pool)
+{
+    io->pool = pool;
+}
+
 static inline void
 rlpx_io_nonce(rlpx_io* io)
 {
@@ -175,7 +245,7 @@ rlpx_io_spub(rlpx_io* tcp)
 static const uecc_public_key*
 rlpx_io_spub_remote(rlpx_io* tcp)
 {
-    return &tcp->node.id;
+    return &tcp->node.id.q;
 }
 
 static const uecc_public_key*
@@ -218,7 +218,6 @@ rlpx_io_devp2p_recv_hello(void* ctx, const urlp* rlp)
 {
     const char* memptr;
     const uint8_t* pub;
-    uint8_t pub_expect[65];
     uint32_t l, pip, les;
     rlpx_io_devp2p* ch = ctx;
 
@@ -234,13 +233,12 @@ rlpx_io_devp2p_recv_hello(void* ctx, const urlp* rlp)
     pip = rlpx_io_devp2p_capabilities(rlp, "pip", 1);
     les = rlpx_io_devp2p_capabilities(rlp, "les", 1);
 
-    if ((rlp = urlp_at(rlp, 4)) &&                          //
-        (pub = urlp_ref(rlp, &l)) &&                        //
-        (l == 64) &&                                        //
-        (!uecc_qtob(&ch->base->node.id, pub_expect, 65)) && //
-        (!(memcmp(pub, &pub_expect[1], 64)))) {
+    if ((rlp = urlp_at(rlp, 4)) &&   //
+        (pub = urlp_ref(rlp, &l)) && //
+        (l == 64) &&                 //
+        (!(memcmp(pub, ch->base->node.id.raw.b, 64)))) {
         ch->base->ready = 1;
-        usys_log("[ IN] (hello) %s pip:%d les:%d", ch->client, pip, les);
+        usys_log_info("[ IN] (hello) %s pip:%d les:%d", ch->client, pip, les);
         return 0;
     } else {
         // Bad public key...
@@ -287,18 +285,19 @@ int
 rlpx_io_devp2p_send_hello(rlpx_io_devp2p* ch)
 {
     int err;
-    uint32_t len = 1200;
-    uint8_t stack[len];
+    rlpx_io_message* msg = rlpx_io_message_alloc(0, 0, 1200);
+    if (!msg) return -1;
     err = rlpx_io_devp2p_write_hello(
         &ch->base->x,
         *ch->base->listen_port,
         &ch->base->node_id[1],
-        stack,
-        &len);
+        msg->b,
+        &msg->sz);
     if (!err) {
-        usys_log("[OUT] (hello) size: %d", len);
-        return rlpx_io_send(ch->base, stack, len);
+        usys_log_info("[OUT] (hello) size: %d", msg->sz);
+        return rlpx_io_send_message(ch->base, msg);
     } else {
+        rlpx_free(msg);
         return err;
     }
 }
@@ -309,14 +308,16 @@ rlpx_io_devp2p_send_disconnect(
     RLPX_DEVP2P_DISCONNECT_REASON reason)
 {
     int err;
-    uint32_t len = 1200;
-    uint8_t stack[len];
-    err = rlpx_io_devp2p_write_disconnect(&ch->base->x, reason, stack, &len);
+    rlpx_io_message* msg = rlpx_io_message_alloc(0, 0, 1200);
+    if (!msg) return -1;
+    err = rlpx_io_devp2p_write_disconnect(
+        &ch->base->x, reason, msg->b, &msg->sz);
     if (!err) {
-        usys_log("[OUT] (disconnect) size: %d", len);
+        usys_log_info("[OUT] (disconnect) size: %d", msg->sz);
         async_io_on_send(&ch->base->io, rlpx_io_devp2p_on_send_shutdown);
-        return rlpx_io_send(ch->base, stack, len);
+        return rlpx_io_send_message(ch->base, msg);
     } else {
+        rlpx_free(msg);
         return err;
     }
 }
@@ -325,13 +326,14 @@ int
 rlpx_io_devp2p_send_ping(rlpx_io_devp2p* ch)
 {
     int err;
-    uint32_t len = 1200;
-    uint8_t stack[len];
-    err = rlpx_io_devp2p_write_ping(&ch->base->x, stack, &len);
+    rlpx_io_message* msg = rlpx_io_message_alloc(0, 0, 1200);
+    if (!msg) return -1;
+    err = rlpx_io_devp2p_write_ping(&ch->base->x, msg->b, &msg->sz);
     if (!err) {
         ch->ping = usys_tick();
-        return rlpx_io_send(ch->base, stack, len);
+        return rlpx_io_send_message(ch->base, msg);
     } else {
+        rlpx_free(msg);
         return err;
     }
 }
@@ -340,12 +342,13 @@ int
 rlpx_io_devp2p_send_pong(rlpx_io_devp2p* ch)
 {
     int err;
-    uint32_t len = 1200;
-    uint8_t stack[len];
-    err = rlpx_io_devp2p_write_pong(&ch->base->x, stack, &len);
+    rlpx_io_message* msg = rlpx_io_message_alloc(0, 0, 1200);
+    if (!msg) return -1;
+    err = rlpx_io_devp2p_write_pong(&ch->base->x, msg->b, &msg->sz);
     if (!err) {
-        return rlpx_io_send(ch->base, stack, len);
+        return rlpx_io_send_message(ch->base, msg);
     } else {
+        rlpx_free(msg);
         return err;
     }
 }
@@ -32,6 +32,19 @@ rlpx_node_init(
     const char* host,
     uint32_t tcp,
     uint32_t udp)
+{
+    uecc_node_id nid;
+    if (uecc_node_id_init(&nid, id)) return -1;
+    return rlpx_node_init_id(self, &nid, host, tcp, udp);
+}
+
+int
+rlpx_node_init_id(
+    rlpx_node* self,
+    const uecc_node_id* id,
+    const char* host,
+    uint32_t tcp,
+    uint32_t udp)
 {
     memset(self, 0, sizeof(rlpx_node));
     if (strlen(host) <= 15) {
@@ -50,16 +63,16 @@ int
 rlpx_node_init_enode(rlpx_node* self, const char* enode)
 {
     uint32_t l, tcp, udp;
-    uint8_t raw[65] = { 0x04 };
+    uint8_t raw[64];
     char host[16], *ctcp = NULL, *cudp = NULL;
-    uecc_public_key key;
+    uecc_node_id id;
 
-    if ((((l = strlen(enode)) < 136) || (l > 164)) ||            //
-        (memcmp(enode, "enode://", 8)) ||                        //
-        (!(enode[136] == '@')) ||                                //
-        (rlpx_node_hex_to_bin(&enode[8], 128, &raw[1], NULL)) || //
-        (!(ctcp = memchr(&enode[136], ':', l - 136))) ||         //
-        (uecc_btoq(raw, 65, &key))) {
+    if ((((l = strlen(enode)) < 136) || (l > 164)) ||        //
+        (memcmp(enode, "enode://", 8)) ||                    //
+        (!(enode[136] == '@')) ||                            //
+        (rlpx_node_hex_to_bin(&enode[8], 128, raw, NULL)) || //
+        (!(ctcp = memchr(&enode[136], ':', l - 136))) ||     //
+        (uecc_node_id_init_bin(&id, raw))) {
         return -1;
     }
     memcpy(host, &enode[137], ctcp - &enode[137]);
@@ -67,7 +80,7 @@ rlpx_node_init_enode(rlpx_node* self, const char* enode)
     cudp = memchr(ctcp, '.', &enode[l] - ctcp); // optional
     tcp = atoi(++ctcp);
     udp = cudp ? atoi(++cudp) : tcp;
-    return rlpx_node_init(self, &key, host, tcp, udp);
+    return rlpx_node_init_id(self, &id, host, tcp, udp);
 }
 
 void
@@ -37,7 +37,7 @@ extern "C" {
 
 typedef struct
 {
-    uecc_public_key id;
+    uecc_node_id id;
     // char ip_v4[16];
     uint32_t ipv4;
     uint32_t port_tcp;
@@ -51,6 +51,24 @@ int rlpx_node_init(
     uint32_t tcp,
     uint32_t udp);
 
+/**
+ * @brief Create a node from an id that is already serialized and hashed
+ *
+ * @param self
+ * @param id
+ * @param host
+ * @param tcp
+ * @param udp
+ *
+ * @return
+ */
+int rlpx_node_init_id(
+    rlpx_node* self,
+    const uecc_node_id* id,
+    const char* host,
+    uint32_t tcp,
+    uint32_t udp);
+
 /**
  * @brief Create a node from an enode string.
  *
@@ -73,15 +73,9 @@ rlpx_test_aes_mac(rlpx_io* ch)
 }
 
 uaes_ctx*
-rlpx_test_aes_enc(rlpx_io* ch)
+rlpx_test_aes(rlpx_io* ch)
 {
-    return &ch->x.aes_enc;
-}
-
-uaes_ctx*
-rlpx_test_aes_dec(rlpx_io* ch)
-{
-    return &ch->x.aes_dec;
+    return &ch->x.aes;
 }
 
 int
@@ -107,8 +101,9 @@ rlpx_test_expect_secrets(
     memcpy(buf, &s->ekey.z.b[1], 32);      // (ephemeral || h(nonces))
     ukeccak256(buf, 64, out, 32);          // S(ephemeral || H(nonces))
     ukeccak256(buf, 64, out, 32);          // S(ephemeral || H(shared))
-    uaes_init_bin(&s->x.aes_enc, out, 32); // aes-secret save
-    uaes_init_bin(&s->x.aes_dec, out, 32); // aes-secret save
+    uaes_init_bin(&s->x.aes, out, 32);     // aes-secret save
+    memset(s->x.iv_enc, 0, 16);            // counters
+    memset(s->x.iv_dec, 0, 16);            //
     if (memcmp(out, aes, 32)) return -1;   // test
     ukeccak256(buf, 64, out, 32);          // S(ephemeral || H(aes-secret))
     uaes_init_bin(&s->x.aes_mac, out, 32); // mac-secret save
@@ -40,8 +40,7 @@ void rlpx_test_ekey_set(rlpx_io* s, uecc_ctx* ekey);
 ukeccak256_ctx* rlpx_test_ingress(rlpx_io* ch);
 ukeccak256_ctx* rlpx_test_egress(rlpx_io* ch);
 uaes_ctx* rlpx_test_aes_mac(rlpx_io* ch);
-uaes_ctx* rlpx_test_aes_enc(rlpx_io* ch);
-uaes_ctx* rlpx_test_aes_dec(rlpx_io* ch);
+uaes_ctx* rlpx_test_aes(rlpx_io* ch);
 int rlpx_test_expect_secrets(
     rlpx_io* s,
     int orig,
@@ -73,7 +73,11 @@ typedef struct
 
 // Mock overrides
 int test_mock_ready(usys_socket_fd*);
-int test_mock_connect(usys_socket_fd* fd, const char* host, int port);
+int test_mock_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags);
 void test_mock_close(usys_socket_fd* fd);
 int test_mock_send(usys_socket_fd* fd, const byte* b, uint32_t l);
 int test_mock_recv(usys_socket_fd* fd, byte* b, uint32_t l);
@@ -22,6 +22,8 @@
 #include "test.h"
 #include "urand.h"
 
+extern async_io_mock_settings g_io_mock_udp_settings;
+
 uint32_t g_ping_v4_sz;
 uint32_t g_ping_v5_sz;
 uint32_t g_pong_sz;
@@ -49,6 +51,10 @@ int test_disc_read();
 // Test some protocol ops
 int test_disc_protocol();
 
+// Verify packets on a crypto offload pool
+int test_disc_offload();
+int test_disc_offload_recv(void* ctx, const urlp* rlp);
+
 // check functions
 typedef int (*check_fn)(ktable*, int, const urlp*);
 int check_ping_v4(ktable* t, int type, const urlp* rlp);
@@ -83,6 +89,7 @@ test_discovery()
     err |= test_disc_read();
     err |= test_disc_write();
     err |= test_disc_protocol();
+    err |= test_disc_offload();
 
     // Free test vectors
     rlpx_free(g_ping_v4);
@@ -104,6 +111,7 @@ test_disc_write()
     urlp* rlp = NULL;
     uecc_ctx skey;
     uecc_public_key q;
+    uecc_node_id id;
     knodes src, dst;
 
     // setup test
@@ -138,7 +146,8 @@ test_disc_write()
 
     // Check find node
     l = sizeof(b);
-    rlpx_io_discovery_write_find(&skey, &skey.Q, 1234, b, &l);
+    uecc_node_id_init(&id, &skey.Q);
+    rlpx_io_discovery_write_find(&skey, &id, 1234, b, &l);
     IF_ERR_EXIT(rlpx_io_parse_udp(b, l, &q, &type, &rlp));
     IF_ERR_EXIT(check_find_node(NULL, type, rlp));
     urlp_free(&rlp);
@@ -198,6 +207,97 @@ test_disc_protocol()
     return 0;
 }
 
+int g_test_disc_offload_count = 0;
+uecc_public_key g_test_disc_offload_id;
+
+int
+test_disc_offload()
+{
+    int err = -1;
+    uint32_t l, port = 20204;
+    uint8_t b[1000];
+    uecc_ctx skey;
+    knodes src, dst;
+    rlpx_io io;
+    upool pool;
+
+    uecc_key_init_new(&skey);
+    memset(&src, 0, sizeof(knodes));
+    memset(&dst, 0, sizeof(knodes));
+    upool_init(&pool, 2);
+    rlpx_io_udp_init(&io, &skey, &port);
+    async_io_install_mock(&io.io, &g_io_mock_udp_settings);
+    io.protocols[0].context = &io;
+    io.protocols[0].recv = test_disc_offload_recv;
+    rlpx_io_pool_set(&io, &pool);
+    g_test_disc_offload_id = skey.Q;
+    g_test_disc_offload_count = 0;
+
+    // Packets are dispatched once the pool is drained
+    for (int i = 0; i < 8; i++) {
+        l = sizeof(b);
+        rlpx_io_discovery_write_ping(&skey, 4, &src, &dst, 1234, b, &l);
+        IF_ERR_EXIT(rlpx_io_recv_udp(&io, b, l));
+    }
+    upool_flush(&pool);
+    IF_ERR_EXIT(g_test_disc_offload_count == 8 ? 0 : -1);
+    IF_ERR_EXIT(io.pending ? -1 : 0);
+
+    // Bad packet is dropped
+    b[40] ^= 0xff;
+    IF_ERR_EXIT(rlpx_io_recv_udp(&io, b, l));
+    upool_flush(&pool);
+    IF_ERR_EXIT(g_test_disc_offload_count == 8 ? 0 : -1);
+    b[40] ^= 0xff;
+
+    // A poll cycle worth of datagrams (one bad) is verified as a batch and
+    // fanned out over both workers
+    for (int i = 0; i < 9; i++) {
+        if (i == 4) b[40] ^= 0xff;
+        IF_ERR_EXIT(rlpx_io_recv_udp_queue(&io, b, l));
+        if (i == 4) b[40] ^= 0xff;
+    }
+    IF_ERR_EXIT(io.rx_n == 9 ? 0 : -1);
+    IF_ERR_EXIT(rlpx_io_recv_udp_flush(&io));
+    IF_ERR_EXIT(io.rx_n ? -1 : 0);
+    upool_flush(&pool);
+    IF_ERR_EXIT(g_test_disc_offload_count == 16 ? 0 : -1);
+
+    // Same batch inline
+    rlpx_io_pool_set(&io, NULL);
+    for (int i = 0; i < 9; i++) {
+        if (i == 4) b[40] ^= 0xff;
+        IF_ERR_EXIT(rlpx_io_recv_udp_queue(&io, b, l));
+        if (i == 4) b[40] ^= 0xff;
+    }
+    IF_ERR_EXIT(rlpx_io_recv_udp_flush(&io));
+    IF_ERR_EXIT(g_test_disc_offload_count == 24 ? 0 : -1);
+
+    // Jobs in flight and unflushed datagrams at teardown are released
+    rlpx_io_pool_set(&io, &pool);
+    IF_ERR_EXIT(rlpx_io_recv_udp(&io, b, l));
+    IF_ERR_EXIT(rlpx_io_recv_udp_queue(&io, b, l));
+    err = 0;
+EXIT:
+    io.protocols[0].context = NULL; // nothing to uninstall
+    rlpx_io_deinit(&io);
+    upool_deinit(&pool);
+    uecc_key_deinit(&skey);
+    return err;
+}
+
+int
+test_disc_offload_recv(void* ctx, const urlp* rlp)
+{
+    rlpx_io* io = ctx;
+    if (cmp_q(&io->node.id.q, &g_test_disc_offload_id)) return -1;
+    if (check_ping_v4(NULL, urlp_as_u32(urlp_at(rlp, 0)), urlp_at(rlp, 1))) {
+        return -1;
+    }
+    g_test_disc_offload_count++;
+    return 0;
+}
+
 int
 check_ping_v4(ktable* t, int type, const urlp* rlp)
 {
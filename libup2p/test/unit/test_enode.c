@@ -73,10 +73,10 @@ test_node()
     IF_ERR_EXIT(rlpx_node_init_enode(&node_failsz, failsz) ? 0 : -1);
     IF_ERR_EXIT(rlpx_node_init_enode(&node_failfmt, failfmt) ? 0 : -1);
     IF_ERR_EXIT(rlpx_node_init_enode(&node_alice, alice_pub));
-    IF_ERR_EXIT(cmp_q(&node_alice.id, rlpx_io_spub(s.alice)));
+    IF_ERR_EXIT(cmp_q(&node_alice.id.q, rlpx_io_spub(s.alice)));
     IF_ERR_EXIT((node_alice.port_tcp == 33) ? 0 : -1);
     IF_ERR_EXIT((node_alice.port_udp == 89) ? 0 : -1);
-    IF_ERR_EXIT(cmp_q(&node_maxok.id, rlpx_io_spub(s.alice)));
+    IF_ERR_EXIT(cmp_q(&node_maxok.id.q, rlpx_io_spub(s.alice)));
     IF_ERR_EXIT((node_maxok.port_tcp == 65535) ? 0 : -1);
     IF_ERR_EXIT((node_maxok.port_udp == 65535) ? 0 : -1);
 
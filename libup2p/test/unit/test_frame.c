@@ -20,6 +20,7 @@
  */
 
 #include "test.h"
+#include "rlpx_helper_macros.h"
 
 extern test_vector g_test_vectors[];
 extern const char* g_alice_epub;
@@ -31,6 +32,8 @@ extern const char* g_go_foo;
 
 int test_frame_read();
 int test_frame_write();
+int test_frame_seal();
+int ref_egress(rlpx_coder*, const uint8_t*, size_t, uint8_t*, uint8_t*);
 
 int
 test_frame()
@@ -38,6 +41,7 @@ test_frame()
     int err = 0;
     err |= test_frame_read();
     err |= test_frame_write();
+    err |= test_frame_seal();
     return err;
 }
 
@@ -171,3 +175,110 @@ EXIT:
     test_session_deinit(&s);
     return err;
 }
+
+int
+test_frame_seal()
+{
+    int err = 0;
+    test_session s;
+    rlpx_coder ref;
+    uint32_t lens[] = { 1, 15, 16, 17, 100, 500 }, l;
+    uint8_t plain[512], frame[600], expect[600], head[16], body[512];
+    uint8_t big[2007], frame_big[2064];
+    urlp* rlp = NULL;
+    size_t sz;
+
+    for (uint32_t i = 0; i < sizeof(plain); i++) plain[i] = (uint8_t)i;
+
+    test_session_init(&s, 1);
+    test_session_connect(&s);
+    test_session_handshake(&s);
+    ref = s.alice->x;
+
+    for (uint32_t n = 0; n < sizeof(lens) / sizeof(lens[0]); n++) {
+        // Reference multi pass egress
+        size_t len = AES_LEN(lens[n]);
+        memset(expect, 0, sizeof(expect));
+        WRITE_BE(3, expect, (uint8_t*)&lens[n]);
+        expect[3] = '\xc2', expect[4] = '\x80', expect[5] = '\x80';
+        memcpy(&expect[32], plain, lens[n]);
+        IF_ERR_EXIT(ref_egress(&ref, expect, 0, expect, &expect[16]));
+        IF_ERR_EXIT(ref_egress(
+            &ref, &expect[32], len, &expect[32], &expect[32 + len]));
+
+        // Fused egress must be bit exact
+        l = sizeof(frame);
+        err = rlpx_frame_write(&s.alice->x, 0, 0, plain, lens[n], frame, &l);
+        IF_ERR_EXIT(err);
+        IF_ERR_EXIT(l == 32 + len + 16 ? 0 : -1);
+        IF_ERR_EXIT(memcmp(frame, expect, l) ? -1 : 0);
+
+        // Fused ingress recovers plain text
+        sz = sizeof(body);
+        IF_ERR_EXIT(rlpx_coder_open(&s.bob->x, frame, l, head, body, &sz));
+        IF_ERR_EXIT(sz == lens[n] ? 0 : -1);
+        IF_ERR_EXIT(memcmp(body, plain, sz) ? -1 : 0);
+    }
+
+    // Tampered frame mac is rejected
+    l = sizeof(frame);
+    IF_ERR_EXIT(rlpx_frame_write(&s.alice->x, 0, 0, plain, 20, frame, &l));
+    frame[l - 1] ^= 0x01;
+    sz = sizeof(body);
+    IF_ERR_EXIT(rlpx_coder_open(&s.bob->x, frame, l, head, body, &sz) ? 0 : -1);
+
+    // ...and leaves the ingress stream as it was, so does a partial frame
+    frame[l - 1] ^= 0x01;
+    sz = sizeof(body);
+    err = rlpx_coder_open(&s.bob->x, frame, l - 1, head, body, &sz);
+    IF_ERR_EXIT(err == 1 ? 0 : -1);
+    IF_ERR_EXIT(sz == 32 ? 0 : -1);
+    IF_ERR_EXIT(rlpx_frame_parse(&s.bob->x, frame, 70, &rlp) == l ? 0 : -1);
+    sz = sizeof(body);
+    IF_ERR_EXIT(rlpx_coder_open(&s.bob->x, frame, l, head, body, &sz));
+    IF_ERR_EXIT(sz == 20 ? 0 : -1);
+    IF_ERR_EXIT(memcmp(body, plain, sz) ? -1 : 0);
+
+    // A body too big for the stack is parsed from a buffer of its own
+    l = sizeof(frame_big);
+    big[0] = 0xf9, big[1] = 0x07, big[2] = 0xd4, big[3] = 0x80;
+    big[4] = 0xb9, big[5] = 0x07, big[6] = 0xd0;
+    memset(&big[7], 0x55, 2000);
+    IF_ERR_EXIT(rlpx_frame_write(&s.alice->x, 0, 0, big, 2007, frame_big, &l));
+    IF_ERR_EXIT(rlpx_frame_parse(&s.bob->x, frame_big, l, &rlp) == l ? 0 : -1);
+    urlp_ref(urlp_at(urlp_at(rlp, 1), 1), &l);
+    IF_ERR_EXIT(l == 2000 ? 0 : -1);
+
+EXIT:
+    if (rlp) urlp_free(&rlp);
+    test_session_deinit(&s);
+    return err;
+}
+
+int
+ref_egress(
+    rlpx_coder* x,
+    const uint8_t* plain,
+    size_t xlen,
+    uint8_t* out,
+    uint8_t* mac)
+{
+    // Step by step egress as specified (if xlen == 0 plain is a header)
+    uint8_t xin[32], tmp[32];
+    memset(xin, 0, 32);
+    if (xlen) {
+        if (uaes_crypt_ctr_op(&x->aes, x->iv_enc, plain, xlen, out)) return -1;
+        ukeccak256_update(&x->emac, (uint8_t*)out, xlen);
+        ukeccak256_digest(&x->emac, xin);
+    } else {
+        if (uaes_crypt_ctr_op(&x->aes, x->iv_enc, plain, 16, out)) return -1;
+        memcpy(xin, out, 16);
+    }
+    ukeccak256_digest(&x->emac, tmp);
+    uaes_crypt_ecb_enc(&x->aes_mac, tmp, tmp);
+    XORN(tmp, xin, 16);
+    ukeccak256_update(&x->emac, tmp, 16);
+    ukeccak256_digest(&x->emac, tmp);
+    memcpy(mac, tmp, 16);
+    return 0;
+}
@@ -20,6 +20,14 @@
  */
 
 #include "test.h"
+#include "uecc_cache.h"
+#include "urand.h"
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+#include <pthread.h>
+#define TEST_HS_THREADS 8
+#define TEST_HS_LOOPS 8
+#endif
 
 extern test_vector g_test_vectors[];
 extern const char* g_alice_epub;
@@ -31,6 +39,20 @@ extern const char* g_foo;
 int test_read();
 int test_write();
 int test_secrets();
+int test_auth_bad_key();
+int test_handshake_threads();
+
+/**
+ * @brief Static keys shared by every thread of the stress test
+ */
+typedef struct
+{
+    uecc_ctx skey_a, skey_b; /*!< shared static keys (with ecdh cache) */
+    uecc_node_id id_a, id_b; /*!< their ids */
+} test_hs_shared;
+
+int test_hs_once(test_hs_shared* g);
+void* test_hs_thread(void* arg);
 
 int
 test_handshake()
@@ -39,6 +61,8 @@ test_handshake()
     IF_ERR_EXIT(test_read());
     IF_ERR_EXIT(test_write());
     IF_ERR_EXIT(test_secrets());
+    IF_ERR_EXIT(test_auth_bad_key());
+    IF_ERR_EXIT(test_handshake_threads());
 
 EXIT:
     return err;
@@ -86,6 +110,39 @@ EXIT:
     return err;
 }
 
+int
+test_auth_bad_key()
+{
+    int err = -1;
+    test_session s;
+    uint8_t q[64];
+    uint32_t l;
+    const uint8_t* b;
+    urlp *rlp = NULL, *bad = NULL;
+
+    test_session_init(&s, 1);
+    test_session_connect(&s);
+    if (rlpx_handshake_auth_recv(s.bob->hs, s.auth, s.authlen, &rlp)) {
+        goto EXIT;
+    }
+
+    // Same auth with a static key that is not on the curve
+    memset(q, 0xff, sizeof(q));
+    if (!(bad = urlp_list())) goto EXIT;
+    b = urlp_ref(urlp_at(rlp, 0), &l);
+    urlp_push(bad, urlp_item_u8_arr(b, l));
+    urlp_push(bad, urlp_item_u8_arr(q, sizeof(q)));
+    b = urlp_ref(urlp_at(rlp, 2), &l);
+    urlp_push(bad, urlp_item_u8_arr(b, l));
+    urlp_push(bad, urlp_item_u8(4));
+    err = rlpx_handshake_auth_install(s.bob->hs, &bad) ? 0 : -1;
+EXIT:
+    if (rlp) urlp_free(&rlp);
+    if (bad) urlp_free(&bad);
+    test_session_deinit(&s);
+    return err;
+}
+
 int
 test_secrets()
 {
@@ -111,6 +168,119 @@ EXIT:
     return err;
 }
 
+int
+test_hs_once(test_hs_shared* g)
+{
+    int err = -1;
+    uecc_ctx ekey_a, ekey_b;
+    h256 nonce_a, nonce_b;
+    rlpx_handshake *a = NULL, *b = NULL;
+    rlpx_coder xa, xb;
+    uaes_ctx aes, *aes_p;
+    uint8_t x[32], y[32], key[16], plain[64], c0[64], c1[64], iv[2][16];
+    urlp* rlp = NULL;
+
+    urand(nonce_a.b, 32);
+    urand(nonce_b.b, 32);
+    if (uecc_key_init_new(&ekey_a)) return -1;
+    if (uecc_key_init_new(&ekey_b)) goto EKEY;
+    a = rlpx_handshake_alloc(1, &g->skey_a, &ekey_a, &nonce_a, &g->id_b);
+    b = rlpx_handshake_alloc(0, &g->skey_b, &ekey_b, &nonce_b, &g->id_a);
+    if (!(a && b)) goto EXIT;
+
+    // bob reads alices auth, alice reads bobs ack
+    if (rlpx_handshake_auth_recv(b, a->cipher, a->cipher_len, &rlp)) goto EXIT;
+    err = rlpx_handshake_auth_install(b, &rlp);
+    urlp_free(&rlp);
+    if (err || (err = cmp_q(&b->ekey_remote, &ekey_a.Q))) goto EXIT;
+    err = -1;
+    if (rlpx_handshake_ack_recv(a, b->cipher, b->cipher_len, &rlp)) goto EXIT;
+    err = rlpx_handshake_ack_install(a, &rlp);
+    urlp_free(&rlp);
+    if (err || (err = cmp_q(&a->ekey_remote, &ekey_b.Q))) goto EXIT;
+
+    // Each side egress must be the other side ingress
+    rlpx_handshake_secrets(a, 1, &xa);
+    rlpx_handshake_secrets(b, 0, &xb);
+    ukeccak256_digest(&xa.emac, x);
+    ukeccak256_digest(&xb.imac, y);
+    err = memcmp(x, y, 32) ? -1 : 0;
+    ukeccak256_digest(&xa.imac, x);
+    ukeccak256_digest(&xb.emac, y);
+    if (!err) err = memcmp(x, y, 32) ? -1 : 0;
+    aes_p = &xa.aes, uaes_deinit(&aes_p);
+    aes_p = &xa.aes_mac, uaes_deinit(&aes_p);
+    aes_p = &xb.aes, uaes_deinit(&aes_p);
+    aes_p = &xb.aes_mac, uaes_deinit(&aes_p);
+
+    // One-shot aes on many threads must agree with a keyed context
+    urand(key, 16);
+    urand(plain, 64);
+    urand(iv[0], 16);
+    memcpy(iv[1], iv[0], 16);
+    uaes_crypt_ctr(128, key, iv[0], plain, 64, c0);
+    uaes_init_128(&aes, key);
+    uaes_crypt_ctr_op(&aes, iv[1], plain, 64, c1);
+    aes_p = &aes;
+    uaes_deinit(&aes_p);
+    if (!err) err = memcmp(c0, c1, 64) ? -1 : 0;
+
+EXIT:
+    if (a) rlpx_handshake_free(&a);
+    if (b) rlpx_handshake_free(&b);
+    uecc_key_deinit(&ekey_b);
+EKEY:
+    uecc_key_deinit(&ekey_a);
+    return err;
+}
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+void*
+test_hs_thread(void* arg)
+{
+    intptr_t err = 0;
+    for (int i = 0; i < TEST_HS_LOOPS && !err; i++) {
+        err = test_hs_once((test_hs_shared*)arg);
+    }
+    return (void*)err;
+}
+#endif
+
+int
+test_handshake_threads()
+{
+    int err = 0;
+    test_hs_shared g;
+    uecc_key_init_new(&g.skey_a);
+    uecc_key_init_new(&g.skey_b);
+    uecc_cache_init(&g.skey_a, 4);
+    uecc_cache_init(&g.skey_b, 4);
+    uecc_node_id_init(&g.id_a, &g.skey_a.Q);
+    uecc_node_id_init(&g.id_b, &g.skey_b.Q);
+
+#ifdef UCRYPTO_CONFIG_PTHREAD
+    // Many handshakes at once against the same static keys
+    pthread_t t[TEST_HS_THREADS];
+    void* ret;
+    int n = 0;
+    for (; n < TEST_HS_THREADS; n++) {
+        if (pthread_create(&t[n], NULL, test_hs_thread, &g)) break;
+    }
+    if (!(n == TEST_HS_THREADS)) err = -1;
+    while (n--) {
+        pthread_join(t[n], &ret);
+        if (ret) err = -1;
+    }
+    if (!err) err = g.skey_a.cache->hits ? 0 : -1;
+#else
+    err = test_hs_once(&g);
+#endif
+
+    uecc_key_deinit(&g.skey_a);
+    uecc_key_deinit(&g.skey_b);
+    return err;
+}
+
 //
 //
 //
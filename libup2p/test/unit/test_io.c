@@ -6,6 +6,7 @@
 
 // Expose private for test
 extern int rlpx_io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
+extern int rlpx_io_on_recv_ack(void* ctx, int err, uint8_t* b, uint32_t l);
 
 // Mock settings
 extern async_io_mock_settings g_io_mock_tcp_settings;
@@ -14,10 +15,32 @@ extern async_io_mock_settings g_io_mock_udp_settings;
 // Mock callbacks
 int test_mock_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
 int test_mock_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
+int test_mock_on_connect(void* ctx);
+int test_mock_sendv_part(usys_socket_fd* fd, const usys_iovec* v, uint32_t n);
+
+int test_io_tcp(void);
+int test_io_handshake(void);
+int test_io_accept(upool* pool);
+int test_io_ack_fail(upool* pool);
+int test_io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
 
 // Counter for pass/fail test
 uint32_t g_test_io_bytes_sent = 0;
 
+// Tcp wire (sendv writes at most TEST_SENDV_MAX per call)
+#define TEST_SENDV_MAX 700
+uint8_t g_test_wire[NUM_ROUNDS * TEST_SIZE];
+uint32_t g_test_wire_l = 0, g_test_wire_calls = 0;
+
+async_io_settings g_test_listen_settings = {.on_accept = test_io_on_accept };
+
+async_io_mock_settings g_io_mock_sendv_settings = { //
+    .connect = test_mock_connect,
+    .ready = test_mock_ready,
+    .close = test_mock_close,
+    .sendv = test_mock_sendv_part
+};
+
 int
 test_io()
 {
@@ -26,6 +49,7 @@ test_io()
     uint8_t b[TEST_SIZE];        // Transmitting tx
     uecc_ctx keys[2];            // alice/bob keys
     rlpx_io io[2];               // alice bob
+    rlpx_io_message* msg;        // encoded in place
     memset(b, 'A', TEST_SIZE);   // init vector
     uecc_key_init_new(&keys[0]); // alice key
     uecc_key_init_new(&keys[1]); // bob key
@@ -72,11 +96,25 @@ test_io()
     now = usys_now();
     while (async_io_state_busy(&io[0].io)) async_io_poll(&io[0].io);
 
-    // Make sure we sent all but not more than we allow for
-    if (!(g_test_io_bytes_sent == (NUM_ROUNDS * TEST_SIZE))) goto EXIT;
+    // Make sure we sent all but not more than we allow for (bytes count
+    // against the throttle until they are on the wire)
+    if (!(g_test_io_bytes_sent == ((NUM_ROUNDS - 1) * TEST_SIZE))) goto EXIT;
     if (!(io[0].outgoing_count == 0)) goto EXIT;
     if (!(io[0].outgoing_bytes == 0)) goto EXIT;
 
+    // Queued, never handed to the driver, then refreshed (test memleak)
+    rlpx_io_outgoing_throttle(io, 0);
+    for (c = 0; c < NUM_ROUNDS; c++) {
+        msg = rlpx_io_message_alloc(usys_atoh("127.0.0.1"), udp[1], TEST_SIZE);
+        if (!msg) goto EXIT;
+        memcpy(msg->b, b, TEST_SIZE);
+        if (rlpx_io_sendto_enqueue(&io[0], msg)) goto EXIT;
+    }
+    if (!(io[0].outgoing_count == NUM_ROUNDS)) goto EXIT;
+    rlpx_io_refresh(&io[0]);
+    if (!(io[0].outgoing == NULL && io[0].outgoing_count == 0)) goto EXIT;
+    if (!(io[0].outgoing_bytes == 0)) goto EXIT;
+
     // Flood transmit queue then shutdown (test memleak)
     for (c = 0; c < NUM_ROUNDS; c++) {
         rlpx_io_sendto(&io[0], usys_atoh("127.0.0.1"), udp[1], b, TEST_SIZE);
@@ -89,9 +127,142 @@ EXIT:
     uecc_key_deinit(&keys[1]);
     rlpx_io_deinit(&io[0]);
     rlpx_io_deinit(&io[1]);
+    return err ? err : test_io_tcp();
+}
+
+int
+test_io_tcp()
+{
+    int err = -1;
+    uint32_t c, port = 30303;
+    uint8_t b[TEST_SIZE];
+    uecc_ctx key;
+    rlpx_io io;
+    uecc_key_init_new(&key);
+    rlpx_io_tcp_init(&io, &key, &port);
+    async_io_install_mock(&io.io, &g_io_mock_sendv_settings);
+    io.io.on_connect = test_mock_on_connect; // no handshake
+    if (!(async_io_tcp_connect(&io.io, "127.0.0.1", port) > 0)) goto EXIT;
+
+    // Every message is queued by reference right away
+    for (c = 0; c < NUM_ROUNDS; c++) {
+        memset(b, 'A' + c, TEST_SIZE);
+        if (rlpx_io_send(&io, b, TEST_SIZE)) goto EXIT;
+    }
+    if (!(io.outgoing == NULL && io.outgoing_count == NUM_ROUNDS)) goto EXIT;
+
+    // Queue goes out in few calls, picking up where partial writes stop
+    while (async_io_state_send(&io.io)) async_io_poll(&io.io);
+    if (!(g_test_wire_l == NUM_ROUNDS * TEST_SIZE)) goto EXIT;
+    if (!(g_test_wire_calls == (g_test_wire_l / TEST_SENDV_MAX) + 1)) goto EXIT;
+    for (c = 0; c < NUM_ROUNDS * TEST_SIZE; c++) {
+        if (!(g_test_wire[c] == 'A' + c / TEST_SIZE)) goto EXIT;
+    }
+    if (!(io.outgoing_count == 0 && io.outgoing_bytes == 0)) goto EXIT;
+
+    // Queued then closed hands messages back (test memleak)
+    for (c = 0; c < NUM_ROUNDS; c++) rlpx_io_send(&io, b, TEST_SIZE);
+    async_io_close(&io.io);
+    if (!(io.outgoing_count == 0 && io.outgoing_bytes == 0)) goto EXIT;
+
+    err = 0;
+EXIT:
+    rlpx_io_deinit(&io);
+    uecc_key_deinit(&key);
+    return err ? err : test_io_handshake();
+}
+
+int
+test_io_handshake()
+{
+    int err = 0;
+    upool pool;
+    upool_init(&pool, 2);
+    err |= test_io_accept(NULL);
+    err |= test_io_accept(&pool);
+    err |= test_io_ack_fail(NULL);
+    err |= test_io_ack_fail(&pool);
+    upool_deinit(&pool);
+    return err;
+}
+
+int
+test_io_accept(upool* pool)
+{
+    int err = -1;
+    uint32_t port = 30310, c;
+    uecc_ctx keys[2]; // alice/bob keys
+    rlpx_io io[2];    // alice dials, bob is accepted
+    uecc_node_id id;
+    async_io listener;
+    async_io_loop loop;
+    uecc_key_init_new(&keys[0]);
+    uecc_key_init_new(&keys[1]);
+    uecc_node_id_init(&id, &keys[0].Q);
+    async_io_loop_init_backend(&loop, ASYNC_IO_BACKEND_EPOLL);
+    async_io_tcp_init(&listener, &g_test_listen_settings, &io[1]);
+    for (c = 0; c < 2; c++) {
+        rlpx_io_tcp_init(&io[c], &keys[c], &port);
+        rlpx_io_devp2p_install(&io[c]);
+        rlpx_io_pool_set(&io[c], pool);
+        async_io_loop_add(&loop, &io[c].io);
+    }
+    if (async_io_tcp_listen(&listener, port, 0)) goto EXIT;
+    if (async_io_loop_add(&loop, &listener)) goto EXIT;
+
+    // Bob never heard of alice, her auth tells him who she is
+    if (rlpx_io_connect(&io[0], &keys[1].Q, usys_atoh("127.0.0.1"), port)) {
+        goto EXIT;
+    }
+    for (c = 0; c < 100; c++) {
+        if (rlpx_io_is_ready(&io[0]) && rlpx_io_is_ready(&io[1])) break;
+        async_io_loop_poll(&loop, 10);
+        upool_poll(pool);
+    }
+    if (!(rlpx_io_is_ready(&io[0]) && rlpx_io_is_ready(&io[1]))) goto EXIT;
+    if (uecc_node_id_cmp(&io[1].node.id, &id)) goto EXIT;
+
+    err = 0;
+EXIT:
+    rlpx_io_deinit(&io[0]);
+    rlpx_io_deinit(&io[1]);
+    async_io_deinit(&listener);
+    async_io_loop_deinit(&loop);
+    uecc_key_deinit(&keys[0]);
+    uecc_key_deinit(&keys[1]);
+    return err;
+}
+
+int
+test_io_ack_fail(upool* pool)
+{
+    int err = -1;
+    uint8_t junk[300];
+    test_session s;
+    memset(junk, 0x5a, sizeof(junk));
+    if (test_session_init(&s, 0)) goto EXIT;
+    test_session_connect(&s);
+    rlpx_io_pool_set(s.alice, pool);
+
+    // A bad ack errors the io, the next frame is not taken for an ack
+    rlpx_io_on_recv_ack(s.alice, 0, junk, sizeof(junk));
+    upool_flush(pool);
+    if (!(rlpx_io_error_get(s.alice) && s.alice->pending == 0)) goto EXIT;
+    if (!(s.alice->hs && !s.alice->job_hs)) goto EXIT;
+    if (s.alice->io.on_recv == rlpx_io_on_recv_ack) goto EXIT;
+
+    err = 0;
+EXIT:
+    test_session_deinit(&s);
     return err;
 }
 
+int
+test_io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    return rlpx_io_accept(ctx, s, addr);
+}
+
 int
 test_mock_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
 {
@@ -114,3 +285,27 @@ test_mock_on_send(void* ctx, int err, const uint8_t* b, uint32_t l)
     g_test_io_bytes_sent += l;
     return 0;
 }
+
+int
+test_mock_on_connect(void* ctx)
+{
+    ((void)ctx);
+    return 0;
+}
+
+int
+test_mock_sendv_part(usys_socket_fd* fd, const usys_iovec* v, uint32_t n)
+{
+    uint32_t sent = 0, l;
+    ((void)fd);
+    g_test_wire_calls++;
+    for (uint32_t i = 0; i < n && sent < TEST_SENDV_MAX; i++) {
+        l = v[i].iov_len;
+        if (l > TEST_SENDV_MAX - sent) l = TEST_SENDV_MAX - sent;
+        if (g_test_wire_l + l > sizeof(g_test_wire)) return -1;
+        memcpy(&g_test_wire[g_test_wire_l], v[i].iov_base, l);
+        g_test_wire_l += l;
+        sent += l;
+    }
+    return sent;
+}
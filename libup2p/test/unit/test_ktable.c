@@ -28,6 +28,7 @@ uint32_t g_test_ktable_want_find_count = 0;
 uint32_t g_test_ktable_want_ping_count = 0;
 
 uecc_ctx g_ktable_test_keys[KTABLE_N_NODES + 1];
+uecc_node_id g_ktable_test_ids[KTABLE_N_NODES + 1];
 
 ktable_settings g_ktable_settings = {
     .refresh = 300,                     // short interval for testing
@@ -48,6 +49,7 @@ test_ktable()
     // Setup test input
     for (int i = 0; i < KTABLE_N_NODES + 1; i++) {
         uecc_key_init_new(&g_ktable_test_keys[i]);
+        uecc_node_id_init(&g_ktable_test_ids[i], &g_ktable_test_keys[i].Q);
     }
 
     err |= test_ktable_storage();
@@ -65,41 +67,52 @@ test_ktable_storage()
 {
     int err = 0, size;
     ktable table;
-    ktable_init(&table, &g_ktable_settings, NULL);
+    if (ktable_init(&table, &g_ktable_settings, NULL)) return -1;
     uint8_t puba[65], pubb[65];
     knodes* node = NULL;
 
     // Insert the same node confirm table doesnt grow
     for (int i = 0; i < 10; i++) {
-        ktable_insert(&table, &g_ktable_test_keys[0].Q, i, i, i, NULL);
+        ktable_insert(&table, &g_ktable_test_ids[0], i, i, i, NULL);
     }
     err |= knodes_size(table.nodes, KTABLE_N_NODES) == 1 ? 0 : -1;
 
     // Make sure no overflow
     for (int i = 0; i < KTABLE_N_NODES + 1; i++) {
-        ktable_insert(&table, &g_ktable_test_keys[i].Q, i, i, i, NULL);
+        ktable_insert(&table, &g_ktable_test_ids[i], i, i, i, NULL);
     }
     err |= knodes_size(table.nodes, KTABLE_N_NODES) == KTABLE_N_NODES ? 0 : -1;
 
     // Access keys
     for (int i = 0; i < KTABLE_N_NODES; i++) {
-        node = ktable_get(&table, &g_ktable_test_keys[i].Q);
+        node = ktable_get(&table, &g_ktable_test_ids[i]);
         if (!node) {
             err |= -1;
         } else {
-            uecc_qtob(&node->nodeid, puba, 65);
+            uecc_qtob(&node->nodeid.q, puba, 65);
             uecc_qtob(&g_ktable_test_keys[i].Q, pubb, 65);
             err |= memcmp(puba, pubb, 65) ? -1 : 0;
+            err |= uecc_node_id_cmp(&node->nodeid, &g_ktable_test_ids[i]);
         }
     }
 
     // Test remove
     for (int i = 0; i < 2; i++) {
-        ktable_remove(&table, &g_ktable_test_keys[i].Q);
+        ktable_remove(&table, &g_ktable_test_ids[i]);
     }
     size = knodes_size(table.nodes, KTABLE_N_NODES);
     err |= size == KTABLE_N_NODES - 2 ? 0 : -1;
 
+    // Probe chains survive removal
+    for (int i = 0; i < KTABLE_N_NODES; i++) {
+        node = ktable_get(&table, &g_ktable_test_ids[i]);
+        err |= (i < 2) == (node == NULL) ? 0 : -1;
+    }
+
+    // Removed slots are reused
+    ktable_insert(&table, &g_ktable_test_ids[KTABLE_N_NODES], 1, 1, 1, NULL);
+    err |= ktable_get(&table, &g_ktable_test_ids[KTABLE_N_NODES]) ? 0 : -1;
+
     // Free
     ktable_deinit(&table);
     return err;
@@ -109,11 +122,11 @@ int
 test_ktable_maintenance()
 {
     int err = 0, size;
-    uint32_t tick = 0;
+    int64_t tick = 0;
     ktable table;
 
     // Init table
-    ktable_init(&table, &g_ktable_settings, NULL);
+    if (ktable_init(&table, &g_ktable_settings, NULL)) return -1;
 
     // Make sure pings will clear table:
     // Fill table,
@@ -123,11 +136,11 @@ test_ktable_maintenance()
     // Size should equal half
     g_test_ktable_want_ping_count = 0;
     for (int i = 0; i < KTABLE_N_NODES; i++) {
-        ktable_insert(&table, &g_ktable_test_keys[i].Q, i, i, i, NULL);
-        ktable_ping(&table, &g_ktable_test_keys[i].Q);
+        ktable_insert(&table, &g_ktable_test_ids[i], i, i, i, NULL);
+        ktable_ping(&table, &g_ktable_test_ids[i]);
     }
     for (uint32_t i = 0; i < KTABLE_N_NODES; i++) {
-        if (!(i % 2)) ktable_on_pong(&table, &g_ktable_test_keys[i].Q, i, i, i);
+        if (!(i % 2)) ktable_on_pong(&table, &g_ktable_test_ids[i], i, i, i);
     }
     usys_msleep(table.settings.pong_timeout + 1);
     ktable_poll(&table);
@@ -171,7 +184,7 @@ test_ktable_maintenance()
     int err = 0;
     uint32_t tick = 0;
     ktable table;
-    ktable_init(&table, &g_ktable_settings, NULL);
+    if (ktable_init(&table, &g_ktable_settings, NULL)) return -1;
 
     // Reset counters for test
     g_test_ktable_want_ping_count = 0;
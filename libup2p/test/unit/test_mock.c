@@ -47,10 +47,15 @@ async_io_mock_settings g_io_mock_udp_settings = { //
 };
 
 int
-test_mock_connect(usys_socket_fd* fd, const char* host, int port)
+test_mock_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags)
 {
     ((void)host);
     ((void)port);
+    ((void)flags);
     static int sock = 0;       // 0 is a valid socket.
     if (*fd >= 0) return -1;   // err already connect
     if (sock >= 10) return -1; // out of test sockets
@@ -51,6 +51,10 @@ test_protocol()
         &lenb);
     IF_ERR_EXIT(err);
     IF_ERR_EXIT(rlpx_io_recv(s.alice, buffb, lenb));
+
+    // A frame cut short is left in the io until the rest of it arrives
+    IF_ERR_EXIT(rlpx_io_recv(s.bob, buffa, lena - 1));
+    IF_ERR_EXIT(s.bob->io.keep == lena - 1 ? 0 : -1);
     IF_ERR_EXIT(rlpx_io_recv(s.bob, buffa, lena));
 
     // Disconnect
@@ -0,0 +1,269 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usim.h"
+#include "usys_log.h"
+#include "usys_time.h"
+
+/**
+ * @brief What a test io saw
+ */
+typedef struct
+{
+    async_io_loop* loop; /*!< accepted io join this loop */
+    async_io* accepted;  /*!< io for the next accepted socket */
+    uint32_t connects;   /*!< on_connect */
+    uint32_t errors;     /*!< on_erro */
+    uint32_t recv;       /*!< bytes received */
+    uint32_t from;       /*!< last sender (ip) */
+} test_peer;
+
+int test_datagram(void);
+int test_stream(void);
+int test_refused(void);
+
+int sim_on_connect(void* ctx);
+int sim_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
+int sim_on_erro(void* ctx);
+int sim_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
+int sim_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+
+async_io_settings g_sim_settings = { //
+    .on_connect = sim_on_connect,
+    .on_accept = sim_on_accept,
+    .on_erro = sim_on_erro,
+    .on_send = sim_on_send,
+    .on_recv = sim_on_recv
+};
+
+usim_link g_sim_link = { .latency = 50, .jitter = 0, .bandwidth = 0 };
+
+int
+main(int argc, char* argv[])
+{
+    ((void)argc);
+    ((void)argv);
+    int err = 0;
+    err |= test_datagram();
+    err |= test_stream();
+    err |= test_refused();
+    if (err) {
+        usys_log_err("%s", "[ERR]");
+    } else {
+        usys_log_ok("%s", "[ OK]");
+    }
+    return err;
+}
+
+int
+test_datagram(void)
+{
+    int err = -1;
+    usim sim;
+    usim_link link = g_sim_link;
+    async_io_loop loop;
+    async_io a, b;
+    test_peer pa = { 0 }, pb = { 0 };
+
+    link.bandwidth = 1000; // 1 byte per ms
+    if (usim_init(&sim, 2, &link, 1)) return -1;
+    async_io_loop_init_backend(&loop, ASYNC_IO_BACKEND_MOCK);
+    usim_host_set(&sim, 0);
+    async_io_udp_init(&a, &g_sim_settings, &pa);
+    if (async_io_udp_listen(&a, 30303)) goto EXIT;
+    usim_host_set(&sim, 1);
+    async_io_udp_init(&b, &g_sim_settings, &pb);
+    if (async_io_udp_listen(&b, 30303)) goto EXIT;
+    async_io_loop_add(&loop, &a);
+    async_io_loop_add(&loop, &b);
+
+    // Virtual time drives the io clock
+    if (!(usys_tick() == 0)) goto EXIT;
+
+    // 10 bytes take 10ms on the uplink, then 50ms on the link
+    async_io_print(&b, 0, "0123456789");
+    if (async_io_udp_send(&b, usim_ip(0), 30303)) goto EXIT;
+    async_io_loop_poll(&loop, 0);
+    if (!(usim_next(&sim) == 60)) goto EXIT;
+    usim_run(&sim, 59);
+    async_io_loop_poll(&loop, 0);
+    if (!(pa.recv == 0 && usys_tick() == 59)) goto EXIT;
+    usim_run(&sim, 60);
+    async_io_loop_poll(&loop, 0);
+    if (!(pa.recv == 10 && a.addr.ip == usim_ip(1))) goto EXIT;
+
+    // Nobody on the port
+    async_io_print(&a, 0, "hello");
+    if (async_io_udp_send(&a, usim_ip(1), 30304)) goto EXIT;
+    async_io_loop_poll(&loop, 0);
+    usim_run(&sim, usim_next(&sim));
+    if (!(sim.stats.unroutable == 1 && usim_next(&sim) == USIM_NONE)) {
+        goto EXIT;
+    }
+
+    // Every datagram lost
+    sim.link.loss = 10000;
+    async_io_print(&a, 0, "hello");
+    if (async_io_udp_send(&a, usim_ip(1), 30303)) goto EXIT;
+    async_io_loop_poll(&loop, 0);
+    if (!(sim.stats.lost == 1 && usim_next(&sim) == USIM_NONE)) goto EXIT;
+    err = 0;
+EXIT:
+    async_io_deinit(&a);
+    async_io_deinit(&b);
+    async_io_loop_deinit(&loop);
+    usim_deinit(&sim);
+    return err;
+}
+
+int
+test_stream(void)
+{
+    int err = -1;
+    usim sim;
+    async_io_loop loop;
+    async_io listener, server, client;
+    test_peer ps = { .loop = &loop, .accepted = &server }, pc = { 0 };
+
+    if (usim_init(&sim, 2, &g_sim_link, 1)) return -1;
+    async_io_loop_init_backend(&loop, ASYNC_IO_BACKEND_MOCK);
+    async_io_tcp_init(&server, &g_sim_settings, &ps);
+    usim_host_set(&sim, 0);
+    async_io_tcp_init(&listener, &g_sim_settings, &ps);
+    if (async_io_tcp_listen(&listener, 30303, 0)) goto EXIT;
+    async_io_loop_add(&loop, &listener);
+    usim_host_set(&sim, 1);
+    async_io_tcp_init(&client, &g_sim_settings, &pc);
+    if (async_io_tcp_connect(&client, "10.0.0.1", 30303) < 0) goto EXIT;
+    async_io_loop_add(&loop, &client);
+
+    // Accepted after one trip, connected after two
+    usim_run(&sim, 50);
+    async_io_loop_poll(&loop, 0);
+    if (!(ps.connects == 1 && ps.from == usim_ip(1) && pc.connects == 0)) {
+        goto EXIT;
+    }
+    usim_run(&sim, 100);
+    async_io_loop_poll(&loop, 0);
+    if (!(pc.connects == 1 && sim.stats.accepted == 1)) goto EXIT;
+
+    // Bytes in order, in one trip
+    async_io_print(&client, 0, "%s", "hello");
+    if (async_io_tcp_send(&client)) goto EXIT;
+    async_io_loop_poll(&loop, 0);
+    usim_run(&sim, 150);
+    async_io_loop_poll(&loop, 0);
+    if (!(ps.recv == 5)) goto EXIT;
+
+    // Closing one end ends the other
+    async_io_close(&client);
+    usim_run(&sim, 200);
+    async_io_loop_poll(&loop, 0);
+    if (!(ps.errors == 1)) goto EXIT;
+    err = 0;
+EXIT:
+    async_io_deinit(&client);
+    async_io_deinit(&server);
+    async_io_deinit(&listener);
+    async_io_loop_deinit(&loop);
+    usim_deinit(&sim);
+    return err;
+}
+
+int
+test_refused(void)
+{
+    int err = -1;
+    usim sim;
+    async_io_loop loop;
+    async_io client;
+    test_peer pc = { 0 };
+
+    if (usim_init(&sim, 2, &g_sim_link, 1)) return -1;
+    async_io_loop_init_backend(&loop, ASYNC_IO_BACKEND_MOCK);
+    usim_host_set(&sim, 1);
+    async_io_tcp_init(&client, &g_sim_settings, &pc);
+    if (async_io_tcp_connect(&client, "10.0.0.1", 30303) < 0) goto EXIT;
+    async_io_loop_add(&loop, &client);
+
+    // Reset comes back after a round trip, the io closes
+    usim_run(&sim, usim_next(&sim));
+    usim_run(&sim, usim_next(&sim));
+    async_io_loop_poll(&loop, 0);
+    if (!(sim.now == 100 && sim.stats.refused == 1 && //
+          !async_io_has_sock(&client))) {
+        goto EXIT;
+    }
+    err = 0;
+EXIT:
+    async_io_deinit(&client);
+    async_io_loop_deinit(&loop);
+    usim_deinit(&sim);
+    return err;
+}
+
+int
+sim_on_connect(void* ctx)
+{
+    ((test_peer*)ctx)->connects++;
+    return 0;
+}
+
+int
+sim_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    test_peer* p = ctx;
+    p->connects++;
+    p->from = addr->ip;
+    async_io_tcp_accept(p->accepted, s, addr);
+    async_io_loop_add(p->loop, p->accepted);
+    return 0;
+}
+
+int
+sim_on_erro(void* ctx)
+{
+    ((test_peer*)ctx)->errors++;
+    return 0;
+}
+
+int
+sim_on_send(void* ctx, int err, const uint8_t* b, uint32_t l)
+{
+    ((void)ctx);
+    ((void)b);
+    ((void)l);
+    return err;
+}
+
+int
+sim_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    test_peer* p = ctx;
+    ((void)err);
+    ((void)b);
+    p->recv += l;
+    return 0;
+}
+
+//
+//
+//
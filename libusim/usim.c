@@ -0,0 +1,762 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usim.h"
+#include "usys_time.h"
+
+typedef enum {
+    USIM_SOCK_FREE = 0,
+    USIM_SOCK_DGRAM = 1,
+    USIM_SOCK_LISTEN = 2,
+    USIM_SOCK_STREAM = 3
+} USIM_SOCK;
+
+typedef enum {
+    USIM_CONN_CONNECTING = 0,
+    USIM_CONN_ESTABLISHED = 1,
+    USIM_CONN_REFUSED = 2,
+    USIM_CONN_EOF = 3 /*!< peer closed */
+} USIM_CONN;
+
+typedef enum {
+    USIM_MSG_DGRAM = 0,  /*!< routed by address on delivery */
+    USIM_MSG_SYN = 1,    /*!< routed by address, then accept queue */
+    USIM_MSG_SYNACK = 2, /*!< connect completes */
+    USIM_MSG_RST = 3,    /*!< connect refused */
+    USIM_MSG_FIN = 4,    /*!< peer closed */
+    USIM_MSG_DATA = 5    /*!< stream bytes */
+} USIM_MSG;
+
+struct usim_msg
+{
+    usim_msg* next;     /*!< receive queue link */
+    int64_t at;         /*!< delivery (ms) */
+    uint32_t seq;       /*!< send order */
+    uint32_t kind;      /*!< USIM_MSG */
+    int32_t src;        /*!< sending socket */
+    uint32_t src_gen;   /*!< of src */
+    int32_t dst;        /*!< receiving socket (accepted socket for SYN) */
+    uint32_t dst_gen;   /*!< of dst */
+    usys_sockaddr from; /*!< sender address */
+    usys_sockaddr to;   /*!< destination address */
+    uint32_t l;         /*!< size of b */
+    byte b[];           /*!< payload */
+};
+
+struct usim_sock
+{
+    uint32_t type;            /*!< USIM_SOCK (free when 0) */
+    uint32_t state;           /*!< USIM_CONN (streams) */
+    uint32_t gen;             /*!< bumps on close, tells stale messages */
+    uint32_t host;            /*!< owner */
+    uint32_t flags;           /*!< USYS_LISTEN_... */
+    int32_t next;             /*!< bound list of host, or free list */
+    int32_t peer;             /*!< other end (streams) */
+    uint32_t peer_gen;        /*!< of peer */
+    int64_t last;             /*!< latest delivery sent (keeps order) */
+    usys_sockaddr addr;       /*!< local address */
+    usys_sockaddr peer_addr;  /*!< remote address (streams) */
+    usim_msg *rx, *rx_last;   /*!< delivered, datagrams or accept queue */
+    uint32_t rx_off;          /*!< bytes of rx read (streams) */
+};
+
+// private
+int64_t usim_clock(void* ctx);
+uint32_t usim_rand(usim* sim);
+int32_t usim_sock_alloc(usim* sim, uint32_t type, uint32_t host);
+void usim_sock_free(usim* sim, int32_t fd);
+void usim_sock_bind(usim* sim, int32_t fd);
+void usim_sock_unbind(usim* sim, int32_t fd);
+usim_sock* usim_sock_get(usim* sim, usys_socket_fd* fd);
+usim_sock* usim_sock_live(usim* sim, int32_t fd, uint32_t gen);
+int32_t usim_route(usim* sim, uint32_t type, const usys_sockaddr* to);
+int usim_bind(usim*, int32_t fd, int port, uint32_t flags);
+usim_msg* usim_msg_alloc(uint32_t kind, int32_t src, uint32_t l);
+int usim_send(usim* sim, usim_msg* msg);
+void usim_deliver(usim* sim, usim_msg* msg);
+void usim_enqueue(usim* sim, usim_sock* s, usim_msg* msg);
+void usim_reply(usim* sim, usim_msg* msg, uint32_t kind, int32_t src);
+void usim_heap_push(usim* sim, usim_msg* msg);
+usim_msg* usim_heap_pop(usim* sim);
+int usim_heap_less(usim_msg* a, usim_msg* b);
+
+// mock sockets
+int usim_listen_udp(usys_socket_fd* fd, int port, uint32_t flags);
+int usim_listen_tcp(usys_socket_fd* fd, int port, uint32_t flags);
+int usim_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags);
+int usim_ready(usys_socket_fd* fd);
+int usim_accept(usys_socket_fd*, usys_socket_fd*, usys_sockaddr*, uint32_t);
+int usim_pending(usys_socket_fd* fd);
+void usim_close(usys_socket_fd* fd);
+int usim_stream_send(usys_socket_fd* fd, const byte* b, uint32_t l);
+int usim_stream_sendv(usys_socket_fd* fd, const usys_iovec* v, uint32_t n);
+int usim_stream_recv(usys_socket_fd* fd, byte* b, uint32_t l);
+int usim_sendto(usys_socket_fd*, const byte*, uint32_t, usys_sockaddr*);
+int usim_recvfrom(usys_socket_fd*, byte*, uint32_t, usys_sockaddr*);
+
+usim* g_usim = NULL; /*!< simulation the mock sockets belong to */
+
+async_io_mock_settings g_usim_tcp = { //
+    .connect = usim_connect,
+    .ready = usim_ready,
+    .accept = usim_accept,
+    .listen = usim_listen_tcp,
+    .pending = usim_pending,
+    .close = usim_close,
+    .send = usim_stream_send,
+    .sendv = usim_stream_sendv,
+    .recv = usim_stream_recv
+};
+
+async_io_mock_settings g_usim_udp = { //
+    .listen = usim_listen_udp,
+    .pending = usim_pending,
+    .close = usim_close,
+    .sendto = usim_sendto,
+    .recvfrom = usim_recvfrom
+};
+
+int
+usim_init(usim* sim, uint32_t hosts, const usim_link* link, uint32_t seed)
+{
+    memset(sim, 0, sizeof(usim));
+    sim->link = *link;
+    sim->rng = seed ? seed : 1;
+    sim->free = -1;
+    sim->nhost = hosts;
+    sim->hosts = usys_malloc(hosts * sizeof(usim_host));
+    if (!sim->hosts) return -1;
+    for (uint32_t i = 0; i < hosts; i++) {
+        sim->hosts[i].tx = 0;
+        sim->hosts[i].bound = -1;
+        sim->hosts[i].port = USIM_PORT_EPHEMERAL;
+        sim->hosts[i].woken = 0;
+    }
+    g_usim = sim;
+    async_io_install_mock_default(&g_usim_tcp, &g_usim_udp);
+    usys_clock_set(usim_clock, sim);
+    return 0;
+}
+
+void
+usim_deinit(usim* sim)
+{
+    usim_msg* msg;
+    usys_clock_set(NULL, NULL);
+    async_io_install_mock_default(NULL, NULL);
+    while ((msg = usim_heap_pop(sim))) usys_free(msg);
+    for (uint32_t i = 0; i < sim->nsock; i++) {
+        while ((msg = sim->socks[i].rx)) {
+            sim->socks[i].rx = msg->next;
+            usys_free(msg);
+        }
+    }
+    usys_free(sim->heap);
+    usys_free(sim->socks);
+    usys_free(sim->hosts);
+    if (g_usim == sim) g_usim = NULL;
+}
+
+void
+usim_host_set(usim* sim, uint32_t host)
+{
+    sim->host = host;
+}
+
+int64_t
+usim_next(usim* sim)
+{
+    return sim->nheap ? sim->heap[0]->at : USIM_NONE;
+}
+
+uint32_t
+usim_run(usim* sim, int64_t until)
+{
+    uint32_t n = 0;
+    while (sim->nheap && sim->heap[0]->at <= until) {
+        usim_msg* msg = usim_heap_pop(sim);
+        if (msg->at > sim->now) sim->now = msg->at;
+        usim_deliver(sim, msg);
+        n++;
+    }
+    if (until > sim->now) sim->now = until;
+    return n;
+}
+
+int64_t
+usim_clock(void* ctx)
+{
+    return ((usim*)ctx)->now;
+}
+
+uint32_t
+usim_rand(usim* sim)
+{
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return sim->rng = x;
+}
+
+int32_t
+usim_sock_alloc(usim* sim, uint32_t type, uint32_t host)
+{
+    int32_t fd = sim->free;
+    uint32_t n;
+    usim_sock *socks, *s;
+    if (fd < 0) {
+        // Grow, new sockets go on the free list in fd order
+        n = sim->nsock ? sim->nsock * 2 : 64;
+        socks = usys_malloc(n * sizeof(usim_sock));
+        if (!socks) return -1;
+        if (sim->nsock) {
+            memcpy(socks, sim->socks, sim->nsock * sizeof(usim_sock));
+        }
+        usys_free(sim->socks);
+        memset(&socks[sim->nsock], 0, (n - sim->nsock) * sizeof(usim_sock));
+        for (uint32_t i = n; i-- > sim->nsock;) {
+            socks[i].next = sim->free;
+            sim->free = i;
+        }
+        sim->socks = socks;
+        sim->nsock = n;
+        fd = sim->free;
+    }
+    s = &sim->socks[fd];
+    sim->free = s->next;
+    s->type = type;
+    s->state = USIM_CONN_CONNECTING;
+    s->host = host;
+    s->flags = 0;
+    s->next = s->peer = -1;
+    s->peer_gen = 0;
+    s->last = 0;
+    s->addr.ip = usim_ip(host);
+    s->addr.port = 0;
+    s->peer_addr.ip = s->peer_addr.port = 0;
+    s->rx = s->rx_last = NULL;
+    s->rx_off = 0;
+    return fd;
+}
+
+void
+usim_sock_free(usim* sim, int32_t fd)
+{
+    usim_sock* s = &sim->socks[fd];
+    usim_msg* msg;
+    usim_sock_unbind(sim, fd);
+    while ((msg = s->rx)) {
+        s->rx = msg->next;
+        usys_free(msg);
+    }
+    s->type = USIM_SOCK_FREE;
+    s->gen++;
+    s->next = sim->free;
+    sim->free = fd;
+}
+
+void
+usim_sock_bind(usim* sim, int32_t fd)
+{
+    usim_host* h = &sim->hosts[sim->socks[fd].host];
+    sim->socks[fd].next = h->bound;
+    h->bound = fd;
+}
+
+void
+usim_sock_unbind(usim* sim, int32_t fd)
+{
+    int32_t* p = &sim->hosts[sim->socks[fd].host].bound;
+    while (*p >= 0 && !(*p == fd)) p = &sim->socks[*p].next;
+    if (*p == fd) *p = sim->socks[fd].next;
+    sim->socks[fd].next = -1;
+}
+
+usim_sock*
+usim_sock_get(usim* sim, usys_socket_fd* fd)
+{
+    if (!sim || *fd < 0 || (uint32_t)*fd >= sim->nsock) return NULL;
+    return sim->socks[*fd].type ? &sim->socks[*fd] : NULL;
+}
+
+usim_sock*
+usim_sock_live(usim* sim, int32_t fd, uint32_t gen)
+{
+    if (fd < 0 || !(sim->socks[fd].gen == gen)) return NULL;
+    return sim->socks[fd].type ? &sim->socks[fd] : NULL;
+}
+
+int32_t
+usim_route(usim* sim, uint32_t type, const usys_sockaddr* to)
+{
+    // Sockets sharing a port (USYS_LISTEN_REUSEPORT) take turns at random
+    int32_t fd, pick = -1;
+    uint32_t n = 0, host = to->ip - USIM_NET;
+    if (!(to->ip >= USIM_NET && host < sim->nhost)) return -1;
+    for (fd = sim->hosts[host].bound; fd >= 0; fd = sim->socks[fd].next) {
+        if (!(sim->socks[fd].type == type && //
+              sim->socks[fd].addr.port == to->port)) {
+            continue;
+        }
+        if (!(usim_rand(sim) % ++n)) pick = fd;
+    }
+    return pick;
+}
+
+int
+usim_bind(usim* sim, int32_t fd, int port, uint32_t flags)
+{
+    usim_sock* s = &sim->socks[fd];
+    usim_host* h = &sim->hosts[s->host];
+    int32_t other;
+    if (!port) port = h->port++;
+    for (other = h->bound; other >= 0; other = sim->socks[other].next) {
+        if (sim->socks[other].type == s->type &&
+            sim->socks[other].addr.port == (uint32_t)port &&
+            !(flags & sim->socks[other].flags & USYS_LISTEN_REUSEPORT)) {
+            return -1; // in use
+        }
+    }
+    s->addr.port = port;
+    s->flags = flags;
+    usim_sock_bind(sim, fd);
+    return 0;
+}
+
+usim_msg*
+usim_msg_alloc(uint32_t kind, int32_t src, uint32_t l)
+{
+    usim_msg* msg = usys_malloc(sizeof(usim_msg) + l);
+    if (msg) {
+        msg->next = NULL;
+        msg->kind = kind;
+        msg->src = src;
+        msg->dst = -1;
+        msg->l = l;
+    }
+    return msg;
+}
+
+int
+usim_send(usim* sim, usim_msg* msg)
+{
+    // Uplink of the sender serializes, then the link delays
+    usim_sock* s = &sim->socks[msg->src];
+    usim_host* h = &sim->hosts[s->host];
+    int64_t now = sim->now * 1000, at;
+    if (sim->link.bandwidth) {
+        if (h->tx < now) h->tx = now;
+        h->tx += (int64_t)msg->l * 1000000 / sim->link.bandwidth;
+        now = h->tx;
+    }
+    at = (now + 999) / 1000 + sim->link.latency;
+    if (sim->link.jitter) at += usim_rand(sim) % (sim->link.jitter + 1);
+    if (!(msg->kind == USIM_MSG_DGRAM)) {
+        // A stream arrives in order
+        if (at < s->last) at = s->last;
+        s->last = at;
+    }
+    msg->at = at;
+    msg->seq = sim->seq++;
+    msg->src_gen = s->gen;
+    msg->from = s->addr;
+    usim_heap_push(sim, msg);
+    return sim->nheap ? 0 : -1;
+}
+
+void
+usim_deliver(usim* sim, usim_msg* msg)
+{
+    usim_sock *s = NULL, *l;
+    int32_t fd;
+    if (msg->kind == USIM_MSG_DGRAM) {
+        fd = usim_route(sim, USIM_SOCK_DGRAM, &msg->to);
+        if (fd < 0) {
+            sim->stats.unroutable++;
+        } else {
+            sim->stats.bytes += msg->l;
+            usim_enqueue(sim, &sim->socks[fd], msg);
+            return;
+        }
+    } else if (msg->kind == USIM_MSG_SYN) {
+        fd = usim_route(sim, USIM_SOCK_LISTEN, &msg->to);
+        if (fd < 0 || (msg->dst = usim_sock_alloc(
+                           sim, USIM_SOCK_STREAM, sim->socks[fd].host)) < 0) {
+            sim->stats.refused++;
+            usim_reply(sim, msg, USIM_MSG_RST, -1);
+        } else {
+            // Accepted end lives on the listener host until accept takes it
+            l = &sim->socks[fd];
+            s = &sim->socks[msg->dst];
+            s->host = l->host;
+            s->addr = l->addr;
+            s->state = USIM_CONN_ESTABLISHED;
+            s->peer = msg->src;
+            s->peer_gen = msg->src_gen;
+            s->peer_addr = msg->from;
+            msg->dst_gen = s->gen;
+            sim->stats.accepted++;
+            usim_reply(sim, msg, USIM_MSG_SYNACK, msg->dst);
+            usim_enqueue(sim, l, msg);
+            return;
+        }
+    } else if ((s = usim_sock_live(sim, msg->dst, msg->dst_gen))) {
+        sim->hosts[s->host].woken = 1;
+        if (msg->kind == USIM_MSG_SYNACK) {
+            s->state = USIM_CONN_ESTABLISHED;
+            s->peer = msg->src;
+            s->peer_gen = msg->src_gen;
+        } else if (msg->kind == USIM_MSG_RST) {
+            s->state = USIM_CONN_REFUSED;
+        } else if (msg->kind == USIM_MSG_FIN) {
+            s->state = USIM_CONN_EOF;
+        } else {
+            sim->stats.bytes += msg->l;
+            usim_enqueue(sim, s, msg);
+            return;
+        }
+    } else if (msg->kind == USIM_MSG_SYNACK) {
+        // Connecting end went away, close the accepted end
+        if (usim_sock_live(sim, msg->src, msg->src_gen)) {
+            usim_reply(sim, msg, USIM_MSG_FIN, msg->src);
+            return;
+        }
+    }
+    usys_free(msg);
+}
+
+void
+usim_enqueue(usim* sim, usim_sock* s, usim_msg* msg)
+{
+    sim->hosts[s->host].woken = 1;
+    msg->next = NULL;
+    if (s->rx) {
+        s->rx_last->next = msg;
+    } else {
+        s->rx = msg;
+    }
+    s->rx_last = msg;
+}
+
+void
+usim_reply(usim* sim, usim_msg* msg, uint32_t kind, int32_t src)
+{
+    // Control message back to the sender of msg (from src, or from its
+    // destination address when there is no socket there)
+    usim_msg* r = usim_msg_alloc(kind, src, 0);
+    usim_sock* s = &sim->socks[msg->src];
+    if (!r) return;
+    r->dst = msg->src;
+    r->dst_gen = msg->src_gen;
+    if (src >= 0) {
+        usim_send(sim, r);
+        return;
+    }
+    r->at = (sim->now > s->last ? sim->now : s->last) + sim->link.latency;
+    r->seq = sim->seq++;
+    r->src_gen = 0;
+    r->from = msg->to;
+    usim_heap_push(sim, r);
+}
+
+int
+usim_heap_less(usim_msg* a, usim_msg* b)
+{
+    return a->at < b->at || (a->at == b->at && (int32_t)(a->seq - b->seq) < 0);
+}
+
+void
+usim_heap_push(usim* sim, usim_msg* msg)
+{
+    uint32_t i, p, cap;
+    usim_msg** heap;
+    if (sim->nheap == sim->capheap) {
+        cap = sim->capheap ? sim->capheap * 2 : 256;
+        if (!(heap = usys_malloc(cap * sizeof(usim_msg*)))) {
+            usys_free(msg);
+            return;
+        }
+        if (sim->nheap) {
+            memcpy(heap, sim->heap, sim->nheap * sizeof(usim_msg*));
+        }
+        usys_free(sim->heap);
+        sim->heap = heap;
+        sim->capheap = cap;
+    }
+    for (i = sim->nheap++; i; i = p) {
+        p = (i - 1) / 2;
+        if (!usim_heap_less(msg, sim->heap[p])) break;
+        sim->heap[i] = sim->heap[p];
+    }
+    sim->heap[i] = msg;
+}
+
+usim_msg*
+usim_heap_pop(usim* sim)
+{
+    usim_msg *top, *last;
+    uint32_t i = 0, c;
+    if (!sim->nheap) return NULL;
+    top = sim->heap[0];
+    last = sim->heap[--sim->nheap];
+    while ((c = i * 2 + 1) < sim->nheap) {
+        if (c + 1 < sim->nheap &&
+            usim_heap_less(sim->heap[c + 1], sim->heap[c])) {
+            c++;
+        }
+        if (!usim_heap_less(sim->heap[c], last)) break;
+        sim->heap[i] = sim->heap[c];
+        i = c;
+    }
+    if (sim->nheap) sim->heap[i] = last;
+    return top;
+}
+
+int
+usim_listen_udp(usys_socket_fd* fd, int port, uint32_t flags)
+{
+    usim* sim = g_usim;
+    if ((*fd = usim_sock_alloc(sim, USIM_SOCK_DGRAM, sim->host)) < 0) {
+        return -1;
+    }
+    if (usim_bind(sim, *fd, port, flags)) {
+        usim_close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int
+usim_listen_tcp(usys_socket_fd* fd, int port, uint32_t flags)
+{
+    usim* sim = g_usim;
+    if ((*fd = usim_sock_alloc(sim, USIM_SOCK_LISTEN, sim->host)) < 0) {
+        return -1;
+    }
+    if (usim_bind(sim, *fd, port, flags)) {
+        usim_close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+int
+usim_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags)
+{
+    ((void)flags); // Socket options mean nothing on the simulated wire
+    usim* sim = g_usim;
+    usim_sock* s;
+    usim_msg* msg;
+    if ((*fd = usim_sock_alloc(sim, USIM_SOCK_STREAM, sim->host)) < 0) {
+        return -1;
+    }
+    s = &sim->socks[*fd];
+    s->addr.port = sim->hosts[s->host].port++;
+    s->peer_addr.ip = usys_atoh(host);
+    s->peer_addr.port = port;
+    if (!(msg = usim_msg_alloc(USIM_MSG_SYN, *fd, 0))) {
+        usim_close(fd);
+        return -1;
+    }
+    msg->to = s->peer_addr;
+    sim->stats.connects++;
+    usim_send(sim, msg);
+    return 0;
+}
+
+int
+usim_ready(usys_socket_fd* fd)
+{
+    usim_sock* s = usim_sock_get(g_usim, fd);
+    if (!s || s->state == USIM_CONN_REFUSED) return -1;
+    return s->state == USIM_CONN_CONNECTING ? 0 : 1;
+}
+
+int
+usim_accept(
+    usys_socket_fd* fd,
+    usys_socket_fd* sock,
+    usys_sockaddr* addr,
+    uint32_t n)
+{
+    usim* sim = g_usim;
+    usim_sock* l = usim_sock_get(sim, fd);
+    usim_msg* msg;
+    uint32_t c = 0;
+    if (!(l && l->type == USIM_SOCK_LISTEN)) return -1;
+    while (c < n && (msg = l->rx)) {
+        l->rx = msg->next;
+        if (usim_sock_live(sim, msg->dst, msg->dst_gen)) {
+            sock[c] = msg->dst;
+            addr[c++] = msg->from;
+        }
+        usys_free(msg);
+    }
+    return c;
+}
+
+int
+usim_pending(usys_socket_fd* fd)
+{
+    usim_sock* s = usim_sock_get(g_usim, fd);
+    if (!s) return USYS_POLL_ERR;
+    if (s->type == USIM_SOCK_LISTEN) return s->rx ? USYS_POLL_IN : 0;
+    if (s->type == USIM_SOCK_DGRAM) {
+        return USYS_POLL_OUT | (s->rx ? USYS_POLL_IN : 0);
+    }
+    if (s->state == USIM_CONN_CONNECTING) return 0;
+    if (s->state == USIM_CONN_REFUSED) return USYS_POLL_OUT;
+    return USYS_POLL_OUT |
+           ((s->rx || s->state == USIM_CONN_EOF) ? USYS_POLL_IN : 0);
+}
+
+void
+usim_close(usys_socket_fd* fd)
+{
+    usim* sim = g_usim;
+    usim_sock* s = usim_sock_get(sim, fd);
+    usim_msg *msg, *fin;
+    int32_t peer;
+    if (!s) {
+        *fd = -1;
+        return;
+    }
+    if (s->type == USIM_SOCK_LISTEN) {
+        // Connections nobody accepted are closed too
+        while ((msg = s->rx)) {
+            s->rx = msg->next;
+            peer = msg->dst;
+            if (usim_sock_live(sim, peer, msg->dst_gen)) usim_close(&peer);
+            usys_free(msg);
+        }
+    } else if (s->type == USIM_SOCK_STREAM && s->peer >= 0 &&
+               usim_sock_live(sim, s->peer, s->peer_gen) &&
+               (fin = usim_msg_alloc(USIM_MSG_FIN, *fd, 0))) {
+        fin->dst = s->peer;
+        fin->dst_gen = s->peer_gen;
+        usim_send(sim, fin);
+    }
+    usim_sock_free(sim, *fd);
+    *fd = -1;
+}
+
+int
+usim_stream_send(usys_socket_fd* fd, const byte* b, uint32_t l)
+{
+    usys_iovec v = { .iov_base = (void*)b, .iov_len = l };
+    return usim_stream_sendv(fd, &v, 1);
+}
+
+int
+usim_stream_sendv(usys_socket_fd* fd, const usys_iovec* v, uint32_t n)
+{
+    usim* sim = g_usim;
+    usim_sock* s = usim_sock_get(sim, fd);
+    usim_msg* msg;
+    uint32_t l = 0, c = 0;
+    if (!(s && s->type == USIM_SOCK_STREAM &&
+          s->state == USIM_CONN_ESTABLISHED)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) l += v[i].iov_len;
+    if (!(msg = usim_msg_alloc(USIM_MSG_DATA, *fd, l))) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(&msg->b[c], v[i].iov_base, v[i].iov_len);
+        c += v[i].iov_len;
+    }
+    msg->dst = s->peer;
+    msg->dst_gen = s->peer_gen;
+    usim_send(sim, msg);
+    return l;
+}
+
+int
+usim_stream_recv(usys_socket_fd* fd, byte* b, uint32_t l)
+{
+    // 0 when empty, as usys_recv would block (or the peer closed)
+    usim_sock* s = usim_sock_get(g_usim, fd);
+    usim_msg* msg;
+    uint32_t c = 0, n;
+    if (!(s && s->type == USIM_SOCK_STREAM)) return -1;
+    while (c < l && (msg = s->rx)) {
+        n = msg->l - s->rx_off;
+        if (n > l - c) n = l - c;
+        memcpy(&b[c], &msg->b[s->rx_off], n);
+        c += n;
+        if ((s->rx_off += n) == msg->l) {
+            s->rx = msg->next;
+            s->rx_off = 0;
+            usys_free(msg);
+        }
+    }
+    return c;
+}
+
+int
+usim_sendto(
+    usys_socket_fd* fd,
+    const byte* b,
+    uint32_t l,
+    usys_sockaddr* addr)
+{
+    usim* sim = g_usim;
+    usim_sock* s = usim_sock_get(sim, fd);
+    usim_msg* msg;
+    if (!(s && s->type == USIM_SOCK_DGRAM)) return -1;
+    sim->stats.datagrams++;
+    if (sim->link.loss && usim_rand(sim) % 10000 < sim->link.loss) {
+        sim->stats.lost++;
+        return l; // gone on the wire
+    }
+    if (!(msg = usim_msg_alloc(USIM_MSG_DGRAM, *fd, l))) return -1;
+    memcpy(msg->b, b, l);
+    msg->to = *addr;
+    usim_send(sim, msg);
+    return l;
+}
+
+int
+usim_recvfrom(usys_socket_fd* fd, byte* b, uint32_t l, usys_sockaddr* addr)
+{
+    usim_sock* s = usim_sock_get(g_usim, fd);
+    usim_msg* msg;
+    if (!(s && s->type == USIM_SOCK_DGRAM)) return -1;
+    if (!(msg = s->rx)) return 0;
+    s->rx = msg->next;
+    if (l > msg->l) l = msg->l;
+    memcpy(b, msg->b, l);
+    if (addr) *addr = msg->from;
+    usys_free(msg);
+    return l;
+}
+
+//
+//
+//
@@ -0,0 +1,162 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file usim.h
+ *
+ * @brief Network simulator. Sockets of async_io live in memory: datagrams
+ * and streams between simulated hosts are delivered after a configurable
+ * latency, jitter and uplink bandwidth, and datagrams may be lost. Time is
+ * virtual (usys_tick follows usim.now) so a driver runs every host until
+ * the next delivery or timer and jumps there, as fast as the cpu allows.
+ *
+ * One simulation runs at a time per process. Nodes (ie: ueth_context) are
+ * created and polled on the host made current with usim_host_set, their
+ * loops must use ASYNC_IO_BACKEND_MOCK.
+ */
+#ifndef USIM_H_
+#define USIM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "async_io.h"
+
+#define USIM_NET 0x0a000001       /*!< address of host 0 (10.0.0.1) */
+#define USIM_PORT_EPHEMERAL 49152 /*!< first port given to port 0 */
+#define USIM_NONE INT64_MAX       /*!< nothing in flight */
+
+/**
+ * @brief Link model (the same for every pair of hosts). Streams are lossless
+ * and keep their order, loss only applies to datagrams.
+ */
+typedef struct
+{
+    uint32_t latency;   /*!< one way delay (ms) */
+    uint32_t jitter;    /*!< extra delay, uniform in 0..jitter (ms) */
+    uint32_t bandwidth; /*!< uplink of each host (bytes/s, 0 unlimited) */
+    uint32_t loss;      /*!< datagrams lost per 10000 */
+} usim_link;
+
+typedef struct
+{
+    uint64_t datagrams;  /*!< sent */
+    uint64_t lost;       /*!< dropped by loss */
+    uint64_t unroutable; /*!< no socket at destination */
+    uint64_t bytes;      /*!< delivered */
+    uint64_t connects;   /*!< streams opened */
+    uint64_t refused;    /*!< connects without a listener */
+    uint64_t accepted;   /*!< connects that reached a listener */
+} usim_stats;
+
+typedef struct usim_msg usim_msg;
+typedef struct usim_sock usim_sock;
+
+typedef struct
+{
+    int64_t tx;     /*!< uplink busy until (us) */
+    int32_t bound;  /*!< sockets that receive by address (list) */
+    uint32_t port;  /*!< next ephemeral port */
+    uint32_t woken; /*!< a socket got something (see usim_host_woken) */
+} usim_host;
+
+typedef struct
+{
+    int64_t now;       /*!< virtual time (ms), usys_tick while installed */
+    usim_link link;    /*!< link model */
+    usim_stats stats;  /*!< counters since init */
+    uint32_t rng;      /*!< loss and jitter (xorshift) */
+    uint32_t host;     /*!< sockets open on this host */
+    uint32_t nhost;    /*!< hosts */
+    usim_host* hosts;  /*!< by index */
+    usim_sock* socks;  /*!< by fd */
+    uint32_t nsock;    /*!< socks allocated */
+    int32_t free;      /*!< unused socks (list) */
+    usim_msg** heap;   /*!< in flight, earliest first */
+    uint32_t nheap;    /*!< messages in flight */
+    uint32_t capheap;  /*!< size of heap */
+    uint32_t seq;      /*!< orders messages due at the same time */
+} usim;
+
+/**
+ * @brief Create hosts and take over sockets (every async_io initialized
+ * from now on) and usys_tick
+ *
+ * @param sim
+ * @param hosts number of hosts, host i has address USIM_NET + i
+ * @param link
+ * @param seed loss and jitter sequence
+ *
+ * @return 0 OK -1 out of memory
+ */
+int usim_init(usim* sim, uint32_t hosts, const usim_link* link, uint32_t seed);
+
+/**
+ * @brief Release messages in flight and hand sockets and time back to the
+ * system. Close the simulated sockets first (ie: deinit nodes).
+ */
+void usim_deinit(usim* sim);
+
+/**
+ * @brief Sockets opened (and connects made) from now on belong to host
+ */
+void usim_host_set(usim* sim, uint32_t host);
+
+/**
+ * @brief Delivery time of the next message in flight
+ *
+ * @return ms or USIM_NONE
+ */
+int64_t usim_next(usim* sim);
+
+/**
+ * @brief Deliver everything due up to until and advance the clock to until
+ *
+ * @return messages delivered
+ */
+uint32_t usim_run(usim* sim, int64_t until);
+
+/**
+ * @brief Did a socket of host receive data or change state since the last
+ * call (ie: poll the node of host before its next timer)
+ */
+static inline int
+usim_host_woken(usim* sim, uint32_t host)
+{
+    uint32_t woken = sim->hosts[host].woken;
+    sim->hosts[host].woken = 0;
+    return woken;
+}
+
+static inline uint32_t
+usim_ip(uint32_t host)
+{
+    return USIM_NET + host;
+}
+
+extern async_io_mock_settings g_usim_tcp; /*!< stream sockets */
+extern async_io_mock_settings g_usim_udp; /*!< datagram sockets */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
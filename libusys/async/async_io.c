@@ -20,21 +20,79 @@
  */
 
 #include "async_io.h"
+#include "usys_time.h"
+
+#include <errno.h>
+
+// io_uring ops in flight (async_io loop_events)
+#define ASYNC_IO_URING_POLL (0x01 << 0)
+#define ASYNC_IO_URING_SEND (0x01 << 1)
+#define ASYNC_IO_URING_RECV (0x01 << 2)
+#define ASYNC_IO_URING_OPS (0x07)
+#define ASYNC_IO_URING_DRAIN (0x01 << 3)
+#define ASYNC_IO_URING_WAKE ASYNC_IO_URING_POLL /*!< tag of loop wake poll */
+
+// private
+void async_io_loop_unwatch(async_io* io);
+int async_io_loop_poll_epoll(async_io_loop* loop, uint32_t ms);
+void async_io_loop_more(async_io* io);
+int async_io_loop_poll_more(async_io_loop* loop);
+void async_io_loop_waited(async_io_stats* stats, int64_t t);
+void async_io_loop_resume(async_io_loop* loop);
+int async_io_call_connect(async_io* io);
+int async_io_call_send(async_io* io, const uint8_t* b, uint32_t l);
+int async_io_call_recv(async_io* io, uint8_t* b, uint32_t l);
+int async_io_tcp_recv_deliver(async_io* io);
+int async_io_loop_poll_select(async_io_loop* loop, uint32_t ms);
+int async_io_loop_poll_uring(async_io_loop* loop, uint32_t ms);
+int async_io_loop_poll_mock(async_io_loop* loop);
+int async_io_loop_select(async_io_loop*, async_io**, uint32_t, uint32_t);
+void async_io_loop_woken(async_io_loop* loop);
+void async_io_loop_sync_uring(async_io* io);
+int async_io_uring_complete(async_io* io, usys_uring_cqe* cqe);
+uint64_t async_io_uring_tag(async_io* io, uint32_t op);
+async_io* async_io_uring_reaped(async_io_loop* loop, usys_uring_cqe* cqe);
+void async_io_loop_retire(async_io_loop* loop);
+async_io_slot* async_io_uring_slot(async_io* io);
+void async_io_buffer_put(async_io* io);
+int async_io_loop_slot_get(async_io_loop* loop, async_io* io);
+void async_io_loop_slot_put(async_io_loop* loop, async_io* io);
+async_io* async_io_uring_tag_io(async_io_loop* loop, uint64_t tag);
+int async_io_is_udp(async_io* io);
+void async_io_buffer_idle(async_io* io, uint32_t used);
+int async_io_sendq(async_io* io, async_io_buf* buf);
+void async_io_sendq_flush(async_io* io);
+void async_io_sendq_advance(async_io* io, uint32_t n);
+void async_io_sendq_drop(async_io* io);
+int async_io_udp_recv_many(async_io* io, usys_datagram* d, uint32_t n);
+int async_io_udp_send_many(async_io* io, usys_datagram* d, uint32_t n);
+
+async_io_mock_settings* g_async_io_mock_tcp = NULL; /*!< installed on init */
+async_io_mock_settings* g_async_io_mock_udp = NULL; /*!< installed on init */
 
 void
 async_io_tcp_init(async_io* io, async_io_settings* settings, void* ctx)
 {
     async_io_init(io, ctx);
     io->send = usys_send;
+    io->sendv = usys_sendv;
+    io->sendv_more = usys_sendv_more;
+    io->cork = usys_sock_cork;
+    io->profile = USYS_SOCK_PROFILE_LATENCY;
     io->recv = usys_recv;
     io->ready = usys_sock_ready;
     io->connect = usys_connect;
+    io->accept = usys_accept;
+    io->listen = usys_listen_tcp;
     io->on_connect = settings->on_connect;
     io->on_accept = settings->on_accept;
     io->on_error = settings->on_erro;
     io->on_send = settings->on_send;
     io->on_recv = settings->on_recv;
+    io->on_drain = settings->on_drain;
+    io->on_sent = settings->on_sent;
     io->poll = async_io_tcp_poll_connect;
+    if (g_async_io_mock_tcp) async_io_install_mock(io, g_async_io_mock_tcp);
 }
 
 void
@@ -43,12 +101,19 @@ async_io_udp_init(async_io* io, async_io_settings* settings, void* ctx)
     async_io_init(io, ctx);
     io->sendto = usys_send_to;
     io->recvfrom = usys_recv_from;
+    io->sendmmsg = usys_send_mmsg;
+    io->recvmmsg = usys_recv_mmsg;
+    io->listen = usys_listen_udp;
+    io->profile = USYS_SOCK_PROFILE_DISCOVERY;
     io->on_connect = settings->on_connect;
     io->on_accept = settings->on_accept;
     io->on_error = settings->on_erro;
     io->on_send = settings->on_send;
     io->on_recv = settings->on_recv;
+    io->on_drain = settings->on_drain;
+    io->on_sent = settings->on_sent;
     io->poll = async_io_udp_poll_recv;
+    if (g_async_io_mock_udp) async_io_install_mock(io, g_async_io_mock_udp);
 }
 
 void
@@ -58,32 +123,158 @@ async_io_init(async_io* io, void* ctx)
     io->addr.ip = io->addr.port = io->c = io->len = io->state = 0;
     io->ctx = ctx;
     io->close = usys_close;
-    memset(io->b, 0, sizeof(io->b));
+    io->pending = NULL;
+    io->stats = NULL;
+    io->loop = NULL;
+    io->loop_next = NULL;
+    io->loop_sock = -1;
+    io->loop_events = 0;
+    io->loop_slot = 0;
+    io->on_sent = NULL;
+    io->q = NULL;
+    io->q_tail = &io->q;
+    io->q_off = io->q_sent = 0;
+    io->pool = &g_async_io_pool;
+    io->max = ASYNC_IO_BUFFER_MAX;
+    io->budget = ASYNC_IO_BUDGET_BYTES;
+    io->budget_n = ASYNC_IO_BUDGET_MSGS;
+    io->more = io->keep = 0;
+    io->pause = 0;
+    io->sendv = io->sendv_more = NULL;
+    io->cork = NULL;
+    io->profile = USYS_SOCK_PROFILE_NONE;
+    io->b = async_io_pool_get(io->pool, ASYNC_IO_POOL_MIN, &io->cap);
+    if (!io->b) io->cap = 0;
 }
 
 void
 async_io_deinit(async_io* io)
 {
     if (async_io_has_sock(io)) async_io_close(io);
-    memset(io->b, 0, sizeof(io->b));
+    async_io_buffer_put(io);
+    if (io->loop) async_io_loop_remove(io->loop, io);
+    io->b = NULL;
+    io->cap = 0;
+}
+
+void
+async_io_close(async_io* io)
+{
+    // Leave the readiness set before the socket number can be reused
+    async_io_loop_unwatch(io);
+    io->close(&io->sock);
+    io->state = io->len = io->c = 0;
+    io->pause = 0;
+    async_io_sendq_drop(io);
+    async_io_buffer_shrink(io);
+}
+
+int
+async_io_buffer_reserve(async_io* io, uint32_t sz)
+{
+    uint8_t* b;
+    uint32_t cap;
+    if (sz <= io->cap) return 0;
+    if (sz > io->max) return -1;
+    if (!(b = async_io_pool_get(io->pool, sz, &cap))) return -1;
+    if (io->c) memcpy(b, io->b, io->c);
+    async_io_buffer_put(io);
+    io->b = b;
+    io->cap = cap;
+    return 0;
+}
+
+void
+async_io_buffer_shrink(async_io* io)
+{
+    uint8_t* b;
+    uint32_t cap;
+    if (io->cap <= ASYNC_IO_POOL_MIN || async_io_state_busy(io)) return;
+    if (!(b = async_io_pool_get(io->pool, ASYNC_IO_POOL_MIN, &cap))) return;
+    async_io_buffer_put(io);
+    io->b = b;
+    io->cap = cap;
+    if (async_io_state_recv(io)) io->len = cap;
+}
+
+int
+async_io_buffer_pool_set(async_io* io, async_io_pool* pool)
+{
+    uint8_t* b;
+    uint32_t cap;
+    if (io->pool == pool) return 0;
+    if (!(b = async_io_pool_get(pool, io->cap ? io->cap : 1, &cap))) return -1;
+    if (io->c) memcpy(b, io->b, io->c);
+    async_io_buffer_put(io);
+    io->pool = pool;
+    io->b = b;
+    io->cap = cap;
+    return 0;
+}
+
+void
+async_io_buffer_put(async_io* io)
+{
+    // A send in the ring may still read the buffer, it waits on the slot
+    // for the completion (io->b is replaced or dropped by the caller)
+    async_io_slot* slot = async_io_uring_slot(io);
+    if (slot && (slot->ops & ASYNC_IO_URING_SEND) && !slot->b) {
+        slot->b = io->b;
+        slot->cap = io->cap;
+        slot->pool = io->pool;
+    } else {
+        async_io_pool_put(io->pool, io->b, io->cap);
+    }
+}
+
+void
+async_io_buffer_idle(async_io* io, uint32_t used)
+{
+    // Keep a big buffer while messages still need a good part of it
+    if (used <= io->cap / 4) async_io_buffer_shrink(io);
 }
 
 void
 async_io_install_mock(async_io* io, async_io_mock_settings* mock)
 {
+    // A datagram mock without batch calls is used one datagram at a time
     if (mock->sendto) {
         io->sendto = mock->sendto;
+        io->sendmmsg = mock->sendmmsg;
     } else if (mock->send) {
         io->send = mock->send;
     }
+    if (mock->sendv) io->sendv = io->sendv_more = mock->sendv;
+    io->cork = mock->cork; // never a real option call on a mock socket
     if (mock->recvfrom) {
         io->recvfrom = mock->recvfrom;
+        io->recvmmsg = mock->recvmmsg;
     } else if (mock->recv) {
         io->recv = mock->recv;
     }
     if (mock->close) io->close = mock->close;
     if (mock->connect) io->connect = mock->connect;
+    if (mock->accept) io->accept = mock->accept;
     if (mock->ready) io->ready = mock->ready;
+    if (mock->listen) io->listen = mock->listen;
+    if (mock->pending) io->pending = mock->pending;
+}
+
+void
+async_io_install_mock_default(
+    async_io_mock_settings* tcp,
+    async_io_mock_settings* udp)
+{
+    g_async_io_mock_tcp = tcp;
+    g_async_io_mock_udp = udp;
+}
+
+int
+async_io_is_udp(async_io* io)
+{
+    return io->poll == async_io_udp_poll_recv ||
+           io->poll == async_io_udp_poll_send ||
+           io->poll == async_io_udp_poll_sendq;
 }
 
 int
@@ -91,7 +282,7 @@ async_io_tcp_connect(async_io* io, const char* ip, uint32_t p)
 {
     int ret;
     if (async_io_has_sock(io)) async_io_close(io);
-    ret = io->connect(&io->sock, ip, p);
+    ret = io->connect(&io->sock, ip, p, USYS_SOCK_PROFILE_FLAGS(io->profile));
     if (ret < 0) {
         async_io_state_erro_set(io);
         io->poll = async_io_tcp_poll_connect;
@@ -101,18 +292,43 @@ async_io_tcp_connect(async_io* io, const char* ip, uint32_t p)
         async_io_state_ready_set(io);
         async_io_state_recv_set(io);
         io->poll = async_io_tcp_poll_recv;
-        io->on_connect(io->ctx);
+        async_io_call_connect(io);
+        async_io_sendq_flush(io);
     }
+    async_io_loop_sync(io);
     return ret;
 }
 
 int
-async_io_tcp_accept(async_io* io)
+async_io_tcp_listen(async_io* io, uint32_t port, uint32_t flags)
 {
-    // TODO - stub
+    int ret = -1;
     if (async_io_has_sock(io)) async_io_close(io);
+    if (!USYS_SOCK_PROFILE_OF(flags)) {
+        flags |= USYS_SOCK_PROFILE_FLAGS(io->profile);
+    }
+    ret = io->listen(&io->sock, port, flags);
+    if (!ret) {
+        async_io_state_ready_set(io);
+        async_io_state_recv_set(io);
+        io->poll = async_io_tcp_poll_accept;
+    } else {
+        async_io_state_erro_set(io);
+    }
+    async_io_loop_sync(io);
+    return ret;
+}
+
+int
+async_io_tcp_accept(async_io* io, usys_socket_fd s, usys_sockaddr* addr)
+{
+    if (async_io_has_sock(io)) async_io_close(io);
+    io->sock = s;
+    io->addr = *addr;
+    async_io_state_ready_set(io);
     async_io_state_recv_set(io);
     io->poll = async_io_tcp_poll_recv;
+    async_io_loop_sync(io);
     return 0;
 }
 
@@ -121,7 +337,7 @@ async_io_udp_listen(async_io* io, uint32_t port)
 {
     int ret = -1;
     if (async_io_has_sock(io)) async_io_close(io);
-    ret = usys_listen_udp(&io->sock, port);
+    ret = io->listen(&io->sock, port, USYS_SOCK_PROFILE_FLAGS(io->profile));
     if (!ret) {
         async_io_state_ready_set(io);
         async_io_state_recv_set(io);
@@ -129,6 +345,7 @@ async_io_udp_listen(async_io* io, uint32_t port)
     } else {
         async_io_state_erro_set(io);
     }
+    async_io_loop_sync(io);
     return ret;
 }
 
@@ -139,6 +356,7 @@ async_io_tcp_send(async_io* io)
         // If we are already not in send state and have a socket
         async_io_state_send_set(io);
         io->poll = async_io_tcp_poll_send;
+        async_io_loop_sync(io);
         return 0;
     } else {
         // We are busy sending already or not connected
@@ -146,6 +364,79 @@ async_io_tcp_send(async_io* io)
     }
 }
 
+int
+async_io_tcp_sendq(async_io* io, async_io_buf* buf)
+{
+    return async_io_sendq(io, buf);
+}
+
+int
+async_io_tcp_cork(async_io* io, int on)
+{
+    if (!(io->cork && async_io_has_sock(io))) return -1;
+    return io->cork(&io->sock, on);
+}
+
+int
+async_io_udp_sendq(async_io* io, async_io_buf* buf)
+{
+    return async_io_sendq(io, buf);
+}
+
+int
+async_io_sendq(async_io* io, async_io_buf* buf)
+{
+    if (!async_io_has_sock(io)) return -1;
+    buf->next = NULL;
+    *io->q_tail = buf;
+    io->q_tail = &buf->next;
+    async_io_sendq_flush(io);
+    return 0;
+}
+
+void
+async_io_sendq_flush(async_io* io)
+{
+    int udp = async_io_is_udp(io);
+
+    // Wait out connect, error, or a copy send (async_io_..._send)
+    if (!(io->q && ASYNC_IO_IS_READY(io->state))) return;
+    if (ASYNC_IO_IS_SEND(io->state)) return;
+    if (ASYNC_IO_IS_ERRO(io->state) && !udp) return;
+
+    // Bytes received so far (io->c) wait in b until the queue is out
+    io->state |= ASYNC_IO_STATE_SEND;
+    io->state &= (~(ASYNC_IO_STATE_RECV));
+    io->poll = udp ? async_io_udp_poll_sendq : async_io_tcp_poll_sendv;
+    io->q_sent = 0;
+    async_io_loop_sync(io);
+}
+
+void
+async_io_sendq_advance(async_io* io, uint32_t n)
+{
+    async_io_buf* buf;
+    io->q_sent += n;
+    while ((buf = io->q) && n >= buf->l - io->q_off) {
+        n -= buf->l - io->q_off;
+        io->q_off = 0;
+        if (!(io->q = buf->next)) io->q_tail = &io->q;
+        if (io->on_sent) io->on_sent(io->ctx, buf);
+    }
+    io->q_off = io->q ? io->q_off + n : 0;
+}
+
+void
+async_io_sendq_drop(async_io* io)
+{
+    async_io_buf* buf;
+    while ((buf = io->q)) {
+        if (!(io->q = buf->next)) io->q_tail = &io->q;
+        if (io->on_sent) io->on_sent(io->ctx, buf);
+    }
+    io->q_off = 0;
+}
+
 int
 async_io_udp_send(async_io* io, uint32_t ip, uint32_t port)
 {
@@ -154,6 +445,7 @@ async_io_udp_send(async_io* io, uint32_t ip, uint32_t port)
         io->addr.port = port;
         async_io_state_send_set(io);
         io->poll = async_io_udp_poll_send;
+        async_io_loop_sync(io);
         return 0;
     } else {
         return -1;
@@ -165,19 +457,658 @@ async_io_poll_n(async_io** io, uint32_t n, uint32_t ms)
 {
     uint32_t mask = 0;
     int reads[n], writes[n], err = 0;
+    int64_t t;
+    async_io_stats* stats = NULL;
+    async_io* cur;
     for (uint32_t c = 0; c < n; c++) {
         reads[c] = async_io_state_recv(io[c]) ? io[c]->sock : -1;
         writes[c] = async_io_state_send(io[c]) ? io[c]->sock : -1;
+        if (!stats) stats = io[c]->stats;
     }
+    t = stats ? usys_tick_cached_ns() : 0;
     err = usys_select(&mask, &mask, ms, reads, n, writes, n);
+    async_io_loop_waited(stats, t);
     if (mask) {
         for (uint32_t i = 0; i < n; i++) {
-            if (mask & (0x01 << i)) err |= async_io_poll(io[i]);
+            // A loop clears io released by handlers before us from its batch
+            if (!(mask & (0x01 << i) && (cur = io[i]))) continue;
+            err |= async_io_poll(cur);
+            async_io_loop_sync(cur);
+        }
+    }
+    return err;
+}
+
+int
+async_io_loop_init(async_io_loop* loop)
+{
+    return async_io_loop_init_backend(loop, ASYNC_IO_BACKEND_AUTO);
+}
+
+int
+async_io_loop_init_backend(async_io_loop* loop, ASYNC_IO_BACKEND b)
+{
+    loop->fd = -1;
+    loop->ring = NULL;
+    loop->n = 0;
+    loop->io = NULL;
+    loop->wake.rd = loop->wake.wr = -1;
+    loop->wake_armed = 0;
+    loop->on_wake = NULL;
+    loop->wake_ctx = NULL;
+    loop->stats = NULL;
+    loop->more = loop->rr = loop->pass = 0;
+    loop->ev = NULL;
+    loop->nev = 0;
+    loop->batch = NULL;
+    loop->nbatch = 0;
+    loop->next = NULL;
+    loop->slot = NULL;
+    loop->nslot = loop->slot_free = 0;
+    loop->paused = 0;
+    loop->backend = ASYNC_IO_BACKEND_SELECT;
+    if (b == ASYNC_IO_BACKEND_MOCK) {
+        loop->backend = b;
+        return 0;
+    }
+    if (b == ASYNC_IO_BACKEND_AUTO || b == ASYNC_IO_BACKEND_URING) {
+        if ((loop->ring = usys_uring_open())) {
+            loop->backend = ASYNC_IO_BACKEND_URING;
+            return 0;
+        }
+    }
+    if (!(b == ASYNC_IO_BACKEND_SELECT)) {
+        if ((loop->fd = usys_poll_open()) >= 0) {
+            loop->backend = ASYNC_IO_BACKEND_EPOLL;
         }
     }
+    return 0;
+}
+
+void
+async_io_loop_deinit(async_io_loop* loop)
+{
+    while (loop->io) async_io_loop_remove(loop, loop->io);
+    if (loop->ring) async_io_loop_retire(loop);
+    usys_poll_close(&loop->fd);
+    usys_uring_close(&loop->ring);
+    usys_wake_close(&loop->wake);
+    usys_free(loop->slot);
+    loop->slot = NULL;
+    loop->nslot = loop->slot_free = 0;
+    loop->on_wake = NULL;
+}
+
+int
+async_io_loop_wake_init(
+    async_io_loop* loop,
+    async_io_on_wake_fn fn,
+    void* ctx)
+{
+    if (loop->on_wake || usys_wake_open(&loop->wake)) return -1;
+    loop->on_wake = fn;
+    loop->wake_ctx = ctx;
+    if (loop->ring) {
+        if (!usys_uring_poll(
+                loop->ring, loop->wake.rd, USYS_POLL_IN, ASYNC_IO_URING_WAKE)) {
+            loop->wake_armed = 1;
+        }
+    } else if (loop->fd >= 0) {
+        // Events of the wake descriptor carry the loop instead of an io
+        usys_poll_set(loop->fd, loop->wake.rd, 0, USYS_POLL_IN, loop);
+    }
+    return 0;
+}
+
+void
+async_io_loop_wake(async_io_loop* loop)
+{
+    usys_wake_signal(&loop->wake);
+}
+
+void
+async_io_loop_woken(async_io_loop* loop)
+{
+    // Drain first, a wake up after this sees the work it was for
+    usys_wake_drain(&loop->wake);
+    if (loop->ring && !loop->wake_armed &&
+        !usys_uring_poll(
+            loop->ring, loop->wake.rd, USYS_POLL_IN, ASYNC_IO_URING_WAKE)) {
+        loop->wake_armed = 1;
+    }
+    loop->on_wake(loop->wake_ctx);
+}
+
+int
+async_io_loop_add(async_io_loop* loop, async_io* io)
+{
+    if (io->loop) return -1;
+    if (loop->ring && async_io_loop_slot_get(loop, io)) return -1;
+    io->loop = loop;
+    io->loop_next = loop->io;
+    io->loop_sock = -1;
+    io->loop_events = 0;
+    if (loop->stats) io->stats = loop->stats;
+    if (io->pause) loop->paused++;
+    loop->io = io;
+    loop->n++;
+    async_io_loop_sync(io);
+    return 0;
+}
+
+void
+async_io_loop_remove(async_io_loop* loop, async_io* io)
+{
+    async_io** p = &loop->io;
+    if (!(io->loop == loop)) return;
+    while (*p && !(*p == io)) p = &(*p)->loop_next;
+    if (*p) {
+        *p = io->loop_next;
+        loop->n--;
+    }
+    if (loop->next == io) loop->next = io->loop_next;
+    async_io_loop_unwatch(io);
+    async_io_loop_slot_put(loop, io);
+    if (io->stats == loop->stats) io->stats = NULL;
+    io->loop = NULL;
+    io->loop_next = NULL;
+}
+
+int
+async_io_loop_poll(async_io_loop* loop, uint32_t ms)
+{
+    int err;
+    int64_t t;
+    uint32_t more = loop->more;
+    async_io_stats* stats = loop->stats;
+
+    // One clock reading for the timers of this iteration (again after a wait)
+    usys_tick_hold();
+    if (stats) {
+        stats->waited = 0;
+        t = usys_tick_cached_ns();
+    }
+    if (!++loop->pass) loop->pass = 1;
+    if (more) {
+        // Someone has work left, no sleeping
+        loop->more = 0;
+        ms = 0;
+    }
+    if (loop->paused) {
+        async_io_loop_resume(loop);
+        if (loop->paused && ms > ASYNC_IO_ACCEPT_PAUSE) {
+            ms = ASYNC_IO_ACCEPT_PAUSE;
+        }
+    }
+    if (loop->ring) {
+        err = async_io_loop_poll_uring(loop, ms);
+    } else if (loop->backend == ASYNC_IO_BACKEND_MOCK) {
+        err = async_io_loop_poll_mock(loop);
+    } else if (loop->fd < 0) {
+        err = async_io_loop_poll_select(loop, ms);
+    } else {
+        err = async_io_loop_poll_epoll(loop, ms);
+    }
+    if (more) err |= async_io_loop_poll_more(loop);
+    if (stats) uhist_record(&stats->iter, usys_tick_ns() - t - stats->waited);
+    usys_tick_release();
     return err;
 }
 
+int
+async_io_loop_poll_epoll(async_io_loop* loop, uint32_t ms)
+{
+    int n, err = 0;
+    int64_t t = loop->stats ? usys_tick_cached_ns() : 0;
+    async_io* io;
+    usys_poll_event ev[ASYNC_IO_LOOP_EVENTS];
+    n = usys_poll_wait(loop->fd, ev, ASYNC_IO_LOOP_EVENTS, ms);
+    async_io_loop_waited(loop->stats, t);
+
+    // Handlers of earlier events may close, remove or free the io of later
+    // ones, async_io_loop_unwatch clears their events from the batch
+    loop->ev = ev;
+    loop->nev = n;
+    for (int i = 0; i < n; i++) {
+        if (ev[i].ptr == (void*)loop) {
+            async_io_loop_woken(loop);
+            continue;
+        }
+        io = ev[i].ptr;
+        if (!(io && io->loop == loop && io->loop_events)) continue;
+        err |= async_io_poll(io);
+        async_io_loop_sync(io);
+    }
+    loop->ev = NULL;
+    loop->nev = 0;
+    return n < 0 ? -1 : err;
+}
+
+int
+async_io_loop_poll_mock(async_io_loop* loop)
+{
+    // Nothing to wait on, time passes outside (ie: a simulator). Visit io
+    // whose mock reports what their state waits for.
+    async_io *batch[32], *io = loop->io;
+    uint32_t b, ev;
+    int err = 0;
+    if (loop->on_wake) async_io_loop_woken(loop);
+    loop->batch = batch;
+    while (io) {
+        for (b = 0; io && b < 32; io = io->loop_next) {
+            if (!(io->pending && async_io_has_sock(io))) continue;
+            ev = io->pending(&io->sock);
+            if ((async_io_state_recv(io) && (ev & USYS_POLL_IN)) ||
+                (async_io_state_send(io) && (ev & USYS_POLL_OUT))) {
+                batch[b++] = io;
+            }
+        }
+        loop->nbatch = b;
+        loop->next = io;
+        for (uint32_t i = 0; i < b; i++) {
+            if (!(io = batch[i])) continue;
+            err |= async_io_poll(io);
+            async_io_loop_sync(io);
+        }
+        io = loop->next;
+    }
+    loop->batch = NULL;
+    loop->next = NULL;
+    loop->nbatch = 0;
+    return err;
+}
+
+int
+async_io_loop_poll_select(async_io_loop* loop, uint32_t ms)
+{
+    // select reports at most 32 io at a time (see usys_select), the first
+    // batch waits and holds the wake descriptor in the last place. Passes
+    // start one io further each time, none is always served last.
+    async_io *batch[32], *io = loop->io;
+    uint32_t b = 0, max = loop->on_wake ? 31 : 32, n = loop->n, c;
+    int err = 0;
+    if (!io && loop->on_wake) return async_io_loop_select(loop, batch, 0, ms);
+    for (c = n ? loop->rr++ % n : 0; c && io; c--) io = io->loop_next;
+    loop->batch = batch;
+    for (c = 0; c < n && io; c++) {
+        batch[b++] = io;
+        io = io->loop_next ? io->loop_next : loop->io;
+        if (b == max || c + 1 == n) {
+            loop->nbatch = b;
+            loop->next = io;
+            err |= max == 32 ? async_io_poll_n(batch, b, ms)
+                             : async_io_loop_select(loop, batch, b, ms);
+            if (!(io = loop->next ? loop->next : loop->io)) break;
+            b = ms = 0;
+            max = 32;
+        }
+    }
+    loop->batch = NULL;
+    loop->next = NULL;
+    loop->nbatch = 0;
+    return err;
+}
+
+int
+async_io_loop_select(
+    async_io_loop* loop,
+    async_io** io,
+    uint32_t n,
+    uint32_t ms)
+{
+    // async_io_poll_n with the wake descriptor read behind the io
+    uint32_t rmask = 0, wmask = 0;
+    int64_t t;
+    int reads[n + 1], writes[n + 1], err = 0;
+    async_io* cur;
+    for (uint32_t c = 0; c < n; c++) {
+        reads[c] = async_io_state_recv(io[c]) ? io[c]->sock : -1;
+        writes[c] = async_io_state_send(io[c]) ? io[c]->sock : -1;
+    }
+    reads[n] = loop->wake.rd;
+    writes[n] = -1;
+    t = loop->stats ? usys_tick_cached_ns() : 0;
+    usys_select(&rmask, &wmask, ms, reads, n + 1, writes, n + 1);
+    async_io_loop_waited(loop->stats, t);
+    if (rmask & (0x01 << n)) async_io_loop_woken(loop);
+    rmask |= wmask;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(rmask & (0x01 << i) && (cur = io[i]))) continue;
+        err |= async_io_poll(cur);
+        async_io_loop_sync(cur);
+    }
+    return err;
+}
+
+int
+async_io_loop_poll_uring(async_io_loop* loop, uint32_t ms)
+{
+    int n, err = 0, ndrain = 0;
+    usys_uring_cqe cqe[ASYNC_IO_LOOP_EVENTS];
+    uint32_t drain[ASYNC_IO_LOOP_EVENTS];
+    async_io *io, *stale;
+
+    // Everything queued since last poll goes in with this one syscall
+    int64_t t = loop->stats ? usys_tick_cached_ns() : 0;
+    if (usys_uring_enter(loop->ring, ms)) return -1;
+    async_io_loop_waited(loop->stats, t);
+    while ((n = usys_uring_reap(loop->ring, cqe, ASYNC_IO_LOOP_EVENTS))) {
+        for (int i = 0; i < n; i++) {
+            stale = async_io_uring_reaped(loop, &cqe[i]);
+            io = async_io_uring_tag_io(loop, cqe[i].tag);
+            if (cqe[i].tag == ASYNC_IO_URING_WAKE) {
+                loop->wake_armed = 0;
+                async_io_loop_woken(loop);
+            } else if (stale) {
+                // An op from before the io unwatched left, queue what waited
+                async_io_loop_sync(stale);
+            } else if (io) {
+                err |= async_io_uring_complete(io, &cqe[i]);
+                if (cqe[i].b && io->loop_slot &&
+                    !(io->loop_events & ASYNC_IO_URING_DRAIN)) {
+                    io->loop_events |= ASYNC_IO_URING_DRAIN;
+                    drain[ndrain++] = io->loop_slot;
+                }
+                async_io_loop_sync(io);
+            }
+            usys_uring_release(loop->ring, cqe[i].bid);
+        }
+
+        // Everything readable this batch was handed to on_recv (slots of
+        // io released since are empty)
+        for (int i = 0; i < ndrain; i++) {
+            if (!(io = loop->slot[drain[i]].io)) continue;
+            io->loop_events &= ~ASYNC_IO_URING_DRAIN;
+            if (io->on_drain) io->on_drain(io->ctx);
+        }
+        ndrain = 0;
+    }
+    return err;
+}
+
+async_io*
+async_io_uring_reaped(async_io_loop* loop, usys_uring_cqe* cqe)
+{
+    // The op has left the ring (a multishot one with its last completion),
+    // its slot may queue the same kind again and a send lets go of the
+    // buffer. Returns the io of the slot if the op was from before it
+    // unwatched.
+    uint32_t s = (uint32_t)(cqe->tag >> 4) & 0x0fffffff;
+    uint32_t op = cqe->tag & ASYNC_IO_URING_OPS;
+    async_io_slot* slot;
+    if (!(s && s < loop->nslot) || cqe->more) return NULL;
+    slot = &loop->slot[s];
+    slot->ops &= ~op;
+    if (op == ASYNC_IO_URING_SEND && slot->b) {
+        async_io_pool_put(slot->pool, slot->b, slot->cap);
+        slot->b = NULL;
+    }
+    if (!slot->io) {
+        // Retired by an io that left, free once nothing points at it
+        if (!slot->ops) {
+            slot->next = loop->slot_free;
+            loop->slot_free = s;
+        }
+        return NULL;
+    }
+    return slot->gen == (uint32_t)(cqe->tag >> 32) ? NULL : slot->io;
+}
+
+void
+async_io_loop_retire(async_io_loop* loop)
+{
+    // Ops cancelled as the io left are reaped before the ring and the
+    // buffers they read go away. One still out after this keeps its buffer.
+    usys_uring_cqe cqe[ASYNC_IO_LOOP_EVENTS];
+    uint32_t ops = 1;
+    int n;
+    for (int c = 0; ops && c < 100; c++) {
+        ops = 0;
+        for (uint32_t s = 1; s < loop->nslot; s++) ops |= loop->slot[s].ops;
+        if (!ops || usys_uring_enter(loop->ring, 10)) break;
+        while ((n = usys_uring_reap(loop->ring, cqe, ASYNC_IO_LOOP_EVENTS))) {
+            for (int i = 0; i < n; i++) {
+                async_io_uring_reaped(loop, &cqe[i]);
+                usys_uring_release(loop->ring, cqe[i].bid);
+            }
+        }
+    }
+}
+
+async_io_slot*
+async_io_uring_slot(async_io* io)
+{
+    async_io_loop* loop = io->loop;
+    return loop && loop->ring && io->loop_slot ? &loop->slot[io->loop_slot]
+                                               : NULL;
+}
+
+int
+async_io_uring_complete(async_io* io, usys_uring_cqe* cqe)
+{
+    int ret = 0, op = cqe->tag & ASYNC_IO_URING_OPS;
+    uint32_t sent;
+    usys_sockaddr addr;
+    if (op == ASYNC_IO_URING_RECV) {
+        if (!cqe->more) io->loop_events &= ~ASYNC_IO_URING_RECV;
+        if (cqe->b) {
+            // Handlers read the sender from io, a send in flight keeps its own
+            addr = io->addr;
+            io->addr = cqe->addr;
+            async_io_call_recv(io, (uint8_t*)cqe->b, cqe->l);
+            if (async_io_state_send(io)) io->addr = addr;
+        } else if (cqe->res < 0 && !(cqe->res == -ENOBUFS)) {
+            io->on_error(io->ctx); // IO error
+            async_io_state_erro_set(io);
+            ret = -1;
+        }
+    } else if (op == ASYNC_IO_URING_POLL) {
+        // Readiness - run the regular handler (recv, or connect complete)
+        io->loop_events &= ~ASYNC_IO_URING_POLL;
+        if (!(io->poll == async_io_tcp_poll_send) && cqe->res >= 0) {
+            ret = async_io_poll(io);
+        }
+    } else if (op == ASYNC_IO_URING_SEND) {
+        io->loop_events &= ~ASYNC_IO_URING_SEND;
+        if (cqe->res < 0) {
+            io->on_error(io->ctx); // IO error
+            async_io_state_erro_set(io);
+            io->poll = async_io_is_udp(io) ? async_io_udp_poll_recv
+                                           : async_io_tcp_poll_connect;
+            ret = -1;
+        } else if ((io->c += cqe->res) >= io->len) {
+            // Send complete - put back to recv state (else send the rest)
+            sent = io->len;
+            async_io_state_recv_set(io);
+            io->poll = async_io_is_udp(io) ? async_io_udp_poll_recv
+                                           : async_io_tcp_poll_recv;
+            async_io_call_send(io, io->b, sent);
+            async_io_buffer_idle(io, sent);
+            async_io_sendq_flush(io);
+        }
+    }
+    return ret;
+}
+
+void
+async_io_loop_sync(async_io* io)
+{
+    uint32_t ev = 0;
+    async_io_loop* loop = io->loop;
+    if (!loop) return;
+    if (loop->ring) {
+        async_io_loop_sync_uring(io);
+        return;
+    }
+    if (loop->fd < 0) return;
+    if (async_io_has_sock(io)) {
+        if (async_io_state_recv(io)) {
+            ev = USYS_POLL_IN;
+        } else if (async_io_state_send(io)) {
+            ev = USYS_POLL_OUT;
+        }
+    }
+    if (!(io->loop_sock == io->sock)) async_io_loop_unwatch(io);
+    if (ev == io->loop_events) return;
+
+    // Sockets the set refuses (ie: test mocks) are left unwatched
+    if (usys_poll_set(loop->fd, io->sock, io->loop_events, ev, io)) ev = 0;
+    io->loop_sock = ev ? io->sock : -1;
+    io->loop_events = ev;
+}
+
+void
+async_io_loop_sync_uring(async_io* io)
+{
+    usys_uring* ring = io->loop->ring;
+    uint32_t *ev = &io->loop_events, *ops, ready;
+    if (!(io->loop_sock == io->sock)) async_io_loop_unwatch(io);
+    if (!async_io_has_sock(io)) return;
+    io->loop_sock = io->sock;
+
+    // An op of a kind still in the ring (ie: cancelled, not reaped) holds
+    // off the next one, it is queued when the old one is reaped
+    ops = &io->loop->slot[io->loop_slot].ops;
+    if (async_io_is_udp(io)) {
+        // Datagrams land in ring buffers whatever our state
+        if (ASYNC_IO_IS_READY(io->state) && !(*ops & ASYNC_IO_URING_RECV) &&
+            !usys_uring_recv_multi(
+                ring, io->sock, async_io_uring_tag(io, ASYNC_IO_URING_RECV))) {
+            *ev |= ASYNC_IO_URING_RECV;
+            *ops |= ASYNC_IO_URING_RECV;
+        }
+        if (io->poll == async_io_udp_poll_sendq) {
+            // Queue goes out with sendmmsg once writable
+            if (!(*ops & ASYNC_IO_URING_POLL) &&
+                !usys_uring_poll(
+                    ring,
+                    io->sock,
+                    USYS_POLL_OUT,
+                    async_io_uring_tag(io, ASYNC_IO_URING_POLL))) {
+                *ev |= ASYNC_IO_URING_POLL;
+                *ops |= ASYNC_IO_URING_POLL;
+            }
+        } else if (async_io_state_send(io) && !(*ops & ASYNC_IO_URING_SEND) &&
+            !usys_uring_sendto(
+                ring,
+                io->sock,
+                &io->b[io->c],
+                io->len - io->c,
+                &io->addr,
+                async_io_uring_tag(io, ASYNC_IO_URING_SEND))) {
+            *ev |= ASYNC_IO_URING_SEND;
+            *ops |= ASYNC_IO_URING_SEND;
+        }
+    } else if (io->poll == async_io_tcp_poll_send) {
+        if (!(*ops & ASYNC_IO_URING_SEND) &&
+            !usys_uring_send(
+                ring,
+                io->sock,
+                &io->b[io->c],
+                io->len - io->c,
+                async_io_uring_tag(io, ASYNC_IO_URING_SEND))) {
+            *ev |= ASYNC_IO_URING_SEND;
+            *ops |= ASYNC_IO_URING_SEND;
+        }
+    } else if (async_io_state_recv(io) || async_io_state_send(io)) {
+        // Readable, or writable when a connect completes
+        ready = async_io_state_recv(io) ? USYS_POLL_IN : USYS_POLL_OUT;
+        if (!(*ops & ASYNC_IO_URING_POLL) &&
+            !usys_uring_poll(
+                ring,
+                io->sock,
+                ready,
+                async_io_uring_tag(io, ASYNC_IO_URING_POLL))) {
+            *ev |= ASYNC_IO_URING_POLL;
+            *ops |= ASYNC_IO_URING_POLL;
+        }
+    }
+}
+
+void
+async_io_loop_unwatch(async_io* io)
+{
+    async_io_loop* loop = io->loop;
+    if (loop && loop->ring && (io->loop_events & ASYNC_IO_URING_OPS)) {
+        // Ops in flight hold the socket, cancel them now (not next poll).
+        // They stay on the slot until reaped (see async_io_uring_reaped).
+        for (uint32_t op = 1; op < ASYNC_IO_URING_OPS; op <<= 1) {
+            if (!(io->loop_events & op)) continue;
+            usys_uring_cancel(loop->ring, async_io_uring_tag(io, op));
+        }
+        usys_uring_enter(loop->ring, 0);
+    } else if (loop && loop->fd >= 0 && io->loop_events) {
+        usys_poll_set(loop->fd, io->loop_sock, io->loop_events, 0, io);
+    }
+    for (int i = 0; loop && i < loop->nev; i++) {
+        if (loop->ev[i].ptr == io) loop->ev[i].ptr = NULL;
+    }
+    for (uint32_t i = 0; loop && i < loop->nbatch; i++) {
+        if (loop->batch[i] == io) loop->batch[i] = NULL;
+    }
+    if (loop && io->loop_slot) loop->slot[io->loop_slot].gen++;
+    io->loop_sock = -1;
+    io->loop_events = 0;
+}
+
+uint64_t
+async_io_uring_tag(async_io* io, uint32_t op)
+{
+    // [gen:32||slot:28||op:4], slot 0 is the loop itself (wake)
+    uint32_t s = io->loop_slot;
+    return ((uint64_t)io->loop->slot[s].gen << 32) | ((uint64_t)s << 4) | op;
+}
+
+async_io*
+async_io_uring_tag_io(async_io_loop* loop, uint64_t tag)
+{
+    // Nothing is read from the io until its slot vouches for it
+    uint32_t s = (uint32_t)(tag >> 4) & 0x0fffffff;
+    if (!(s && s < loop->nslot)) return NULL;
+    if (!(loop->slot[s].gen == (uint32_t)(tag >> 32))) return NULL; // stale
+    return loop->slot[s].io;
+}
+
+int
+async_io_loop_slot_get(async_io_loop* loop, async_io* io)
+{
+    uint32_t s, n = loop->nslot ? loop->nslot * 2 : 64;
+    async_io_slot* slot;
+    if (!loop->slot_free) {
+        // Grow, slots keep their index (tags in flight name them)
+        if (!(n < 0x10000000 && (slot = usys_malloc(n * sizeof(*slot))))) {
+            return -1;
+        }
+        if (loop->nslot) memcpy(slot, loop->slot, loop->nslot * sizeof(*slot));
+        for (s = loop->nslot; s < n; s++) {
+            memset(&slot[s], 0, sizeof(*slot));
+            slot[s].next = s + 1 < n ? s + 1 : 0;
+        }
+        usys_free(loop->slot);
+        loop->slot_free = loop->nslot ? loop->nslot : 1;
+        loop->slot = slot;
+        loop->nslot = n;
+    }
+    s = loop->slot_free;
+    loop->slot_free = loop->slot[s].next;
+    loop->slot[s].io = io;
+    io->loop_slot = s;
+    return 0;
+}
+
+void
+async_io_loop_slot_put(async_io_loop* loop, async_io* io)
+{
+    uint32_t s = io->loop_slot;
+    if (!s) return;
+    loop->slot[s].io = NULL;
+    loop->slot[s].gen++;
+    io->loop_slot = 0;
+    if (loop->slot[s].ops) return; // freed as they are reaped
+    loop->slot[s].next = loop->slot_free;
+    loop->slot_free = s;
+}
+
 int
 async_io_tcp_poll_connect(async_io* io)
 {
@@ -194,7 +1125,8 @@ async_io_tcp_poll_connect(async_io* io)
             async_io_state_ready_set(io);
             async_io_state_recv_set(io);
             io->poll = async_io_tcp_poll_recv;
-            ret = io->on_connect(io->ctx);
+            ret = async_io_call_connect(io);
+            async_io_sendq_flush(io);
         }
     } else {
         // Invalid socket
@@ -202,6 +1134,34 @@ async_io_tcp_poll_connect(async_io* io)
     return ret;
 }
 
+int
+async_io_tcp_poll_accept(async_io* io)
+{
+    int n;
+    usys_socket_fd s[ASYNC_IO_ACCEPT_MAX];
+    usys_sockaddr addr[ASYNC_IO_ACCEPT_MAX];
+
+    // Drain the backlog, a full batch means there may be more queued
+    do {
+        n = io->accept(&io->sock, s, addr, ASYNC_IO_ACCEPT_MAX);
+        for (int i = 0; i < n; i++) {
+            if (!io->on_accept || io->on_accept(io->ctx, s[i], &addr[i])) {
+                io->close(&s[i]);
+            }
+        }
+    } while (n == ASYNC_IO_ACCEPT_MAX && async_io_has_sock(io));
+
+    // The backlog stays readable while we have no descriptor (or memory) to
+    // take it, sit out for a while instead of spinning on it
+    if (n < 0 && io->loop && (errno == EMFILE || errno == ENFILE ||
+                              errno == ENOBUFS || errno == ENOMEM)) {
+        io->pause = usys_tick_cached() + ASYNC_IO_ACCEPT_PAUSE;
+        io->state &= ~ASYNC_IO_STATE_RECV;
+        io->loop->paused++;
+    }
+    return n < 0 ? -1 : 0;
+}
+
 int
 async_io_tcp_poll_send(async_io* io)
 {
@@ -214,7 +1174,9 @@ async_io_tcp_poll_send(async_io* io)
                 sent = io->len;
                 async_io_state_recv_set(io);
                 io->poll = async_io_tcp_poll_recv;
-                io->on_send(io->ctx, 0, io->b, sent);
+                async_io_call_send(io, io->b, sent);
+                async_io_buffer_idle(io, sent);
+                async_io_sendq_flush(io);
                 ret = 0;
                 break;
             } else if (ret == 0) {
@@ -234,32 +1196,80 @@ async_io_tcp_poll_send(async_io* io)
     return ret;
 }
 
+int
+async_io_tcp_poll_sendv(async_io* io)
+{
+    int ret;
+    uint32_t n = 0;
+    usys_iovec v[ASYNC_IO_IOV_MAX];
+    async_io_buf* buf = io->q;
+
+    // Gather the queue, the head from where the last call left off. When
+    // more is queued than one call takes the tail may wait to fill a segment
+    for (; buf && n < ASYNC_IO_IOV_MAX; buf = buf->next, n++) {
+        v[n].iov_base = (void*)&buf->b[n ? 0 : io->q_off];
+        v[n].iov_len = buf->l - (n ? 0 : io->q_off);
+    }
+    ret = !n ? 0 : buf ? io->sendv_more(&io->sock, v, n)
+                       : io->sendv(&io->sock, v, n);
+    if (ret < 0) {
+        io->on_error(io->ctx); // IO error
+        async_io_state_erro_set(io);
+        io->poll = async_io_tcp_poll_connect;
+        return ret;
+    }
+    async_io_sendq_advance(io, ret);
+    if (!io->q && io->poll == async_io_tcp_poll_sendv) {
+        // Queue is out - back to recv state (keeping any bytes received)
+        io->state |= ASYNC_IO_STATE_RECV;
+        io->state &= (~(ASYNC_IO_STATE_SEND));
+        io->len = io->cap;
+        io->poll = async_io_tcp_poll_recv;
+        if (io->more) async_io_loop_more(io);
+        async_io_call_send(io, NULL, io->q_sent);
+    }
+    return 0;
+}
+
 int
 async_io_tcp_poll_recv(async_io* io)
 {
     int ret = -1;
+    uint32_t got = 0, more = io->more;
+    io->more = 0;
 
-    for (int c = 0; c < 2; c++) {
+    // Read until the socket is empty. A message only ends with an empty
+    // read so the buffer grows (up to io->max) to hold all of it.
+    for (int c = 0;; c++) {
         ret = io->recv(&io->sock, &io->b[io->c], io->len - io->c);
         if (ret >= 0) {
             io->c += ret;
+            got += ret;
             if (io->c >= io->len) {
-                // Buffer isn't big enough
-                io->on_error(io->ctx);
-                async_io_state_erro_set(io);
-                io->poll = async_io_tcp_poll_connect;
-                break;
+                if (async_io_buffer_reserve(io, io->cap * 2)) {
+                    // Buffer can't get big enough
+                    io->on_error(io->ctx);
+                    async_io_state_erro_set(io);
+                    io->poll = async_io_tcp_poll_connect;
+                    break;
+                }
+                io->len = io->cap;
+                ret = 0;
             } else if (ret == 0) {
-                if (c == 0) {
+                if (c == 0 && !more) {
                     // When a readable socket returns 0 bytes on first then
-                    // that means remote has disconnected.
+                    // that means remote has disconnected. (A turn we took
+                    // for data left by our budget may find nothing new.)
+                    async_io_state_erro_set(io);
+                    io->on_error(io->ctx);
+                    io->poll = async_io_tcp_poll_connect;
+                } else if (async_io_tcp_recv_deliver(io) &&
+                           async_io_has_sock(io)) {
+                    // Receiver refused the stream (and did not close it)
                     async_io_state_erro_set(io);
                     io->on_error(io->ctx);
                     io->poll = async_io_tcp_poll_connect;
                 } else {
-                    // Looks like we read every thing.
-                    io->on_recv(io->ctx, 0, io->b, io->c);
-                    io->c = 0;
                     ret = 0; // OK no more data
                 }
                 break;
@@ -272,11 +1282,46 @@ async_io_tcp_poll_recv(async_io* io)
             io->on_error(io->ctx); // IO error
             async_io_state_erro_set(io);
             io->poll = async_io_tcp_poll_connect;
+            break;
+        }
+        if (got >= io->budget) {
+            // Keep what we have, the rest waits for our next turn
+            async_io_loop_more(io);
+            break;
         }
     }
     return ret;
 }
 
+int
+async_io_tcp_recv_deliver(async_io* io)
+{
+    // Looks like we read every thing. What on_recv keeps of it (a message
+    // cut short) moves to the front and waits for the rest.
+    uint32_t l = io->c;
+    int err;
+    io->keep = 0;
+    err = async_io_call_recv(io, io->b, l);
+    if (err || !async_io_has_sock(io)) return err;
+    if (io->keep > l) io->keep = l;
+    if (io->keep < l) memmove(io->b, &io->b[l - io->keep], io->keep);
+    io->c = io->keep;
+    io->keep = 0;
+    if (!io->c) async_io_buffer_idle(io, l);
+    return 0;
+}
+
+int
+async_io_recv_again(async_io* io, const uint8_t* b, uint32_t l)
+{
+    if (async_io_buffer_reserve(io, io->c + l)) return -1;
+    memmove(&io->b[l], io->b, io->c);
+    memcpy(io->b, b, l);
+    io->c += l;
+    io->len = io->cap;
+    return io->c ? async_io_tcp_recv_deliver(io) : 0;
+}
+
 int
 async_io_udp_poll_send(async_io* io)
 {
@@ -289,7 +1334,7 @@ async_io_udp_poll_send(async_io* io)
                 sent = io->len;
                 async_io_state_recv_set(io);
                 io->poll = async_io_udp_poll_recv;
-                io->on_send(io->ctx, 0, io->b, sent);
+                async_io_call_send(io, io->b, sent);
                 ret = 0;
                 break;
             } else if (ret == 0) {
@@ -309,31 +1354,251 @@ async_io_udp_poll_send(async_io* io)
     return ret;
 }
 
+int
+async_io_udp_poll_sendq(async_io* io)
+{
+    int ret;
+    uint32_t n = 0, l = 0;
+    usys_datagram d[USYS_MMSG_MAX];
+    async_io_buf* buf = io->q;
+    for (; buf && n < USYS_MMSG_MAX; buf = buf->next, n++) {
+        d[n].b = (byte*)buf->b;
+        d[n].l = buf->l;
+        d[n].addr = buf->addr;
+    }
+    ret = n ? async_io_udp_send_many(io, d, n) : 0;
+    if (ret < 0) {
+        // Datagram at head refused, drop it and carry on with the rest
+        io->on_error(io->ctx); // IO error
+        ret = 0;
+        l = io->q->l;
+        io->q_sent -= l;
+    }
+    for (int i = 0; i < ret; i++) l += d[i].l;
+    async_io_sendq_advance(io, l);
+    if (!io->q && io->poll == async_io_udp_poll_sendq) {
+        // Queue is out, put into listen mode
+        async_io_state_recv_set(io);
+        io->poll = async_io_udp_poll_recv;
+        async_io_call_send(io, NULL, io->q_sent);
+    }
+    return 0;
+}
+
 int
 async_io_udp_poll_recv(async_io* io)
 {
+    int n = 0;
+    uint32_t slot = ASYNC_IO_POOL_MIN, slots = USYS_MMSG_MAX, i;
+    uint32_t got = 0, bytes = 0, peak = 0;
+    usys_datagram d[USYS_MMSG_MAX];
+    io->more = 0;
 
-    int r = -1;
-    while (1) {
-        r = io->recvfrom(&io->sock, &io->b[io->c], io->len - io->c, &io->addr);
-        if (r > 0) {
-            io->c += r;
-            if (io->c >= io->len) {
-                io->on_error(io->ctx); // IO error
+    // A slot of b per datagram (fewer if b can't grow), read until a call
+    // leaves slots empty. The byte budget is checked after each call.
+    if (slots > io->budget_n) slots = io->budget_n;
+    if (async_io_buffer_reserve(io, slot * slots)) slots = io->cap / slot;
+    while (slots) {
+        for (i = 0; i < slots; i++) {
+            d[i].b = &io->b[i * slot];
+            d[i].l = slot;
+        }
+        n = async_io_udp_recv_many(io, d, slots);
+        if (n < 0) {
+            io->on_error(io->ctx); // IO error
+            async_io_state_erro_set(io);
+            break;
+        }
+        if ((uint32_t)n > peak) peak = n;
+        for (i = 0; i < (uint32_t)n && async_io_has_sock(io); i++) {
+            if (d[i].l >= slot) {
+                // Datagram did not fit
+                io->on_error(io->ctx);
                 async_io_state_erro_set(io);
+                n = 0;
                 break;
-            } else {
-                io->on_recv(io->ctx, 0, io->b, io->c);
-                io->c = 0;
             }
-        } else if (r < 0) {
-            io->on_error(io->ctx); // IO error
-            async_io_state_erro_set(io);
+            io->addr = d[i].addr;
+            bytes += d[i].l;
+            async_io_call_recv(io, d[i].b, d[i].l);
+        }
+        if (!((uint32_t)n == slots && async_io_has_sock(io))) break;
+        if ((got += n) >= io->budget_n || bytes >= io->budget) {
+            async_io_loop_more(io);
             break;
-        } else {
-            break; // r==0
         }
+        if (slots > io->budget_n - got) slots = io->budget_n - got;
     }
 
-    return r;
+    // Everything readable this cycle was handed to on_recv, the slots go
+    // back to the pool unless batches still fill a good part of them
+    if (io->on_drain) io->on_drain(io->ctx);
+    async_io_buffer_idle(io, peak * slot);
+    return n < 0 ? -1 : 0;
+}
+
+int
+async_io_udp_recv_many(async_io* io, usys_datagram* d, uint32_t n)
+{
+    int r = 0;
+    uint32_t c = 0;
+    if (io->recvmmsg) return io->recvmmsg(&io->sock, d, n);
+    for (; c < n; c++) {
+        r = io->recvfrom(&io->sock, d[c].b, d[c].l, &d[c].addr);
+        if (r <= 0) break;
+        if ((d[c].l = r) >= ASYNC_IO_POOL_MIN) return c + 1; // too big
+    }
+    return (r < 0 && !c) ? -1 : (int)c;
+}
+
+int
+async_io_udp_send_many(async_io* io, usys_datagram* d, uint32_t n)
+{
+    int r = 0;
+    uint32_t c = 0;
+    if (io->sendmmsg) return io->sendmmsg(&io->sock, d, n);
+    for (; c < n; c++) {
+        r = io->sendto(&io->sock, d[c].b, d[c].l, &d[c].addr);
+        if (r <= 0) break;
+    }
+    return (r < 0 && !c) ? -1 : (int)c;
+}
+
+void
+async_io_loop_resume(async_io_loop* loop)
+{
+    // Listeners whose pause is over are watched again
+    async_io* io = loop->io;
+    int64_t now = usys_tick_cached();
+    loop->paused = 0;
+    for (; io; io = io->loop_next) {
+        if (!io->pause) continue;
+        if (now < io->pause) {
+            loop->paused++;
+            continue;
+        }
+        io->pause = 0;
+        if (io->poll == async_io_tcp_poll_accept && async_io_has_sock(io)) {
+            async_io_state_recv_set(io);
+            async_io_loop_sync(io);
+        }
+    }
+}
+
+void
+async_io_loop_more(async_io* io)
+{
+    io->more = io->loop ? io->loop->pass : 1;
+    if (io->loop) io->loop->more++;
+}
+
+int
+async_io_loop_poll_more(async_io_loop* loop)
+{
+    // Io cut short on an earlier pass and not polled since. Their socket
+    // may be empty now (nothing to report) while the budget kept a part of
+    // a message in io->b.
+    async_io* io = loop->io;
+    int err = 0;
+    while (io) {
+        loop->next = io->loop_next;
+        if (io->more && io->more != loop->pass && async_io_state_recv(io) &&
+            !ASYNC_IO_IS_ERRO(io->state)) {
+            err |= async_io_poll(io);
+            async_io_loop_sync(io);
+        }
+        io = loop->next;
+    }
+    loop->next = NULL;
+    return err;
+}
+
+void
+async_io_loop_stats_set(async_io_loop* loop, async_io_stats* stats)
+{
+    for (async_io* io = loop->io; io; io = io->loop_next) io->stats = stats;
+    loop->stats = stats;
+}
+
+void
+async_io_stats_init(async_io_stats* stats)
+{
+    uhist_init(&stats->wait);
+    uhist_init(&stats->iter);
+    uhist_init(&stats->recv);
+    uhist_init(&stats->send);
+    uhist_init(&stats->connect);
+    uhist_init(&stats->timers);
+    stats->waited = 0;
+}
+
+void
+async_io_stats_print(async_io_stats* stats, const char* name)
+{
+    char label[64];
+    const char* what[] = { "wait", "iter",    "recv",
+                           "send", "connect", "timers" };
+    const uhist* h[] = { &stats->wait, &stats->iter,    &stats->recv,
+                         &stats->send, &stats->connect, &stats->timers };
+    for (uint32_t i = 0; i < sizeof(h) / sizeof(h[0]); i++) {
+        snprintf(label, sizeof(label), "%s %s", name, what[i]);
+        uhist_print(h[i], label);
+    }
+}
+
+void
+async_io_stats_timers(async_io_stats* stats, int64_t t)
+{
+    if (stats) uhist_record(&stats->timers, usys_tick_ns() - t);
+}
+
+void
+async_io_loop_waited(async_io_stats* stats, int64_t t)
+{
+    usys_tick_update();
+    if (stats) {
+        t = usys_tick_cached_ns() - t;
+        stats->waited += t;
+        uhist_record(&stats->wait, t);
+    }
+}
+
+int
+async_io_call_connect(async_io* io)
+{
+    // Callbacks may release io, keep what we record into
+    async_io_stats* stats = io->stats;
+    int64_t t;
+    int ret;
+    if (!stats) return io->on_connect(io->ctx);
+    t = usys_tick_ns();
+    ret = io->on_connect(io->ctx);
+    uhist_record(&stats->connect, usys_tick_ns() - t);
+    return ret;
+}
+
+int
+async_io_call_send(async_io* io, const uint8_t* b, uint32_t l)
+{
+    async_io_stats* stats = io->stats;
+    int64_t t;
+    int ret;
+    if (!stats) return io->on_send(io->ctx, 0, b, l);
+    t = usys_tick_ns();
+    ret = io->on_send(io->ctx, 0, b, l);
+    uhist_record(&stats->send, usys_tick_ns() - t);
+    return ret;
+}
+
+int
+async_io_call_recv(async_io* io, uint8_t* b, uint32_t l)
+{
+    async_io_stats* stats = io->stats;
+    int64_t t;
+    int ret;
+    if (!stats) return io->on_recv(io->ctx, 0, b, l);
+    t = usys_tick_ns();
+    ret = io->on_recv(io->ctx, 0, b, l);
+    uhist_record(&stats->recv, usys_tick_ns() - t);
+    return ret;
 }
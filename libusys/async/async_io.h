@@ -26,8 +26,11 @@
 extern "C" {
 #endif
 
+#include "async_io_pool.h"
+#include "uhist.h"
 #include "usys_config.h"
 #include "usys_io.h"
+#include "usys_uring.h"
 
 #define ASYNC_IO_STATE_READY (0x01 << 0)
 #define ASYNC_IO_STATE_ERRO (0x01 << 1)
@@ -39,14 +42,65 @@ extern "C" {
 #define ASYNC_IO_IS_RECV(x) ((x) & (ASYNC_IO_STATE_RECV))
 #define ASYNC_IO_IS_ERRO(x) ((x) & (ASYNC_IO_STATE_ERRO))
 
+#define ASYNC_IO_IOV_MAX 64    /*!< queued buffers per send call */
+#define ASYNC_IO_ACCEPT_MAX 64 /*!< connections taken per listener poll */
+#define ASYNC_IO_ACCEPT_PAUSE 100 /*!< ms a listener out of fds sits out */
+
+#ifndef ASYNC_IO_BUFFER_MAX
+#define ASYNC_IO_BUFFER_MAX (1 << 20) /*!< default ceiling of io buffer */
+#endif
+
+// Work one io may do per poll before other io get their turn (see
+// async_io_budget_set)
+#ifndef ASYNC_IO_BUDGET_BYTES
+#define ASYNC_IO_BUDGET_BYTES (256 << 10) /*!< bytes read */
+#endif
+#ifndef ASYNC_IO_BUDGET_MSGS
+#define ASYNC_IO_BUDGET_MSGS 256 /*!< datagrams read */
+#endif
+
 /**
  * @brief IO callback
  */
 typedef int (*async_io_on_connect_fn)(void*);
-typedef int (*async_io_on_accept_fn)(void*);
+typedef int (*async_io_on_accept_fn)(void*, usys_socket_fd, usys_sockaddr*);
 typedef int (*async_io_on_erro_fn)(void*);
 typedef int (*async_io_on_send_fn)(void*, int, const uint8_t*, uint32_t);
 typedef int (*async_io_on_recv_fn)(void*, int err, uint8_t* b, uint32_t);
+typedef int (*async_io_on_drain_fn)(void*);
+typedef void (*async_io_on_wake_fn)(void*);
+
+/**
+ * @brief Buffer queued to send by reference. Must stay valid until on_sent
+ * hands it back, when it is sent or the socket closes.
+ */
+typedef struct async_io_buf
+{
+    struct async_io_buf* next; /*!< queue link */
+    const uint8_t* b;          /*!< bytes to send */
+    uint32_t l;                /*!< size of b */
+    usys_sockaddr addr;        /*!< destination (udp) */
+} async_io_buf;
+
+typedef void (*async_io_on_sent_fn)(void*, async_io_buf*);
+
+struct async_io_loop;
+
+/**
+ * @brief Where the time of a loop goes (ns). Attach with
+ * async_io_loop_stats_set (or async_io_stats_set for io polled with
+ * async_io_poll_n), nothing is measured while detached.
+ */
+typedef struct async_io_stats
+{
+    uhist wait;     /*!< blocked waiting for io */
+    uhist iter;     /*!< loop iteration, waiting excluded */
+    uhist recv;     /*!< in on_recv */
+    uhist send;     /*!< in on_send */
+    uhist connect;  /*!< in on_connect */
+    uhist timers;   /*!< timer dispatch (see async_io_stats_timers) */
+    int64_t waited; /*!< wait of the running iteration */
+} async_io_stats;
 
 /**
  * @brief Initialize io context with callbacks
@@ -58,26 +112,53 @@ typedef struct async_io_settings
     async_io_on_erro_fn on_erro;
     async_io_on_send_fn on_send;
     async_io_on_recv_fn on_recv;
+    async_io_on_drain_fn on_drain; /*!< (udp) socket read empty (optional) */
+    async_io_on_sent_fn on_sent;   /*!< queued buffer done (optional) */
 } async_io_settings;
 
 /**
- * @brief Override usys_io_... with mock behavior for test
+ * @brief Override usys_io_... with mock behavior for test. A mock transport
+ * that has no descriptors to wait on reports readiness with pending, and its
+ * io are polled by a loop of ASYNC_IO_BACKEND_MOCK.
  */
 typedef struct async_io_mock_settings
 {
     usys_io_send_fn send;
+    usys_io_sendv_fn sendv;
     usys_io_send_to_fn sendto;
+    usys_io_mmsg_fn sendmmsg;
     usys_io_recv_fn recv;
     usys_io_recv_from_fn recvfrom;
+    usys_io_mmsg_fn recvmmsg;
     usys_io_ready_fn ready;
     usys_io_connect_fn connect;
+    usys_io_accept_fn accept;
+    usys_io_listen_fn listen;
+    usys_io_pending_fn pending;
     usys_io_close_fn close;
+    usys_io_cork_fn cork; /*!< NULL io can't cork */
 } async_io_mock_settings;
 
 /**
  * @brief Main async io context
  * Send/Recv in a union to support different function pointer types for type
  * checking.
+ *
+ * Sends copy into b (async_io_..._send), or queue buffers that go out
+ * without a copy, many per call (async_io_..._sendq). Datagrams are read
+ * in batches, one slot of b each.
+ *
+ * A listener (async_io_tcp_listen) takes every queued connection when
+ * readable and hands each socket to on_accept, which owns it unless it
+ * returns an error (the socket is closed). Give the socket to an io of the
+ * same loop (or another loop, see USYS_LISTEN_REUSEPORT) with
+ * async_io_tcp_accept. A listener that runs out of descriptors (or kernel
+ * memory) leaves its loop for ASYNC_IO_ACCEPT_PAUSE ms instead of being
+ * reported ready, and failing, over and over.
+ *
+ * The buffer is taken from a pool. A receive that fills it trades it for one
+ * twice the size (up to max), and a buffer left mostly unused by a message
+ * (or by a closed socket) goes back to the smallest size.
  */
 typedef struct async_io
 {
@@ -89,11 +170,32 @@ typedef struct async_io
     usys_io_close_fn close;
     usys_io_ready_fn ready;
     usys_io_connect_fn connect;
+    usys_io_accept_fn accept;
+    usys_io_listen_fn listen;
+    usys_io_pending_fn pending; /*!< readiness of mock sockets */
     async_io_on_connect_fn on_connect;
     async_io_on_accept_fn on_accept;
     async_io_on_erro_fn on_error;
     async_io_on_send_fn on_send;
     async_io_on_recv_fn on_recv;
+    async_io_on_drain_fn on_drain;
+    async_io_on_sent_fn on_sent;
+    usys_io_sendv_fn sendv;
+    usys_io_sendv_fn sendv_more; /*!< sendv when more is queued */
+    usys_io_cork_fn cork;        /*!< NULL can't cork */
+    USYS_SOCK_PROFILE profile;   /*!< options of sockets io creates */
+    usys_io_mmsg_fn sendmmsg;    /*!< NULL sendto one at a time */
+    usys_io_mmsg_fn recvmmsg;    /*!< NULL recvfrom one at a time */
+    async_io_buf* q;             /*!< buffers to send by reference */
+    async_io_buf** q_tail;       /*!< tail ptr */
+    uint32_t q_off;              /*!< bytes of q head sent already */
+    uint32_t q_sent;             /*!< bytes sent since q was empty */
+    async_io_stats* stats;       /*!< callback latency (NULL off) */
+    struct async_io_loop* loop;  /*!< readiness set we are registered with */
+    struct async_io* loop_next;  /*!< next io registered with loop */
+    usys_socket_fd loop_sock;    /*!< socket watched by loop */
+    uint32_t loop_events;        /*!< interest (or ops in flight) in loop */
+    uint32_t loop_slot;          /*!< slot in loop (io_uring tags) 0 none */
     union
     {
         usys_io_send_fn send;
@@ -104,9 +206,94 @@ typedef struct async_io
         usys_io_recv_fn recv;
         usys_io_recv_from_fn recvfrom;
     };
-    uint8_t b[1290];
+    async_io_pool* pool; /*!< where b comes from */
+    uint32_t cap;        /*!< size of b */
+    uint32_t max;        /*!< b grows up to this */
+    uint32_t budget;     /*!< bytes read per poll */
+    uint32_t budget_n;   /*!< datagrams read per poll */
+    uint32_t more;       /*!< loop pass that cut the read short (0 none) */
+    uint32_t keep;       /*!< (stream) tail of b on_recv left for later */
+    int64_t pause;       /*!< (listener) unwatched until this tick (0 none) */
+    uint8_t* b;
 } async_io;
 
+#define ASYNC_IO_LOOP_EVENTS USYS_POLL_MAX_EVENTS
+
+/**
+ * @brief Event loop backends
+ */
+typedef enum {
+    ASYNC_IO_BACKEND_AUTO = 0, /*!< best available */
+    ASYNC_IO_BACKEND_URING,    /*!< io_uring, ops complete in the ring */
+    ASYNC_IO_BACKEND_EPOLL,    /*!< epoll, readiness then syscall */
+    ASYNC_IO_BACKEND_SELECT,   /*!< select, 32 io per call */
+    ASYNC_IO_BACKEND_MOCK      /*!< io->pending, never waits (simulation) */
+} ASYNC_IO_BACKEND;
+
+/**
+ * @brief Loop side of a registered io. Ring ops are tagged with the slot
+ * and its generation, never the io, so a completion for an io that has
+ * left (or unwatched since) is recognized without touching it.
+ *
+ * An op holds its slot until its completion is reaped (cancelled or not),
+ * no op of the same kind is queued before then. The buffer a send reads
+ * waits here if the io lets go of it (close, deinit) before that.
+ */
+typedef struct
+{
+    struct async_io* io;  /*!< io in the slot (NULL free or retired) */
+    uint32_t gen;         /*!< bumped when the io unwatches or leaves */
+    uint32_t next;        /*!< next free slot (0 none) */
+    uint32_t ops;         /*!< ops in the ring, completion not reaped */
+    uint8_t* b;           /*!< buffer a send in the ring still reads */
+    uint32_t cap;         /*!< size of b */
+    async_io_pool* pool;  /*!< where b goes back */
+} async_io_slot;
+
+/**
+ * @brief Persistent set of many async_io. Interest follows each io state
+ * (send or recv) as it changes, and a poll only visits io that are ready.
+ *
+ * With io_uring sends are submitted as ops (from io->b) and datagrams are
+ * received by one multishot op into ring buffers, every op queued during a
+ * poll reaches the kernel with one syscall on the next poll. Tcp receive
+ * and queued sends (async_io_tcp_sendq) stay readiness driven, because
+ * io->b is shared with send and a queue gathers whatever is queued when
+ * the socket is writable. Falls back to
+ * epoll, then select (async_io_poll_n), where a backend is unavailable.
+ *
+ * A poll reads at most the budget of each io (async_io_budget_set). Io
+ * left readable are reported again on the next poll, which does not wait,
+ * and behind the others: epoll queues them last, select passes start one
+ * io further each time. Io the poll did not report (their socket emptied
+ * right at the budget) get a turn after the others.
+ */
+typedef struct async_io_loop
+{
+    ASYNC_IO_BACKEND backend;    /*!< backend in use */
+    usys_poll_fd fd;             /*!< readiness set (epoll) */
+    usys_uring* ring;            /*!< ring (io_uring) */
+    uint32_t n;                  /*!< io registered */
+    async_io* io;                /*!< registered io */
+    usys_wake wake;              /*!< other threads wake us (rd -1 if off) */
+    uint32_t wake_armed;         /*!< wake poll op in the ring */
+    async_io_on_wake_fn on_wake; /*!< runs on the loop thread */
+    void* wake_ctx;              /*!< passed to on_wake */
+    async_io_stats* stats;       /*!< latency of the loop (NULL off) */
+    uint32_t more;               /*!< io left readable by their budget */
+    uint32_t rr;                 /*!< first io of the next select pass */
+    uint32_t pass;               /*!< polls so far (never 0) */
+    usys_poll_event* ev;         /*!< events being dispatched (epoll) */
+    int nev;                     /*!< number of ev */
+    async_io** batch;            /*!< io being dispatched (select, mock) */
+    uint32_t nbatch;             /*!< number of batch */
+    async_io* next;              /*!< where a walk of io resumes */
+    async_io_slot* slot;         /*!< io by slot (io_uring), 0 unused */
+    uint32_t nslot;              /*!< size of slot */
+    uint32_t slot_free;          /*!< first free slot (0 none) */
+    uint32_t paused;             /*!< listeners paused (see io->pause) */
+} async_io_loop;
+
 void async_io_tcp_init(async_io* io, async_io_settings* settings, void* ctx);
 void async_io_udp_init(async_io* io, async_io_settings* settings, void* ctx);
 void async_io_init(async_io* io, void* ctx);
@@ -114,20 +301,203 @@ void async_io_deinit(async_io* io);
 
 void async_io_install_mock(async_io* io, async_io_mock_settings* mock);
 
+/**
+ * @brief Install tcp (and udp) on every io initialized from now on, ie: the
+ * sockets of a whole node. NULL for real sockets.
+ */
+void async_io_install_mock_default(
+    async_io_mock_settings* tcp,
+    async_io_mock_settings* udp);
+
+/**
+ * @brief Make room for sz bytes in io buffer (keeps the io->c bytes already
+ * received)
+ *
+ * @return 0 OK -1 over io->max or out of memory
+ */
+int async_io_buffer_reserve(async_io* io, uint32_t sz);
+
+/**
+ * @brief Return an oversized buffer to the pool for the smallest size. No-op
+ * while the buffer holds data.
+ */
+void async_io_buffer_shrink(async_io* io);
+
+/**
+ * @brief Take buffers from pool from now on (ie: the pool of the thread that
+ * will poll io). The buffer is traded for one of the same size from pool.
+ *
+ * @return 0 OK -1 out of memory (io keeps its buffer and old pool)
+ */
+int async_io_buffer_pool_set(async_io* io, async_io_pool* pool);
+
+static inline void
+async_io_stats_set(async_io* io, async_io_stats* stats)
+{
+    io->stats = stats;
+}
+
+/**
+ * @brief Bound what one poll of io reads (0 keeps the current bound). A
+ * receive that reaches its budget keeps the rest for the next loop
+ * iteration, a stream keeps what it read so far in io->b (on_recv still
+ * sees the message in one piece).
+ */
+static inline void
+async_io_budget_set(async_io* io, uint32_t bytes, uint32_t n)
+{
+    if (bytes) io->budget = bytes;
+    if (n) io->budget_n = n;
+}
+
+/**
+ * @brief Socket options of the next connect or listen (streams start with
+ * USYS_SOCK_PROFILE_LATENCY, datagrams with USYS_SOCK_PROFILE_DISCOVERY)
+ */
+static inline void
+async_io_profile_set(async_io* io, USYS_SOCK_PROFILE profile)
+{
+    io->profile = profile;
+}
+
+static inline USYS_SOCK_PROFILE
+async_io_profile(async_io* io)
+{
+    return io->profile;
+}
+
+static inline void
+async_io_buffer_max_set(async_io* io, uint32_t max)
+{
+    io->max = max;
+}
+
 int async_io_tcp_connect(async_io* tcp, const char* ip, uint32_t p);
-int async_io_tcp_accept(async_io* io);
+
+/**
+ * @brief Listen for connections (see USYS_LISTEN_REUSEPORT to run one
+ * listener per loop thread on the same port)
+ *
+ * @return 0 OK -1 error
+ */
+int async_io_tcp_listen(async_io* io, uint32_t port, uint32_t flags);
+
+/**
+ * @brief Take over an accepted socket (from on_accept). io is ready to
+ * receive and send.
+ *
+ * @return 0 OK
+ */
+int async_io_tcp_accept(async_io* io, usys_socket_fd s, usys_sockaddr* addr);
 int async_io_udp_listen(async_io* io, uint32_t port);
 
 int async_io_tcp_send(async_io* io);
+
+/**
+ * @brief Queue buf to send without a copy. Everything queued goes out in as
+ * few calls as the socket allows, then on_send is called.
+ *
+ * @return 0 OK -1 no socket
+ */
+int async_io_tcp_sendq(async_io* io, async_io_buf* buf);
+
+/**
+ * @brief While corked partial segments wait for more, uncork pushes what
+ * waits. Lets a burst of small sends leave as full segments.
+ *
+ * @return 0 OK -1 no socket or io can't cork
+ */
+int async_io_tcp_cork(async_io* io, int on);
+
+/**
+ * @brief Queue datagram buf (to buf->addr) to send without a copy. Up to
+ * USYS_MMSG_MAX queued datagrams go out per call, then on_send is called.
+ *
+ * @return 0 OK -1 no socket
+ */
+int async_io_udp_sendq(async_io* io, async_io_buf* buf);
 int async_io_udp_send(async_io* io, uint32_t ip, uint32_t port);
 
 int async_io_poll_n(async_io** io, uint32_t n, uint32_t ms);
 
+int async_io_loop_init(async_io_loop* loop);
+
+/**
+ * @brief Init loop with backend b, or the next best one if b is unavailable
+ * (see loop->backend for the one in use)
+ *
+ * @return 0 OK
+ */
+int async_io_loop_init_backend(async_io_loop* loop, ASYNC_IO_BACKEND b);
+void async_io_loop_deinit(async_io_loop* loop);
+
+/**
+ * @brief Register an (initialized) io. The io is watched until removed or
+ * deinitialized. Handlers may deinitialize (and free) any io of the loop,
+ * events already reported for it are dropped.
+ *
+ * @return 0 OK -1 already registered
+ */
+int async_io_loop_add(async_io_loop* loop, async_io* io);
+void async_io_loop_remove(async_io_loop* loop, async_io* io);
+
+/**
+ * @brief Wait up to ms for ready io and run their poll handlers
+ *
+ * @return 0 OK or or'd handler errors, -1 wait error
+ */
+int async_io_loop_poll(async_io_loop* loop, uint32_t ms);
+
+/**
+ * @brief Let other threads interrupt async_io_loop_poll with
+ * async_io_loop_wake. fn runs on the loop thread from inside the poll, once
+ * for any number of wake ups since it last ran.
+ *
+ * @return 0 OK -1 error
+ */
+int async_io_loop_wake_init(
+    async_io_loop* loop,
+    async_io_on_wake_fn fn,
+    void* ctx);
+
+/**
+ * @brief Wake the loop (safe from any thread)
+ */
+void async_io_loop_wake(async_io_loop* loop);
+
+/**
+ * @brief Measure loop (and every io registered now or later) into stats,
+ * NULL stops measuring. Read stats from the loop thread.
+ */
+void async_io_loop_stats_set(async_io_loop* loop, async_io_stats* stats);
+
+void async_io_stats_init(async_io_stats* stats);
+
+/**
+ * @brief Log every histogram of stats, prefixed by name
+ */
+void async_io_stats_print(async_io_stats* stats, const char* name);
+
+/**
+ * @brief Record timer dispatch that started at t (usys_tick_ns), no-op
+ * when stats is NULL
+ */
+void async_io_stats_timers(async_io_stats* stats, int64_t t);
+
+/**
+ * @brief Update the loop with io state. Called by async_io whenever state
+ * changes, no-op if io is not registered.
+ */
+void async_io_loop_sync(async_io* io);
+
 int async_io_tcp_poll_connect(async_io* io);
+int async_io_tcp_poll_accept(async_io* io);
 int async_io_tcp_poll_send(async_io* io);
+int async_io_tcp_poll_sendv(async_io* io);
 int async_io_tcp_poll_recv(async_io* io);
 
 int async_io_udp_poll_send(async_io* io);
+int async_io_udp_poll_sendq(async_io* io);
 int async_io_udp_poll_recv(async_io* io);
 
 static inline int
@@ -136,19 +506,34 @@ async_io_has_sock(async_io* io)
     return (io->sock >= 0);
 }
 
+void async_io_close(async_io* io);
+
 static inline void
-async_io_close(async_io* io)
+async_io_on_recv(async_io* io, async_io_on_recv_fn fn)
 {
-    io->close(&io->sock);
-    io->state = io->len = io->c = 0;
+    io->on_recv = fn;
 }
 
+/**
+ * @brief From on_recv of a stream: leave the last l bytes it was handed in
+ * io->b (ie: the start of a message that is not all here yet). The next
+ * read appends to them and on_recv gets them again in front of it.
+ */
 static inline void
-async_io_on_recv(async_io* io, async_io_on_recv_fn fn)
+async_io_recv_keep(async_io* io, uint32_t l)
 {
-    io->on_recv = fn;
+    io->keep = l;
 }
 
+/**
+ * @brief Hand l bytes of b, followed by what io->b kept, to on_recv now as
+ * if just read (ie: bytes a previous on_recv took over before the receiver
+ * changed). An error is returned, not passed to on_erro.
+ *
+ * @return return of on_recv, -1 out of memory
+ */
+int async_io_recv_again(async_io* io, const uint8_t* b, uint32_t l);
+
 static inline void
 async_io_on_send(async_io* io, async_io_on_send_fn fn)
 {
@@ -188,7 +573,7 @@ async_io_len(async_io* self)
 static inline const void*
 async_io_memcpy(async_io* self, void* mem, size_t l)
 {
-    l = (l <= self->len) ? l : self->len;
+    if (async_io_buffer_reserve(self, l)) l = self->cap;
     self->len = l;
     return memcpy(self->b, mem, l);
 }
@@ -199,9 +584,13 @@ async_io_print(async_io* self, uint32_t idx, const char* fmt, ...)
     int l;
     va_list ap;
     va_start(ap, fmt);
-    l = vsnprintf((char*)&self->b[idx], sizeof(self->b) - idx, fmt, ap);
-    if (l >= 0) self->len = l;
+    l = vsnprintf(NULL, 0, fmt, ap);
     va_end(ap);
+    if (l < 0 || async_io_buffer_reserve(self, idx + l + 1)) return -1;
+    va_start(ap, fmt);
+    vsnprintf((char*)&self->b[idx], self->cap - idx, fmt, ap);
+    va_end(ap);
+    self->len = l;
     return l;
 }
 
@@ -220,7 +609,7 @@ async_io_buffer_length_pointer(async_io* io)
 static inline void
 async_io_len_reset(async_io* tcp)
 {
-    ((async_io*)tcp)->len = sizeof((async_io*)tcp)->b;
+    ((async_io*)tcp)->len = ((async_io*)tcp)->cap;
 }
 
 static inline int
@@ -254,7 +643,7 @@ async_io_state_recv_set(async_io* io)
     io->state |= ASYNC_IO_STATE_RECV;
     io->state &= (~(ASYNC_IO_STATE_SEND));
     io->c = 0;
-    io->len = sizeof(io->b);
+    io->len = io->cap;
 }
 
 static inline int
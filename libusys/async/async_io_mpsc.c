@@ -0,0 +1,96 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_io_mpsc.h"
+
+// Sequence per cell (bounded queue after D. Vyukov): a cell is free for the
+// push at position p when seq == p and holds an item for the pop at p when
+// seq == p + 1. Producers only race for tail.
+
+int
+async_io_mpsc_init(async_io_mpsc* q, uint32_t size)
+{
+    uint32_t n = 2;
+    memset(q, 0, sizeof(async_io_mpsc));
+    while (n < size) n <<= 1;
+    if (!(q->cell = usys_malloc(n * sizeof(async_io_mpsc_cell)))) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        q->cell[i].seq = i;
+        q->cell[i].item = NULL;
+    }
+    q->mask = n - 1;
+    return 0;
+}
+
+void
+async_io_mpsc_deinit(async_io_mpsc* q)
+{
+    if (q->cell) usys_free(q->cell);
+    memset(q, 0, sizeof(async_io_mpsc));
+}
+
+int
+async_io_mpsc_push(async_io_mpsc* q, void* item)
+{
+    async_io_mpsc_cell* c;
+    uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED), seq;
+    int32_t dif;
+    while (1) {
+        c = &q->cell[pos & q->mask];
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        dif = (int32_t)(seq - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                    &q->tail,
+                    &pos,
+                    pos + 1,
+                    1,
+                    __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1; // full
+        } else {
+            pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+    c->item = item;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void*
+async_io_mpsc_pop(async_io_mpsc* q)
+{
+    async_io_mpsc_cell* c = &q->cell[q->head & q->mask];
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    void* item;
+    if (!(seq == q->head + 1)) return NULL; // empty (or push in progress)
+    item = c->item;
+    __atomic_store_n(&c->seq, q->head + q->mask + 1, __ATOMIC_RELEASE);
+    q->head++;
+    return item;
+}
+
+//
+//
+//
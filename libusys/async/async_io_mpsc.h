@@ -0,0 +1,84 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_io_mpsc.h
+ *
+ * @brief Bounded lock-free queue of pointers, many producers (any thread)
+ * and one consumer (the loop thread). A push never blocks, it fails when
+ * the queue is full.
+ */
+#ifndef ASYNC_ASYNC_IO_MPSC_H_
+#define ASYNC_ASYNC_IO_MPSC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#define ASYNC_IO_MPSC_LINE 64 /*!< keep producer and consumer lines apart */
+
+typedef struct
+{
+    uint32_t seq; /*!< position the cell is ready for */
+    void* item;   /*!< queued pointer */
+} async_io_mpsc_cell;
+
+typedef struct
+{
+    async_io_mpsc_cell* cell; /*!< ring */
+    uint32_t mask;            /*!< size - 1 */
+    uint8_t pad0[ASYNC_IO_MPSC_LINE];
+    uint32_t tail; /*!< next position to push (producers) */
+    uint8_t pad1[ASYNC_IO_MPSC_LINE];
+    uint32_t head; /*!< next position to pop (consumer) */
+} async_io_mpsc;
+
+/**
+ * @brief Allocate queue
+ *
+ * @param q
+ * @param size number of items (rounded up to a power of 2)
+ *
+ * @return 0 OK -1 out of memory
+ */
+int async_io_mpsc_init(async_io_mpsc* q, uint32_t size);
+void async_io_mpsc_deinit(async_io_mpsc* q);
+
+/**
+ * @brief Queue item (any thread)
+ *
+ * @return 0 OK -1 full
+ */
+int async_io_mpsc_push(async_io_mpsc* q, void* item);
+
+/**
+ * @brief Take oldest item (consumer thread only)
+ *
+ * @return item or NULL if empty
+ */
+void* async_io_mpsc_pop(async_io_mpsc* q);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,91 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "async_io_pool.h"
+
+async_io_pool g_async_io_pool;
+
+// private
+int async_io_pool_class(uint32_t sz);
+
+void
+async_io_pool_init(async_io_pool* pool)
+{
+    memset(pool, 0, sizeof(async_io_pool));
+}
+
+void
+async_io_pool_deinit(async_io_pool* pool)
+{
+    void* b;
+    for (int i = 0; i < ASYNC_IO_POOL_CLASSES; i++) {
+        while ((b = pool->free[i])) {
+            pool->free[i] = *(void**)b;
+            usys_free(b);
+        }
+        pool->nfree[i] = 0;
+    }
+}
+
+uint8_t*
+async_io_pool_get(async_io_pool* pool, uint32_t sz, uint32_t* cap)
+{
+    void* b;
+    int i = async_io_pool_class(sz);
+    if (i < 0) return NULL;
+    if ((b = pool->free[i])) {
+        // Free buffers keep the list link in their first bytes
+        pool->free[i] = *(void**)b;
+        pool->nfree[i]--;
+    } else if (!(b = usys_malloc(ASYNC_IO_POOL_MIN << i))) {
+        return NULL;
+    }
+    pool->used++;
+    *cap = ASYNC_IO_POOL_MIN << i;
+    return b;
+}
+
+void
+async_io_pool_put(async_io_pool* pool, uint8_t* b, uint32_t cap)
+{
+    int i = async_io_pool_class(cap);
+    if (!b) return;
+    pool->used--;
+    if (pool->nfree[i] < ASYNC_IO_POOL_KEEP) {
+        *(void**)b = pool->free[i];
+        pool->free[i] = b;
+        pool->nfree[i]++;
+    } else {
+        usys_free(b);
+    }
+}
+
+int
+async_io_pool_class(uint32_t sz)
+{
+    int i = 0;
+    while (i < ASYNC_IO_POOL_CLASSES && (ASYNC_IO_POOL_MIN << i) < sz) i++;
+    return i < ASYNC_IO_POOL_CLASSES ? i : -1;
+}
+
+//
+//
+//
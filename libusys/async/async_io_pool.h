@@ -0,0 +1,84 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file async_io_pool.h
+ *
+ * @brief Free lists of io buffers in power of two sizes, so a connection
+ * can trade its buffer for a bigger (or smaller) one without a malloc per
+ * message. A pool is not locked, keep one per poll thread.
+ */
+#ifndef ASYNC_ASYNC_IO_POOL_H_
+#define ASYNC_ASYNC_IO_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#ifndef ASYNC_IO_POOL_MIN
+#define ASYNC_IO_POOL_MIN 2048u /*!< smallest buffer (a datagram fits) */
+#endif
+#ifndef ASYNC_IO_POOL_CLASSES
+#define ASYNC_IO_POOL_CLASSES 10 /*!< MIN..MIN<<9 (1MB) */
+#endif
+#ifndef ASYNC_IO_POOL_KEEP
+#define ASYNC_IO_POOL_KEEP 16 /*!< free buffers kept per size */
+#endif
+
+#define ASYNC_IO_POOL_MAX (ASYNC_IO_POOL_MIN << (ASYNC_IO_POOL_CLASSES - 1))
+
+typedef struct async_io_pool
+{
+    void* free[ASYNC_IO_POOL_CLASSES];     /*!< free list per size */
+    uint32_t nfree[ASYNC_IO_POOL_CLASSES]; /*!< length of free list */
+    uint32_t used;                         /*!< buffers handed out */
+} async_io_pool;
+
+/**
+ * @brief Pool used by async_io_init
+ */
+extern async_io_pool g_async_io_pool;
+
+void async_io_pool_init(async_io_pool* pool);
+void async_io_pool_deinit(async_io_pool* pool);
+
+/**
+ * @brief Take a buffer of at least sz bytes
+ *
+ * @param pool
+ * @param sz requested size (<= ASYNC_IO_POOL_MAX)
+ * @param cap [out] actual size of buffer
+ *
+ * @return buffer or NULL
+ */
+uint8_t* async_io_pool_get(async_io_pool* pool, uint32_t sz, uint32_t* cap);
+
+/**
+ * @brief Give back a buffer from async_io_pool_get (NULL is a no-op)
+ */
+void async_io_pool_put(async_io_pool* pool, uint8_t* b, uint32_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -20,8 +20,19 @@
  */
 
 #include "async_io.h"
+#include "async_io_mpsc.h"
 #include "usys_log.h"
 #include "usys_time.h"
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#ifdef USYS_TEST_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 extern int test_timers(void);
 
@@ -30,22 +41,44 @@ char* g_lorem = "Lorem ipsum dolor sit amet, consectetur adipisicing elit";
 
 // Mock overrides
 int io_mock_ready(usys_socket_fd*);
-int io_mock_connect(usys_socket_fd* fd, const char* host, int port);
+int io_mock_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags);
 void io_mock_close(usys_socket_fd* fd);
 int io_mock_send_all(usys_socket_fd* fd, const byte* b, uint32_t l);
 int io_mock_send_one(usys_socket_fd* fd, const byte* b, uint32_t l);
 int io_mock_send_min(usys_socket_fd* fd, const byte* b, uint32_t l);
 int io_mock_recv(usys_socket_fd* fd, byte* b, uint32_t l);
+int io_mock_recv_stream(usys_socket_fd* fd, byte* b, uint32_t l);
+int io_mock_recv_flood(usys_socket_fd*, byte*, uint32_t, usys_sockaddr*);
 
 // Callbacks from IO
 int io_on_connect(void* ctx);
-int io_on_accept(void* ctx);
+int io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
 int io_on_erro(void* ctx);
 int io_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
 int io_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
 int io_udp_on_erro(void* ctx);
 int io_udp_on_send(void* ctx, int err, const uint8_t* b, uint32_t l);
 int io_udp_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_stream_on_erro(void* ctx);
+int io_stream_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_listen_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr);
+int io_accepted_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_peer_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+
+#define TEST_ACCEPT_N 20 /*!< connections spread over two listeners */
+
+typedef struct
+{
+    async_io_loop* loop;
+    async_io io[TEST_ACCEPT_N]; /*!< accepted connections */
+    uint32_t n;                 /*!< accepted */
+    uint32_t local;             /*!< accepted from 127.0.0.1 */
+    uint32_t recv;              /*!< bytes received by accepted */
+} test_acceptor;
 
 typedef struct
 {
@@ -53,6 +86,13 @@ typedef struct
     async_io_mock_settings* settings;
 } io_test_settings;
 
+typedef struct test_peer
+{
+    async_io* io;           /*!< heap io, NULL once released */
+    struct test_peer* peer; /*!< released by our first datagram */
+    uint32_t* recv;         /*!< datagrams received by either */
+} test_peer;
+
 async_io_settings g_io_udp_settings = {.on_send = io_udp_on_send,
                                        .on_recv = io_udp_on_recv,
                                        .on_erro = io_udp_on_erro };
@@ -61,6 +101,27 @@ async_io_settings g_io_tcp_settings = {.on_connect = io_on_connect,
                                        .on_erro = io_on_erro,
                                        .on_send = io_on_send,
                                        .on_recv = io_on_recv };
+async_io_settings g_io_listen_settings = {.on_accept = io_listen_on_accept,
+                                          .on_erro = io_on_erro };
+async_io_settings g_io_accepted_settings = {.on_connect = io_on_connect,
+                                            .on_erro = io_on_erro,
+                                            .on_send = io_on_send,
+                                            .on_recv = io_accepted_on_recv };
+async_io_settings g_io_peer_settings = {.on_send = io_udp_on_send,
+                                        .on_recv = io_peer_on_recv,
+                                        .on_erro = io_udp_on_erro };
+async_io_settings g_io_stream_settings = {.on_connect = io_on_connect,
+                                          .on_erro = io_stream_on_erro,
+                                          .on_send = io_on_send,
+                                          .on_recv = io_stream_on_recv };
+async_io_mock_settings g_io_settings_stream = {.ready = io_mock_ready,
+                                               .connect = io_mock_connect,
+                                               .send = io_mock_send_all,
+                                               .recv = io_mock_recv_stream,
+                                               .close = io_mock_close };
+async_io_mock_settings g_io_settings_flood = {
+    .recvfrom = io_mock_recv_flood
+};
 async_io_mock_settings g_io_settings_all = {.ready = io_mock_ready,
                                             .connect = io_mock_connect,
                                             .send = io_mock_send_all,
@@ -79,6 +140,49 @@ async_io_mock_settings g_io_settings_min = {.ready = io_mock_ready,
 
 int test_send(void);
 int test_udp(void);
+int test_loop(void);
+int test_loop_backend(ASYNC_IO_BACKEND b, uint32_t port);
+int test_loop_wake(ASYNC_IO_BACKEND b, uint32_t port);
+int test_loop_free(ASYNC_IO_BACKEND b, uint32_t port);
+int test_listen(ASYNC_IO_BACKEND b, uint32_t port);
+int test_listen_nofile(ASYNC_IO_BACKEND b, uint32_t port);
+int test_close_sending(uint32_t port);
+void io_on_wake(void* ctx);
+int test_buffer(void);
+int test_udp_batch(void);
+int test_mpsc(void);
+int test_mpsc_threads(void);
+int test_log(void);
+int test_hist(void);
+int test_budget(void);
+int test_recv_keep(void);
+int test_profile(void);
+int io_batch_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+int io_batch_on_drain(void* ctx);
+void io_batch_on_sent(void* ctx, async_io_buf* buf);
+int io_keep_on_erro(void* ctx);
+int io_keep_on_recv(void* ctx, int err, uint8_t* b, uint32_t l);
+
+typedef struct
+{
+    async_io io;
+    uint32_t keep; /*!< bytes on_recv leaves in io->b */
+    int ret;       /*!< on_recv return */
+    uint32_t rx;   /*!< bytes on_recv was handed last */
+    uint8_t first; /*!< first of them */
+    int erro;      /*!< on_erro calls */
+} test_keep;
+
+async_io_settings g_io_keep_settings = {.on_connect = io_on_connect,
+                                        .on_erro = io_keep_on_erro,
+                                        .on_send = io_on_send,
+                                        .on_recv = io_keep_on_recv };
+
+#define TEST_BATCH_N 48 /*!< more datagrams than one batch call moves */
+
+uint32_t g_stream_left = 0; /*!< bytes the mock peer has yet to send */
+
+#define TEST_LOOP_N 40 /*!< more sockets than one select mask holds */
 
 int
 main(int argc, char* argv[])
@@ -89,6 +193,15 @@ main(int argc, char* argv[])
     err |= test_timers();
     err |= test_send();
     err |= test_udp();
+    err |= test_loop();
+    err |= test_buffer();
+    err |= test_udp_batch();
+    err |= test_mpsc();
+    err |= test_log();
+    err |= test_hist();
+    err |= test_budget();
+    err |= test_recv_keep();
+    err |= test_profile();
     if (err) {
         usys_log_err("%s", "[ERR]");
     } else {
@@ -115,12 +228,689 @@ test_udp(void)
         usys_msleep(10);
         async_io_poll_n(ptrs, 2, 100);
     }
+
+    // A quiet socket does not hold on to a batch worth of slots
+    if (s.cap > ASYNC_IO_POOL_MIN) count = 0;
 EXIT:
     async_io_deinit(&c);
     async_io_deinit(&s);
     return (count == 2) ? 0 : -1;
 }
 
+int
+test_loop(void)
+{
+    int err = 0;
+    err |= test_loop_backend(ASYNC_IO_BACKEND_SELECT, 12300);
+    err |= test_loop_backend(ASYNC_IO_BACKEND_EPOLL, 12400);
+    err |= test_loop_backend(ASYNC_IO_BACKEND_URING, 12500);
+    err |= test_loop_wake(ASYNC_IO_BACKEND_SELECT, 12700);
+    err |= test_loop_wake(ASYNC_IO_BACKEND_EPOLL, 12701);
+    err |= test_loop_wake(ASYNC_IO_BACKEND_URING, 12702);
+    err |= test_loop_free(ASYNC_IO_BACKEND_SELECT, 12720);
+    err |= test_loop_free(ASYNC_IO_BACKEND_EPOLL, 12723);
+    err |= test_loop_free(ASYNC_IO_BACKEND_URING, 12726);
+    err |= test_listen(ASYNC_IO_BACKEND_SELECT, 12710);
+    err |= test_listen(ASYNC_IO_BACKEND_EPOLL, 12711);
+    err |= test_listen(ASYNC_IO_BACKEND_URING, 12712);
+    err |= test_listen_nofile(ASYNC_IO_BACKEND_SELECT, 12730);
+    err |= test_listen_nofile(ASYNC_IO_BACKEND_EPOLL, 12731);
+    err |= test_listen_nofile(ASYNC_IO_BACKEND_URING, 12732);
+    err |= test_close_sending(12740);
+    return err;
+}
+
+int
+test_loop_backend(ASYNC_IO_BACKEND b, uint32_t port)
+{
+    int err = -1;
+    async_io_loop loop;
+    async_io io[TEST_LOOP_N];
+    uint32_t count = 0, n = 0;
+
+    // Each socket sends to the next one around the ring (a backend the
+    // system lacks falls back and runs the test anyway)
+    async_io_loop_init_backend(&loop, b);
+    for (; n < TEST_LOOP_N; n++) {
+        async_io_udp_init(&io[n], &g_io_udp_settings, &count);
+        if (async_io_udp_listen(&io[n], port + n)) goto EXIT;
+        if (async_io_loop_add(&loop, &io[n])) goto EXIT;
+    }
+    if (!(loop.n == TEST_LOOP_N)) goto EXIT;
+    for (uint32_t i = 0; i < TEST_LOOP_N; i++) {
+        async_io_print(&io[i], 0, "hello");
+        if (async_io_udp_send(&io[i], 0, port + (i + 1) % TEST_LOOP_N)) {
+            goto EXIT;
+        }
+    }
+    for (int i = 0; i < 10 && count < TEST_LOOP_N; i++) {
+        async_io_loop_poll(&loop, 100);
+    }
+    if (!(count == TEST_LOOP_N)) goto EXIT;
+
+    // Listening again moves the loop over to the new socket
+    if (async_io_udp_listen(&io[1], port + TEST_LOOP_N)) goto EXIT;
+    async_io_print(&io[0], 0, "hello");
+    if (async_io_udp_send(&io[0], 0, port + TEST_LOOP_N)) goto EXIT;
+    for (int i = 0; i < 10 && count < TEST_LOOP_N + 1; i++) {
+        async_io_loop_poll(&loop, 100);
+    }
+    if (!(count == TEST_LOOP_N + 1)) goto EXIT;
+
+    // A released io leaves the loop
+    async_io_deinit(&io[0]);
+    err = loop.n == TEST_LOOP_N - 1 && !io[0].loop ? 0 : -1;
+EXIT:
+    while (n--) async_io_deinit(&io[n]);
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_loop_wake(ASYNC_IO_BACKEND b, uint32_t port)
+{
+    int err = -1;
+    async_io_loop loop;
+    async_io io;
+    uint32_t count = 0, wakes = 0, t;
+
+    // A quiet socket keeps the loop waiting
+    async_io_loop_init_backend(&loop, b);
+    async_io_udp_init(&io, &g_io_udp_settings, &count);
+    if (async_io_udp_listen(&io, port)) goto EXIT;
+    if (async_io_loop_add(&loop, &io)) goto EXIT;
+    if (async_io_loop_wake_init(&loop, io_on_wake, &wakes)) goto EXIT;
+
+    // Wake ups coalesce and end the wait early
+    async_io_loop_wake(&loop);
+    async_io_loop_wake(&loop);
+    t = usys_tick();
+    async_io_loop_poll(&loop, 2000);
+    if (!(wakes == 1 && usys_tick() - t < 1000)) goto EXIT;
+
+    // And are consumed
+    t = usys_tick();
+    async_io_loop_poll(&loop, 50);
+    err = (wakes == 1 && usys_tick() - t >= 40) ? 0 : -1;
+EXIT:
+    async_io_deinit(&io);
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_loop_free(ASYNC_IO_BACKEND b, uint32_t port)
+{
+    int err = -1;
+    async_io_loop loop;
+    test_peer p[2];
+    uint32_t recv = 0, i;
+
+    // Both io receive at once, whichever is served first frees the other
+    async_io_loop_init_backend(&loop, b);
+    for (i = 0; i < 2; i++) {
+        p[i].peer = &p[i ^ 1];
+        p[i].recv = &recv;
+        if ((p[i].io = usys_malloc(sizeof(async_io)))) {
+            async_io_udp_init(p[i].io, &g_io_peer_settings, &p[i]);
+        }
+    }
+    if (!(p[0].io && p[1].io)) goto EXIT;
+    for (i = 0; i < 2; i++) {
+        if (async_io_udp_listen(p[i].io, port + i)) goto EXIT;
+        if (async_io_loop_add(&loop, p[i].io)) goto EXIT;
+    }
+    for (i = 0; i < 2; i++) {
+        async_io_print(p[i].io, 0, "hello");
+        if (async_io_udp_send(p[i].io, 0, port + (i ^ 1))) goto EXIT;
+    }
+    async_io_loop_poll(&loop, 20);
+    usys_msleep(20);
+    for (i = 0; i < 5; i++) async_io_loop_poll(&loop, 20);
+    err = recv == 1 && loop.n == 1 ? 0 : -1;
+EXIT:
+    for (i = 0; i < 2; i++) {
+        if (!p[i].io) continue;
+        async_io_deinit(p[i].io);
+        usys_free(p[i].io);
+    }
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+void
+io_on_wake(void* ctx)
+{
+    (*(uint32_t*)ctx)++;
+}
+
+int
+test_listen(ASYNC_IO_BACKEND b, uint32_t port)
+{
+    int err = -1;
+    async_io_loop loop;
+    async_io listener[2];
+    test_acceptor a = { .loop = &loop, .n = 0, .local = 0, .recv = 0 };
+    usys_socket_fd c[TEST_ACCEPT_N];
+    uint32_t n = 0, i;
+
+    // Two listeners share the port (as one per loop thread would)
+    async_io_loop_init_backend(&loop, b);
+    for (i = 0; i < 2; i++) {
+        async_io_tcp_init(&listener[i], &g_io_listen_settings, &a);
+    }
+    for (i = 0; i < 2; i++) {
+        if (async_io_tcp_listen(&listener[i], port, USYS_LISTEN_REUSEPORT)) {
+            goto EXIT;
+        }
+        if (async_io_loop_add(&loop, &listener[i])) goto EXIT;
+    }
+    for (; n < TEST_ACCEPT_N; n++) {
+        if (usys_connect(&c[n], "127.0.0.1", port, 0) < 0) goto EXIT;
+    }
+    for (i = 0; i < 20 && a.n < TEST_ACCEPT_N; i++) {
+        async_io_loop_poll(&loop, 50);
+    }
+    if (!(a.n == TEST_ACCEPT_N && a.local == TEST_ACCEPT_N)) goto EXIT;
+
+    // Accepted sockets are ordinary connections of the loop
+    for (i = 0; i < n; i++) usys_send(&c[i], (const byte*)"hello", 5);
+    for (i = 0; i < 20 && a.recv < TEST_ACCEPT_N * 5; i++) {
+        async_io_loop_poll(&loop, 50);
+    }
+    err = a.recv == TEST_ACCEPT_N * 5 ? 0 : -1;
+EXIT:
+    while (n--) usys_close(&c[n]);
+    for (i = 0; i < a.n; i++) async_io_deinit(&a.io[i]);
+    for (i = 0; i < 2; i++) async_io_deinit(&listener[i]);
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_listen_nofile(ASYNC_IO_BACKEND b, uint32_t port)
+{
+    int err = -1, fd;
+    async_io_loop loop;
+    async_io listener;
+    test_acceptor a = { .loop = &loop, .n = 0, .local = 0, .recv = 0 };
+    usys_socket_fd c[TEST_ACCEPT_N];
+    uint32_t n = 0, i;
+    struct rlimit lim, low;
+    int64_t t;
+
+    async_io_loop_init_backend(&loop, b);
+    async_io_tcp_init(&listener, &g_io_listen_settings, &a);
+    if (async_io_tcp_listen(&listener, port, 0)) goto EXIT;
+    if (async_io_loop_add(&loop, &listener)) goto EXIT;
+    for (; n < TEST_ACCEPT_N; n++) {
+        if (usys_connect(&c[n], "127.0.0.1", port, 0) < 0) goto EXIT;
+    }
+
+    // No descriptor left to accept into, the listener waits it out instead
+    // of waking the loop over and over
+    if (getrlimit(RLIMIT_NOFILE, &lim) || (fd = dup(0)) < 0) goto EXIT;
+    close(fd);
+    low = lim;
+    low.rlim_cur = fd;
+    if (setrlimit(RLIMIT_NOFILE, &low)) goto EXIT;
+    t = usys_tick();
+    for (i = 0; i < 5; i++) async_io_loop_poll(&loop, 20);
+    t = usys_tick() - t;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    if (!(a.n == 0 && t >= 80 && loop.paused == 1)) goto EXIT;
+
+    // And takes the backlog once descriptors are back
+    for (i = 0; i < 20 && a.n < TEST_ACCEPT_N; i++) {
+        async_io_loop_poll(&loop, 50);
+    }
+    err = a.n == TEST_ACCEPT_N && !loop.paused ? 0 : -1;
+EXIT:
+    while (n--) usys_close(&c[n]);
+    for (i = 0; i < a.n; i++) async_io_deinit(&a.io[i]);
+    async_io_deinit(&listener);
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+int
+test_close_sending(uint32_t port)
+{
+    int err = -1, sending = 1, small = 4096;
+    usys_socket_fd listener = -1;
+    async_io_loop loop;
+    async_io io;
+    async_io_slot* slot;
+    uint8_t* b;
+    uint32_t s, i;
+
+    // Peer never reads (nor accepts), a big send stays in the ring
+    async_io_loop_init_backend(&loop, ASYNC_IO_BACKEND_URING);
+    async_io_tcp_init(&io, &g_io_tcp_settings, &sending);
+    if (!loop.ring) {
+        err = 0; // nothing to test without io_uring
+        goto EXIT;
+    }
+    if (usys_listen_tcp(&listener, port, 0)) goto EXIT;
+    setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    if (async_io_loop_add(&loop, &io)) goto EXIT;
+    if (async_io_tcp_connect(&io, "127.0.0.1", port) < 0) goto EXIT;
+    setsockopt(io.sock, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    for (i = 0; i < 20 && !async_io_state_recv(&io); i++) {
+        async_io_loop_poll(&loop, 10);
+    }
+    if (async_io_buffer_reserve(&io, ASYNC_IO_BUFFER_MAX)) goto EXIT;
+    memset(io.b, 'A', io.cap);
+    io.len = io.cap;
+    io.c = 0;
+    if (async_io_tcp_send(&io)) goto EXIT;
+    for (i = 0; i < 5; i++) async_io_loop_poll(&loop, 10);
+    s = io.loop_slot;
+    if (!(sending && (loop.slot[s].ops & 0x02) && io.c < io.len)) goto EXIT;
+
+    // Closing hands the buffer to the slot until the cancelled send is
+    // reaped, nor is another send queued before then
+    b = io.b;
+    async_io_close(&io);
+    slot = &loop.slot[s];
+    if (!(slot->b == b && !(io.b == b))) goto EXIT;
+    for (i = 0; i < 20 && slot->ops; i++) async_io_loop_poll(&loop, 10);
+    if (!(slot->ops == 0 && slot->b == NULL)) goto EXIT;
+
+    err = 0;
+EXIT:
+    usys_close(&listener);
+    async_io_deinit(&io);
+    async_io_loop_deinit(&loop);
+    return err;
+}
+
+int
+io_listen_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
+{
+    test_acceptor* a = ctx;
+    async_io* io;
+    if (a->n == TEST_ACCEPT_N) return -1;
+    io = &a->io[a->n++];
+    if (addr->ip == 0x7f000001) a->local++;
+    async_io_tcp_init(io, &g_io_accepted_settings, &a->recv);
+    async_io_tcp_accept(io, s, addr);
+    async_io_loop_add(a->loop, io);
+    return 0;
+}
+
+int
+io_accepted_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    ((void)err);
+    ((void)b);
+    *(uint32_t*)ctx += l;
+    return 0;
+}
+
+int
+test_hist(void)
+{
+    int err = -1;
+    uhist h;
+    uint64_t v;
+    async_io_stats stats;
+    int32_t rx = 0;
+    async_io io;
+
+    // Small values are exact, buckets follow each other
+    uhist_init(&h);
+    uhist_record(&h, 3);
+    if (!(uhist_value_at(&h, 5000) == 3 && h.min == 3)) return -1;
+    for (v = 1; v < (1 << 20); v++) {
+        if (!(uhist_bucket(v) - uhist_bucket(v - 1) <= 1)) return -1;
+    }
+    if (!(uhist_bucket(UINT64_MAX) == UHIST_BUCKETS - 1)) return -1;
+
+    // Percentiles read back within a bucket
+    uhist_init(&h);
+    for (v = 1; v <= 1000; v++) uhist_record(&h, v * 1000);
+    v = uhist_value_at(&h, 5000);
+    if (!(v >= 500000 && v <= 500000 + 500000 / UHIST_SUB)) return -1;
+    v = uhist_value_at(&h, 9900);
+    if (!(v >= 990000 && v <= 990000 + 990000 / UHIST_SUB)) return -1;
+    if (!(uhist_value_at(&h, 10000) == 1000000 && h.n == 1000)) return -1;
+
+    // Callbacks of a measured io land in its stats
+    async_io_stats_init(&stats);
+    async_io_tcp_init(&io, &g_io_stream_settings, &rx);
+    async_io_install_mock(&io, &g_io_settings_stream);
+    async_io_stats_set(&io, &stats);
+    async_io_tcp_connect(&io, "thhpt", 8080);
+    g_stream_left = 100;
+    async_io_poll(&io);
+    if (!(rx == 100 && stats.connect.n == 1 && stats.recv.n == 1)) goto EXIT;
+    err = 0;
+EXIT:
+    async_io_deinit(&io);
+    return err;
+}
+
+int
+test_buffer(void)
+{
+    int err = -1;
+    int32_t rx = 0; // last message size or -1 on error
+    async_io io;
+    async_io_tcp_init(&io, &g_io_stream_settings, &rx);
+    async_io_install_mock(&io, &g_io_settings_stream);
+    async_io_tcp_connect(&io, "thhpt", 8080);
+
+    // A message many times the idle buffer arrives in one piece
+    g_stream_left = 100000;
+    async_io_poll(&io);
+    if (!(rx == 100000 && io.cap >= 100000)) goto EXIT;
+
+    // A small message after it gives the big buffer back
+    g_stream_left = 100;
+    async_io_poll(&io);
+    if (!(rx == 100 && io.cap == ASYNC_IO_POOL_MIN)) goto EXIT;
+
+    // Bigger than the ceiling is an error
+    async_io_buffer_max_set(&io, 8192);
+    g_stream_left = 10000;
+    async_io_poll(&io);
+    if (!(rx == -1)) goto EXIT;
+
+    // Sends grow the buffer too
+    async_io_tcp_connect(&io, "thhpt", 8080);
+    async_io_buffer_max_set(&io, ASYNC_IO_BUFFER_MAX);
+    if (!(async_io_print(&io, 0, "%5000s", "") == 5000)) goto EXIT;
+    if (!(async_io_len(&io) == 5000)) goto EXIT;
+    err = 0;
+EXIT:
+    async_io_deinit(&io);
+    return err || g_async_io_pool.used ? -1 : 0;
+}
+
+typedef struct
+{
+    uint32_t recv, drain, sent;
+} io_batch_count;
+
+async_io_settings g_io_batch_settings = {.on_send = io_udp_on_send,
+                                         .on_sent = io_batch_on_sent,
+                                         .on_recv = io_batch_on_recv,
+                                         .on_drain = io_batch_on_drain,
+                                         .on_erro = io_udp_on_erro };
+
+int
+test_udp_batch(void)
+{
+    int err = -1;
+    uint32_t port = 12600;
+    io_batch_count count = { 0, 0, 0 };
+    async_io c, s;
+    async_io* ptrs[] = { &c, &s };
+    async_io_buf buf[TEST_BATCH_N];
+    async_io_udp_init(&c, &g_io_batch_settings, &count);
+    async_io_udp_init(&s, &g_io_batch_settings, &count);
+    if (async_io_udp_listen(&c, port)) goto EXIT;
+    if (async_io_udp_listen(&s, port + 1)) goto EXIT;
+
+    // Queue every datagram, they go out by batch when c is writable
+    for (uint32_t i = 0; i < TEST_BATCH_N; i++) {
+        buf[i].b = (const uint8_t*)g_lorem;
+        buf[i].l = 1 + i;
+        buf[i].addr.ip = usys_atoh("127.0.0.1");
+        buf[i].addr.port = port + 1;
+        if (async_io_udp_sendq(&c, &buf[i])) goto EXIT;
+    }
+    for (int i = 0; i < 3 && async_io_state_send(&c); i++) {
+        async_io_poll_n(ptrs, 1, 100);
+    }
+    if (!(count.sent == TEST_BATCH_N)) goto EXIT;
+
+    // And are read back with one poll
+    async_io_poll_n(&ptrs[1], 1, 100);
+    err = (count.recv == TEST_BATCH_N && count.drain == 1) ? 0 : -1;
+EXIT:
+    async_io_deinit(&c);
+    async_io_deinit(&s);
+    return err;
+}
+
+int
+test_budget(void)
+{
+    int err = -1;
+    int32_t rx = 0;
+    uint32_t polls = 0;
+    io_batch_count count = { 0, 0, 0 };
+    async_io io, udp;
+    async_io_tcp_init(&io, &g_io_stream_settings, &rx);
+    async_io_udp_init(&udp, &g_io_batch_settings, &count);
+    async_io_install_mock(&io, &g_io_settings_stream);
+    async_io_tcp_connect(&io, "thhpt", 8080);
+
+    // A stream is read a budget at a time, on_recv sees the whole message
+    async_io_budget_set(&io, 16384, 0);
+    g_stream_left = 100000;
+    while (rx == 0 && polls++ < 20) async_io_poll(&io);
+    if (!(rx == 100000 && polls > 1)) goto EXIT;
+
+    // A socket that never drains gives up its turn
+    if (async_io_udp_listen(&udp, 12620)) goto EXIT;
+    async_io_install_mock(&udp, &g_io_settings_flood);
+    async_io_budget_set(&udp, 0, 40);
+    async_io_poll(&udp);
+    if (!(count.recv == 40 && count.drain == 1)) goto EXIT;
+    async_io_budget_set(&udp, 100, 0); // Bytes are counted by batch
+    async_io_poll(&udp);
+    err = count.recv == 40 + USYS_MMSG_MAX ? 0 : -1;
+EXIT:
+    async_io_deinit(&io);
+    async_io_deinit(&udp);
+    return err;
+}
+
+int
+test_recv_keep(void)
+{
+    int err = -1;
+    uint32_t polls = 0;
+    test_keep t = { .keep = 10 };
+    async_io_tcp_init(&t.io, &g_io_keep_settings, &t);
+    async_io_install_mock(&t.io, &g_io_settings_stream);
+    async_io_tcp_connect(&t.io, "thhpt", 8080);
+
+    // The tail on_recv keeps leads the next read
+    g_stream_left = 100;
+    while (t.rx == 0 && polls++ < 4) async_io_poll(&t.io);
+    if (!(t.rx == 100 && t.io.c == 10)) goto EXIT;
+    t.keep = 0;
+    g_stream_left = 50;
+    async_io_poll(&t.io);
+    if (!(t.rx == 60 && t.io.c == 0)) goto EXIT;
+
+    // Bytes a receiver took over are handed on in front of what io keeps
+    t.keep = 20;
+    g_stream_left = 20;
+    async_io_poll(&t.io);
+    if (!(t.rx == 20 && t.io.c == 20)) goto EXIT;
+    t.keep = 0;
+    if (async_io_recv_again(&t.io, (const uint8_t*)"xyz", 3)) goto EXIT;
+    if (!(t.rx == 23 && t.first == 'x' && t.io.c == 0)) goto EXIT;
+
+    // A receiver that refuses the stream fails the io
+    t.ret = -1;
+    g_stream_left = 10;
+    async_io_poll(&t.io);
+    err = t.erro == 1 && ASYNC_IO_IS_ERRO(t.io.state) ? 0 : -1;
+EXIT:
+    async_io_deinit(&t.io);
+    return err;
+}
+
+int
+test_profile(void)
+{
+    int err = -1, on = 0, tos = 0;
+    socklen_t len = sizeof(int);
+    usys_socket_fd c = -1;
+    async_io l, udp;
+    async_io_tcp_init(&l, &g_io_listen_settings, NULL);
+    async_io_udp_init(&udp, &g_io_udp_settings, NULL);
+
+    // Streams are low latency unless told otherwise, accepted sockets
+    // inherit it from their listener
+    if (!(async_io_profile(&l) == USYS_SOCK_PROFILE_LATENCY)) goto EXIT;
+    if (async_io_tcp_listen(&l, 12640, 0)) goto EXIT;
+    getsockopt(l.sock, IPPROTO_TCP, TCP_NODELAY, &on, &len);
+    if (!on) goto EXIT;
+
+    // Bulk keeps Nagle and can cork
+    if (usys_connect(
+            &c,
+            "127.0.0.1",
+            12640,
+            USYS_SOCK_PROFILE_FLAGS(USYS_SOCK_PROFILE_BULK)) < 0) {
+        goto EXIT;
+    }
+    getsockopt(c, IPPROTO_TCP, TCP_NODELAY, &on, &len);
+    if (on || usys_sock_cork(&c, 1) || usys_sock_cork(&c, 0)) goto EXIT;
+
+    // Datagrams are for discovery
+    if (async_io_udp_listen(&udp, 12641)) goto EXIT;
+    getsockopt(udp.sock, IPPROTO_IP, IP_TOS, &tos, &len);
+    err = tos == IPTOS_LOWDELAY ? 0 : -1;
+EXIT:
+    if (c >= 0) usys_close(&c);
+    async_io_deinit(&l);
+    async_io_deinit(&udp);
+    return err;
+}
+
+int
+test_mpsc(void)
+{
+    int err = 0;
+    uintptr_t i;
+    async_io_mpsc q;
+    if (async_io_mpsc_init(&q, 5)) return -1;
+
+    // Size rounds up to 8, pushes past that fail
+    for (i = 1; i <= 8; i++) err |= async_io_mpsc_push(&q, (void*)i);
+    err |= async_io_mpsc_push(&q, (void*)i) ? 0 : -1;
+
+    // Order kept across wrap around
+    for (i = 1; i <= 4; i++) err |= async_io_mpsc_pop(&q) == (void*)i ? 0 : -1;
+    for (i = 9; i <= 12; i++) err |= async_io_mpsc_push(&q, (void*)i);
+    for (i = 5; i <= 12; i++) err |= async_io_mpsc_pop(&q) == (void*)i ? 0 : -1;
+    err |= async_io_mpsc_pop(&q) ? -1 : 0;
+    async_io_mpsc_deinit(&q);
+    err |= test_mpsc_threads();
+    return err;
+}
+
+#ifdef USYS_TEST_PTHREAD
+#define TEST_MPSC_THREADS 4
+#define TEST_MPSC_N 100000
+
+typedef struct
+{
+    async_io_mpsc* q;
+    uintptr_t id;
+} test_mpsc_producer;
+
+void*
+test_mpsc_produce(void* arg)
+{
+    // Items carry producer id (high bits) and sequence (low bits)
+    test_mpsc_producer* p = arg;
+    for (uintptr_t i = 1; i <= TEST_MPSC_N; i++) {
+        while (async_io_mpsc_push(p->q, (void*)((p->id << 24) | i))) {
+            sched_yield(); // full, let the consumer catch up
+        }
+    }
+    return NULL;
+}
+
+int
+test_mpsc_threads(void)
+{
+    int err = 0;
+    async_io_mpsc q;
+    pthread_t t[TEST_MPSC_THREADS];
+    test_mpsc_producer p[TEST_MPSC_THREADS];
+    uintptr_t item, last[TEST_MPSC_THREADS] = { 0 };
+    uint32_t n = 0;
+    if (async_io_mpsc_init(&q, 64)) return -1;
+    for (uintptr_t i = 0; i < TEST_MPSC_THREADS; i++) {
+        p[i].q = &q;
+        p[i].id = i;
+        pthread_create(&t[i], NULL, test_mpsc_produce, &p[i]);
+    }
+
+    // Every item arrives once and in order of its producer
+    while (n < TEST_MPSC_THREADS * TEST_MPSC_N) {
+        if (!(item = (uintptr_t)async_io_mpsc_pop(&q))) {
+            sched_yield();
+            continue;
+        }
+        if (!((item & 0xffffff) == last[item >> 24] + 1)) err = -1;
+        last[item >> 24] = item & 0xffffff;
+        n++;
+    }
+    for (int i = 0; i < TEST_MPSC_THREADS; i++) pthread_join(t[i], NULL);
+    async_io_mpsc_deinit(&q);
+    return err;
+}
+#else
+int
+test_mpsc_threads(void)
+{
+    return 0;
+}
+#endif
+
+int
+test_log(void)
+{
+    int err = -1, fd, out = -1;
+    char path[] = "/tmp/usys_log_XXXXXX", scratch[16], b[1024];
+    ssize_t n;
+    uint32_t mask;
+    if ((fd = mkstemp(path)) < 0) return -1;
+    unlink(path);
+    fflush(stdout);
+    if ((out = dup(STDOUT_FILENO)) < 0) goto EXIT;
+    dup2(fd, STDOUT_FILENO);
+
+    // Filtered lines never reach the ring, strings are copied when recorded
+    mask = usys_log_mask_set(USYS_LOG_MASK_ALL & ~USYS_LOG_MASK(USYS_LOG_INFO));
+    usys_log_info("hidden %d", 1);
+    usys_log("shown %d", 2);
+    snprintf(scratch, sizeof(scratch), "peer");
+    usys_log_err("err %s %d", scratch, 42);
+    memset(scratch, 'x', sizeof(scratch) - 1);
+    usys_log_ok("%5.1f|%lu|%%|%c|%zu", 2.25, 7ul, 'y', (size_t)3);
+    usys_log_warn("%*d|%s", 3, 9, (char*)NULL);
+    usys_log_mask_set(mask);
+    usys_log_flush();
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+
+    lseek(fd, 0, SEEK_SET);
+    if ((n = read(fd, b, sizeof(b) - 1)) < 0) goto EXIT;
+    b[n] = 0;
+    if (strstr(b, "hidden")) goto EXIT;
+    if (!strstr(b, "shown 2\n")) goto EXIT;
+    if (!strstr(b, "err peer 42\n")) goto EXIT;
+    if (!strstr(b, "  2.2|7|%|y|3\n")) goto EXIT;
+    if (!strstr(b, "  9|(null)\n")) goto EXIT;
+    err = usys_log_dropped() ? -1 : 0;
+EXIT:
+    if (out >= 0) close(out);
+    close(fd);
+    return err;
+}
+
 int
 test_send(void)
 {
@@ -158,10 +948,15 @@ test_send(void)
 }
 
 int
-io_mock_connect(usys_socket_fd* fd, const char* host, int port)
+io_mock_connect(
+    usys_socket_fd* fd,
+    const char* host,
+    int port,
+    uint32_t flags)
 {
     ((void)host);
     ((void)port);
+    ((void)flags);
     static int sock = 0;     // 0 is a valid socket.
     if (*fd >= 0) return -1; // err already connect
     *fd = sock++;
@@ -213,6 +1008,31 @@ io_mock_recv(usys_socket_fd* fd, byte* b, uint32_t l)
     return 0; // TODO - need test vectors.
 }
 
+int
+io_mock_recv_stream(usys_socket_fd* fd, byte* b, uint32_t l)
+{
+    ((void)fd);
+    if (l > g_stream_left) l = g_stream_left;
+    memset(b, 'a', l);
+    g_stream_left -= l;
+    return l;
+}
+
+int
+io_mock_recv_flood(
+    usys_socket_fd* fd,
+    byte* b,
+    uint32_t l,
+    usys_sockaddr* addr)
+{
+    ((void)fd);
+    if (l > 10) l = 10;
+    memcpy(b, g_lorem, l);
+    addr->ip = 0x7f000001;
+    addr->port = 12621;
+    return l;
+}
+
 int
 io_on_connect(void* ctx)
 {
@@ -221,10 +1041,12 @@ io_on_connect(void* ctx)
 }
 
 int
-io_on_accept(void* ctx)
+io_on_accept(void* ctx, usys_socket_fd s, usys_sockaddr* addr)
 {
     ((void)ctx);
-    return 0;
+    ((void)s);
+    ((void)addr);
+    return -1;
 }
 
 int
@@ -274,3 +1096,76 @@ io_udp_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
     usys_log("[ IN] [UDP] size: %d", l);
     return 0;
 }
+
+int
+io_peer_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    test_peer* p = ctx;
+    ((void)err);
+    ((void)b);
+    ((void)l);
+    (*p->recv)++;
+    if (p->peer->io) {
+        async_io_deinit(p->peer->io);
+        usys_free(p->peer->io);
+        p->peer->io = NULL;
+    }
+    return 0;
+}
+
+int
+io_stream_on_erro(void* ctx)
+{
+    *(int32_t*)ctx = -1;
+    return 0;
+}
+
+int
+io_stream_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    ((void)err);
+    ((void)b);
+    *(int32_t*)ctx = l;
+    return 0;
+}
+
+int
+io_keep_on_erro(void* ctx)
+{
+    ((test_keep*)ctx)->erro++;
+    return 0;
+}
+
+int
+io_keep_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    test_keep* t = ctx;
+    ((void)err);
+    t->rx = l;
+    t->first = b[0];
+    async_io_recv_keep(&t->io, t->keep);
+    return t->ret;
+}
+
+int
+io_batch_on_recv(void* ctx, int err, uint8_t* b, uint32_t l)
+{
+    ((void)err);
+    io_batch_count* count = ctx;
+    if (!memcmp(b, g_lorem, l)) count->recv++;
+    return 0;
+}
+
+int
+io_batch_on_drain(void* ctx)
+{
+    ((io_batch_count*)ctx)->drain++;
+    return 0;
+}
+
+void
+io_batch_on_sent(void* ctx, async_io_buf* buf)
+{
+    ((void)buf);
+    ((io_batch_count*)ctx)->sent++;
+}
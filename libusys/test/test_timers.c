@@ -1,9 +1,22 @@
 #include "utimers.h"
+#include "uwheel.h"
 
-int test_timers_fn(utimers* t, void* ctx, uint32_t tick);
+#define TEST_WHEEL_N 10000
+
+typedef struct
+{
+    uwheel_node node;
+    uint64_t expire, fired;
+} test_wheel_timer;
+
+int test_timers_fn(utimers* t, void* ctx, uint64_t tick);
+void test_wheel_fn(uwheel_node* n, void* ctx, uint64_t tick);
 
 int test_timers_storage();
 int test_timers_trigger();
+int test_timers_wheel();
+int test_timers_next();
+int test_timers_cached();
 
 int
 test_timers()
@@ -11,6 +24,9 @@ test_timers()
     int err = 0;
     err |= test_timers_storage();
     err |= test_timers_trigger();
+    err |= test_timers_wheel();
+    err |= test_timers_next();
+    err |= test_timers_cached();
     return err;
 }
 
@@ -23,7 +39,7 @@ test_timers_storage()
     utimers* timer = NULL;
 
     // Init timers
-    utimers_init(timers, 100);
+    if (utimers_init(timers, 100)) return -1;
 
     // Check init state
     err |= utimers_size(timers, 100) == 0 ? 0 : -1;
@@ -65,9 +81,9 @@ int
 test_timers_trigger()
 {
     int err = 0;
-    uint32_t now = 0, then = 0, diff;
+    uint64_t now = 0, then = 0, diff;
     utimers timer[1];
-    utimers_init(timer, 1);
+    if (utimers_init(timer, 1)) return -1;
 
     utimers_insert(timer, 0, test_timers_fn, &then);
 
@@ -101,10 +117,117 @@ test_timers_trigger()
 }
 
 int
-test_timers_fn(utimers* t, void* ctx, uint32_t tick)
+test_timers_wheel()
+{
+    // Fake ticks starting close to wrap around, delays on every level
+    static test_wheel_timer t[TEST_WHEEL_N];
+    static uwheel wheel;
+    int err = 0, fired = 0;
+    uint64_t start = 0xffffffffffffff00ull, tick = start, delay;
+
+    uwheel_init(&wheel, start);
+    for (int i = 0; i < TEST_WHEEL_N; i++) {
+        uwheel_node_init(&t[i].node);
+        delay = (i * 7919u) % (i % 2 ? 300000 : 5000);
+        t[i].expire = start + delay;
+        t[i].fired = 0;
+        uwheel_add(&wheel, &t[i].node, t[i].expire);
+    }
+
+    // Cancel every third, re-arm every fifth later
+    for (int i = 0; i < TEST_WHEEL_N; i += 3) uwheel_del(&wheel, &t[i].node);
+    for (int i = 0; i < TEST_WHEEL_N; i += 5) {
+        t[i].expire += 1000;
+        uwheel_add(&wheel, &t[i].node, t[i].expire);
+    }
+
+    // Poll with uneven steps
+    while (wheel.count) {
+        tick += 1 + (tick % 97);
+        uwheel_poll(&wheel, tick, test_wheel_fn, &tick);
+    }
+    for (int i = 0; i < TEST_WHEEL_N; i++) {
+        if (i % 3 == 0 && i % 5) {
+            err |= t[i].fired ? -1 : 0;
+        } else {
+            fired++;
+            // fired on first poll at or after expire (no step exceeds 97ms)
+            err |= (int64_t)(t[i].fired - t[i].expire) >= 0 ? 0 : -1;
+            err |= t[i].fired - t[i].expire <= 97 ? 0 : -1;
+        }
+    }
+    err |= fired ? 0 : -1;
+    return err;
+}
+
+int
+test_timers_next()
+{
+    // Sleeping for uwheel_next between polls fires every timer on time
+    static test_wheel_timer t[100];
+    static uwheel wheel;
+    int err = 0, polls = 0;
+    uint64_t tick = 1000;
+    uint32_t ms;
+
+    uwheel_init(&wheel, tick);
+    err |= uwheel_next(&wheel, tick) == UWHEEL_NONE ? 0 : -1;
+    for (int i = 0; i < 100; i++) {
+        uwheel_node_init(&t[i].node);
+        t[i].expire = tick + 10 + (i * i * i * 37u) % 500000;
+        t[i].fired = 0;
+        uwheel_add(&wheel, &t[i].node, t[i].expire);
+    }
+    err |= uwheel_next(&wheel, tick) == 10 ? 0 : -1;
+    while (wheel.count && polls < 10000) {
+        ms = uwheel_next(&wheel, tick);
+        if (ms == UWHEEL_NONE) break;
+        tick += ms;
+        uwheel_poll(&wheel, tick, test_wheel_fn, NULL);
+        polls++;
+    }
+    for (int i = 0; i < 100; i++) err |= t[i].fired == t[i].expire ? 0 : -1;
+
+    // Far fewer wake ups than ms elapsed
+    err |= polls < 1000 ? 0 : -1;
+    return err;
+}
+
+int
+test_timers_cached()
+{
+    // Held readings stand still until updated, nested holds keep it
+    int err = 0;
+    int64_t t;
+    usys_tick_hold();
+    t = usys_tick_cached_ns();
+    usys_msleep(2);
+    err |= usys_tick_cached_ns() == t ? 0 : -1;
+    usys_tick_hold();
+    usys_tick_update();
+    err |= usys_tick_cached_ns() - t >= 2000000 ? 0 : -1;
+    t = usys_tick_cached();
+    usys_tick_release();
+    usys_msleep(2);
+    err |= usys_tick_cached() == t ? 0 : -1;
+    usys_tick_release();
+    err |= usys_tick_cached() - t >= 2 ? 0 : -1;
+    return err;
+}
+
+void
+test_wheel_fn(uwheel_node* n, void* ctx, uint64_t tick)
+{
+    test_wheel_timer* t = (test_wheel_timer*)n;
+    ((void)ctx);
+    t->fired = tick;
+}
+
+int
+test_timers_fn(utimers* t, void* ctx, uint64_t tick)
 {
     ((void)t);
-    uint32_t* then = (uint32_t*)ctx;
+    uint64_t* then = (uint64_t*)ctx;
     *then = tick;
     return 0;
 }
@@ -0,0 +1,87 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "uhist.h"
+#include "usys_log.h"
+
+// private
+uint64_t uhist_bucket_max(uint32_t i);
+
+void
+uhist_init(uhist* h)
+{
+    memset(h, 0, sizeof(uhist));
+    h->min = UINT64_MAX;
+}
+
+void
+uhist_merge(uhist* dst, const uhist* src)
+{
+    dst->n += src->n;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    for (uint32_t i = 0; i < UHIST_BUCKETS; i++) dst->b[i] += src->b[i];
+}
+
+uint64_t
+uhist_bucket_max(uint32_t i)
+{
+    // Bucket i covers (UHIST_SUB + sub) << shift, for 1 << shift values
+    uint32_t shift;
+    if (i < UHIST_SUB) return i;
+    shift = (i >> UHIST_SUB_BITS) - 1;
+    return (((uint64_t)(UHIST_SUB | (i & (UHIST_SUB - 1))) + 1) << shift) - 1;
+}
+
+uint64_t
+uhist_value_at(const uhist* h, uint32_t q)
+{
+    uint64_t rank, seen = 0, v;
+    if (!h->n) return 0;
+    if (q > 10000) q = 10000;
+    rank = (h->n * q + 9999) / 10000;
+    if (!rank) rank = 1;
+    for (uint32_t i = 0; i < UHIST_BUCKETS; i++) {
+        if ((seen += h->b[i]) < rank) continue;
+        v = uhist_bucket_max(i);
+        return v < h->max ? v : h->max;
+    }
+    return h->max;
+}
+
+void
+uhist_print(const uhist* h, const char* name)
+{
+    usys_log_note(
+        "[SYS] %s n %lu avg %lu p50 %lu p99 %lu p999 %lu max %lu (us)",
+        name,
+        (unsigned long)h->n,
+        (unsigned long)(h->n ? h->sum / h->n / 1000 : 0),
+        (unsigned long)(uhist_value_at(h, 5000) / 1000),
+        (unsigned long)(uhist_value_at(h, 9900) / 1000),
+        (unsigned long)(uhist_value_at(h, 9990) / 1000),
+        (unsigned long)(h->max / 1000));
+}
+
+//
+//
+//
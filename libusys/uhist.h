@@ -0,0 +1,99 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file uhist.h
+ *
+ * @brief Log-linear latency histogram (HDR style). Values below
+ * UHIST_SUB are exact, above that each power of 2 is split into UHIST_SUB
+ * buckets, so a percentile reads back within 1/UHIST_SUB of the value
+ * recorded. Recording is a few instructions and never allocates.
+ */
+#ifndef UHIST_H_
+#define UHIST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#define UHIST_SUB_BITS 4                 /*!< 16 buckets per power of 2 */
+#define UHIST_SUB (1 << UHIST_SUB_BITS)  /*!< */
+#define UHIST_MAX_BITS 40                /*!< larger values are clamped */
+#define UHIST_BUCKETS ((UHIST_MAX_BITS - UHIST_SUB_BITS + 1) * UHIST_SUB)
+
+typedef struct
+{
+    uint64_t n;                /*!< values recorded */
+    uint64_t sum;              /*!< of values */
+    uint64_t min;              /*!< smallest value (UINT64_MAX if none) */
+    uint64_t max;              /*!< largest value */
+    uint32_t b[UHIST_BUCKETS]; /*!< counts */
+} uhist;
+
+void uhist_init(uhist* h);
+
+/**
+ * @brief Add src counts into dst (ie: sum histograms of many loops)
+ */
+void uhist_merge(uhist* dst, const uhist* src);
+
+/**
+ * @brief Value at or below which q of the values lie
+ *
+ * @param h
+ * @param q per 10000 (ie: 9900 is the 99th percentile)
+ *
+ * @return upper bound of the bucket holding it (0 when empty)
+ */
+uint64_t uhist_value_at(const uhist* h, uint32_t q);
+
+/**
+ * @brief Log count, mean, p50, p99, p99.9 and max (ns values shown in us)
+ */
+void uhist_print(const uhist* h, const char* name);
+
+static inline uint32_t
+uhist_bucket(uint64_t v)
+{
+    uint32_t k;
+    if (v < UHIST_SUB) return v;
+    if (v >> UHIST_MAX_BITS) v = (1ull << UHIST_MAX_BITS) - 1;
+    k = 63 - usys_clz64_fn(v);
+    return ((k - UHIST_SUB_BITS + 1) << UHIST_SUB_BITS) |
+           ((v >> (k - UHIST_SUB_BITS)) & (UHIST_SUB - 1));
+}
+
+static inline void
+uhist_record(uhist* h, uint64_t v)
+{
+    h->n++;
+    h->sum += v;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->b[uhist_bucket(v)]++;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -36,4 +36,9 @@
 #define usys_free_fn free
 #define usys_free(x) usys_free_fn(x)
 
+#define usys_ctz64_fn __builtin_ctzll
+#define usys_clz64_fn __builtin_clzll
+
+#define usys_thread_local __thread
+
 #endif
@@ -19,31 +19,79 @@
  * @date 2017
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
 #include "usys_io.h"
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define USYS_HAVE_EPOLL 1
+#define USYS_HAVE_EVENTFD 1
+#define USYS_HAVE_MMSG 1
+#define USYS_HAVE_ACCEPT4 1
+#endif
+
+#ifndef MSG_MORE
+#define MSG_MORE 0 // Segments are not held, every call may push
+#endif
+
+/**
+ * @brief What a profile sets (0 leaves the system default)
+ */
+typedef struct
+{
+    int nodelay;   /*!< TCP_NODELAY */
+    int keepalive; /*!< SO_KEEPALIVE, probes after USYS_SOCK_KEEPIDLE */
+    int tos;       /*!< IP_TOS */
+    int sndbuf;    /*!< SO_SNDBUF */
+    int rcvbuf;    /*!< SO_RCVBUF */
+} usys_sock_opts;
+
+static const usys_sock_opts g_usys_sock_profiles[USYS_SOCK_PROFILE_COUNT] = {
+    [USYS_SOCK_PROFILE_LATENCY] = { .nodelay = 1,
+                                    .keepalive = 1,
+                                    .tos = IPTOS_LOWDELAY },
+    [USYS_SOCK_PROFILE_BULK] = { .keepalive = 1,
+                                 .tos = IPTOS_THROUGHPUT,
+                                 .sndbuf = USYS_SOCK_BULK_BUFFER,
+                                 .rcvbuf = USYS_SOCK_BULK_BUFFER },
+    [USYS_SOCK_PROFILE_DISCOVERY] = { .tos = IPTOS_LOWDELAY,
+                                      .rcvbuf = USYS_SOCK_DISCOVERY_RCVBUF },
+};
+
+// private
+int usys_sock_opt(usys_socket_fd fd, int level, int name, int val);
+int usys_sendv_flags_fd(usys_socket_fd, const usys_iovec*, uint32_t, int);
+
 int
-usys_connect(usys_socket_fd* sock_p, const char* host, int port)
+usys_connect(usys_socket_fd* sock_p, const char* host, int port, uint32_t f)
 {
     // return <0 if err, 0 if INPROGRESS, >0 if connect instant (ie local host)
     uint32_t ip;
     if (inet_pton(AF_INET, host, &ip)) {
-        return usys_connect_raw(sock_p, ip, port);
+        return usys_connect_raw(sock_p, ip, port, f);
     } else {
         return -1;
     }
 }
 
 int
-usys_connect_raw(usys_socket_fd* sock_p, uint32_t ip, int port)
+usys_connect_raw(usys_socket_fd* sock_p, uint32_t ip, int port, uint32_t f)
 {
     int ret = 0;
     struct sockaddr_in addr;
@@ -55,6 +103,8 @@ usys_connect_raw(usys_socket_fd* sock_p, uint32_t ip, int port)
     if ((*sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
         return -1;
     }
+    // Before connect, the receive buffer sets the window scale of the SYN
+    usys_sock_profile_set(*sock, USYS_SOCK_PROFILE_OF(f));
     int rc = connect(*sock, (struct sockaddr*)&addr, sizeof(addr));
     if (rc < 0) {
         if (errno == EINPROGRESS) {
@@ -71,9 +121,9 @@ usys_connect_raw(usys_socket_fd* sock_p, uint32_t ip, int port)
 }
 
 int
-usys_listen_udp(usys_socket_fd* sock_p, int port)
+usys_listen_udp(usys_socket_fd* sock_p, int port, uint32_t flags)
 {
-    int ret = 0;
+    int ret = 0, one = 1;
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -81,6 +131,19 @@ usys_listen_udp(usys_socket_fd* sock_p, int port)
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     *sock_p = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
     if (*sock_p < 0) return -1;
+    usys_sock_profile_set(*sock_p, USYS_SOCK_PROFILE_OF(flags));
+#ifdef SO_REUSEPORT
+    if ((flags & USYS_LISTEN_REUSEPORT) &&
+        setsockopt(*sock_p, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+        usys_close(sock_p);
+        return -1;
+    }
+#else
+    if (flags & USYS_LISTEN_REUSEPORT) {
+        usys_close(sock_p);
+        return -1;
+    }
+#endif
     if (bind(*sock_p, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
         usys_close(sock_p);
         return -1;
@@ -88,6 +151,121 @@ usys_listen_udp(usys_socket_fd* sock_p, int port)
     return ret;
 }
 
+int
+usys_listen_tcp(usys_socket_fd* sock_p, int port, uint32_t flags)
+{
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    *sock_p = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (*sock_p < 0) return -1;
+    setsockopt(*sock_p, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    usys_sock_profile_set(*sock_p, USYS_SOCK_PROFILE_OF(flags));
+    if (flags & USYS_LISTEN_REUSEPORT) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(*sock_p, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+            usys_close(sock_p);
+            return -1;
+        }
+#else
+        usys_close(sock_p);
+        return -1;
+#endif
+    }
+    if (bind(*sock_p, (const struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(*sock_p, USYS_LISTEN_BACKLOG) == -1) {
+        usys_close(sock_p);
+        return -1;
+    }
+    return 0;
+}
+
+int
+usys_sock_profile_set(usys_socket_fd fd, USYS_SOCK_PROFILE profile)
+{
+    int err = 0, type = 0;
+    socklen_t len = sizeof(type);
+    const usys_sock_opts* o;
+    if (!(profile > USYS_SOCK_PROFILE_NONE &&
+          profile < USYS_SOCK_PROFILE_COUNT)) {
+        return profile == USYS_SOCK_PROFILE_NONE ? 0 : -1;
+    }
+    o = &g_usys_sock_profiles[profile];
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len)) return -1;
+    if (o->sndbuf) err |= usys_sock_opt(fd, SOL_SOCKET, SO_SNDBUF, o->sndbuf);
+    if (o->rcvbuf) err |= usys_sock_opt(fd, SOL_SOCKET, SO_RCVBUF, o->rcvbuf);
+    if (o->tos) err |= usys_sock_opt(fd, IPPROTO_IP, IP_TOS, o->tos);
+    if (type != SOCK_STREAM) return err;
+    if (o->nodelay) err |= usys_sock_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    if (o->keepalive) {
+        err |= usys_sock_opt(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+#ifdef TCP_KEEPIDLE
+        err |= usys_sock_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE, USYS_SOCK_KEEPIDLE);
+#endif
+    }
+    return err;
+}
+
+int
+usys_sock_cork_fd(usys_socket_fd fd, int on)
+{
+#if defined(TCP_CORK)
+    return usys_sock_opt(fd, IPPROTO_TCP, TCP_CORK, on ? 1 : 0);
+#elif defined(TCP_NOPUSH)
+    return usys_sock_opt(fd, IPPROTO_TCP, TCP_NOPUSH, on ? 1 : 0);
+#else
+    ((void)fd);
+    ((void)on);
+    return -1;
+#endif
+}
+
+int
+usys_sock_opt(usys_socket_fd fd, int level, int name, int val)
+{
+    return setsockopt(fd, level, name, &val, sizeof(val)) ? -1 : 0;
+}
+
+int
+usys_accept_fd(
+    usys_socket_fd sockfd,
+    usys_socket_fd* s,
+    usys_sockaddr* addr,
+    uint32_t n)
+{
+    uint32_t c = 0;
+    struct sockaddr_in in;
+    socklen_t inlen;
+    while (c < n) {
+        inlen = sizeof(in);
+#if USYS_HAVE_ACCEPT4
+        s[c] = accept4(
+            sockfd,
+            (struct sockaddr*)&in,
+            &inlen,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        if ((s[c] = accept(sockfd, (struct sockaddr*)&in, &inlen)) >= 0) {
+            fcntl(s[c], F_SETFL, fcntl(s[c], F_GETFL) | O_NONBLOCK);
+            fcntl(s[c], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (s[c] < 0) {
+            // Peer gave up while queued, take the next one
+            if (errno == ECONNABORTED || errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return c ? (int)c : -1;
+        }
+        addr[c].ip = ntohl(in.sin_addr.s_addr);
+        addr[c].port = ntohs(in.sin_port);
+        c++;
+    }
+    return c;
+}
+
 int
 usys_recv_fd(int sockfd, byte* b, size_t len)
 {
@@ -135,6 +313,39 @@ usys_send_fd(usys_socket_fd sockfd, const byte* b, uint32_t len)
     return bytes_sent;
 }
 
+int
+usys_sendv_fd(usys_socket_fd sockfd, const usys_iovec* v, uint32_t n)
+{
+    return usys_sendv_flags_fd(sockfd, v, n, 0);
+}
+
+int
+usys_sendv_more_fd(usys_socket_fd sockfd, const usys_iovec* v, uint32_t n)
+{
+    return usys_sendv_flags_fd(sockfd, v, n, MSG_MORE);
+}
+
+int
+usys_sendv_flags_fd(
+    usys_socket_fd sockfd,
+    const usys_iovec* v,
+    uint32_t n,
+    int flags)
+{
+    ssize_t bytes_sent = 0;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)v;
+    msg.msg_iovlen = n;
+    bytes_sent = sendmsg(sockfd, &msg, flags);
+    if (bytes_sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            bytes_sent = 0;
+        }
+    }
+    return bytes_sent;
+}
+
 int
 usys_send_to_fd(
     usys_socket_fd sockfd,
@@ -164,6 +375,82 @@ usys_send_to_fd(
     return bytes;
 }
 
+int
+usys_recv_mmsg_fd(usys_socket_fd sockfd, usys_datagram* d, uint32_t n)
+{
+#if USYS_HAVE_MMSG
+    int r;
+    struct mmsghdr msg[USYS_MMSG_MAX];
+    struct iovec v[USYS_MMSG_MAX];
+    struct sockaddr_in in[USYS_MMSG_MAX];
+    if (n > USYS_MMSG_MAX) n = USYS_MMSG_MAX;
+    memset(msg, 0, n * sizeof(struct mmsghdr));
+    for (uint32_t i = 0; i < n; i++) {
+        v[i].iov_base = d[i].b;
+        v[i].iov_len = d[i].l;
+        msg[i].msg_hdr.msg_iov = &v[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+        msg[i].msg_hdr.msg_name = &in[i];
+        msg[i].msg_hdr.msg_namelen = sizeof(in[i]);
+    }
+    r = recvmmsg(sockfd, msg, n, MSG_DONTWAIT, NULL);
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    for (int i = 0; i < r; i++) {
+        d[i].l = msg[i].msg_len;
+        d[i].addr.ip = ntohl(in[i].sin_addr.s_addr);
+        d[i].addr.port = ntohs(in[i].sin_port);
+    }
+    return r;
+#else
+    int r = 0;
+    uint32_t c = 0;
+    for (; c < n; c++) {
+        r = usys_recv_from_fd(sockfd, d[c].b, d[c].l, &d[c].addr);
+        if (r <= 0) break;
+        d[c].l = r;
+    }
+    if (r < 0 && !c) return -1;
+    return c;
+#endif
+}
+
+int
+usys_send_mmsg_fd(usys_socket_fd sockfd, usys_datagram* d, uint32_t n)
+{
+#if USYS_HAVE_MMSG
+    int r;
+    struct mmsghdr msg[USYS_MMSG_MAX];
+    struct iovec v[USYS_MMSG_MAX];
+    struct sockaddr_in dest[USYS_MMSG_MAX];
+    if (n > USYS_MMSG_MAX) n = USYS_MMSG_MAX;
+    memset(msg, 0, n * sizeof(struct mmsghdr));
+    memset(dest, 0, n * sizeof(struct sockaddr_in));
+    for (uint32_t i = 0; i < n; i++) {
+        v[i].iov_base = d[i].b;
+        v[i].iov_len = d[i].l;
+        dest[i].sin_family = AF_INET;
+        dest[i].sin_addr.s_addr = htonl(d[i].addr.ip);
+        dest[i].sin_port = htons(d[i].addr.port);
+        msg[i].msg_hdr.msg_iov = &v[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+        msg[i].msg_hdr.msg_name = &dest[i];
+        msg[i].msg_hdr.msg_namelen = sizeof(dest[i]);
+    }
+    r = sendmmsg(sockfd, msg, n, MSG_DONTWAIT);
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return r;
+#else
+    int r = 0;
+    uint32_t c = 0;
+    for (; c < n; c++) {
+        r = usys_send_to_fd(sockfd, d[c].b, d[c].l, &d[c].addr);
+        if (r <= 0) break;
+    }
+    if (r < 0 && !c) return -1;
+    return c;
+#endif
+}
+
 void
 usys_close(usys_socket_fd* ctx)
 {
@@ -194,8 +481,8 @@ usys_select(
     // Init stack
     FD_ZERO(&readfds);
     FD_ZERO(&writefds);
-    tv.tv_sec = 0;
-    tv.tv_usec = (time * 1000);
+    tv.tv_sec = time / 1000;
+    tv.tv_usec = (time % 1000) * 1000;
 
     // Get highest socket number (for select)
     sock_p = reads;
@@ -228,6 +515,127 @@ usys_select(
     return 0;
 }
 
+usys_poll_fd
+usys_poll_open()
+{
+#ifdef USYS_HAVE_EPOLL
+    return epoll_create1(EPOLL_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+void
+usys_poll_close(usys_poll_fd* fd)
+{
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+}
+
+int
+usys_poll_set(
+    usys_poll_fd fd,
+    usys_socket_fd s,
+    uint32_t was,
+    uint32_t events,
+    void* ptr)
+{
+#ifdef USYS_HAVE_EPOLL
+    int op;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & USYS_POLL_IN) ? EPOLLIN : 0) |
+                ((events & USYS_POLL_OUT) ? EPOLLOUT : 0);
+    ev.data.ptr = ptr;
+    op = !events ? EPOLL_CTL_DEL : was ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    return epoll_ctl(fd, op, s, &ev) ? -1 : 0;
+#else
+    ((void)fd);
+    ((void)s);
+    ((void)was);
+    ((void)events);
+    ((void)ptr);
+    return -1;
+#endif
+}
+
+int
+usys_poll_wait(usys_poll_fd fd, usys_poll_event* ev, int n, int ms)
+{
+#ifdef USYS_HAVE_EPOLL
+    struct epoll_event e[USYS_POLL_MAX_EVENTS];
+    if (n > USYS_POLL_MAX_EVENTS) n = USYS_POLL_MAX_EVENTS;
+    n = epoll_wait(fd, e, n, ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n; i++) {
+        ev[i].ptr = e[i].data.ptr;
+        ev[i].events = ((e[i].events & EPOLLIN) ? USYS_POLL_IN : 0) |
+                       ((e[i].events & EPOLLOUT) ? USYS_POLL_OUT : 0) |
+                       ((e[i].events & (EPOLLERR | EPOLLHUP)) ? USYS_POLL_ERR
+                                                               : 0);
+    }
+    return n;
+#else
+    ((void)fd);
+    ((void)ev);
+    ((void)n);
+    ((void)ms);
+    return -1;
+#endif
+}
+
+int
+usys_wake_open(usys_wake* wake)
+{
+#ifdef USYS_HAVE_EVENTFD
+    wake->rd = wake->wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return wake->rd < 0 ? -1 : 0;
+#else
+    int fd[2];
+    wake->rd = wake->wr = -1;
+    if (pipe(fd)) return -1;
+    for (int i = 0; i < 2; i++) {
+        fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+    }
+    wake->rd = fd[0];
+    wake->wr = fd[1];
+    return 0;
+#endif
+}
+
+void
+usys_wake_close(usys_wake* wake)
+{
+    if (!(wake->wr == wake->rd) && wake->wr >= 0) close(wake->wr);
+    if (wake->rd >= 0) close(wake->rd);
+    wake->rd = wake->wr = -1;
+}
+
+void
+usys_wake_signal(usys_wake* wake)
+{
+#ifdef USYS_HAVE_EVENTFD
+    uint64_t one = 1;
+#else
+    byte one = 1;
+#endif
+    // Would block (pipe full) means a signal is pending already
+    ssize_t n = write(wake->wr, &one, sizeof(one));
+    ((void)n);
+}
+
+void
+usys_wake_drain(usys_wake* wake)
+{
+    // eventfd reads the whole count at once, a pipe reads until empty
+    uint64_t b[8];
+    ssize_t n;
+    do {
+        n = read(wake->rd, b, sizeof(b));
+    } while (n == sizeof(b));
+}
+
 int
 usys_sock_error(usys_socket_fd* sock)
 {
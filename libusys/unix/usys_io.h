@@ -34,6 +34,8 @@ extern "C" {
 
 #include "usys_config.h"
 
+#include <sys/uio.h>
+
 typedef int usys_socket_fd;
 typedef int usys_file_fd;
 typedef unsigned char byte;
@@ -42,6 +44,50 @@ typedef struct
     uint32_t ip;
     uint32_t port;
 } usys_sockaddr;
+typedef struct iovec usys_iovec; /*!< iov_base, iov_len */
+
+#define USYS_MMSG_MAX 32 /*!< datagrams per usys_recv_mmsg/usys_send_mmsg */
+
+#define USYS_LISTEN_BACKLOG 1024          /*!< pending connections queued */
+#define USYS_LISTEN_REUSEPORT (0x01 << 0) /*!< share port (one per thread) */
+
+/**
+ * @brief Socket options set when a socket is created (usys_connect...,
+ * usys_listen_...). Options the system refuses or caps (ie: buffers above
+ * net.core.rmem_max) are best effort, they never fail the socket.
+ */
+typedef enum {
+    USYS_SOCK_PROFILE_NONE = 0,  /*!< system defaults */
+    USYS_SOCK_PROFILE_LATENCY,   /*!< TCP_NODELAY, keepalive, low delay TOS */
+    USYS_SOCK_PROFILE_BULK,      /*!< big buffers, keepalive, throughput TOS */
+    USYS_SOCK_PROFILE_DISCOVERY, /*!< big receive buffer for udp bursts */
+    USYS_SOCK_PROFILE_COUNT
+} USYS_SOCK_PROFILE;
+
+#define USYS_SOCK_PROFILE_SHIFT 8
+#define USYS_SOCK_PROFILE_FLAGS(p) ((uint32_t)(p) << USYS_SOCK_PROFILE_SHIFT)
+#define USYS_SOCK_PROFILE_OF(flags)                                            \
+    ((USYS_SOCK_PROFILE)(((flags) >> USYS_SOCK_PROFILE_SHIFT) & 0xff))
+
+#ifndef USYS_SOCK_BULK_BUFFER
+#define USYS_SOCK_BULK_BUFFER (4 << 20) /*!< send and receive buffers */
+#endif
+#ifndef USYS_SOCK_DISCOVERY_RCVBUF
+#define USYS_SOCK_DISCOVERY_RCVBUF (1 << 20) /*!< datagrams held */
+#endif
+#ifndef USYS_SOCK_KEEPIDLE
+#define USYS_SOCK_KEEPIDLE 60 /*!< seconds quiet before the first probe */
+#endif
+
+/**
+ * @brief One datagram of a batch
+ */
+typedef struct
+{
+    byte* b;            /*!< payload */
+    uint32_t l;         /*!< size (recv: room in b, then size read) */
+    usys_sockaddr addr; /*!< sender or destination */
+} usys_datagram;
 
 // File sys call abstraction layer
 usys_file_fd usys_file_open(const char* path);
@@ -51,24 +97,75 @@ int usys_file_close(usys_file_fd* fd);
 
 // Networking sys call abstraction layer
 typedef int (*usys_io_send_fn)(usys_socket_fd*, const byte*, uint32_t);
+typedef int (*usys_io_sendv_fn)(usys_socket_fd*, const usys_iovec*, uint32_t);
 typedef int (*usys_io_send_to_fn)(
     usys_socket_fd*,
     const byte*,
     uint32_t,
     usys_sockaddr*);
 typedef int (*usys_io_recv_fn)(usys_socket_fd*, byte*, uint32_t);
+typedef int (*usys_io_mmsg_fn)(usys_socket_fd*, usys_datagram*, uint32_t);
 typedef int (
     *usys_io_recv_from_fn)(usys_socket_fd*, byte*, uint32_t, usys_sockaddr*);
-typedef int (*usys_io_connect_fn)(usys_socket_fd*, const char*, int);
+typedef int (*usys_io_connect_fn)(usys_socket_fd*, const char*, int, uint32_t);
+typedef int (*usys_io_accept_fn)(
+    usys_socket_fd*,
+    usys_socket_fd*,
+    usys_sockaddr*,
+    uint32_t);
 typedef int (*usys_io_ready_fn)(usys_socket_fd*);
+typedef int (*usys_io_listen_fn)(usys_socket_fd*, int, uint32_t);
+typedef int (*usys_io_pending_fn)(usys_socket_fd*); /*!< USYS_POLL_... now */
 typedef void (*usys_io_close_fn)(usys_socket_fd*);
-int usys_connect(usys_socket_fd* fd, const char* host, int port);
-int usys_connect_raw(usys_socket_fd* fd, uint32_t ip, int port);
-int usys_listen_udp(usys_socket_fd* sock_p, int port);
+typedef int (*usys_io_cork_fn)(usys_socket_fd*, int);
+
+/**
+ * @brief Non blocking connect and udp listener
+ *
+ * @param flags USYS_SOCK_PROFILE_FLAGS(profile) (and USYS_LISTEN_REUSEPORT
+ * for listeners)
+ */
+int usys_connect(usys_socket_fd* fd, const char* host, int port, uint32_t);
+int usys_connect_raw(usys_socket_fd* fd, uint32_t ip, int port, uint32_t);
+int usys_listen_udp(usys_socket_fd* sock_p, int port, uint32_t flags);
+
+/**
+ * @brief Non blocking tcp listener on every interface
+ *
+ * @param sock_p listening socket
+ * @param port
+ * @param flags USYS_LISTEN_REUSEPORT lets each thread listen on the same port
+ * with its own socket, the kernel spreads connections across them. A
+ * USYS_SOCK_PROFILE_FLAGS(profile) is what accepted sockets inherit.
+ *
+ * @return 0 OK -1 error
+ */
+int usys_listen_tcp(usys_socket_fd* sock_p, int port, uint32_t flags);
+
+/**
+ * @brief Apply a profile to an open socket (tcp only options are skipped on
+ * datagram sockets). Accepted sockets inherit the options of their listener.
+ *
+ * @return 0 OK -1 some option was refused
+ */
+int usys_sock_profile_set(usys_socket_fd fd, USYS_SOCK_PROFILE profile);
+
+/**
+ * @brief Hold partial segments while on, what is held goes out when turned
+ * off (TCP_CORK, TCP_NOPUSH)
+ *
+ * @return 0 OK -1 error or not supported
+ */
+int usys_sock_cork_fd(usys_socket_fd fd, int on);
+int usys_accept_fd(usys_socket_fd, usys_socket_fd*, usys_sockaddr*, uint32_t);
 int usys_send_fd(usys_socket_fd fd, const byte* b, uint32_t len);
+int usys_sendv_fd(usys_socket_fd fd, const usys_iovec* v, uint32_t n);
+int usys_sendv_more_fd(usys_socket_fd fd, const usys_iovec* v, uint32_t n);
 int usys_send_to_fd(usys_socket_fd, const byte*, uint32_t, usys_sockaddr*);
 int usys_recv_fd(int sockfd, byte* b, size_t len);
 int usys_recv_from_fd(int sockfd, byte* b, size_t len, usys_sockaddr*);
+int usys_recv_mmsg_fd(usys_socket_fd fd, usys_datagram* d, uint32_t n);
+int usys_send_mmsg_fd(usys_socket_fd fd, usys_datagram* d, uint32_t n);
 void usys_close(usys_socket_fd* fd);
 void usys_close_fd(usys_socket_fd s);
 int usys_sock_error(usys_socket_fd* fd);
@@ -89,12 +186,115 @@ uint32_t usys_select(
     int nreads,
     int* writes,
     int nwrites);
+
+// Readiness notification (epoll where available)
+#define USYS_POLL_IN (0x01 << 0)
+#define USYS_POLL_OUT (0x01 << 1)
+#define USYS_POLL_ERR (0x01 << 2)
+#define USYS_POLL_MAX_EVENTS 64
+
+typedef int usys_poll_fd;
+typedef struct
+{
+    uint32_t events; /*!< USYS_POLL_... */
+    void* ptr;       /*!< as registered */
+} usys_poll_event;
+
+/**
+ * @brief Open a readiness set. Sockets stay registered between waits so a
+ * wait only costs the number of ready sockets.
+ *
+ * @return fd or -1 if the platform has no readiness set (use usys_select)
+ */
+usys_poll_fd usys_poll_open(void);
+void usys_poll_close(usys_poll_fd* fd);
+
+/**
+ * @brief Add, change or remove (events == 0) interest in a socket
+ *
+ * @param fd readiness set
+ * @param s socket
+ * @param was events currently registered (0 if not registered)
+ * @param events USYS_POLL_IN and/or USYS_POLL_OUT, 0 to remove
+ * @param ptr returned with events of s
+ *
+ * @return 0 OK -1 error
+ */
+int usys_poll_set(
+    usys_poll_fd fd,
+    usys_socket_fd s,
+    uint32_t was,
+    uint32_t events,
+    void* ptr);
+
+/**
+ * @brief Wait for ready sockets
+ *
+ * @param fd readiness set
+ * @param ev result
+ * @param n size of ev (at most USYS_POLL_MAX_EVENTS)
+ * @param ms timeout
+ *
+ * @return number of ev populated, -1 error
+ */
+int usys_poll_wait(usys_poll_fd fd, usys_poll_event* ev, int n, int ms);
+
+/**
+ * @brief Wake a thread blocked in a readiness wait from any thread (eventfd
+ * where available, else a pipe). Watch rd for USYS_POLL_IN.
+ */
+typedef struct
+{
+    usys_file_fd rd; /*!< becomes readable when signaled */
+    usys_file_fd wr; /*!< written by usys_wake_signal (rd for eventfd) */
+} usys_wake;
+
+int usys_wake_open(usys_wake* wake);
+void usys_wake_close(usys_wake* wake);
+
+/**
+ * @brief Make rd readable (safe from any thread, signals coalesce)
+ */
+void usys_wake_signal(usys_wake* wake);
+
+/**
+ * @brief Consume every signal so far (call before looking for work)
+ */
+void usys_wake_drain(usys_wake* wake);
+
 static inline int
 usys_send(usys_socket_fd* fd, const byte* b, uint32_t len)
 {
     return usys_send_fd(*(usys_socket_fd*)fd, b, len);
 }
 
+/**
+ * @brief Send n buffers with one call (gather write)
+ *
+ * @return bytes sent (0 would block, may end part way in a buffer) or -1
+ */
+static inline int
+usys_sendv(usys_socket_fd* fd, const usys_iovec* v, uint32_t n)
+{
+    return usys_sendv_fd(*(usys_socket_fd*)fd, v, n);
+}
+
+/**
+ * @brief usys_sendv when more follows at once (MSG_MORE), the tail may wait
+ * for the next call to fill a segment
+ */
+static inline int
+usys_sendv_more(usys_socket_fd* fd, const usys_iovec* v, uint32_t n)
+{
+    return usys_sendv_more_fd(*(usys_socket_fd*)fd, v, n);
+}
+
+static inline int
+usys_sock_cork(usys_socket_fd* fd, int on)
+{
+    return usys_sock_cork_fd(*(usys_socket_fd*)fd, on);
+}
+
 static inline int
 usys_recv(usys_socket_fd* fd, byte* b, uint32_t len)
 {
@@ -117,6 +317,39 @@ usys_recv_from(usys_socket_fd* fd, byte* b, uint32_t len, usys_sockaddr* addr)
     return usys_recv_from_fd(*(usys_socket_fd*)fd, b, len, addr);
 }
 
+/**
+ * @brief Take up to n queued connections (non blocking, close on exec)
+ *
+ * @return connections taken (0 would block) or -1
+ */
+static inline int
+usys_accept(usys_socket_fd* fd, usys_socket_fd* s, usys_sockaddr* a, uint32_t n)
+{
+    return usys_accept_fd(*(usys_socket_fd*)fd, s, a, n);
+}
+
+/**
+ * @brief Read up to n datagrams with one call
+ *
+ * @return datagrams read (0 would block) or -1
+ */
+static inline int
+usys_recv_mmsg(usys_socket_fd* fd, usys_datagram* d, uint32_t n)
+{
+    return usys_recv_mmsg_fd(*(usys_socket_fd*)fd, d, n);
+}
+
+/**
+ * @brief Send up to n datagrams with one call
+ *
+ * @return datagrams sent (0 would block) or -1
+ */
+static inline int
+usys_send_mmsg(usys_socket_fd* fd, usys_datagram* d, uint32_t n)
+{
+    return usys_send_mmsg_fd(*(usys_socket_fd*)fd, d, n);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,21 +20,420 @@
  */
 
 #include "usys_log.h"
+#include "usys_time.h"
+
+#ifdef USYS_CONFIG_PTHREAD
+#include "usys_io.h"
+#include <poll.h>
+#include <pthread.h>
+#endif
+
+#define USYS_LOG_BATCH 16384 /*!< writer output buffer */
+
+/**
+ * @brief How a captured argument is passed back to snprintf
+ */
+typedef enum {
+    USYS_LOG_ARG_INT = 0,
+    USYS_LOG_ARG_LONG = 1,
+    USYS_LOG_ARG_LLONG = 2,
+    USYS_LOG_ARG_SIZE = 3,
+    USYS_LOG_ARG_DBL = 4,
+    USYS_LOG_ARG_PTR = 5,
+    USYS_LOG_ARG_STR = 6 /*!< offset into str */
+} USYS_LOG_ARG;
+
+typedef union
+{
+    int64_t i;
+    double d;
+    const void* p;
+} usys_log_arg;
+
+/**
+ * @brief One line in flight
+ */
+typedef struct
+{
+    uint32_t seq;                    /*!< ring position + 1 when published */
+    uint8_t lvl;                     /*!< USYS_LOG_LEVEL */
+    uint8_t n;                       /*!< captured arguments */
+    uint8_t kind[USYS_LOG_ARGS];     /*!< USYS_LOG_ARG per argument */
+    const char* fmt;                 /*!< caller format, NULL if str is line */
+    usys_log_arg arg[USYS_LOG_ARGS]; /*!< captured arguments */
+    char str[USYS_LOG_STRS];         /*!< copied strings */
+} usys_log_rec;
+
+// private
+int usys_log_capture(usys_log_rec* rec, const char* fmt, va_list ap);
+void usys_log_fill(usys_log_rec*, USYS_LOG_LEVEL, const char*, va_list);
+int usys_log_print(char*, uint32_t, const char*, const usys_log_rec*, int);
+uint32_t usys_log_format(const usys_log_rec* rec, char* out, uint32_t sz);
+void usys_log_write(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap);
+#ifdef USYS_CONFIG_PTHREAD
+void usys_log_start(void);
+void usys_log_push(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap);
+uint32_t usys_log_drain(void);
+int usys_log_pending(void);
+void* usys_log_thread(void* ctx);
+#endif
+
+const char* g_usys_log_colors[] = USYS_LOG_COLORS;
+uint32_t g_usys_log_mask = USYS_LOG_MASK_ALL;
+uint32_t g_usys_log_drops = 0;
+#ifdef USYS_CONFIG_PTHREAD
+usys_log_rec g_usys_log_ring[USYS_LOG_RING]; /*!< bounded mpsc ring */
+uint32_t g_usys_log_tail = 0;    /*!< next position to reserve (producers) */
+uint32_t g_usys_log_head = 0;    /*!< next position to write (writer) */
+uint32_t g_usys_log_idle = 0;    /*!< writer is (about to be) blocked */
+uint32_t g_usys_log_running = 0; /*!< writer accepts records */
+uint32_t g_usys_log_busy = 0;    /*!< producers between check and publish */
+usys_wake g_usys_log_wake;       /*!< wakes an idle writer */
+pthread_t g_usys_log_writer;
+pthread_once_t g_usys_log_once = PTHREAD_ONCE_INIT;
+#endif
 
 void
 usys_log_(USYS_LOG_LEVEL lvl, const char* fmt, ...)
 {
-    char* usys_colors[] = USYS_LOG_COLORS;
     va_list ap;
-
-    // Switch font color
-    printf("%s", usys_colors[lvl]);
-
-    // print user
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+#ifdef USYS_CONFIG_PTHREAD
+    pthread_once(&g_usys_log_once, usys_log_start);
+    __atomic_fetch_add(&g_usys_log_busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_usys_log_running, __ATOMIC_SEQ_CST)) {
+        usys_log_push(lvl, fmt, ap);
+        __atomic_fetch_sub(&g_usys_log_busy, 1, __ATOMIC_RELEASE);
+        va_end(ap);
+        return;
+    }
+    __atomic_fetch_sub(&g_usys_log_busy, 1, __ATOMIC_RELEASE);
+#endif
+    usys_log_write(lvl, fmt, ap);
     va_end(ap);
+}
+
+uint32_t
+usys_log_mask_set(uint32_t mask)
+{
+    return __atomic_exchange_n(&g_usys_log_mask, mask, __ATOMIC_RELAXED);
+}
 
-    // newline
-    printf("\n" USYS_LOG_RESET);
+uint32_t
+usys_log_dropped(void)
+{
+    return __atomic_load_n(&g_usys_log_drops, __ATOMIC_RELAXED);
+}
+
+void
+usys_log_flush(void)
+{
+#ifdef USYS_CONFIG_PTHREAD
+    while (__atomic_load_n(&g_usys_log_running, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&g_usys_log_head, __ATOMIC_ACQUIRE) !=
+               __atomic_load_n(&g_usys_log_tail, __ATOMIC_ACQUIRE)) {
+        usys_msleep(1);
+    }
+#endif
+}
+
+void
+usys_log_stop(void)
+{
+#ifdef USYS_CONFIG_PTHREAD
+    if (!__atomic_exchange_n(&g_usys_log_running, 0, __ATOMIC_SEQ_CST)) return;
+    usys_wake_signal(&g_usys_log_wake);
+    pthread_join(g_usys_log_writer, NULL);
+
+    // Producers that saw us running may still be publishing (and signal
+    // the wake), the lines they finish are written by the last drain
+    while (__atomic_load_n(&g_usys_log_busy, __ATOMIC_ACQUIRE)) usys_msleep(1);
+    usys_wake_close(&g_usys_log_wake);
+    usys_log_drain();
+#endif
+}
+
+int
+usys_log_capture(usys_log_rec* rec, const char* fmt, va_list ap)
+{
+    uint32_t s = 0, l;
+    const char* v;
+    usys_log_arg* a;
+    USYS_LOG_ARG kind;
+
+    rec->n = 0;
+    while ((fmt = strchr(fmt, '%'))) {
+        if (*++fmt == '%') {
+            fmt++;
+            continue;
+        }
+        while (*fmt && strchr("-+ #.0123456789", *fmt)) fmt++;
+        kind = USYS_LOG_ARG_INT;
+        if (*fmt == 'h') {
+            fmt += fmt[1] == 'h' ? 2 : 1;
+        } else if (*fmt == 'z') {
+            fmt++;
+            kind = USYS_LOG_ARG_SIZE;
+        } else if (*fmt == 'l') {
+            kind = *++fmt == 'l' ? USYS_LOG_ARG_LLONG : USYS_LOG_ARG_LONG;
+            if (*fmt == 'l') fmt++;
+        }
+        if (rec->n == USYS_LOG_ARGS) return -1;
+        a = &rec->arg[rec->n];
+        switch (*fmt++) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                if (kind == USYS_LOG_ARG_INT) {
+                    a->i = va_arg(ap, int);
+                } else if (kind == USYS_LOG_ARG_LONG) {
+                    a->i = va_arg(ap, long);
+                } else if (kind == USYS_LOG_ARG_LLONG) {
+                    a->i = va_arg(ap, long long);
+                } else {
+                    a->i = (int64_t)va_arg(ap, size_t);
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                if (kind > USYS_LOG_ARG_LONG) return -1;
+                kind = USYS_LOG_ARG_DBL;
+                a->d = va_arg(ap, double);
+                break;
+            case 'p':
+                if (kind != USYS_LOG_ARG_INT) return -1;
+                kind = USYS_LOG_ARG_PTR;
+                a->p = va_arg(ap, const void*);
+                break;
+            case 's':
+                // Callers pass scratch buffers (usys_ntoa...) so copy now
+                if (kind != USYS_LOG_ARG_INT) return -1;
+                kind = USYS_LOG_ARG_STR;
+                v = va_arg(ap, const char*);
+                if (!v) v = "(null)";
+                l = strnlen(v, USYS_LOG_STRS - 1 - s);
+                memcpy(&rec->str[s], v, l);
+                rec->str[s + l] = 0;
+                a->i = s;
+                s += l;
+                if (s < USYS_LOG_STRS - 1) s++;
+                break;
+            default: return -1;
+        }
+        rec->kind[rec->n++] = kind;
+    }
+    return 0;
+}
+
+void
+usys_log_fill(
+    usys_log_rec* rec,
+    USYS_LOG_LEVEL lvl,
+    const char* fmt,
+    va_list ap)
+{
+    va_list cp;
+    rec->lvl = lvl;
+    rec->fmt = fmt;
+    va_copy(cp, ap);
+    if (usys_log_capture(rec, fmt, cp)) {
+        // Conversion we do not replay (%*d, %Lf...) format it here
+        rec->fmt = NULL;
+        vsnprintf(rec->str, sizeof(rec->str), fmt, ap);
+    }
+    va_end(cp);
 }
+
+int
+usys_log_print(
+    char* out,
+    uint32_t sz,
+    const char* spec,
+    const usys_log_rec* rec,
+    int i)
+{
+    const usys_log_arg* a = &rec->arg[i];
+    int ret = 0;
+    switch (rec->kind[i]) {
+        case USYS_LOG_ARG_INT: ret = snprintf(out, sz, spec, (int)a->i); break;
+        case USYS_LOG_ARG_LONG:
+            ret = snprintf(out, sz, spec, (long)a->i);
+            break;
+        case USYS_LOG_ARG_LLONG:
+            ret = snprintf(out, sz, spec, (long long)a->i);
+            break;
+        case USYS_LOG_ARG_SIZE:
+            ret = snprintf(out, sz, spec, (size_t)a->i);
+            break;
+        case USYS_LOG_ARG_DBL: ret = snprintf(out, sz, spec, a->d); break;
+        case USYS_LOG_ARG_PTR: ret = snprintf(out, sz, spec, a->p); break;
+        case USYS_LOG_ARG_STR:
+            ret = snprintf(out, sz, spec, &rec->str[a->i]);
+            break;
+    }
+    return ret < 0 ? 0 : ret;
+}
+
+uint32_t
+usys_log_format(const usys_log_rec* rec, char* out, uint32_t sz)
+{
+    static const char end[] = "\n" USYS_LOG_RESET;
+    uint32_t len, room = sz - sizeof(end);
+    const char *f = rec->fmt, *s;
+    char spec[16];
+    int n = 0;
+
+    len = snprintf(out, room, "%s", g_usys_log_colors[rec->lvl]);
+    if (!f) {
+        len += snprintf(&out[len], room - len, "%s", rec->str);
+        if (len >= room) len = room - 1;
+        f = "";
+    }
+    while (*f && len < room - 1) {
+        if (*f != '%') {
+            out[len++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[len++] = '%';
+            f += 2;
+            continue;
+        }
+        s = f++;
+        while (*f && !strchr("diuxXocfFeEgGps", *f)) f++;
+        if (!*f || f - s + 2 > (int)sizeof(spec) || n == rec->n) break;
+        memcpy(spec, s, ++f - s);
+        spec[f - s] = 0;
+        len += usys_log_print(&out[len], room - len, spec, rec, n++);
+        if (len >= room) len = room - 1;
+    }
+    memcpy(&out[len], end, sizeof(end));
+    return len + sizeof(end) - 1;
+}
+
+void
+usys_log_write(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap)
+{
+    usys_log_rec rec;
+    char line[USYS_LOG_LINE];
+    usys_log_fill(&rec, lvl, fmt, ap);
+    fwrite(line, 1, usys_log_format(&rec, line, sizeof(line)), stdout);
+}
+
+#ifdef USYS_CONFIG_PTHREAD
+void
+usys_log_start(void)
+{
+    for (uint32_t i = 0; i < USYS_LOG_RING; i++) g_usys_log_ring[i].seq = i;
+    if (usys_wake_open(&g_usys_log_wake)) return;
+    if (pthread_create(&g_usys_log_writer, NULL, usys_log_thread, NULL)) {
+        usys_wake_close(&g_usys_log_wake);
+        return;
+    }
+    __atomic_store_n(&g_usys_log_running, 1, __ATOMIC_RELEASE);
+    atexit(usys_log_stop);
+}
+
+void
+usys_log_push(USYS_LOG_LEVEL lvl, const char* fmt, va_list ap)
+{
+    uint32_t pos = __atomic_load_n(&g_usys_log_tail, __ATOMIC_RELAXED);
+    usys_log_rec* rec;
+    int32_t dif;
+
+    // Reserve a record (bounded mpsc, see async_io_mpsc_push)
+    while (1) {
+        rec = &g_usys_log_ring[pos & (USYS_LOG_RING - 1)];
+        dif = (int32_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(
+                    &g_usys_log_tail,
+                    &pos,
+                    pos + 1,
+                    1,
+                    __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // Writer is behind, never block the caller
+            __atomic_fetch_add(&g_usys_log_drops, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&g_usys_log_tail, __ATOMIC_RELAXED);
+        }
+    }
+    usys_log_fill(rec, lvl, fmt, ap);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Only pay for the syscall when the writer went to sleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_usys_log_idle, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&g_usys_log_idle, 0, __ATOMIC_ACQ_REL)) {
+        usys_wake_signal(&g_usys_log_wake);
+    }
+}
+
+int
+usys_log_pending(void)
+{
+    uint32_t head = g_usys_log_head;
+    usys_log_rec* rec = &g_usys_log_ring[head & (USYS_LOG_RING - 1)];
+    return __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == head + 1;
+}
+
+uint32_t
+usys_log_drain(void)
+{
+    char buf[USYS_LOG_BATCH];
+    uint32_t n = 0, len = 0, head = g_usys_log_head;
+    usys_log_rec* rec;
+
+    while (usys_log_pending()) {
+        rec = &g_usys_log_ring[head & (USYS_LOG_RING - 1)];
+        if (sizeof(buf) - len < USYS_LOG_LINE) {
+            fwrite(buf, 1, len, stdout);
+            len = 0;
+        }
+        len += usys_log_format(rec, &buf[len], USYS_LOG_LINE);
+        __atomic_store_n(&rec->seq, head + USYS_LOG_RING, __ATOMIC_RELEASE);
+        __atomic_store_n(&g_usys_log_head, ++head, __ATOMIC_RELEASE);
+        n++;
+    }
+    if (len) fwrite(buf, 1, len, stdout);
+    if (n) fflush(stdout);
+    return n;
+}
+
+void*
+usys_log_thread(void* ctx)
+{
+    struct pollfd pfd = { .fd = g_usys_log_wake.rd, .events = POLLIN };
+    ((void)ctx);
+    while (1) {
+        if (usys_log_drain()) continue;
+        if (!__atomic_load_n(&g_usys_log_running, __ATOMIC_ACQUIRE)) break;
+
+        // Announce the nap then look again, a producer that missed the flag
+        // published before our second look
+        __atomic_store_n(&g_usys_log_idle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!usys_log_pending()) poll(&pfd, 1, -1);
+        __atomic_store_n(&g_usys_log_idle, 0, __ATOMIC_RELAXED);
+        usys_wake_drain(&g_usys_log_wake);
+    }
+    return NULL;
+}
+#endif
+
+//
+//
+//
@@ -27,19 +27,48 @@ extern "C" {
 
 #include "usys_config.h"
 
-// TODO fix debug switch (not catcing from cmake)
-#if NDEBUG
-#define usys_log_fn usys_log_
+#define USYS_LOG_MASK(lvl) (1u << (lvl))
+#define USYS_LOG_MASK_ALL 0x1fu
+
+/**
+ * @brief Levels compiled in (USYS_LOG_MASK bits). Release builds drop the per
+ * packet INFO lines (usys_log_info) unless -DUSYS_LOG_LEVEL_MASK=... says
+ * otherwise, plain usys_log lines are NOTE and always compiled in.
+ */
+#ifndef USYS_LOG_LEVEL_MASK
+#ifdef NDEBUG
+#define USYS_LOG_LEVEL_MASK (USYS_LOG_MASK_ALL & ~USYS_LOG_MASK(USYS_LOG_INFO))
 #else
-#define usys_log_fn usys_log_
+#define USYS_LOG_LEVEL_MASK USYS_LOG_MASK_ALL
+#endif
 #endif
 
-#define usys_log_ok(...) usys_log_fn(USYS_LOG_OK, __VA_ARGS__)
-#define usys_log_note(...) usys_log_fn(USYS_LOG_NOTE, __VA_ARGS__)
-#define usys_log_info(...) usys_log_fn(USYS_LOG_INFO, __VA_ARGS__)
-#define usys_log_warn(...) usys_log_fn(USYS_LOG_WARN, __VA_ARGS__)
-#define usys_log_err(...) usys_log_fn(USYS_LOG_ERRO, __VA_ARGS__)
-#define usys_log(...) usys_log_info(__VA_ARGS__)
+#define USYS_LOG_RING 1024 /*!< records in flight (power of 2) */
+#define USYS_LOG_ARGS 8    /*!< captured arguments per record */
+#define USYS_LOG_STRS 128  /*!< copied %s bytes per record */
+#define USYS_LOG_LINE 512  /*!< formatted line */
+
+#define usys_log_fn usys_log_
+
+/**
+ * @brief Compile time and runtime filter, arguments are not evaluated when
+ * the level is off
+ */
+#define usys_log_enabled(lvl)                                                  \
+    ((USYS_LOG_LEVEL_MASK & USYS_LOG_MASK(lvl)) &&                             \
+     (g_usys_log_mask & USYS_LOG_MASK(lvl)))
+
+#define usys_log_at(lvl, ...)                                                  \
+    do {                                                                       \
+        if (usys_log_enabled(lvl)) usys_log_fn(lvl, __VA_ARGS__);              \
+    } while (0)
+
+#define usys_log_ok(...) usys_log_at(USYS_LOG_OK, __VA_ARGS__)
+#define usys_log_note(...) usys_log_at(USYS_LOG_NOTE, __VA_ARGS__)
+#define usys_log_info(...) usys_log_at(USYS_LOG_INFO, __VA_ARGS__)
+#define usys_log_warn(...) usys_log_at(USYS_LOG_WARN, __VA_ARGS__)
+#define usys_log_err(...) usys_log_at(USYS_LOG_ERRO, __VA_ARGS__)
+#define usys_log(...) usys_log_note(__VA_ARGS__)
 
 // clang-format off
 #define USYS_LOG_RESET "\x1b[0m"
@@ -60,8 +89,39 @@ typedef enum {
     USYS_LOG_ERRO = 4  // Red
 } USYS_LOG_LEVEL;
 
+extern uint32_t g_usys_log_mask; /*!< runtime filter, see usys_log_mask_set */
+
+/**
+ * @brief Record a line. The format pointer and the arguments are copied into
+ * a lock free ring (%s is copied, so fmt must be a literal) and a background
+ * thread formats and writes them. Without pthreads, or when the thread could
+ * not start, the line is written right away.
+ */
 void usys_log_(USYS_LOG_LEVEL lvl, const char* fmt, ...);
 
+/**
+ * @brief Runtime filter (USYS_LOG_MASK bits)
+ *
+ * @return previous mask
+ */
+uint32_t usys_log_mask_set(uint32_t mask);
+
+/**
+ * @brief Lines lost because the ring was full
+ */
+uint32_t usys_log_dropped(void);
+
+/**
+ * @brief Wait until every recorded line is written
+ */
+void usys_log_flush(void);
+
+/**
+ * @brief Write what is left and join the writer (also runs at exit). A later
+ * usys_log_ writes synchronously.
+ */
+void usys_log_stop(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,12 @@
 #include "usys_time.h"
 #include <time.h>
 
+usys_clock_fn g_usys_clock = NULL; /*!< virtual clock (ms) or NULL */
+void* g_usys_clock_ctx = NULL;     /*!< passed to g_usys_clock */
+int64_t g_usys_clock_epoch = 0;    /*!< usys_now when the clock was set */
+usys_thread_local uint32_t g_usys_tick_held = 0; /*!< hold depth */
+usys_thread_local int64_t g_usys_tick_ns = 0;    /*!< reading held */
+
 void
 usys_msleep(uint32_t ms)
 {
@@ -30,14 +36,51 @@ usys_msleep(uint32_t ms)
 
 int64_t
 usys_tick()
+{
+    return usys_tick_ns() / 1000000;
+}
+
+int64_t
+usys_tick_ns()
 {
     struct timespec ts;
+    if (g_usys_clock) return g_usys_clock(g_usys_clock_ctx) * 1000000;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (int64_t)((int64_t)ts.tv_sec * 1000 + (int64_t)ts.tv_nsec / 1000000);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+usys_tick_hold()
+{
+    if (!g_usys_tick_held++) g_usys_tick_ns = usys_tick_ns();
+}
+
+void
+usys_tick_update()
+{
+    if (g_usys_tick_held) g_usys_tick_ns = usys_tick_ns();
+}
+
+void
+usys_tick_release()
+{
+    if (g_usys_tick_held) g_usys_tick_held--;
 }
 
 int64_t
 usys_now()
 {
+    if (g_usys_clock) {
+        return g_usys_clock_epoch + g_usys_clock(g_usys_clock_ctx) / 1000;
+    }
     return (int64_t)time(NULL);
 }
+
+void
+usys_clock_set(usys_clock_fn fn, void* ctx)
+{
+    g_usys_clock = NULL;
+    if (fn) g_usys_clock_epoch = usys_now() - fn(ctx) / 1000;
+    g_usys_clock_ctx = ctx;
+    g_usys_clock = fn;
+}
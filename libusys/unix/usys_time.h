@@ -28,10 +28,53 @@ extern "C" {
 
 #include "usys_config.h"
 
+typedef int64_t (*usys_clock_fn)(void*);
+
 void usys_msleep(uint32_t ms);
 int64_t usys_now();
 int64_t usys_tick();
 
+/**
+ * @brief Monotonic clock (ns), to measure below a millisecond. A vDSO call
+ * where the system has one (Linux), no system call.
+ */
+int64_t usys_tick_ns();
+
+/**
+ * @brief Clock of an event loop iteration (per thread). While held, timers
+ * read the one reading taken by usys_tick_hold (or the last
+ * usys_tick_update, ie: after a wait) instead of the clock. Holds nest,
+ * the clock is read again once every hold is released.
+ */
+void usys_tick_hold();
+void usys_tick_update();
+void usys_tick_release();
+
+extern usys_thread_local uint32_t g_usys_tick_held; /*!< hold depth */
+extern usys_thread_local int64_t g_usys_tick_ns;    /*!< reading held */
+
+/**
+ * @brief usys_tick / usys_tick_ns of this iteration (see usys_tick_hold)
+ */
+static inline int64_t
+usys_tick_cached()
+{
+    return g_usys_tick_held ? g_usys_tick_ns / 1000000 : usys_tick();
+}
+
+static inline int64_t
+usys_tick_cached_ns()
+{
+    return g_usys_tick_held ? g_usys_tick_ns : usys_tick_ns();
+}
+
+/**
+ * @brief Take usys_tick (ms) from fn instead of the monotonic clock, and
+ * advance usys_now with it (ie: virtual time of a simulation). NULL restores
+ * the system clock.
+ */
+void usys_clock_set(usys_clock_fn fn, void* ctx);
+
 #ifdef __cplusplus
 }
 #endif
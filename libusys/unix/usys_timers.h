@@ -34,6 +34,7 @@ extern "C" {
 
 #include "usys_config.h"
 #include "usys_time.h"
+#include "uwheel.h"
 
 #include "khash.h"
 
@@ -48,16 +49,19 @@ typedef khiter_t usys_timer_iter;
  */
 typedef struct usys_timer
 {
-    uint32_t ms, fire, flags;
+    uwheel_node node; /*!< wheel link (first member) */
+    uint32_t ms, flags;
+    uint64_t fire;
     usys_timer_key key;
     void* ctx;
-    int (*fn)(usys_timer_key, void*, uint32_t);
+    int (*fn)(usys_timer_key, void*, uint64_t);
 } usys_timer;
 
 /**
- * @brief klib context (klib hash table)
+ * @brief klib context (klib hash table). Timers are allocated so the wheel
+ * links survive the table moving its values around.
  */
-KHASH_MAP_INIT_INT64(usys_timers, usys_timer);
+KHASH_MAP_INIT_INT64(usys_timers, usys_timer*);
 
 /**
  * @brief Our wrapper around kh_* to provided bounds
@@ -66,12 +70,13 @@ typedef struct
 {
     uint32_t max;
     kh_usys_timers_t* timers;
+    uwheel wheel; /*!< armed timers */
 } usys_timers_context;
 
 /**
  * @brief Callers on expirey function
  */
-typedef int (*usys_timer_fn)(usys_timer_key, void*, uint32_t);
+typedef int (*usys_timer_fn)(usys_timer_key, void*, uint64_t);
 
 /**
  * @brief Allocate a main timers context
@@ -87,6 +92,7 @@ usys_timers_init(usys_timers_context* context, uint32_t c)
     if (context->timers) {
         context->max = c;
         kh_resize(usys_timers, context->timers, c);
+        uwheel_init(&context->wheel, usys_tick_cached());
         return 0;
     }
     return -1;
@@ -100,6 +106,10 @@ usys_timers_init(usys_timers_context* context, uint32_t c)
 static inline void
 usys_timers_deinit(usys_timers_context* self)
 {
+    khiter_t k;
+    for (k = kh_begin(self->timers); k != kh_end(self->timers); k++) {
+        if (kh_exist(self->timers, k)) usys_free(kh_val(self->timers, k));
+    }
     kh_destroy_usys_timers(self->timers);
     memset(self, 0, sizeof(usys_timers_context));
 }
@@ -129,7 +139,7 @@ static inline usys_timer*
 usys_timers_get(usys_timers_context* context, usys_timer_key key)
 {
     khiter_t k = kh_get(usys_timers, context->timers, key);
-    return k == kh_end(context->timers) ? NULL : &kh_val(context->timers, k);
+    return k == kh_end(context->timers) ? NULL : kh_val(context->timers, k);
 }
 
 /**
@@ -142,11 +152,12 @@ static inline int
 usys_timers_start(usys_timers_context* context, usys_timer_key key, uint32_t ms)
 {
     usys_timer* t = usys_timers_get(context, key);
-    uint32_t tick = usys_tick();
+    uint64_t tick = usys_tick_cached();
     if (t) {
         if (ms) t->ms = ms;
         t->flags |= 1;
         t->fire = tick + t->ms;
+        uwheel_add(&context->wheel, &t->node, t->fire);
         return 0;
     }
     return -1;
@@ -159,6 +170,7 @@ usys_timers_cancel(usys_timers_context* context, usys_timer_key key)
     if (t) {
         t->flags &= (~(1));
         t->fire = 0;
+        uwheel_del(&context->wheel, &t->node);
     }
     return -1;
 }
@@ -188,7 +200,17 @@ usys_timers_insert(
 
     if (usys_timers_size(context) < context->max) {
         k = kh_put(usys_timers, context->timers, key, &absent);
-        t = &kh_val(context->timers, k);
+        if (absent) {
+            t = kh_val(context->timers, k) = usys_malloc(sizeof(usys_timer));
+            if (!t) {
+                kh_del(usys_timers, context->timers, k);
+                return 0;
+            }
+            uwheel_node_init(&t->node);
+        } else {
+            t = kh_val(context->timers, k);
+            uwheel_del(&context->wheel, &t->node);
+        }
         t->fn = fn;
         t->ctx = ctx;
         t->ms = ms;
@@ -209,30 +231,42 @@ static inline void
 usys_timers_remove(usys_timers_context* self, usys_timer_key key)
 {
     usys_timer_iter k = kh_get(usys_timers, self->timers, key);
-    if (!(k == kh_end(self->timers))) kh_del(usys_timers, self->timers, k);
+    if (!(k == kh_end(self->timers))) {
+        uwheel_del(&self->wheel, &kh_val(self->timers, k)->node);
+        usys_free(kh_val(self->timers, k));
+        kh_del(usys_timers, self->timers, k);
+    }
+}
+
+static inline void
+usys_timers_expire(uwheel_node* node, void* ctx, uint64_t tick)
+{
+    usys_timer* t = (usys_timer*)node;
+    ((void)ctx);
+    t->flags &= (~(1));
+    t->fire = 0;
+    t->fn(t->key, t->ctx, tick);
 }
 
 /**
- * @brief Loop active timers in hash table, fire any time out callbacks
+ * @brief ms until usys_timers_poll has a timer to fire (UWHEEL_NONE if none)
+ */
+static inline uint32_t
+usys_timers_next(usys_timers_context* ctx)
+{
+    return uwheel_next(&ctx->wheel, usys_tick_cached());
+}
+
+/**
+ * @brief Fire any time out callbacks (walks only the wheel buckets that came
+ * due since last poll)
  *
  * @param ctx
  */
 static inline void
 usys_timers_poll(usys_timers_context* ctx)
 {
-    usys_timer* t;
-    khiter_t iter;
-    uint32_t tick = usys_tick();
-    for (iter = kh_begin(ctx->timers); iter != kh_end(ctx->timers); iter++) {
-        t = &kh_val(ctx->timers, iter);
-        if (kh_exist(ctx->timers, iter)) {
-            if (t && t->flags && t->fire && tick >= t->fire) {
-                t->flags &= (~(1));
-                t->fire = 0;
-                t->fn(t->key, t->ctx, tick);
-            }
-        }
-    }
+    uwheel_poll(&ctx->wheel, usys_tick_cached(), usys_timers_expire, NULL);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,447 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "usys_uring.h"
+
+#ifdef USYS_CONFIG_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USYS_URING_BGID 0
+
+// Features we rely on: one mmap for both rings, no dropped completions,
+// sqe payload (ie: msghdr) consumed at submit, and enter with a timeout.
+#define USYS_URING_FEATURES                                                    \
+    (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |                           \
+     IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_EXT_ARG)
+
+#define usys_uring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define usys_uring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+struct usys_uring
+{
+    int fd;                          /*!< ring */
+    void* ring;                      /*!< sq and cq ring mapping */
+    size_t ring_sz;                  /*!< mapped */
+    struct io_uring_sqe* sqes;       /*!< submission entries */
+    size_t sqes_sz;                  /*!< mapped */
+    uint32_t *sq_head, *sq_tail;     /*!< kernel consumer, our producer */
+    uint32_t *sq_array, sq_mask;     /*!< sqe index ring */
+    uint32_t *cq_head, *cq_tail;     /*!< our consumer, kernel producer */
+    uint32_t cq_mask;                /*!< */
+    struct io_uring_cqe* cqes;       /*!< completion entries */
+    struct io_uring_buf_ring* br;    /*!< provided buffer ring */
+    uint16_t br_tail;                /*!< our producer */
+    uint8_t* bufs;                   /*!< buffer memory */
+    struct msghdr rx;                /*!< multishot recvmsg template */
+    struct msghdr msg[USYS_URING_ENTRIES]; /*!< sendmsg per sqe slot */
+    struct iovec iov[USYS_URING_ENTRIES];  /*!< */
+    struct sockaddr_in sin[USYS_URING_ENTRIES]; /*!< */
+};
+
+// private
+int usys_uring_setup(uint32_t entries, struct io_uring_params* p);
+int usys_uring_register(int fd, uint32_t op, void* arg, uint32_t n);
+int usys_uring_sys_enter(int fd, uint32_t sub, uint32_t min, uint32_t flags,
+                         void* arg, size_t argsz);
+struct io_uring_sqe* usys_uring_sqe(usys_uring* ring, uint32_t* slot);
+int usys_uring_buf_init(usys_uring* ring);
+
+usys_uring*
+usys_uring_open()
+{
+    struct io_uring_params p;
+    usys_uring* ring = usys_malloc(sizeof(usys_uring));
+    uint8_t* m;
+    if (!ring) return NULL;
+    memset(ring, 0, sizeof(usys_uring));
+    memset(&p, 0, sizeof(p));
+    ring->ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+    ring->fd = usys_uring_setup(USYS_URING_ENTRIES, &p);
+    if (ring->fd < 0) goto ERR;
+    if (!((p.features & USYS_URING_FEATURES) == USYS_URING_FEATURES)) {
+        goto ERR;
+    }
+
+    // Map sq and cq rings (one mapping) and the sqe array
+    ring->ring_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    if (ring->ring_sz < p.cq_off.cqes + p.cq_entries * sizeof(*ring->cqes)) {
+        ring->ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(*ring->cqes);
+    }
+    ring->ring = mmap(NULL, ring->ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring == MAP_FAILED) goto ERR;
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto ERR;
+    m = ring->ring;
+    ring->sq_head = (uint32_t*)(m + p.sq_off.head);
+    ring->sq_tail = (uint32_t*)(m + p.sq_off.tail);
+    ring->sq_mask = *(uint32_t*)(m + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(m + p.sq_off.array);
+    ring->cq_head = (uint32_t*)(m + p.cq_off.head);
+    ring->cq_tail = (uint32_t*)(m + p.cq_off.tail);
+    ring->cq_mask = *(uint32_t*)(m + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(m + p.cq_off.cqes);
+
+    // Datagrams land in buffers we registered, reserve room for the sender
+    if (usys_uring_buf_init(ring)) goto ERR;
+    ring->rx.msg_namelen = sizeof(struct sockaddr_in);
+    return ring;
+ERR:
+    usys_uring_close(&ring);
+    return NULL;
+}
+
+void
+usys_uring_close(usys_uring** ring_p)
+{
+    usys_uring* ring = *ring_p;
+    *ring_p = NULL;
+    if (!ring) return;
+    if (ring->fd >= 0) close(ring->fd);
+    if (ring->br) munmap(ring->br, USYS_URING_BUFS * sizeof(*ring->br->bufs));
+    if (ring->bufs) usys_free(ring->bufs);
+    if (!(ring->sqes == MAP_FAILED)) munmap(ring->sqes, ring->sqes_sz);
+    if (!(ring->ring == MAP_FAILED)) munmap(ring->ring, ring->ring_sz);
+    usys_free(ring);
+}
+
+int
+usys_uring_poll(usys_uring* ring, usys_socket_fd s, uint32_t ev, uint64_t tag)
+{
+    struct io_uring_sqe* sqe = usys_uring_sqe(ring, NULL);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = s;
+    sqe->poll32_events = ((ev & USYS_POLL_IN) ? POLLIN : 0) |
+                         ((ev & USYS_POLL_OUT) ? POLLOUT : 0);
+    sqe->user_data = tag;
+    return 0;
+}
+
+int
+usys_uring_send(
+    usys_uring* ring,
+    usys_socket_fd s,
+    const byte* b,
+    uint32_t l,
+    uint64_t tag)
+{
+    struct io_uring_sqe* sqe = usys_uring_sqe(ring, NULL);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s;
+    sqe->addr = (uint64_t)(uintptr_t)b;
+    sqe->len = l;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int
+usys_uring_sendto(
+    usys_uring* ring,
+    usys_socket_fd s,
+    const byte* b,
+    uint32_t l,
+    const usys_sockaddr* addr,
+    uint64_t tag)
+{
+    uint32_t i;
+    struct io_uring_sqe* sqe = usys_uring_sqe(ring, &i);
+    if (!sqe) return -1;
+
+    // Header only has to live until submit (IORING_FEAT_SUBMIT_STABLE)
+    memset(&ring->sin[i], 0, sizeof(struct sockaddr_in));
+    ring->sin[i].sin_family = AF_INET;
+    ring->sin[i].sin_port = htons(addr->port);
+    ring->sin[i].sin_addr.s_addr = htonl(addr->ip);
+    ring->iov[i].iov_base = (void*)b;
+    ring->iov[i].iov_len = l;
+    memset(&ring->msg[i], 0, sizeof(struct msghdr));
+    ring->msg[i].msg_name = &ring->sin[i];
+    ring->msg[i].msg_namelen = sizeof(struct sockaddr_in);
+    ring->msg[i].msg_iov = &ring->iov[i];
+    ring->msg[i].msg_iovlen = 1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->msg[i];
+    sqe->len = 1;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int
+usys_uring_recv_multi(usys_uring* ring, usys_socket_fd s, uint64_t tag)
+{
+    struct io_uring_sqe* sqe = usys_uring_sqe(ring, NULL);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = s;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->rx;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = USYS_URING_BGID;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int
+usys_uring_cancel(usys_uring* ring, uint64_t tag)
+{
+    struct io_uring_sqe* sqe = usys_uring_sqe(ring, NULL);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0; // tag 0 is never ours, completion is ignored
+    return 0;
+}
+
+int
+usys_uring_enter(usys_uring* ring, uint32_t ms)
+{
+    int ret;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    uint32_t flags = IORING_ENTER_EXT_ARG;
+    uint32_t sub = *ring->sq_tail - usys_uring_load(ring->sq_head);
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    if (ms) flags |= IORING_ENTER_GETEVENTS;
+    if (!(sub || ms)) return 0;
+    ret = usys_uring_sys_enter(ring->fd, sub, ms ? 1 : 0, flags, &arg,
+                               sizeof(arg));
+    if (ret >= 0) return 0;
+    return (errno == ETIME || errno == EINTR || errno == EBUSY) ? 0 : -1;
+}
+
+int
+usys_uring_reap(usys_uring* ring, usys_uring_cqe* out, int n)
+{
+    int c = 0;
+    uint32_t head = *ring->cq_head, tail = usys_uring_load(ring->cq_tail);
+    struct io_uring_cqe* cqe;
+    struct io_uring_recvmsg_out* o;
+    struct sockaddr_in* sin;
+    for (; c < n && !(head == tail); head++, c++) {
+        cqe = &ring->cqes[head & ring->cq_mask];
+        out[c].tag = cqe->user_data;
+        out[c].res = cqe->res;
+        out[c].more = (cqe->flags & IORING_CQE_F_MORE) ? 1 : 0;
+        out[c].bid = -1;
+        out[c].b = NULL;
+        out[c].l = 0;
+        out[c].addr.ip = out[c].addr.port = 0;
+        if (!(cqe->flags & IORING_CQE_F_BUFFER)) continue;
+
+        // [recvmsg_out||name (our namelen)||payload]
+        out[c].bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res < (int)(sizeof(*o) + ring->rx.msg_namelen)) continue;
+        o = (struct io_uring_recvmsg_out*)&ring->bufs[out[c].bid *
+                                                     USYS_URING_BUF_SZ];
+        sin = (struct sockaddr_in*)&o[1];
+        out[c].b = (byte*)&o[1] + ring->rx.msg_namelen;
+        out[c].l = o->payloadlen;
+        out[c].addr.ip = ntohl(sin->sin_addr.s_addr);
+        out[c].addr.port = ntohs(sin->sin_port);
+        if (o->flags & MSG_TRUNC) out[c].res = -EMSGSIZE;
+    }
+    usys_uring_store(ring->cq_head, head);
+    return c;
+}
+
+void
+usys_uring_release(usys_uring* ring, int32_t bid)
+{
+    struct io_uring_buf* buf;
+    if (bid < 0) return;
+    buf = &ring->br->bufs[ring->br_tail & (USYS_URING_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)&ring->bufs[bid * USYS_URING_BUF_SZ];
+    buf->len = USYS_URING_BUF_SZ;
+    buf->bid = bid;
+    usys_uring_store(&ring->br->tail, ++ring->br_tail);
+}
+
+struct io_uring_sqe*
+usys_uring_sqe(usys_uring* ring, uint32_t* slot)
+{
+    uint32_t tail = *ring->sq_tail, i;
+    struct io_uring_sqe* sqe;
+
+    // Full - hand what we have to the kernel to make room
+    if (tail - usys_uring_load(ring->sq_head) > ring->sq_mask) {
+        usys_uring_enter(ring, 0);
+        if (tail - usys_uring_load(ring->sq_head) > ring->sq_mask) {
+            return NULL;
+        }
+    }
+    i = tail & ring->sq_mask;
+    sqe = &ring->sqes[i];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[i] = i;
+
+    // Kernel only reads sqes in enter (no sq polling) so caller can still
+    // fill this one in after we publish it
+    usys_uring_store(ring->sq_tail, tail + 1);
+    if (slot) *slot = i;
+    return sqe;
+}
+
+int
+usys_uring_buf_init(usys_uring* ring)
+{
+    struct io_uring_buf_reg reg;
+    size_t sz = USYS_URING_BUFS * sizeof(struct io_uring_buf);
+    void* br = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) return -1;
+    ring->br = br;
+    ring->bufs = usys_malloc(USYS_URING_BUFS * USYS_URING_BUF_SZ);
+    if (!ring->bufs) return -1;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = USYS_URING_BUFS;
+    reg.bgid = USYS_URING_BGID;
+    if (usys_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        return -1;
+    }
+    for (int32_t i = 0; i < USYS_URING_BUFS; i++) usys_uring_release(ring, i);
+    return 0;
+}
+
+int
+usys_uring_setup(uint32_t entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int
+usys_uring_register(int fd, uint32_t op, void* arg, uint32_t n)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n) < 0 ? -1 : 0;
+}
+
+int
+usys_uring_sys_enter(
+    int fd,
+    uint32_t sub,
+    uint32_t min,
+    uint32_t flags,
+    void* arg,
+    size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, sub, min, flags, arg, argsz);
+}
+
+#else
+
+usys_uring*
+usys_uring_open()
+{
+    return NULL;
+}
+
+void
+usys_uring_close(usys_uring** ring_p)
+{
+    *ring_p = NULL;
+}
+
+int
+usys_uring_poll(usys_uring* ring, usys_socket_fd s, uint32_t ev, uint64_t tag)
+{
+    return -1;
+}
+
+int
+usys_uring_send(
+    usys_uring* ring,
+    usys_socket_fd s,
+    const byte* b,
+    uint32_t l,
+    uint64_t tag)
+{
+    return -1;
+}
+
+int
+usys_uring_sendto(
+    usys_uring* ring,
+    usys_socket_fd s,
+    const byte* b,
+    uint32_t l,
+    const usys_sockaddr* addr,
+    uint64_t tag)
+{
+    return -1;
+}
+
+int
+usys_uring_recv_multi(usys_uring* ring, usys_socket_fd s, uint64_t tag)
+{
+    return -1;
+}
+
+int
+usys_uring_cancel(usys_uring* ring, uint64_t tag)
+{
+    return -1;
+}
+
+int
+usys_uring_enter(usys_uring* ring, uint32_t ms)
+{
+    return -1;
+}
+
+int
+usys_uring_reap(usys_uring* ring, usys_uring_cqe* cqe, int n)
+{
+    return 0;
+}
+
+void
+usys_uring_release(usys_uring* ring, int32_t bid)
+{
+}
+
+#endif
+
+//
+//
+//
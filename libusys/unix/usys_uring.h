@@ -0,0 +1,109 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file usys_uring.h
+ *
+ * @brief Minimal io_uring submission/completion wrapper (no liburing). Ops
+ * are only queued by the usys_uring_... calls below and all of them reach
+ * the kernel with the next usys_uring_enter.
+ */
+#ifndef USYS_URING_H_
+#define USYS_URING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_io.h"
+
+#define USYS_URING_ENTRIES 256 /*!< submission queue depth */
+#define USYS_URING_BUFS 256    /*!< provided datagram buffers */
+#define USYS_URING_BUF_SZ 2048 /*!< datagram + recvmsg header */
+
+typedef struct usys_uring usys_uring;
+
+/**
+ * @brief One completion
+ */
+typedef struct
+{
+    uint64_t tag;       /*!< as queued */
+    int32_t res;        /*!< bytes, poll mask or -errno */
+    uint32_t more;      /*!< multishot op is still armed */
+    int32_t bid;        /*!< provided buffer to release, -1 if none */
+    const byte* b;      /*!< datagram (usys_uring_recv_multi) */
+    uint32_t l;         /*!< datagram size */
+    usys_sockaddr addr; /*!< datagram sender */
+} usys_uring_cqe;
+
+/**
+ * @brief Create a ring with a provided buffer group for datagrams.
+ *
+ * @return ring or NULL if io_uring (or a feature we use) is unavailable
+ */
+usys_uring* usys_uring_open(void);
+void usys_uring_close(usys_uring** ring_p);
+
+/**
+ * @brief Queue ops. Each returns 0 when queued and -1 when the queue is full
+ * (even after pushing queued ops to the kernel).
+ */
+int usys_uring_poll(usys_uring*, usys_socket_fd, uint32_t events, uint64_t);
+int usys_uring_send(
+    usys_uring*,
+    usys_socket_fd,
+    const byte*,
+    uint32_t,
+    uint64_t);
+int usys_uring_sendto(
+    usys_uring*,
+    usys_socket_fd,
+    const byte*,
+    uint32_t,
+    const usys_sockaddr*,
+    uint64_t);
+int usys_uring_recv_multi(usys_uring*, usys_socket_fd, uint64_t);
+int usys_uring_cancel(usys_uring*, uint64_t);
+
+/**
+ * @brief Submit everything queued and wait for a completion
+ *
+ * @param ring
+ * @param ms max wait (0 do not wait)
+ *
+ * @return 0 OK -1 error
+ */
+int usys_uring_enter(usys_uring* ring, uint32_t ms);
+
+/**
+ * @brief Take completions. usys_uring_release every bid >= 0 once the
+ * datagram was consumed.
+ *
+ * @return number of cqe populated
+ */
+int usys_uring_reap(usys_uring* ring, usys_uring_cqe* cqe, int n);
+void usys_uring_release(usys_uring* ring, int32_t bid);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -34,33 +34,50 @@ extern "C" {
 
 #include "usys_config.h"
 #include "usys_time.h"
+#include "uwheel.h"
 
 #define UTIMERS_EMPTY 0x01
 #define UTIMERS_ARMED 0x02
 
 #define UTIMERS_IS_EMPTY(t) (t.flags & UTIMERS_EMPTY)
 
+/**
+ * @brief The caller owns the array, armed timers are also linked into a
+ * timing wheel shared by the array (allocated by utimers_init) so polling
+ * does not scan the array.
+ */
 typedef struct utimers
 {
-    uint32_t ms, fire;
+    uwheel_node node; /*!< wheel link (first member) */
+    uwheel* wheel;    /*!< shared by all timers of the array */
+    uint32_t ms;
+    uint64_t fire;
     uint8_t flags;
     int key;
     void* ctx;
-    int (*fn)(struct utimers*, void*, uint32_t);
+    int (*fn)(struct utimers*, void*, uint64_t);
 } utimers;
 
-typedef int (*utimers_fn)(utimers*, void*, uint32_t);
+typedef int (*utimers_fn)(utimers*, void*, uint64_t);
 
-static inline void
+static inline int
 utimers_init(utimers* timers, int count)
 {
+    uwheel* wheel = usys_malloc(sizeof(uwheel));
     memset(timers, 0, sizeof(utimers) * count);
-    for (int i = 0; i < count; i++) timers[i].flags |= UTIMERS_EMPTY;
+    if (!wheel) return -1;
+    uwheel_init(wheel, usys_tick_cached());
+    for (int i = 0; i < count; i++) {
+        timers[i].flags |= UTIMERS_EMPTY;
+        timers[i].wheel = wheel;
+    }
+    return 0;
 }
 
 static inline void
 utimers_deinit(utimers* timers, int count)
 {
+    if (count && timers[0].wheel) usys_free(timers[0].wheel);
     memset(timers, 0, sizeof(utimers) * count);
 }
 
@@ -80,9 +97,18 @@ utimers_get(utimers* timers, uint32_t idx)
     return !UTIMERS_IS_EMPTY(timers[idx]) ? &timers[idx] : NULL;
 }
 
+static inline int
+utimers_cancel(utimers* timers, int idx)
+{
+    timers[idx].flags &= (~(UTIMERS_ARMED));
+    uwheel_del(timers[idx].wheel, &timers[idx].node);
+    return 0;
+}
+
 static inline int
 utimers_insert(utimers* timers, int idx, utimers_fn fn, void* ctx)
 {
+    utimers_cancel(timers, idx);
     timers[idx].ms = timers[idx].flags = 0;
     timers[idx].fn = fn;
     timers[idx].ctx = ctx;
@@ -93,6 +119,7 @@ utimers_insert(utimers* timers, int idx, utimers_fn fn, void* ctx)
 static inline int
 utimers_remove(utimers* timers, int idx)
 {
+    utimers_cancel(timers, idx);
     timers[idx].flags |= UTIMERS_EMPTY;
     return 0;
 }
@@ -102,29 +129,39 @@ utimers_start(utimers* timers, int idx, uint32_t ms)
 {
     timers[idx].flags |= UTIMERS_ARMED;
     if (ms) timers[idx].ms = ms;
-    timers[idx].fire = usys_tick() + timers[idx].ms;
+    timers[idx].fire = usys_tick_cached() + timers[idx].ms;
+    uwheel_add(timers[idx].wheel, &timers[idx].node, timers[idx].fire);
     return 0;
 }
 
-static inline int
-utimers_cancel(utimers* timers, int idx)
+static inline void
+utimers_expire(uwheel_node* node, void* ctx, uint64_t tick)
 {
-    timers[idx].flags &= (~(UTIMERS_ARMED));
-    return 0;
+    utimers* t = (utimers*)node;
+    ((void)ctx);
+    t->flags &= (~(UTIMERS_ARMED));
+    t->fn(t, t->ctx, tick);
 }
 
+/**
+ * @brief ms until utimers_poll has a timer to fire (UWHEEL_NONE if none)
+ */
+static inline uint32_t
+utimers_next(utimers* timers, uint32_t count)
+{
+    if (!count) return UWHEEL_NONE;
+    return uwheel_next(timers[0].wheel, usys_tick_cached());
+}
+
+/**
+ * @brief Fire expired timers. Only the wheel buckets due since the last poll
+ * are visited (count is kept for compatibility).
+ */
 static inline void
 utimers_poll(utimers* timers, uint32_t count)
 {
-    uint32_t tick = usys_tick();
-    for (uint32_t i = 0; i < count; i++) {
-        if ((timers[i].flags & UTIMERS_ARMED) &&
-            (!(timers[i].flags & UTIMERS_EMPTY)) && //
-            (tick >= timers[i].fire)) {
-            timers[i].flags &= (~(UTIMERS_ARMED));
-            timers[i].fn(&timers[i], timers[i].ctx, tick);
-        }
-    }
+    if (!count) return;
+    uwheel_poll(timers[0].wheel, usys_tick_cached(), utimers_expire, NULL);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,202 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+#include "uwheel.h"
+
+// private
+void uwheel_link(uwheel* wheel, uwheel_node* node);
+void uwheel_unlink(uwheel* wheel, uwheel_node* node);
+void uwheel_splice(uwheel* wheel, int level, int slot, uwheel_node* head);
+void uwheel_cascade(uwheel* wheel);
+
+void
+uwheel_init(uwheel* wheel, uint64_t tick)
+{
+    uwheel_node* head;
+    memset(wheel, 0, sizeof(uwheel));
+    wheel->now = tick;
+    for (int l = 0; l < UWHEEL_LEVELS; l++) {
+        for (int s = 0; s < UWHEEL_SLOTS; s++) {
+            head = &wheel->slots[l][s];
+            head->next = head->prev = head;
+        }
+    }
+}
+
+void
+uwheel_node_init(uwheel_node* node)
+{
+    memset(node, 0, sizeof(uwheel_node));
+}
+
+void
+uwheel_add(uwheel* wheel, uwheel_node* node, uint64_t tick)
+{
+    if (node->next) {
+        uwheel_unlink(wheel, node);
+    } else {
+        wheel->count++;
+    }
+    if ((int64_t)(tick - wheel->now) < 0) tick = wheel->now;
+    if (tick - wheel->now >= UWHEEL_SPAN) tick = wheel->now + UWHEEL_SPAN - 1;
+    node->expire = tick;
+    uwheel_link(wheel, node);
+}
+
+void
+uwheel_del(uwheel* wheel, uwheel_node* node)
+{
+    if (!node->next) return;
+    uwheel_unlink(wheel, node);
+    wheel->count--;
+}
+
+void
+uwheel_poll(uwheel* wheel, uint64_t tick, uwheel_fn fn, void* ctx)
+{
+    uwheel_node head, *n;
+    uint64_t next;
+    int slot;
+    while ((int64_t)(tick - wheel->now) >= 0) {
+        if (!wheel->count) {
+            // Nothing armed, nothing to walk
+            wheel->now = tick + 1;
+            break;
+        }
+        if (!(wheel->now & UWHEEL_MASK)) uwheel_cascade(wheel);
+        if (!wheel->used[0]) {
+            // Skip to the next cascade (or to tick) over empty buckets
+            next = (wheel->now | UWHEEL_MASK) + 1;
+            wheel->now = (int64_t)(next - tick) > 0 ? tick + 1 : next;
+            continue;
+        }
+        slot = wheel->now & UWHEEL_MASK;
+        wheel->now++;
+
+        // Detach bucket so callbacks can re-arm (into a later bucket) and
+        // cancel (unlinks from our list) freely.
+        uwheel_splice(wheel, 0, slot, &head);
+        while (head.next != &head) {
+            n = head.next;
+            n->prev->next = n->next;
+            n->next->prev = n->prev;
+            n->next = n->prev = NULL;
+            wheel->count--;
+            fn(n, ctx, tick);
+        }
+    }
+}
+
+uint32_t
+uwheel_next(uwheel* wheel, uint64_t tick)
+{
+    uint64_t bits, deadline;
+    uint32_t c, d, shift, ms, best = UWHEEL_NONE;
+    if (!wheel->count) return UWHEEL_NONE;
+    for (int l = 0; l < UWHEEL_LEVELS; l++) {
+        if (!(bits = wheel->used[l])) continue;
+        shift = UWHEEL_BITS * l;
+        c = (wheel->now >> shift) & UWHEEL_MASK;
+        if (c) bits = (bits >> c) | (bits << (UWHEEL_SLOTS - c));
+
+        // Current bucket of a coarse level moves down on the boundary, if
+        // now is past the boundary it was moved already and holds timers
+        // for the next time around.
+        if (l && (wheel->now & ((1ull << shift) - 1)) && (bits & 1)) {
+            bits &= ~1ull;
+            d = bits ? usys_ctz64_fn(bits) : UWHEEL_SLOTS;
+        } else {
+            d = usys_ctz64_fn(bits);
+        }
+        deadline = l ? (((wheel->now >> shift) + d) << shift) : wheel->now + d;
+        ms = (int64_t)(deadline - tick) > 0 ? deadline - tick : 0;
+        if (ms < best) best = ms;
+    }
+    return best;
+}
+
+void
+uwheel_link(uwheel* wheel, uwheel_node* node)
+{
+    uint64_t delta = node->expire - wheel->now;
+    uwheel_node* head;
+    int l = 0;
+    while (l < UWHEEL_LEVELS - 1 && delta >= (1u << (UWHEEL_BITS * (l + 1))))
+        l++;
+    node->level = l;
+    node->slot = (node->expire >> (UWHEEL_BITS * l)) & UWHEEL_MASK;
+    head = &wheel->slots[l][node->slot];
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+    wheel->used[l] |= (1ull << node->slot);
+}
+
+void
+uwheel_unlink(uwheel* wheel, uwheel_node* node)
+{
+    uwheel_node* head = &wheel->slots[node->level][node->slot];
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+    if (head->next == head) wheel->used[node->level] &= ~(1ull << node->slot);
+}
+
+void
+uwheel_splice(uwheel* wheel, int level, int slot, uwheel_node* head)
+{
+    uwheel_node* from = &wheel->slots[level][slot];
+    if (from->next == from) {
+        head->next = head->prev = head;
+    } else {
+        head->next = from->next;
+        head->prev = from->prev;
+        head->next->prev = head;
+        head->prev->next = head;
+        from->next = from->prev = from;
+    }
+    wheel->used[level] &= ~(1ull << slot);
+}
+
+void
+uwheel_cascade(uwheel* wheel)
+{
+    // Called when now crosses a level 0 boundary. Move the bucket of each
+    // coarser level that came around down into the finer levels (coarse
+    // first stops at the first level that did not wrap).
+    uwheel_node head, *n;
+    int l, slot;
+    for (l = 1; l < UWHEEL_LEVELS; l++) {
+        slot = (wheel->now >> (UWHEEL_BITS * l)) & UWHEEL_MASK;
+        uwheel_splice(wheel, l, slot, &head);
+        while (head.next != &head) {
+            n = head.next;
+            head.next = n->next;
+            uwheel_link(wheel, n);
+        }
+        if (slot) break;
+    }
+}
+
+//
+//
+//
@@ -0,0 +1,116 @@
+// Copyright 2017 Altronix Corp.
+// This file is part of the tiny-ether library
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @author Thomas Chiantia <thomas@altronix>
+ * @date 2017
+ */
+
+/**
+ * @file uwheel.h
+ *
+ * @brief Hierarchical timing wheel (1ms resolution, 64 bit ticks that do
+ * not wrap in practice). Arming and cancelling a timer is a list
+ * link/unlink, and a poll only walks the buckets that came due since the
+ * last poll. Timers further out than a level sit in a coarser bucket and are
+ * moved down a level when that bucket comes around.
+ */
+#ifndef UWHEEL_H_
+#define UWHEEL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usys_config.h"
+
+#define UWHEEL_BITS 6                       /*!< 64 buckets per level */
+#define UWHEEL_SLOTS (1 << UWHEEL_BITS)     /*!< */
+#define UWHEEL_MASK (UWHEEL_SLOTS - 1)      /*!< */
+#define UWHEEL_LEVELS 5                     /*!< 2^30ms (~12 days) */
+#define UWHEEL_SPAN (1u << (UWHEEL_BITS * UWHEEL_LEVELS)) /*!< max delay */
+#define UWHEEL_NONE 0xffffffff /*!< uwheel_next: nothing armed */
+
+/**
+ * @brief Embed in a timer. Not armed while next == NULL.
+ */
+typedef struct uwheel_node
+{
+    struct uwheel_node *next, *prev; /*!< bucket list */
+    uint64_t expire;                 /*!< tick to fire on */
+    uint8_t level, slot;             /*!< bucket we are linked in */
+} uwheel_node;
+
+typedef struct uwheel
+{
+    uint64_t now;                                 /*!< next tick to expire */
+    uint32_t count;                               /*!< armed timers */
+    uint64_t used[UWHEEL_LEVELS];                 /*!< non empty buckets */
+    uwheel_node slots[UWHEEL_LEVELS][UWHEEL_SLOTS]; /*!< bucket heads */
+} uwheel;
+
+/**
+ * @brief Called for each expired node (the node is no longer armed and can
+ * be armed again from the callback)
+ */
+typedef void (*uwheel_fn)(uwheel_node*, void*, uint64_t);
+
+void uwheel_init(uwheel* wheel, uint64_t tick);
+void uwheel_node_init(uwheel_node* node);
+
+/**
+ * @brief Arm node to fire on tick (tick is relative to the wheel, a tick
+ * already passed fires on the next poll). Node is re-armed if armed.
+ */
+void uwheel_add(uwheel* wheel, uwheel_node* node, uint64_t tick);
+
+/**
+ * @brief Disarm node (no-op if not armed)
+ */
+void uwheel_del(uwheel* wheel, uwheel_node* node);
+
+/**
+ * @brief Expire every node due at or before tick
+ *
+ * @param wheel
+ * @param tick current tick
+ * @param fn called per expired node
+ * @param ctx callers context passed to fn
+ */
+void uwheel_poll(uwheel* wheel, uint64_t tick, uwheel_fn fn, void* ctx);
+
+/**
+ * @brief How long a caller may block before the next uwheel_poll has work.
+ * Timers on coarse levels report when their bucket moves down a level so the
+ * answer may be early, never late.
+ *
+ * @param wheel
+ * @param tick current tick
+ *
+ * @return ms (0 poll now) or UWHEEL_NONE when nothing is armed
+ */
+uint32_t uwheel_next(uwheel* wheel, uint64_t tick);
+
+static inline int
+uwheel_armed(uwheel_node* node)
+{
+    return node->next ? 1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif